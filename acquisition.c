@@ -0,0 +1,280 @@
+/*
+ * File:    acquisition.c
+ * author:  patrick conroy
+ *
+ * The old loop was read / build / publish / sleep( sleepSeconds ), so the real
+ * period was sleepSeconds plus however long everything else took, and a slow
+ * or reconnecting broker held up the next read. Now these threads only talk
+ * to the controllers. Deadlines are absolute: deadline N is start + N * period,
+ * whatever the previous cycle cost. If a cycle overruns a whole period we skip
+ * ahead instead of firing a burst of late reads.
+ *
+ * We wait on a condition variable bound to CLOCK_MONOTONIC rather than
+ * sleep() so Acquisition_Stop() doesn't have to wait out a full period.
+ *
+ * There is one worker per bus, not per controller. Each cycle it reads the
+ * slaves on its bus one after the other - they share the wire, so there is
+ * nothing to gain by asking in parallel - and pushes their samples into the
+ * bus's ring. A cycle's sequence number is the same for every controller on
+ * the bus.
+ *
+ * The reads themselves are bus scheduler jobs, run while the worker waits,
+ * so they take their turn on the RS485 line behind any user command and
+ * ahead of clock and settings housekeeping. One job per slave, so a command
+ * never waits for the whole bus to be polled. A read the line lost is only
+ * asked again if the answer could still be in before the next deadline.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "extraData.h"
+#include "settingsCache.h"
+#include "busScheduler.h"
+#include "clockSync.h"
+#include "sampleRing.h"
+#include "realTimeReader.h"
+#include "controllers.h"
+#include "metrics.h"
+#include "modbusProxy.h"
+#include "capture.h"
+#include "timeUtils.h"
+#include "acquisition.h"
+
+
+//
+//  One per bus
+typedef struct  acquisitionWorker {
+    controllerBus_t     *bus;
+    pthread_t           thread;
+    int                 started;
+    acquisitionStats_t  stats;
+} acquisitionWorker_t;
+
+//
+//  What a read job needs
+typedef struct  readJob {
+    controller_t        *controller;
+    sample_t            *sample;
+    uint64_t            deadlineNanos;  // retries that would run past it aren't tried
+} readJob_t;
+
+static  acquisitionConfig_t config;
+static  void                (*notifyPublisher)( void ) = NULL;
+
+static  acquisitionWorker_t workers[ MAX_BUSES ];
+static  pthread_mutex_t     waitMutex = PTHREAD_MUTEX_INITIALIZER;
+static  pthread_cond_t      waitCondition;
+static  volatile int        running = FALSE;
+
+
+// -----------------------------------------------------------------------------
+static
+int waitUntil (uint64_t deadlineNanos)
+{
+    struct timespec deadline = Time_NanosToTimespec( deadlineNanos );
+
+    pthread_mutex_lock( &waitMutex );
+    while (running && Time_MonotonicNanos() < deadlineNanos)
+        pthread_cond_timedwait( &waitCondition, &waitMutex, &deadline );
+    pthread_mutex_unlock( &waitMutex );
+
+    return running;
+}
+
+// -----------------------------------------------------------------------------
+static
+int realTimeJob (void *arg)
+{
+    readJob_t   *job = arg;
+    sample_t    *sample = job->sample;
+    controller_t    *controller = job->controller;
+    uint64_t    started = Time_MonotonicNanos();
+
+    //
+    //  deadlineNanos holds the time we queued this job until the loop
+    //  stamps the real deadline in
+    Metrics_Record( STAGE_BUS_WAIT, started - sample->deadlineNanos );
+
+    Bus_SetDeadline( controller->device.bus, job->deadlineNanos );
+    RealTimeReader_Read( &controller->reader, &controller->device, &sample->rtData, &sample->rtRead );
+    Bus_SetDeadline( controller->device.bus, 0 );
+    ModbusProxy_Update( controller, &controller->reader.snapshot, Time_MonotonicNanos() );
+    if (config.sendExtraData) {
+        ExtraData_Decode( &controller->reader.snapshot, SettingsCache_Get( &controller->settings ), &sample->extraData );
+        sample->haveExtraData = TRUE;
+    }
+
+    Metrics_Record( STAGE_MODBUS_READ, Time_MonotonicNanos() - started );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int settingsJob (void *arg)
+{
+    readJob_t   *job = arg;
+    sample_t    *sample = job->sample;
+    settingsCache_t *cache = &job->controller->settings;
+    uint64_t    started = Time_MonotonicNanos();
+
+    Bus_SetDeadline( job->controller->device.bus, job->deadlineNanos );
+    sample->settingsChanged = SettingsCache_Refresh( cache, &job->controller->device, time( NULL ) );
+    Bus_SetDeadline( job->controller->device.bus, 0 );
+    if (cache->lastReadOK)
+        ModbusProxy_Update( job->controller, &cache->snapshot, Time_MonotonicNanos() );
+    sample->extraData.settings = *SettingsCache_Get( cache );
+
+    Metrics_Record( STAGE_SETTINGS_READ, Time_MonotonicNanos() - started );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    readOneSample (busScheduler_t *scheduler, controller_t *controller, sample_t *sample, uint64_t nextDeadline)
+{
+    readJob_t   job = { controller, sample, nextDeadline };
+
+    memset( sample, '\0', sizeof( sample_t ) );
+
+    //
+    //  Queues a clock check now and then - it runs when the bus is free
+    if (config.synchClocks)
+        ClockSync_Poll( &controller->clock, Time_MonotonicNanos() );
+
+    sample->deadlineNanos = Time_MonotonicNanos();
+    BusScheduler_Run( scheduler, BUS_CLASS_REALTIME, nextDeadline, realTimeJob, &job );
+
+    if (config.sendExtraData && SettingsCache_IsDue( &controller->settings, time( NULL ) ))
+        BusScheduler_Run( scheduler, BUS_CLASS_SETTINGS, nextDeadline, settingsJob, &job );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *acquisitionLoop (void *arg)
+{
+    acquisitionWorker_t *worker = arg;
+    controllerBus_t     *bus = worker->bus;
+    acquisitionStats_t  *stats = &worker->stats;
+    uint64_t    period = (uint64_t) config.periodMillis * NANOS_PER_MILLI;
+    uint64_t    deadline = Time_MonotonicNanos();
+    uint64_t    sequence = 0;
+    sample_t    sample;
+
+    while (waitUntil( deadline )) {
+        uint64_t    woke = Time_MonotonicNanos();
+
+        for (int i = 0; i < bus->numControllers && running; i += 1) {
+            int controllerIndex = bus->controllers[ i ];
+
+            readOneSample( &bus->scheduler, &controllers[ controllerIndex ], &sample, deadline + period );
+
+            sample.controller = controllerIndex;
+            sample.sequence = sequence;
+            sample.wallTime = time( NULL );
+            sample.deadlineNanos = deadline;
+            sample.acquiredNanos = Time_MonotonicNanos();
+
+            SampleRing_Push( &bus->ring, &sample );
+            Capture_Record( controllerIndex, &controllers[ controllerIndex ].reader,
+                            (sample.settingsChanged ? &controllers[ controllerIndex ].settings : NULL), sample.wallTime );
+            if (sequence == 0)
+                Metrics_StartupEvent( STARTUP_FIRST_SAMPLE );
+            if (notifyPublisher != NULL)
+                (*notifyPublisher)();
+        }
+        sequence += 1;
+
+        stats->cycles += 1;
+        stats->lastCycleNanos = Time_MonotonicNanos() - woke;
+        Metrics_Record( STAGE_CYCLE, stats->lastCycleNanos );
+        if (stats->lastCycleNanos > stats->maxCycleNanos)
+            stats->maxCycleNanos = stats->lastCycleNanos;
+        if ((woke - deadline) > stats->maxLatenessNanos)
+            stats->maxLatenessNanos = woke - deadline;
+
+        deadline += period;
+        uint64_t now = Time_MonotonicNanos();
+        if (now >= deadline) {
+            uint64_t missed = ((now - deadline) / period) + 1;
+            Logger_LogWarning( "Reads on [%s] took %lu ms - skipping %lu polling period(s)\n", bus->portName,
+                                (unsigned long) (stats->lastCycleNanos / NANOS_PER_MILLI), (unsigned long) missed );
+            stats->missedDeadlines += missed;
+            deadline += missed * period;
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Acquisition_Start (const acquisitionConfig_t *acquisitionConfig, void (*sampleReady)( void ))
+{
+    pthread_condattr_t  attributes;
+
+    config = *acquisitionConfig;
+    if (config.periodMillis <= 0)
+        config.periodMillis = 1000;
+    notifyPublisher = sampleReady;
+    memset( workers, '\0', sizeof workers );
+
+    pthread_condattr_init( &attributes );
+    pthread_condattr_setclock( &attributes, CLOCK_MONOTONIC );
+    pthread_cond_init( &waitCondition, &attributes );
+    pthread_condattr_destroy( &attributes );
+
+    running = TRUE;
+    for (int i = 0; i < numBuses; i += 1) {
+        workers[ i ].bus = &buses[ i ];
+        if (pthread_create( &workers[ i ].thread, NULL, acquisitionLoop, &workers[ i ] )) {
+            Logger_LogFatal( "Unable to start the acquisition thread for [%s]!\n", buses[ i ].portName );
+            Acquisition_Stop();
+            return FALSE;
+        }
+        workers[ i ].started = TRUE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Acquisition_Stop (void)
+{
+    if (!running)
+        return;
+
+    pthread_mutex_lock( &waitMutex );
+    running = FALSE;
+    pthread_cond_broadcast( &waitCondition );
+    pthread_mutex_unlock( &waitMutex );
+
+    for (int i = 0; i < numBuses; i += 1)
+        if (workers[ i ].started)
+            pthread_join( workers[ i ].thread, NULL );
+}
+
+// -----------------------------------------------------------------------------
+void    Acquisition_GetStats (acquisitionStats_t *out)
+{
+    //
+    //  Summed over the buses; the worst case of the worst bus
+    memset( out, '\0', sizeof( acquisitionStats_t ) );
+    for (int i = 0; i < numBuses; i += 1) {
+        const acquisitionStats_t *stats = &workers[ i ].stats;
+
+        out->cycles += stats->cycles;
+        out->missedDeadlines += stats->missedDeadlines;
+        out->lastCycleNanos = stats->lastCycleNanos;
+        if (stats->maxLatenessNanos > out->maxLatenessNanos)
+            out->maxLatenessNanos = stats->maxLatenessNanos;
+        if (stats->maxCycleNanos > out->maxCycleNanos)
+            out->maxCycleNanos = stats->maxCycleNanos;
+    }
+}
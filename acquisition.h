@@ -0,0 +1,42 @@
+/*
+ * File:   acquisition.h
+ * Author: pconroy
+ *
+ * The polling threads, one per bus. Each reads the controllers on its bus on
+ * absolute CLOCK_MONOTONIC deadlines and hands the samples to the publisher
+ * through the bus's sample ring.
+ */
+
+#ifndef ACQUISITION_H
+#define ACQUISITION_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  acquisitionConfig {
+    int     periodMillis;               // time between deadlines
+    int     synchClocks;                // keep the controller clock in line with ours
+    int     sendExtraData;              // also read status bits / settings cache
+} acquisitionConfig_t;
+
+typedef struct  acquisitionStats {
+    unsigned long   cycles;             // passes over a bus, summed across buses
+    unsigned long   missedDeadlines;    // whole periods skipped because a cycle overran
+    uint64_t        maxLatenessNanos;   // worst wake up after a deadline
+    uint64_t        lastCycleNanos;     // how long the last set of reads took
+    uint64_t        maxCycleNanos;
+} acquisitionStats_t;
+
+extern  int     Acquisition_Start( const acquisitionConfig_t *config, void (*sampleReady)( void ) );
+extern  void    Acquisition_Stop( void );
+extern  void    Acquisition_GetStats( acquisitionStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACQUISITION_H */
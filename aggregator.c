@@ -0,0 +1,129 @@
+/*
+ * File:    aggregator.c
+ * author:  patrick conroy
+ *
+ * Each publish period the DATA message still carries the latest reading of
+ * every field, plus
+ *
+ *    "aggregates":{"samples":60,"seconds":59,
+ *                  "pvPower":{"min":..,"max":..,"mean":..,"last":..,"Wh":..}, ...}
+ *
+ * for the instantaneous fields flagged 'aggregated' in realTimeFields[]. Power
+ * fields are also integrated with the trapezoid rule. The integration carries
+ * the last reading over from one period to the next, so the stretch between
+ * the last sample of a period and the first sample of the next is counted
+ * once and no energy falls between two messages.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "realTimeFields.h"
+#include "timeUtils.h"
+#include "aggregator.h"
+
+
+#define NANOS_PER_HOUR      (3600.0 * NANOS_PER_SECOND)
+
+// -----------------------------------------------------------------------------
+void    Aggregator_Initialize (aggregator_t *aggregator)
+{
+    memset( aggregator, '\0', sizeof( aggregator_t ) );
+}
+
+// -----------------------------------------------------------------------------
+void    Aggregator_Add (aggregator_t *aggregator, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, uint64_t sampleNanos)
+{
+    periodAggregates_t  *current = &aggregator->current;
+
+    if (current->startNanos == 0)
+        current->startNanos = sampleNanos;
+    current->lastNanos = sampleNanos;
+    current->samples += 1;
+
+    for (int i = 0; i < numRealTimeFields && i < AGGREGATE_MAX_FIELDS; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ i ];
+        if (!field->aggregated)
+            continue;
+
+        //
+        //  A reading we would not publish doesn't go into the stats either,
+        //  and breaks the integration rather than bridging the gap with it
+        if (!RealTimeFields_IsValid( field, rtData, rtRead )) {
+            aggregator->havePrevious[ i ] = FALSE;
+            continue;
+        }
+
+        double              value = field->number( rtData );
+        fieldAggregate_t    *aggregate = &current->fields[ i ];
+
+        if (aggregate->count == 0 || value < aggregate->min)
+            aggregate->min = value;
+        if (aggregate->count == 0 || value > aggregate->max)
+            aggregate->max = value;
+        aggregate->sum += value;
+        aggregate->last = value;
+        aggregate->count += 1;
+
+        if (field->integrated) {
+            if (aggregator->havePrevious[ i ] && sampleNanos > aggregator->previousNanos[ i ])
+                aggregate->wattHours += ((aggregator->previousValue[ i ] + value) / 2.0)
+                                            * ((sampleNanos - aggregator->previousNanos[ i ]) / NANOS_PER_HOUR);
+            aggregator->havePrevious[ i ] = TRUE;
+            aggregator->previousValue[ i ] = value;
+            aggregator->previousNanos[ i ] = sampleNanos;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+unsigned long   Aggregator_Samples (const aggregator_t *aggregator)
+{
+    return aggregator->current.samples;
+}
+
+// -----------------------------------------------------------------------------
+const periodAggregates_t    *Aggregator_EndPeriod (aggregator_t *aggregator)
+{
+    //
+    //  Hand back the finished period and start a fresh one where it ended.
+    //  The integration state stays put
+    aggregator->completed = aggregator->current;
+    memset( &aggregator->current, '\0', sizeof( periodAggregates_t ) );
+    aggregator->current.startNanos = aggregator->completed.lastNanos;
+    return &aggregator->completed;
+}
+
+// -----------------------------------------------------------------------------
+void    Aggregator_Write (jsonWriter_t *writer, const periodAggregates_t *aggregates)
+{
+    JSON_BeginObject( writer, "aggregates" );
+    JSON_AddInt( writer, "samples", aggregates->samples );
+    JSON_AddFixed( writer, "seconds", (aggregates->lastNanos - aggregates->startNanos) / (double) NANOS_PER_SECOND, 1 );
+
+    for (int i = 0; i < numRealTimeFields && i < AGGREGATE_MAX_FIELDS; i += 1) {
+        const realTimeField_t   *field = &realTimeFields[ i ];
+        const fieldAggregate_t  *aggregate = &aggregates->fields[ i ];
+
+        if (!field->aggregated || aggregate->count == 0)
+            continue;
+
+        //
+        //  Same precision as the reading itself; the mean gets one more place
+        JSON_BeginObject( writer, field->key );
+        JSON_AddFixed( writer, "min", aggregate->min, field->decimals );
+        JSON_AddFixed( writer, "max", aggregate->max, field->decimals );
+        JSON_AddFixed( writer, "mean", aggregate->sum / aggregate->count, field->decimals + 1 );
+        JSON_AddFixed( writer, "last", aggregate->last, field->decimals );
+        if (field->integrated)
+            JSON_AddFixed( writer, "Wh", aggregate->wattHours, 3 );
+        JSON_EndObject( writer );
+    }
+
+    JSON_EndObject( writer );
+}
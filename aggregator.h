@@ -0,0 +1,62 @@
+/*
+ * File:   aggregator.h
+ * Author: pconroy
+ *
+ * Streaming per-field statistics over one publish period, for when we read
+ * the controller faster than we publish ("-r"). O(1) per sample per field.
+ */
+
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stdint.h>
+#include <time.h>
+#include "libepsolar.h"
+#include "registerPlanner.h"
+#include "jsonWriter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define AGGREGATE_MAX_FIELDS    64
+
+typedef struct  fieldAggregate {
+    unsigned long   count;
+    double          min;
+    double          max;
+    double          sum;
+    double          last;
+    double          wattHours;          // trapezoid integral, 'integrated' fields only
+} fieldAggregate_t;
+
+typedef struct  periodAggregates {
+    unsigned long       samples;
+    uint64_t            startNanos;     // CLOCK_MONOTONIC of the previous period's last sample (or our first)
+    uint64_t            lastNanos;      // ...and of our last one
+    fieldAggregate_t    fields[ AGGREGATE_MAX_FIELDS ];     // indexed the same as realTimeFields[]
+} periodAggregates_t;
+
+typedef struct  aggregator {
+    periodAggregates_t  current;
+    periodAggregates_t  completed;
+
+    //
+    //  Last valid reading of each integrated field, carried across periods
+    int                 havePrevious[ AGGREGATE_MAX_FIELDS ];
+    double              previousValue[ AGGREGATE_MAX_FIELDS ];
+    uint64_t            previousNanos[ AGGREGATE_MAX_FIELDS ];
+} aggregator_t;
+
+extern  void    Aggregator_Initialize( aggregator_t *aggregator );
+extern  void    Aggregator_Add( aggregator_t *aggregator, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, uint64_t sampleNanos );
+extern  unsigned long   Aggregator_Samples( const aggregator_t *aggregator );
+extern  const periodAggregates_t    *Aggregator_EndPeriod( aggregator_t *aggregator );
+extern  void    Aggregator_Write( jsonWriter_t *writer, const periodAggregates_t *aggregates );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AGGREGATOR_H */
@@ -0,0 +1,364 @@
+/*
+ * File:    asyncLog.c
+ * author:  patrick conroy
+ *
+ * Any thread logs, one thread writes. The ring is a bounded multi producer
+ * queue: each slot carries a sequence number, a producer claims the next
+ * index with a compare-and-swap on head and owns that slot until it bumps
+ * the slot's sequence. The writer is the only consumer. When the ring is
+ * full the message is dropped and counted - the caller never waits.
+ *
+ * Repeats are matched on the message with its numbers taken out, so
+ * "batteryTemperature out of range. Ignoring: 91.3" and "...: 91.4" are
+ * the same message but a different field's is not. The first few of a
+ * window go to the file, the rest are counted and summed up in one line
+ * when the window closes.
+ *
+ * Before AsyncLog_Initialize() and after AsyncLog_Terminate() messages go
+ * straight to stderr.
+ */
+
+#define _GNU_SOURCE
+#define ASYNCLOG_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libepsolar.h"
+#include "timeUtils.h"
+#include "asyncLog.h"
+
+
+#define WRITER_INTERVAL_NANOS   (100 * NANOS_PER_MILLI)
+#define REPEAT_SLOTS            64
+
+typedef struct  logSlot {
+    uint64_t        sequence;
+    logLevel_t      level;
+    struct timespec when;
+    char            text[ LOG_LINE_LENGTH ];
+} logSlot_t;
+
+//
+//  One per message shape seen in the last window
+typedef struct  repeatEntry {
+    uint32_t        hash;
+    logLevel_t      level;
+    time_t          windowStart;
+    unsigned long   count;              // this window, written or not
+    char            last[ LOG_LINE_LENGTH ];
+} repeatEntry_t;
+
+static  logSlot_t       slots[ LOG_RING_CAPACITY ];
+static  uint64_t        head = 0;           // producers
+static  uint64_t        tail = 0;           // writer only
+
+static  repeatEntry_t   repeats[ REPEAT_SLOTS ];
+static  FILE            *logFile = NULL;
+static  const char      *logFileName;
+static  long            logFileBytes;
+static  long            maxBytes;
+static  int             logLevel = LOG_LEVEL_WARNING;
+
+static  pthread_t       writerThread;
+static  volatile int    running = FALSE;
+static  asyncLogStats_t stats;
+
+static  const char      *levelNames[] = { "", "FATAL", "ERROR", "WARN ", "INFO ", "DEBUG" };
+
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    shapeOf (const char *text, logLevel_t level)
+{
+    //
+    //  FNV-1a of the message without its numbers
+    uint32_t    hash = 2166136261u ^ (uint32_t) level;
+
+    for (const char *p = text; *p != '\0'; p += 1) {
+        if (isdigit( (unsigned char) *p ) || *p == '.' || *p == '-')
+            continue;
+        hash = (hash ^ (uint8_t) *p) * 16777619u;
+    }
+    return hash;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    rotate (void)
+{
+    char    from[ 512 ];
+    char    to[ 512 ];
+
+    fclose( logFile );
+    for (int i = LOG_KEEP_FILES; i > 1; i -= 1) {
+        snprintf( from, sizeof from, "%s.%d", logFileName, i - 1 );
+        snprintf( to, sizeof to, "%s.%d", logFileName, i );
+        rename( from, to );
+    }
+    snprintf( to, sizeof to, "%s.1", logFileName );
+    rename( logFileName, to );
+
+    logFile = fopen( logFileName, "w" );
+    logFileBytes = 0;
+    stats.rotations += 1;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    writeLine (logLevel_t level, const struct timespec *when, const char *prefix, const char *text)
+{
+    struct tm   local;
+    char        stamp[ 32 ];
+
+    if (logFile == NULL)
+        return;
+    if (maxBytes > 0 && logFileBytes >= maxBytes)
+        rotate();
+    if (logFile == NULL)
+        return;
+
+    localtime_r( &when->tv_sec, &local );
+    strftime( stamp, sizeof stamp, "%Y-%m-%d %H:%M:%S", &local );
+
+    size_t  length = strlen( text );
+    int     n = fprintf( logFile, "%s.%03ld %s %s%s%s", stamp, when->tv_nsec / 1000000, levelNames[ level ], prefix, text,
+                            (length > 0 && text[ length - 1 ] == '\n') ? "" : "\n" );
+    if (n > 0)
+        logFileBytes += n;
+    stats.written += 1;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    closeWindow (repeatEntry_t *entry, const struct timespec *when)
+{
+    //
+    //  Whatever was only counted gets one line
+    if (entry->count > LOG_REPEAT_BURST) {
+        char    prefix[ 64 ];
+
+        snprintf( prefix, sizeof prefix, "repeated %lu times in %lds, last: ", entry->count - LOG_REPEAT_BURST,
+                    (long) (when->tv_sec - entry->windowStart) );
+        writeLine( entry->level, when, prefix, entry->last );
+    }
+    entry->hash = 0;
+    entry->count = 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    handle (const logSlot_t *slot)
+{
+    uint32_t        hash = shapeOf( slot->text, slot->level );
+    repeatEntry_t   *entry = NULL;
+    repeatEntry_t   *victim = NULL;             // a free entry, else the one with the oldest window
+
+    for (int i = 0; i < REPEAT_SLOTS && entry == NULL; i += 1) {
+        repeatEntry_t   *candidate = &repeats[ i ];
+
+        if (candidate->count > 0 && candidate->hash == hash)
+            entry = candidate;
+        else if (victim == NULL || (victim->count > 0 && (candidate->count == 0 || candidate->windowStart < victim->windowStart)))
+            victim = candidate;
+    }
+
+    if (entry != NULL && slot->when.tv_sec - entry->windowStart >= LOG_REPEAT_WINDOW_SECONDS)
+        closeWindow( entry, &slot->when );
+    if (entry == NULL || entry->count == 0) {
+        if (entry == NULL) {
+            entry = victim;
+            if (entry->count > 0)
+                closeWindow( entry, &slot->when );
+        }
+        entry->hash = hash;
+        entry->level = slot->level;
+        entry->windowStart = slot->when.tv_sec;
+    }
+
+    entry->count += 1;
+    if (entry->count <= LOG_REPEAT_BURST) {
+        writeLine( slot->level, &slot->when, "", slot->text );
+    } else {
+        strcpy( entry->last, slot->text );
+        stats.suppressed += 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int drain (void)
+{
+    int drained = 0;
+
+    for (;;) {
+        logSlot_t   *slot = &slots[ tail % LOG_RING_CAPACITY ];
+        if (__atomic_load_n( &slot->sequence, __ATOMIC_ACQUIRE ) != tail + 1)
+            break;
+
+        handle( slot );
+        __atomic_store_n( &slot->sequence, tail + LOG_RING_CAPACITY, __ATOMIC_RELEASE );
+        tail += 1;
+        drained += 1;
+    }
+    return drained;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    closeExpiredWindows (int all)
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    for (int i = 0; i < REPEAT_SLOTS; i += 1)
+        if (repeats[ i ].count > 0 && (all || now.tv_sec - repeats[ i ].windowStart >= LOG_REPEAT_WINDOW_SECONDS))
+            closeWindow( &repeats[ i ], &now );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *writerLoop (void *arg)
+{
+    struct timespec interval = Time_NanosToTimespec( WRITER_INTERVAL_NANOS );
+    unsigned long   droppedReported = 0;
+
+    (void) arg;
+    while (running) {
+        nanosleep( &interval, NULL );
+
+        unsigned long   writtenBefore = stats.written;
+        drain();
+        closeExpiredWindows( FALSE );
+
+        unsigned long dropped = __atomic_load_n( &stats.dropped, __ATOMIC_RELAXED );
+        if (dropped != droppedReported) {
+            struct timespec now;
+            char            text[ 96 ];
+
+            clock_gettime( CLOCK_REALTIME, &now );
+            snprintf( text, sizeof text, "%lu log messages lost - the log ring was full\n", dropped - droppedReported );
+            writeLine( LOG_LEVEL_WARNING, &now, "", text );
+            droppedReported = dropped;
+        }
+
+        //
+        //  One flush per batch, not per line - the card sees a write every
+        //  tenth of a second at most
+        if (stats.written != writtenBefore && logFile != NULL)
+            fflush( logFile );
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int AsyncLog_Initialize (const char *fileName, int level, int maxMB)
+{
+    //
+    //  log4c stays around for what the libraries log themselves
+    Logger_Initialize( LOG_LIBRARY_FILE, level );
+
+    logFileName = fileName;
+    logLevel = level;
+    maxBytes = (long) maxMB * 1024 * 1024;
+    for (uint64_t i = 0; i < LOG_RING_CAPACITY; i += 1)
+        slots[ i ].sequence = i;
+
+    logFile = fopen( fileName, "a" );
+    if (logFile == NULL) {
+        fprintf( stderr, "Unable to open the log file [%s]\n", fileName );
+        return FALSE;
+    }
+    fseek( logFile, 0, SEEK_END );
+    logFileBytes = ftell( logFile );
+
+    running = TRUE;
+    if (pthread_create( &writerThread, NULL, writerLoop, NULL )) {
+        fprintf( stderr, "Unable to start the log writer thread\n" );
+        running = FALSE;
+        return FALSE;
+    }
+
+    //
+    //  So a fatal error's message still makes it out when main() returns
+    atexit( AsyncLog_Terminate );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    AsyncLog_Write (logLevel_t level, const char *format, ...)
+{
+    va_list args;
+
+    if ((int) level > logLevel)
+        return;
+
+    if (!running) {
+        va_start( args, format );
+        vfprintf( stderr, format, args );
+        va_end( args );
+        return;
+    }
+
+    uint64_t    index = __atomic_load_n( &head, __ATOMIC_RELAXED );
+    logSlot_t   *slot;
+    for (;;) {
+        slot = &slots[ index % LOG_RING_CAPACITY ];
+        int64_t lag = (int64_t) __atomic_load_n( &slot->sequence, __ATOMIC_ACQUIRE ) - (int64_t) index;
+
+        if (lag == 0) {
+            if (__atomic_compare_exchange_n( &head, &index, index + 1, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED ))
+                break;
+        } else if (lag < 0) {
+            __atomic_add_fetch( &stats.dropped, 1, __ATOMIC_RELAXED );
+            return;
+        } else {
+            index = __atomic_load_n( &head, __ATOMIC_RELAXED );
+        }
+    }
+
+    slot->level = level;
+    clock_gettime( CLOCK_REALTIME, &slot->when );
+    va_start( args, format );
+    vsnprintf( slot->text, sizeof slot->text, format, args );
+    va_end( args );
+
+    __atomic_store_n( &slot->sequence, index + 1, __ATOMIC_RELEASE );
+    __atomic_add_fetch( &stats.logged, 1, __ATOMIC_RELAXED );
+}
+
+// -----------------------------------------------------------------------------
+void    AsyncLog_Terminate (void)
+{
+    if (!running)
+        return;
+
+    running = FALSE;
+    pthread_join( writerThread, NULL );
+
+    //
+    //  Whatever came in while the writer was on its way out
+    drain();
+    closeExpiredWindows( TRUE );
+    if (logFile != NULL)
+        fclose( logFile );
+    logFile = NULL;
+
+    Logger_Terminate();
+}
+
+// -----------------------------------------------------------------------------
+void    AsyncLog_GetStats (asyncLogStats_t *out)
+{
+    out->logged = __atomic_load_n( &stats.logged, __ATOMIC_RELAXED );
+    out->written = stats.written;
+    out->suppressed = stats.suppressed;
+    out->dropped = __atomic_load_n( &stats.dropped, __ATOMIC_RELAXED );
+    out->rotations = stats.rotations;
+}
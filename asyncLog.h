@@ -0,0 +1,69 @@
+/*
+ * File:   asyncLog.h
+ * Author: pconroy
+ *
+ * Logging that costs the caller a vsnprintf() and a slot in a lock-free
+ * ring, never a file write. A background thread drains the ring into the
+ * log file, rate limits messages that keep repeating ("repeated 3600 times")
+ * and rotates the file when it reaches its cap ("-l").
+ *
+ * Include this instead of log4c.h - the Logger_Log* calls below are routed
+ * through the ring. log4c itself is still set up, for the libraries' own
+ * messages, on a file of its own.
+ */
+
+#ifndef ASYNCLOG_H
+#define ASYNCLOG_H
+
+#include "log4c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOG_DEFAULT_FILE            "/tmp/epsolar_mqtt.log"
+#define LOG_LIBRARY_FILE            "/tmp/epsolar_mqtt.lib.log"
+#define LOG_DEFAULT_MAX_MB          4           // "-l" - 0 for no cap
+#define LOG_KEEP_FILES              3           // .1 .. .3 after rotation
+#define LOG_RING_CAPACITY           512         // power of two
+#define LOG_LINE_LENGTH             240
+#define LOG_REPEAT_WINDOW_SECONDS   60
+#define LOG_REPEAT_BURST            3           // the same message this many times a window, then just counted
+
+//
+//  "-v" 1..5 - only messages at or below it are written
+typedef enum {
+    LOG_LEVEL_FATAL = 1,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+} logLevel_t;
+
+typedef struct  asyncLogStats {
+    unsigned long   logged;             // into the ring
+    unsigned long   written;            // lines in the file
+    unsigned long   suppressed;         // repeats only counted
+    unsigned long   dropped;            // the ring was full
+    unsigned long   rotations;
+} asyncLogStats_t;
+
+extern  int     AsyncLog_Initialize( const char *fileName, int level, int maxMB );
+extern  void    AsyncLog_Write( logLevel_t level, const char *format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+extern  void    AsyncLog_Terminate( void );
+extern  void    AsyncLog_GetStats( asyncLogStats_t *stats );
+
+#ifndef ASYNCLOG_IMPLEMENTATION
+#define Logger_LogFatal( ... )      AsyncLog_Write( LOG_LEVEL_FATAL, __VA_ARGS__ )
+#define Logger_LogError( ... )      AsyncLog_Write( LOG_LEVEL_ERROR, __VA_ARGS__ )
+#define Logger_LogWarning( ... )    AsyncLog_Write( LOG_LEVEL_WARNING, __VA_ARGS__ )
+#define Logger_LogInfo( ... )       AsyncLog_Write( LOG_LEVEL_INFO, __VA_ARGS__ )
+#define Logger_LogDebug( ... )      AsyncLog_Write( LOG_LEVEL_DEBUG, __VA_ARGS__ )
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ASYNCLOG_H */
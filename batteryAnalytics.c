@@ -0,0 +1,212 @@
+/*
+ * File:    batteryAnalytics.c
+ * author:  patrick conroy
+ *
+ * Adds to the DATA message
+ *
+ *    "battery":{"resistanceMilliOhms":24.8,"netPower":-13.9,"hoursToEmpty":61.3,
+ *               "socTrend":-0.42,"ahInToday":31.07,"ahOutToday":12.55}
+ *
+ * Each window is exponential - the sums are scaled down by exp(-dt / window)
+ * before a sample goes in - so nothing is ever stored per sample. Keys are
+ * left out until there is enough behind them: no resistance until the
+ * current has stepped a few times, no hours to full / empty without a
+ * capacity or while the battery is just sitting there.
+ *
+ * Resistance: a battery's voltage is its open circuit voltage plus I * R,
+ * and the open circuit voltage barely moves between two samples. So the
+ * change in voltage over the change in current, when the current jumps
+ * (a load switching, a cloud), is R - and fitting dV against dI through
+ * the origin averages the noise out.
+ *
+ * The state of charge trend is an ordinary least squares slope over the
+ * window, in % per hour. The sums are kept with the latest sample at t = 0,
+ * so they stay small however long we run.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "realTimeFields.h"
+#include "timeUtils.h"
+#include "batteryAnalytics.h"
+
+
+#define MIN_RESISTANCE_STEPS    3.0     // weighted count of 1 A steps before R means much
+#define MIN_SOC_WEIGHT          10.0    // weighted samples before the trend is reported
+#define MIN_SOC_SPREAD_HOURS    (5.0 / 60.0)
+
+static  const char  *inputs[] = { "batteryVoltage", "batteryCurrent", "batterySOC" };
+static  fieldMask_t inputsRead;         // their bits in a sample's field mask
+
+
+// -----------------------------------------------------------------------------
+int BatteryAnalytics_Check (void)
+{
+    //
+    //  Everything is worked out from these, so "-f" / "-F" mustn't take them away
+    for (size_t i = 0; i < sizeof inputs / sizeof inputs[ 0 ]; i += 1) {
+        int index = RealTimeFields_Find( inputs[ i ] );
+        if (index < 0 || !RealTimeFields_IsEnabled( &realTimeFields[ index ] )) {
+            Logger_LogFatal( "Battery analytics need [%s] - it has been masked out\n", inputs[ i ] );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    BatteryAnalytics_Initialize (batteryAnalytics_t *analytics, double capacityAh)
+{
+    memset( analytics, '\0', sizeof( batteryAnalytics_t ) );
+    analytics->capacityAh = capacityAh;
+
+    inputsRead = 0;
+    for (size_t i = 0; i < sizeof inputs / sizeof inputs[ 0 ]; i += 1) {
+        int index = RealTimeFields_Find( inputs[ i ] );
+        if (index >= 0)
+            inputsRead |= (fieldMask_t) 1 << index;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+time_t  nextMidnight (time_t wallTime)
+{
+    struct tm   local;
+
+    localtime_r( &wallTime, &local );
+    local.tm_mday += 1;
+    local.tm_hour = local.tm_min = local.tm_sec = 0;
+    local.tm_isdst = -1;
+    return mktime( &local );
+}
+
+// -----------------------------------------------------------------------------
+void    BatteryAnalytics_Add (batteryAnalytics_t *analytics, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, time_t wallTime, uint64_t sampleNanos)
+{
+    double  voltage = rtData->batteryVoltage;
+    double  current = rtData->batteryCurrent;
+    double  soc = rtData->batteryStateOfCharge;
+
+    //
+    //  Not if any of them didn't come back - and a zero voltage isn't a
+    //  battery either
+    if ((rtRead & inputsRead) != inputsRead || voltage <= 0.0 || soc < 0.0 || soc > 100.0)
+        return;
+
+    //
+    //  localtime() only when the day is over
+    if (wallTime >= analytics->dayEnds) {
+        analytics->dayEnds = nextMidnight( wallTime );
+        analytics->ahIn = analytics->ahOut = 0.0;
+    }
+
+    if (!analytics->haveSample) {
+        analytics->haveSample = TRUE;
+        analytics->netPower = voltage * current;
+    } else {
+        double  dt = (sampleNanos - analytics->lastNanos) / (double) NANOS_PER_SECOND;
+        if (dt <= 0.0)
+            return;
+
+        //
+        //  Trapezoid, split where the current crosses zero so charge and
+        //  discharge are counted apart
+        if (dt <= BATTERY_MAX_INTEGRATION_GAP_SECONDS) {
+            double  from = analytics->lastCurrent;
+            double  hours = dt / 3600.0;
+
+            if ((from >= 0.0) == (current >= 0.0)) {
+                double ah = (from + current) / 2.0 * hours;
+                if (ah >= 0.0)
+                    analytics->ahIn += ah;
+                else
+                    analytics->ahOut -= ah;
+            } else {
+                double  crossing = from / (from - current);     // fraction of dt before zero
+                double  first = from / 2.0 * hours * crossing;
+                double  second = current / 2.0 * hours * (1.0 - crossing);
+                analytics->ahIn += (first > 0.0 ? first : second);
+                analytics->ahOut -= (first < 0.0 ? first : second);
+            }
+        }
+
+        //
+        //  Resistance - only a real step in the current, not drift across a gap
+        double  decay = exp( -dt / BATTERY_RESISTANCE_WINDOW_SECONDS );
+        double  dI = current - analytics->lastCurrent;
+        double  dV = voltage - analytics->lastVoltage;
+        analytics->stepsIV *= decay;
+        analytics->stepsII *= decay;
+        if (fabs( dI ) >= BATTERY_RESISTANCE_MIN_STEP_AMPS && dt <= BATTERY_RESISTANCE_MAX_GAP_SECONDS) {
+            analytics->stepsIV += dI * dV;
+            analytics->stepsII += dI * dI;
+        }
+
+        double  alpha = 1.0 - exp( -dt / BATTERY_POWER_WINDOW_SECONDS );
+        analytics->netPower += alpha * ((voltage * current) - analytics->netPower);
+
+        //
+        //  Slide the time origin up to this sample, then age everything
+        double  h = dt / 3600.0;
+        decay = exp( -dt / BATTERY_SOC_WINDOW_SECONDS );
+        analytics->socTT = (analytics->socTT - 2.0 * h * analytics->socT + h * h * analytics->socWeight) * decay;
+        analytics->socTY = (analytics->socTY - h * analytics->socY) * decay;
+        analytics->socT = (analytics->socT - h * analytics->socWeight) * decay;
+        analytics->socWeight *= decay;
+        analytics->socY *= decay;
+    }
+
+    //
+    //  This sample is at t = 0, so it only adds to the weight and the y sum
+    analytics->socWeight += 1.0;
+    analytics->socY += soc;
+
+    analytics->lastNanos = sampleNanos;
+    analytics->lastVoltage = voltage;
+    analytics->lastCurrent = current;
+    analytics->soc = soc;
+    analytics->voltage = voltage;
+}
+
+// -----------------------------------------------------------------------------
+void    BatteryAnalytics_Write (jsonWriter_t *writer, const batteryAnalytics_t *analytics)
+{
+    if (!analytics->haveSample)
+        return;
+
+    JSON_BeginObject( writer, "battery" );
+
+    if (analytics->stepsII >= MIN_RESISTANCE_STEPS * BATTERY_RESISTANCE_MIN_STEP_AMPS * BATTERY_RESISTANCE_MIN_STEP_AMPS) {
+        double resistance = analytics->stepsIV / analytics->stepsII;
+        if (resistance > 0.0)
+            JSON_AddFixed( writer, "resistanceMilliOhms", resistance * 1000.0, 1 );
+    }
+
+    JSON_AddFixed( writer, "netPower", analytics->netPower, 1 );
+    if (analytics->capacityAh > 0.0 && fabs( analytics->netPower ) >= BATTERY_POWER_MIN_WATTS) {
+        double  percent = (analytics->netPower > 0.0) ? 100.0 - analytics->soc : analytics->soc;
+        double  hours = (percent / 100.0) * analytics->capacityAh * analytics->voltage / fabs( analytics->netPower );
+        if (hours <= BATTERY_MAX_HOURS)
+            JSON_AddFixed( writer, (analytics->netPower > 0.0 ? "hoursToFull" : "hoursToEmpty"), hours, 1 );
+    }
+
+    //
+    //  Weighted variance of t, times the weight squared
+    double  spread = analytics->socWeight * analytics->socTT - analytics->socT * analytics->socT;
+    if (analytics->socWeight >= MIN_SOC_WEIGHT && spread > analytics->socWeight * analytics->socWeight * MIN_SOC_SPREAD_HOURS * MIN_SOC_SPREAD_HOURS) {
+        double slope = (analytics->socWeight * analytics->socTY - analytics->socT * analytics->socY) / spread;
+        JSON_AddFixed( writer, "socTrend", slope, 2 );
+    }
+
+    JSON_AddFixed( writer, "ahInToday", analytics->ahIn, 2 );
+    JSON_AddFixed( writer, "ahOutToday", analytics->ahOut, 2 );
+    JSON_EndObject( writer );
+}
@@ -0,0 +1,80 @@
+/*
+ * File:   batteryAnalytics.h
+ * Author: pconroy
+ *
+ * "-u" battery estimates worked out as the samples go by, so subscribers
+ * don't each have to keep history to get them: internal resistance, a
+ * smoothed net battery power and the hours to full / empty it implies, the
+ * state of charge trend, and today's charge and discharge in Ah. Every
+ * estimator is a handful of exponentially weighted sums - O(1) per sample
+ * and O(1) memory per controller.
+ */
+
+#ifndef BATTERYANALYTICS_H
+#define BATTERYANALYTICS_H
+
+#include <stdint.h>
+#include <time.h>
+#include "libepsolar.h"
+#include "registerPlanner.h"
+#include "jsonWriter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATTERY_RESISTANCE_WINDOW_SECONDS   3600.0
+#define BATTERY_RESISTANCE_MIN_STEP_AMPS    1.0     // smaller current steps are mostly noise
+#define BATTERY_RESISTANCE_MAX_GAP_SECONDS  10.0    // ...and so are steps across a longer gap
+#define BATTERY_POWER_WINDOW_SECONDS        300.0
+#define BATTERY_POWER_MIN_WATTS             5.0     // less than this either way - neither filling nor emptying
+#define BATTERY_SOC_WINDOW_SECONDS          1800.0
+#define BATTERY_MAX_INTEGRATION_GAP_SECONDS 300.0   // don't guess what the current did across a longer gap
+#define BATTERY_MAX_HOURS                   240.0   // further out than this isn't worth reporting
+
+typedef struct  batteryAnalytics {
+    double      capacityAh;             // "-u", or the controller's setting - 0 if neither
+    int         haveSample;
+    uint64_t    lastNanos;
+    double      lastVoltage;
+    double      lastCurrent;
+
+    //
+    //  Internal resistance: regression through the origin of dV on dI
+    //  between neighbouring samples
+    double      stepsIV;
+    double      stepsII;
+
+    //
+    //  Net battery power, V * I, charging positive
+    double      netPower;
+
+    //
+    //  State of charge against time, in hours, the latest sample at 0
+    double      socWeight;
+    double      socT;
+    double      socTT;
+    double      socY;
+    double      socTY;
+
+    //
+    //  Today, local time
+    time_t      dayEnds;
+    double      ahIn;
+    double      ahOut;
+
+    double      soc;
+    double      voltage;
+} batteryAnalytics_t;
+
+extern  int     BatteryAnalytics_Check( void );
+extern  void    BatteryAnalytics_Initialize( batteryAnalytics_t *analytics, double capacityAh );
+extern  void    BatteryAnalytics_Add( batteryAnalytics_t *analytics, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, time_t wallTime, uint64_t sampleNanos );
+extern  void    BatteryAnalytics_Write( jsonWriter_t *writer, const batteryAnalytics_t *analytics );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATTERYANALYTICS_H */
@@ -0,0 +1,54 @@
+/*
+ * File:    allocCounter.c
+ * author:  patrick conroy
+ *
+ * Linked into the benchmark programs (or LD_PRELOADed as a shared object) to
+ * count heap allocations. glibc exports its real allocator as __libc_malloc()
+ * and friends, so we just count and pass the call on.
+ */
+
+#include <stddef.h>
+
+#include "allocCounter.h"
+
+
+extern  void    *__libc_malloc( size_t size );
+extern  void    *__libc_calloc( size_t count, size_t size );
+extern  void    *__libc_realloc( void *ptr, size_t size );
+extern  void    __libc_free( void *ptr );
+
+static  volatile unsigned long  allocations = 0;
+
+
+// -----------------------------------------------------------------------------
+void    *malloc (size_t size)
+{
+    __atomic_add_fetch( &allocations, 1, __ATOMIC_RELAXED );
+    return __libc_malloc( size );
+}
+
+// -----------------------------------------------------------------------------
+void    *calloc (size_t count, size_t size)
+{
+    __atomic_add_fetch( &allocations, 1, __ATOMIC_RELAXED );
+    return __libc_calloc( count, size );
+}
+
+// -----------------------------------------------------------------------------
+void    *realloc (void *ptr, size_t size)
+{
+    __atomic_add_fetch( &allocations, 1, __ATOMIC_RELAXED );
+    return __libc_realloc( ptr, size );
+}
+
+// -----------------------------------------------------------------------------
+void    free (void *ptr)
+{
+    __libc_free( ptr );
+}
+
+// -----------------------------------------------------------------------------
+unsigned long   AllocCounter_Get (void)
+{
+    return __atomic_load_n( &allocations, __ATOMIC_RELAXED );
+}
@@ -0,0 +1,14 @@
+/*
+ * File:   allocCounter.h
+ * Author: pconroy
+ *
+ * Counts every malloc/calloc/realloc in the process, shared libraries
+ * included, by interposing on the glibc allocator entry points.
+ */
+
+#ifndef ALLOCCOUNTER_H
+#define ALLOCCOUNTER_H
+
+extern  unsigned long   AllocCounter_Get( void );
+
+#endif /* ALLOCCOUNTER_H */
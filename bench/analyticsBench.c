@@ -0,0 +1,159 @@
+/*
+ * File:    analyticsBench.c
+ * author:  patrick conroy
+ *
+ * Microbenchmark: the "-u" battery estimators. Feeds a simulated battery -
+ * known internal resistance and capacity, a daily charge curve with loads
+ * switching on and off - through BatteryAnalytics_Add() at 1 Hz, checks the
+ * estimates against what was simulated, then times runs of growing length
+ * to show the cost per sample doesn't grow with them.
+ *
+ *  usage: analyticsBench [ samples ]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "libepsolar.h"
+#include "jsonWriter.h"
+#include "timeUtils.h"
+#include "batteryAnalytics.h"
+
+
+#define RESISTANCE          0.025       // ohms
+#define CAPACITY_AH         200.0
+#define START_TIME          1700000000  // 2023-11-14, any day will do
+
+typedef struct  simulation {
+    double      soc;
+    double      loadAmps;
+    double      exactAhIn;
+    double      exactAhOut;
+    double      lastCurrent;
+    unsigned    random;
+} simulation_t;
+
+
+// -----------------------------------------------------------------------------
+static
+double  now (void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    step (simulation_t *sim, long second, epsolarRealTimeData_t *rtData)
+{
+    //
+    //  Charging through the middle of the day, loads switching every so often
+    double  hourOfDay = fmod( second / 3600.0, 24.0 );
+    double  solarAmps = (hourOfDay > 7.0 && hourOfDay < 17.0) ? 20.0 * sin( M_PI * (hourOfDay - 7.0) / 10.0 ) : 0.0;
+
+    if ((second % 30) == 0) {
+        sim->random = sim->random * 1103515245u + 12345u;
+        sim->loadAmps = ((sim->random >> 16) % 4) * 2.5;
+    }
+
+    double  current = solarAmps - sim->loadAmps;
+    if (second > 0) {
+        double ah = (sim->lastCurrent + current) / 2.0 / 3600.0;
+        if ((sim->lastCurrent >= 0.0) == (current >= 0.0)) {
+            if (ah >= 0.0)
+                sim->exactAhIn += ah;
+            else
+                sim->exactAhOut -= ah;
+        }
+    }
+    sim->lastCurrent = current;
+    sim->soc += current / 3600.0 / CAPACITY_AH * 100.0;
+    if (sim->soc > 100.0)
+        sim->soc = 100.0;
+    if (sim->soc < 0.0)
+        sim->soc = 0.0;
+
+    memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
+    rtData->batteryCurrent = current;
+    rtData->batteryVoltage = 11.8 + 0.014 * sim->soc + current * RESISTANCE;
+    rtData->batteryStateOfCharge = (int) (sim->soc + 0.5);
+}
+
+// -----------------------------------------------------------------------------
+static
+int check (void)
+{
+    //
+    //  Six hours from midnight into the morning charge - one day, so the Ah
+    //  totals haven't been reset
+    batteryAnalytics_t      analytics;
+    epsolarRealTimeData_t   rtData;
+    simulation_t            sim = { 50.0, 0.0, 0.0, 0.0, 0.0, 1 };
+    char                    buffer[ 512 ];
+    jsonWriter_t            writer;
+
+    BatteryAnalytics_Initialize( &analytics, CAPACITY_AH );
+    time_t  midnight = (START_TIME / 86400) * 86400;
+    for (long second = 0; second < 6 * 3600; second += 1) {
+        step( &sim, second + 5 * 3600, &rtData );
+        BatteryAnalytics_Add( &analytics, &rtData, FIELD_MASK_ALL, midnight + 12 * 3600 + second, (uint64_t) second * NANOS_PER_SECOND );
+    }
+
+    JSON_Begin( &writer, buffer, sizeof buffer );
+    BatteryAnalytics_Write( &writer, &analytics );
+    printf( "    %s\n", JSON_End( &writer ) );
+
+    double  resistance = analytics.stepsIV / analytics.stepsII;
+    int     ok = fabs( resistance - RESISTANCE ) < RESISTANCE * 0.05;
+    printf( "    resistance %.2f mOhm, simulated %.2f mOhm: %s\n", resistance * 1000.0, RESISTANCE * 1000.0, (ok ? "ok" : "WRONG") );
+
+    int ahOK = fabs( analytics.ahIn - sim.exactAhIn ) < 0.02 * sim.exactAhIn + 0.1 &&
+                fabs( analytics.ahOut - sim.exactAhOut ) < 0.02 * sim.exactAhOut + 0.1;
+    printf( "    Ah in %.2f / out %.2f, simulated %.2f / %.2f: %s\n", analytics.ahIn, analytics.ahOut, sim.exactAhIn, sim.exactAhOut, (ahOK ? "ok" : "WRONG") );
+
+    return ok && ahOK;
+}
+
+// -----------------------------------------------------------------------------
+static
+double  nanosPerSample (long samples)
+{
+    batteryAnalytics_t      analytics;
+    epsolarRealTimeData_t   *inputs = malloc( 1024 * sizeof( epsolarRealTimeData_t ) );
+    simulation_t            sim = { 50.0, 0.0, 0.0, 0.0, 0.0, 1 };
+
+    //
+    //  Inputs made up front so only the estimators are timed
+    for (long i = 0; i < 1024; i += 1)
+        step( &sim, i * 37, &inputs[ i ] );
+
+    BatteryAnalytics_Initialize( &analytics, CAPACITY_AH );
+    double start = now();
+    for (long i = 0; i < samples; i += 1)
+        BatteryAnalytics_Add( &analytics, &inputs[ i & 1023 ], FIELD_MASK_ALL, START_TIME + i, (uint64_t) (i + 1) * NANOS_PER_SECOND );
+    double seconds = now() - start;
+
+    free( inputs );
+    return seconds * 1e9 / samples;
+}
+
+// -----------------------------------------------------------------------------
+int main (int argc, char *argv[])
+{
+    long    samples = (argc > 1) ? atol( argv[ 1 ] ) : 10000000;
+
+    printf( "Battery analytics benchmark - up to %ld samples\n", samples );
+    int ok = check();
+
+    printf( "    %8s  %10s  %s\n", "samples", "ns/sample", "state bytes" );
+    for (long n = 1000; n <= samples; n *= 10)
+        printf( "    %8ld  %10.1f  %zu\n", n, nanosPerSample( n ), sizeof( batteryAnalytics_t ) );
+
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,153 @@
+/*
+ * File:    endToEnd.c
+ * author:  patrick conroy
+ *
+ * End-to-end benchmark: no controller, no broker, no network. Starts the
+ * simulated controller on a pty and the MQTT sink on the loopback, then runs
+ * the real daemon (the benchmark build, which counts allocations) against
+ * them for a fixed number of samples. The daemon prints its own RESULT line
+ * (cycles/sec, cycle and end-to-end p50/p99, allocations per cycle, RSS);
+ * we add what the simulator and the sink saw.
+ *
+ *  usage: endToEnd [ -n samples ] [ -r seconds ] [ -l latencyMicros ] [ -j jitterMicros ]
+ *                  [ -t timeout% ] [ -e exception% ] [ -c corrupt% ] [ -x ] [ -d daemon ]
+ *                  [ -T ] [ -w inflight ] [ -N networkMicros ] [ -b badCount% ]
+ *
+ * "-T" puts the simulated controller behind a Modbus TCP gateway; run it with
+ * "-w 1" and then "-w 4" and some "-N" to see what pipelining is worth. "-b"
+ * garbles the byte count of some answers; every one of them should be read
+ * again, so the daemon still gets all its samples.
+ *
+ * The defaults - 1ms sampling, every sample published, no faults - are what
+ * "make bench" runs, so its numbers can be compared commit to commit.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "epsolarSim.h"
+#include "mqttSink.h"
+
+
+// -----------------------------------------------------------------------------
+static
+void    showHelp (void)
+{
+    puts( "usage: endToEnd [ options ]" );
+    puts( "  -n  N          samples to run (defaults to 5000)" );
+    puts( "  -r  N          read the controller every N seconds (defaults to 0.001)" );
+    puts( "  -l  N          simulated controller response latency <microseconds>" );
+    puts( "  -j  N          plus up to N microseconds of jitter" );
+    puts( "  -t  N          percent of requests the controller never answers" );
+    puts( "  -e  N          percent of requests answered with a Modbus exception" );
+    puts( "  -c  N          percent of responses sent with a bad CRC" );
+    puts( "  -x             run the daemon with extra data (-x)" );
+    puts( "  -d  <string>   daemon to run (defaults to build/bench/epsolar_mqtt_bench)" );
+    puts( "  -T             talk Modbus TCP to the simulator instead of RTU on a pty" );
+    puts( "  -w  N          with -T, let the daemon have N requests in flight" );
+    puts( "  -N  N          with -T, one way network delay <microseconds>" );
+    puts( "  -b  N          percent of register reads answered with the wrong byte count" );
+    exit( 1 );
+}
+
+// -----------------------------------------------------------------------------
+int main (int argc, char *argv[])
+{
+    simConfig_t simConfig = { 1, 0, 0, 0.0, 0.0, 0.0, 0, 0, 0.0 };
+    int         inflight = 0;
+    const char  *samples = "5000";
+    const char  *sampleSeconds = "0.001";
+    const char  *daemon = "build/bench/epsolar_mqtt_bench";
+    int         extraData = 0;
+    int         c;
+
+    while ((c = getopt( argc, argv, "n:r:l:j:t:e:c:xd:Tw:N:b:" )) != -1) {
+        switch (c) {
+            case 'n':   samples = optarg;                               break;
+            case 'r':   sampleSeconds = optarg;                         break;
+            case 'l':   simConfig.latencyMicros = atoi( optarg );       break;
+            case 'j':   simConfig.jitterMicros = atoi( optarg );        break;
+            case 't':   simConfig.timeoutPercent = atof( optarg );      break;
+            case 'e':   simConfig.exceptionPercent = atof( optarg );    break;
+            case 'c':   simConfig.corruptPercent = atof( optarg );      break;
+            case 'x':   extraData = 1;                                  break;
+            case 'd':   daemon = optarg;                                break;
+            case 'T':   simConfig.tcp = 1;                              break;
+            case 'w':   inflight = atoi( optarg );                      break;
+            case 'N':   simConfig.networkMicros = atoi( optarg );       break;
+            case 'b':   simConfig.badCountPercent = atof( optarg );     break;
+            default:    showHelp();                                     break;
+        }
+    }
+
+    if (!Sim_Start( &simConfig ))
+        return EXIT_FAILURE;
+    int port = Sink_Start();
+    if (port < 0)
+        return EXIT_FAILURE;
+
+    char    portArgument[ 16 ];
+    char    deviceArgument[ 192 ];
+    snprintf( portArgument, sizeof portArgument, "%d", port );
+    if (simConfig.tcp && inflight > 0)
+        snprintf( deviceArgument, sizeof deviceArgument, "%s?inflight=%d", Sim_PortName(), inflight );
+    else
+        snprintf( deviceArgument, sizeof deviceArgument, "%s", Sim_PortName() );
+    printf( "endToEnd: controller on %s, broker on 127.0.0.1:%d, %s samples every %s s\n",
+                deviceArgument, port, samples, sampleSeconds );
+    fflush( stdout );
+
+    //
+    //  "-s 0" - publish every sample, so every cycle goes through the JSON
+    //  and mosquitto paths, not just one per aggregation period
+    char    *arguments[ 24 ];
+    int     n = 0;
+    arguments[ n++ ] = (char *) daemon;
+    arguments[ n++ ] = "-p";    arguments[ n++ ] = deviceArgument;
+    arguments[ n++ ] = "-h";    arguments[ n++ ] = "127.0.0.1";
+    arguments[ n++ ] = "-P";    arguments[ n++ ] = portArgument;
+    arguments[ n++ ] = "-s";    arguments[ n++ ] = "0";
+    arguments[ n++ ] = "-r";    arguments[ n++ ] = (char *) sampleSeconds;
+    arguments[ n++ ] = "-n";    arguments[ n++ ] = (char *) samples;
+    arguments[ n++ ] = "-m";    arguments[ n++ ] = "0";
+    arguments[ n++ ] = "-v";    arguments[ n++ ] = "1";
+    if (extraData)
+        arguments[ n++ ] = "-x";
+    arguments[ n ] = NULL;
+
+    pid_t   child = fork();
+    if (child == 0) {
+        execv( daemon, arguments );
+        perror( daemon );
+        _exit( 127 );
+    }
+
+    int status = 1;
+    if (child < 0 || waitpid( child, &status, 0 ) < 0)
+        perror( "endToEnd" );
+
+    //
+    //  Let the last messages drain into the sink before we count them
+    usleep( 200000 );
+    Sink_Stop();
+    Sim_Stop();
+
+    simStats_t  sim;
+    sinkStats_t sink;
+    Sim_GetStats( &sim );
+    Sink_GetStats( &sink );
+    printf( "SIMULATOR requests=%lu badFrames=%lu timeouts=%lu exceptions=%lu corrupted=%lu badCounts=%lu connections=%lu maxInFlight=%lu\n",
+                sim.requests, sim.badFrames, sim.timeouts, sim.exceptions, sim.corrupted, sim.badCounts, sim.connections, sim.maxInFlight );
+    printf( "BROKER connections=%lu messages=%lu payloadBytes=%lu bytesPerMessage=%.1f\n",
+                sink.connections, sink.messages, sink.payloadBytes,
+                (sink.messages > 0 ? (double) sink.payloadBytes / sink.messages : 0.0) );
+
+    return (WIFEXITED( status ) && WEXITSTATUS( status ) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,684 @@
+/*
+ * File:    epsolarSim.c
+ * author:  patrick conroy
+ *
+ * Speaks Modbus RTU on the master side of a pty; the daemon opens the slave
+ * side as if it were /dev/ttyUSB0. The framing is done here rather than with
+ * a libmodbus server context so faults can be injected per request.
+ *
+ * With "tcp" set it plays an RS485 to Ethernet gateway instead: MBAP framed
+ * requests on a loopback port, any number in flight. Like a real gateway it
+ * answers them in order, one at a time on the (simulated) serial side, so
+ * pipelining only buys back the network round trips - networkMicros each
+ * way - which is exactly what it buys on site.
+ *
+ * The register map follows the "Tracer A/B series Modbus protocol" document
+ * closely enough for libepsolar and our block reads:
+ *  coils       0x0000 - 0x00FF     (0x0002 manual load control)
+ *  discretes   0x2000 - 0x20FF     (0x200C night time)
+ *  input       0x3000 - 0x33FF     (ratings, realtime, status, statistics)
+ *  holding     0x9000 - 0x90FF     (settings, 0x9013 - 0x9015 the clock)
+ * Anything else gets an "illegal data address" exception. The realtime values
+ * wander a little on every read so delta mode and the aggregates have some
+ * work to do.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "epsolarSim.h"
+
+
+#define COIL_BASE           0x0000
+#define DISCRETE_BASE       0x2000
+#define INPUT_BASE          0x3000
+#define HOLDING_BASE        0x9000
+#define NUM_COILS           0x100
+#define NUM_DISCRETES       0x100
+#define NUM_INPUTS          0x400
+#define NUM_HOLDING         0x100
+
+#define MAX_FRAME           256
+#define MBAP_HEADER         7
+#define MAX_PENDING         32
+#define EXCEPTION_ILLEGAL_FUNCTION  0x01
+#define EXCEPTION_ILLEGAL_ADDRESS   0x02
+#define EXCEPTION_BUSY              0x06
+
+static  simConfig_t     config;
+static  simStats_t      stats;
+
+static  int             masterFD = -1;
+static  int             slaveFD = -1;       // kept open so the master never sees a hangup
+static  int             listenFD = -1;      // TCP
+static  int             clientFD = -1;
+static  char            portName[ 128 ];
+static  pthread_t       simThread;
+static  volatile int    running = 0;
+static  unsigned int    randomSeed = 1;
+
+static  uint8_t         coils[ NUM_COILS ];
+static  uint8_t         discretes[ NUM_DISCRETES ];
+static  uint16_t        inputs[ NUM_INPUTS ];
+static  uint16_t        holding[ NUM_HOLDING ];
+
+//
+//  TCP: answers waiting for their turn on the wire, oldest first
+typedef struct  pendingResponse {
+    uint64_t    sendAtNanos;
+    int         length;
+    uint8_t     bytes[ MBAP_HEADER + MAX_FRAME ];
+} pendingResponse_t;
+
+static  pendingResponse_t   pending[ MAX_PENDING ];
+static  int                 numPending = 0;
+static  uint64_t            serialFreeNanos = 0;    // when the gateway's serial side is done with what it has
+
+
+// -----------------------------------------------------------------------------
+static
+uint16_t    crc16 (const uint8_t *bytes, size_t length)
+{
+    uint16_t    crc = 0xFFFF;
+
+    for (size_t i = 0; i < length; i += 1) {
+        crc ^= bytes[ i ];
+        for (int bit = 0; bit < 8; bit += 1)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+    return crc;
+}
+
+// -----------------------------------------------------------------------------
+static
+int percentChance (double percent)
+{
+    return (percent > 0.0) && ((rand_r( &randomSeed ) / (RAND_MAX + 1.0)) * 100.0 < percent);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    setInput32 (int address, uint32_t value)
+{
+    //
+    //  EPSolar 32 bit values are low word first
+    inputs[ address - INPUT_BASE ] = value & 0xFFFF;
+    inputs[ address - INPUT_BASE + 1 ] = value >> 16;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    initializeRegisters (void)
+{
+    memset( coils, '\0', sizeof coils );
+    memset( discretes, '\0', sizeof discretes );
+    memset( inputs, '\0', sizeof inputs );
+    memset( holding, '\0', sizeof holding );
+
+    coils[ 0x0002 ] = 1;                                    // load on
+
+    inputs[ 0x3000 - INPUT_BASE ] = 10000;                  // rated PV voltage 100.00V
+    inputs[ 0x3001 - INPUT_BASE ] = 4000;                   // rated PV current 40.00A
+    setInput32( 0x3002, 104000 );                           // rated PV power 1040.00W
+    inputs[ 0x3004 - INPUT_BASE ] = 1200;                   // rated battery voltage
+    inputs[ 0x3005 - INPUT_BASE ] = 4000;
+    setInput32( 0x3006, 52000 );
+    inputs[ 0x300E - INPUT_BASE ] = 4000;                   // rated load current
+
+    inputs[ 0x3200 - INPUT_BASE ] = 0x0000;                 // battery status
+    inputs[ 0x3201 - INPUT_BASE ] = 0x0009;                 // charging: running, MPPT
+    inputs[ 0x3202 - INPUT_BASE ] = 0x0001;                 // discharging: running
+
+    inputs[ 0x3302 - INPUT_BASE ] = 1442;                   // max battery voltage today
+    inputs[ 0x3303 - INPUT_BASE ] = 1261;                   // min battery voltage today
+    setInput32( 0x3304, 12 );                               // consumed today 0.12kWh
+    setInput32( 0x3306, 340 );
+    setInput32( 0x3308, 4107 );
+    setInput32( 0x330A, 21290 );
+    setInput32( 0x330C, 93 );                               // generated today
+    setInput32( 0x330E, 1722 );
+    setInput32( 0x3310, 20150 );
+    setInput32( 0x3312, 124033 );
+
+    holding[ 0x9000 - HOLDING_BASE ] = 0x0001;              // battery type: sealed
+    holding[ 0x9001 - HOLDING_BASE ] = 200;                 // capacity Ah
+    holding[ 0x9002 - HOLDING_BASE ] = 300;                 // temperature compensation
+    static const uint16_t voltages[] = { 1600, 1500, 1500, 1460, 1440, 1380, 1320, 1260, 1220, 1200, 1110, 1060 };
+    for (size_t i = 0; i < sizeof voltages / sizeof voltages[ 0 ]; i += 1)
+        holding[ 0x9003 - HOLDING_BASE + i ] = voltages[ i ];
+    holding[ 0x9017 - HOLDING_BASE ] = 6500;                // battery temperature upper limit
+    holding[ 0x9018 - HOLDING_BASE ] = (uint16_t) -4000;
+    holding[ 0x9019 - HOLDING_BASE ] = 8500;
+    holding[ 0x901A - HOLDING_BASE ] = 7500;
+    holding[ 0x906A - HOLDING_BASE ] = 120;                 // boost duration
+    holding[ 0x906B - HOLDING_BASE ] = 120;                 // equalize duration
+    holding[ 0x906D - HOLDING_BASE ] = 80;                  // discharging percentage
+    holding[ 0x906E - HOLDING_BASE ] = 100;                 // charging percentage
+}
+
+// -----------------------------------------------------------------------------
+static
+void    updateRegisters (void)
+{
+    struct timespec now;
+    struct tm       local;
+
+    clock_gettime( CLOCK_REALTIME, &now );
+    double  t = now.tv_sec + now.tv_nsec / 1e9;
+
+    //
+    //  A slow swing with a little noise on top
+    double  noise = (rand_r( &randomSeed ) / (double) RAND_MAX) - 0.5;
+    double  pvVolts = 38.0 + 2.0 * sin( t / 30.0 ) + 0.1 * noise;
+    double  pvAmps = 4.2 + 0.5 * sin( t / 45.0 ) + 0.05 * noise;
+    double  batteryVolts = 13.3 + 0.2 * sin( t / 60.0 );
+    double  loadAmps = 0.87 + 0.05 * noise;
+
+    inputs[ 0x3100 - INPUT_BASE ] = (uint16_t) (pvVolts * 100.0);
+    inputs[ 0x3101 - INPUT_BASE ] = (uint16_t) (pvAmps * 100.0);
+    setInput32( 0x3102, (uint32_t) (pvVolts * pvAmps * 100.0) );
+    inputs[ 0x3104 - INPUT_BASE ] = (uint16_t) (batteryVolts * 100.0);
+    inputs[ 0x3105 - INPUT_BASE ] = (uint16_t) (pvAmps * 0.9 * 100.0);
+    setInput32( 0x3106, (uint32_t) (batteryVolts * pvAmps * 0.9 * 100.0) );
+    inputs[ 0x310C - INPUT_BASE ] = (uint16_t) (batteryVolts * 100.0);
+    inputs[ 0x310D - INPUT_BASE ] = (uint16_t) (loadAmps * 100.0);
+    setInput32( 0x310E, (uint32_t) (batteryVolts * loadAmps * 100.0) );
+    inputs[ 0x3110 - INPUT_BASE ] = (uint16_t) (2137 + 20 * noise);        // battery temperature
+    inputs[ 0x3111 - INPUT_BASE ] = (uint16_t) (2980 + 20 * noise);        // controller temperature
+    inputs[ 0x311A - INPUT_BASE ] = 87;                                     // SOC
+    inputs[ 0x331A - INPUT_BASE ] = (uint16_t) (batteryVolts * 100.0);
+    setInput32( 0x331B, (uint32_t) (int32_t) ((pvAmps * 0.9 - loadAmps) * 100.0) );
+
+    discretes[ 0x200C - DISCRETE_BASE ] = 0;                                // daytime
+
+    //
+    //  The clock runs on its own unless the daemon has set it
+    localtime_r( &now.tv_sec, &local );
+    holding[ 0x9013 - HOLDING_BASE ] = (local.tm_min << 8) | local.tm_sec;
+    holding[ 0x9014 - HOLDING_BASE ] = (local.tm_mday << 8) | local.tm_hour;
+    holding[ 0x9015 - HOLDING_BASE ] = ((local.tm_year - 100) << 8) | (local.tm_mon + 1);
+}
+
+// -----------------------------------------------------------------------------
+static
+int frameLength (const uint8_t *frame, size_t available)
+{
+    //
+    //  0 - need more bytes, -1 - not a request we understand
+    if (available < 2)
+        return 0;
+
+    switch (frame[ 1 ]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06:
+            return 8;
+        case 0x0F: case 0x10:
+            return (available < 7) ? 0 : 9 + frame[ 6 ];
+        default:
+            return -1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int exception (uint8_t *response, const uint8_t *request, int code)
+{
+    response[ 0 ] = request[ 0 ];
+    response[ 1 ] = request[ 1 ] | 0x80;
+    response[ 2 ] = code;
+    return 3;
+}
+
+// -----------------------------------------------------------------------------
+static
+int readBits (uint8_t *response, const uint8_t *request, const uint8_t *bits, int base, int numBits, int address, int count)
+{
+    if (count < 1 || count > 2000 || address < base || (address + count) > (base + numBits))
+        return exception( response, request, EXCEPTION_ILLEGAL_ADDRESS );
+
+    int byteCount = (count + 7) / 8;
+    response[ 0 ] = request[ 0 ];
+    response[ 1 ] = request[ 1 ];
+    response[ 2 ] = byteCount;
+    memset( &response[ 3 ], '\0', byteCount );
+    for (int i = 0; i < count; i += 1)
+        if (bits[ address - base + i ])
+            response[ 3 + (i / 8) ] |= (1 << (i % 8));
+    return 3 + byteCount;
+}
+
+// -----------------------------------------------------------------------------
+static
+int readWords (uint8_t *response, const uint8_t *request, const uint16_t *words, int base, int numWords, int address, int count)
+{
+    if (count < 1 || count > 125 || address < base || (address + count) > (base + numWords))
+        return exception( response, request, EXCEPTION_ILLEGAL_ADDRESS );
+
+    response[ 0 ] = request[ 0 ];
+    response[ 1 ] = request[ 1 ];
+    response[ 2 ] = count * 2;
+    for (int i = 0; i < count; i += 1) {
+        response[ 3 + (i * 2) ] = words[ address - base + i ] >> 8;
+        response[ 4 + (i * 2) ] = words[ address - base + i ] & 0xFF;
+    }
+    return 3 + (count * 2);
+}
+
+// -----------------------------------------------------------------------------
+static
+int handleRequest (const uint8_t *request, uint8_t *response)
+{
+    //
+    //  Returns the response length without the CRC
+    int address = (request[ 2 ] << 8) | request[ 3 ];
+    int value = (request[ 4 ] << 8) | request[ 5 ];
+
+    updateRegisters();
+
+    switch (request[ 1 ]) {
+        case 0x01:  return readBits( response, request, coils, COIL_BASE, NUM_COILS, address, value );
+        case 0x02:  return readBits( response, request, discretes, DISCRETE_BASE, NUM_DISCRETES, address, value );
+        case 0x03:  return readWords( response, request, holding, HOLDING_BASE, NUM_HOLDING, address, value );
+        case 0x04:  return readWords( response, request, inputs, INPUT_BASE, NUM_INPUTS, address, value );
+
+        case 0x05:
+            if (address < COIL_BASE || address >= COIL_BASE + NUM_COILS)
+                return exception( response, request, EXCEPTION_ILLEGAL_ADDRESS );
+            coils[ address - COIL_BASE ] = (value == 0xFF00);
+            memcpy( response, request, 6 );
+            return 6;
+
+        case 0x06:
+            if (address < HOLDING_BASE || address >= HOLDING_BASE + NUM_HOLDING)
+                return exception( response, request, EXCEPTION_ILLEGAL_ADDRESS );
+            holding[ address - HOLDING_BASE ] = value;
+            memcpy( response, request, 6 );
+            return 6;
+
+        case 0x0F:
+            if (address < COIL_BASE || (address + value) > COIL_BASE + NUM_COILS)
+                return exception( response, request, EXCEPTION_ILLEGAL_ADDRESS );
+            for (int i = 0; i < value; i += 1)
+                coils[ address - COIL_BASE + i ] = (request[ 7 + (i / 8) ] >> (i % 8)) & 1;
+            memcpy( response, request, 6 );
+            return 6;
+
+        case 0x10:
+            if (address < HOLDING_BASE || (address + value) > HOLDING_BASE + NUM_HOLDING || request[ 6 ] != value * 2)
+                return exception( response, request, EXCEPTION_ILLEGAL_ADDRESS );
+            for (int i = 0; i < value; i += 1)
+                holding[ address - HOLDING_BASE + i ] = (request[ 7 + (i * 2) ] << 8) | request[ 8 + (i * 2) ];
+            memcpy( response, request, 6 );
+            return 6;
+    }
+
+    return exception( response, request, EXCEPTION_ILLEGAL_FUNCTION );
+}
+
+// -----------------------------------------------------------------------------
+static
+int buildResponse (const uint8_t *request, uint8_t *response)
+{
+    //
+    //  The response without any framing, or -1 when we're playing dead
+    stats.requests += 1;
+    if (percentChance( config.timeoutPercent )) {
+        stats.timeouts += 1;
+        return -1;
+    }
+
+    if (percentChance( config.exceptionPercent )) {
+        stats.exceptions += 1;
+        return exception( response, request, EXCEPTION_BUSY );
+    }
+
+    int length = handleRequest( request, response );
+
+    //
+    //  A well framed answer the master has to throw away - with TCP, in the
+    //  middle of whatever else is in flight
+    if ((response[ 1 ] == 0x03 || response[ 1 ] == 0x04) && percentChance( config.badCountPercent )) {
+        stats.badCounts += 1;
+        response[ 2 ] -= 2;
+    }
+    return length;
+}
+
+// -----------------------------------------------------------------------------
+static
+int responseDelayMicros (void)
+{
+    int delay = config.latencyMicros;
+    if (config.jitterMicros > 0)
+        delay += rand_r( &randomSeed ) % config.jitterMicros;
+    return delay;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    respond (const uint8_t *request)
+{
+    uint8_t     response[ MAX_FRAME ];
+
+    int length = buildResponse( request, response );
+    if (length < 0)
+        return;
+
+    uint16_t crc = crc16( response, length );
+    if (percentChance( config.corruptPercent )) {
+        stats.corrupted += 1;
+        crc ^= 0x5555;
+    }
+    response[ length++ ] = crc & 0xFF;
+    response[ length++ ] = crc >> 8;
+
+    int delay = responseDelayMicros();
+    if (delay > 0) {
+        struct timespec pause = { delay / 1000000, (delay % 1000000) * 1000L };
+        nanosleep( &pause, NULL );
+    }
+
+    if (write( masterFD, response, length ) != length)
+        fprintf( stderr, "epsolarSim: short write: %s\n", strerror( errno ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *simLoop (void *arg)
+{
+    uint8_t     frame[ MAX_FRAME ];
+    size_t      have = 0;
+
+    while (running) {
+        struct pollfd   pfd = { masterFD, POLLIN, 0 };
+        if (poll( &pfd, 1, 100 ) <= 0)
+            continue;
+
+        ssize_t n = read( masterFD, &frame[ have ], sizeof frame - have );
+        if (n <= 0)
+            continue;
+        have += n;
+
+        //
+        //  Requests come one at a time, so anything we can't make sense of
+        //  is thrown away whole, like a real slave waiting out the 3.5 char gap
+        while (have > 0) {
+            int length = frameLength( frame, have );
+            if (length == 0 || (length > 0 && (size_t) length > have))
+                break;
+
+            if (length < 0 || length > MAX_FRAME || crc16( frame, length - 2 ) != (frame[ length - 2 ] | (frame[ length - 1 ] << 8))) {
+                stats.badFrames += 1;
+                have = 0;
+                break;
+            }
+
+            if (frame[ 0 ] == config.slaveID)
+                respond( frame );
+
+            memmove( frame, &frame[ length ], have - length );
+            have -= length;
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    nowNanos (void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    closeClient (void)
+{
+    if (clientFD >= 0)
+        close( clientFD );
+    clientFD = -1;
+    numPending = 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    queueTcpResponse (const uint8_t *frame)
+{
+    //
+    //  frame[ 6 ] onwards is laid out like an RTU request without the CRC
+    if (frame[ 6 ] != config.slaveID)
+        return;
+    if (numPending >= MAX_PENDING) {
+        stats.timeouts += 1;
+        return;
+    }
+
+    pendingResponse_t *response = &pending[ numPending ];
+    int length = buildResponse( &frame[ 6 ], &response->bytes[ 6 ] );
+    if (length < 0)
+        return;
+
+    if (percentChance( config.corruptPercent )) {
+        stats.corrupted += 1;
+        closeClient();
+        return;
+    }
+
+    memcpy( response->bytes, frame, 4 );        // transaction and protocol ids
+    response->bytes[ 4 ] = length >> 8;
+    response->bytes[ 5 ] = length & 0xFF;
+    response->length = 6 + length;
+
+    //
+    //  Over the network to the gateway, wait for the serial side, the
+    //  controller's own latency, back over the network
+    uint64_t    network = (uint64_t) config.networkMicros * 1000;
+    uint64_t    start = nowNanos() + network;
+    if (start < serialFreeNanos)
+        start = serialFreeNanos;
+    serialFreeNanos = start + (uint64_t) responseDelayMicros() * 1000;
+    response->sendAtNanos = serialFreeNanos + network;
+
+    numPending += 1;
+    if ((unsigned long) numPending > stats.maxInFlight)
+        stats.maxInFlight = numPending;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    sendDueResponses (void)
+{
+    uint64_t    now = nowNanos();
+    int         sent = 0;
+
+    while (sent < numPending && pending[ sent ].sendAtNanos <= now) {
+        if (write( clientFD, pending[ sent ].bytes, pending[ sent ].length ) != pending[ sent ].length)
+            fprintf( stderr, "epsolarSim: short write: %s\n", strerror( errno ) );
+        sent += 1;
+    }
+
+    memmove( pending, &pending[ sent ], (numPending - sent) * sizeof( pendingResponse_t ) );
+    numPending -= sent;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *simTcpLoop (void *arg)
+{
+    uint8_t     frame[ MBAP_HEADER + MAX_FRAME ];
+    size_t      have = 0;
+
+    while (running) {
+        struct pollfd   pfds[ 2 ] = { { listenFD, POLLIN, 0 }, { clientFD, POLLIN, 0 } };
+        struct timespec wait = { 0, 100000000L };
+
+        if (numPending > 0) {
+            uint64_t now = nowNanos();
+            uint64_t due = (pending[ 0 ].sendAtNanos > now) ? pending[ 0 ].sendAtNanos - now : 0;
+            wait.tv_sec = due / 1000000000ULL;
+            wait.tv_nsec = due % 1000000000ULL;
+        }
+
+        if (ppoll( pfds, (clientFD >= 0 ? 2 : 1), &wait, NULL ) < 0)
+            continue;
+
+        //
+        //  A new connection replaces the old one, same as most gateways
+        if (pfds[ 0 ].revents & POLLIN) {
+            int fd = accept( listenFD, NULL, NULL );
+            if (fd >= 0) {
+                int on = 1;
+                closeClient();
+                setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on );
+                clientFD = fd;
+                have = 0;
+                stats.connections += 1;
+            }
+        }
+
+        if (clientFD >= 0 && (pfds[ 1 ].revents & (POLLIN | POLLHUP | POLLERR))) {
+            ssize_t n = read( clientFD, &frame[ have ], sizeof frame - have );
+            if (n <= 0) {
+                closeClient();
+                continue;
+            }
+            have += n;
+
+            while (clientFD >= 0 && have >= MBAP_HEADER) {
+                size_t length = 6 + ((frame[ 4 ] << 8) | frame[ 5 ]);
+                if (length < MBAP_HEADER + 1 || length > sizeof frame) {
+                    stats.badFrames += 1;
+                    have = 0;
+                    break;
+                }
+                if (have < length)
+                    break;
+
+                queueTcpResponse( frame );
+                memmove( frame, &frame[ length ], have - length );
+                have -= length;
+            }
+        }
+
+        if (clientFD >= 0)
+            sendDueResponses();
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int startTcp (void)
+{
+    struct sockaddr_in  address;
+    socklen_t           addressLength = sizeof address;
+    int                 on = 1;
+
+    listenFD = socket( AF_INET, SOCK_STREAM, 0 );
+    memset( &address, '\0', sizeof address );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    address.sin_port = 0;
+
+    setsockopt( listenFD, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on );
+    if (listenFD < 0 || bind( listenFD, (struct sockaddr *) &address, sizeof address ) != 0
+            || listen( listenFD, 4 ) != 0 || getsockname( listenFD, (struct sockaddr *) &address, &addressLength ) != 0) {
+        fprintf( stderr, "epsolarSim: unable to listen on the loopback: %s\n", strerror( errno ) );
+        return 0;
+    }
+
+    snprintf( portName, sizeof portName, "tcp://127.0.0.1:%d", ntohs( address.sin_port ) );
+    running = 1;
+    if (pthread_create( &simThread, NULL, simTcpLoop, NULL ) != 0) {
+        running = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+int Sim_Start (const simConfig_t *simConfig)
+{
+    struct termios  raw;
+
+    config = *simConfig;
+    if (config.slaveID <= 0)
+        config.slaveID = 1;
+    memset( &stats, '\0', sizeof stats );
+    initializeRegisters();
+    if (config.tcp)
+        return startTcp();
+
+    masterFD = posix_openpt( O_RDWR | O_NOCTTY );
+    if (masterFD < 0 || grantpt( masterFD ) != 0 || unlockpt( masterFD ) != 0
+            || ptsname_r( masterFD, portName, sizeof portName ) != 0) {
+        fprintf( stderr, "epsolarSim: unable to create a pty: %s\n", strerror( errno ) );
+        return 0;
+    }
+
+    //
+    //  No echo, no line editing, no CR/LF games - libmodbus sets the same
+    //  when it opens the other end, but the first request may beat it there
+    slaveFD = open( portName, O_RDWR | O_NOCTTY );
+    if (slaveFD < 0 || tcgetattr( slaveFD, &raw ) != 0) {
+        fprintf( stderr, "epsolarSim: unable to open [%s]: %s\n", portName, strerror( errno ) );
+        return 0;
+    }
+    cfmakeraw( &raw );
+    tcsetattr( slaveFD, TCSANOW, &raw );
+
+    running = 1;
+    if (pthread_create( &simThread, NULL, simLoop, NULL ) != 0) {
+        running = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// -----------------------------------------------------------------------------
+const char  *Sim_PortName (void)
+{
+    return portName;
+}
+
+// -----------------------------------------------------------------------------
+void    Sim_Stop (void)
+{
+    if (!running)
+        return;
+
+    running = 0;
+    pthread_join( simThread, NULL );
+    if (config.tcp) {
+        closeClient();
+        close( listenFD );
+        return;
+    }
+    close( slaveFD );
+    close( masterFD );
+}
+
+// -----------------------------------------------------------------------------
+void    Sim_GetStats (simStats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,51 @@
+/*
+ * File:   epsolarSim.h
+ * Author: pconroy
+ *
+ * A simulated Tracer controller: a Modbus RTU slave serving the EPSolar
+ * register map on a pseudo-terminal, or the same controller behind a Modbus
+ * TCP gateway on a loopback port, with configurable response latency and
+ * fault injection. Point the daemon's "-p" at Sim_PortName().
+ */
+
+#ifndef EPSOLARSIM_H
+#define EPSOLARSIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  simConfig {
+    int     slaveID;
+    int     latencyMicros;          // added before every response
+    int     jitterMicros;           // plus up to this much, uniformly
+    double  timeoutPercent;         // requests we never answer
+    double  exceptionPercent;       // requests answered with "slave device busy"
+    double  corruptPercent;         // responses sent with a bad CRC (TCP: the gateway drops the connection instead)
+    int     tcp;                    // serve Modbus TCP instead of RTU on a pty
+    int     networkMicros;          // TCP: one way network delay, each way
+    double  badCountPercent;        // register reads answered with the wrong byte count, framing intact
+} simConfig_t;
+
+typedef struct  simStats {
+    unsigned long   requests;
+    unsigned long   badFrames;
+    unsigned long   timeouts;
+    unsigned long   exceptions;
+    unsigned long   corrupted;
+    unsigned long   badCounts;
+    unsigned long   connections;    // TCP: connections accepted
+    unsigned long   maxInFlight;    // TCP: most requests we held at once
+} simStats_t;
+
+extern  int         Sim_Start( const simConfig_t *config );
+extern  const char  *Sim_PortName( void );
+extern  void        Sim_Stop( void );
+extern  void        Sim_GetStats( simStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EPSOLARSIM_H */
@@ -0,0 +1,225 @@
+/*
+ * File:    historyBench.c
+ * author:  patrick conroy
+ *
+ * Benchmark for the sample history: appends a synthetic week of 1 Hz samples
+ * (a day / night PV curve, a battery that charges and sags, noisy readings
+ * quantized the way the registers are) to a scratch file, then reports bytes
+ * per sample, append rate, and query throughput for the whole range, a
+ * three field range and a one hour window. Every sample read back is checked
+ * against what went in.
+ *
+ *  usage: historyBench [ samples [ megabytes ] ]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libepsolar.h"
+#include "realTimeFields.h"
+#include "history.h"
+
+
+#define START_TIME      1760000000L
+
+typedef struct  countState {
+    long        samples;
+    double      sum;
+} countState_t;
+
+typedef struct  checkState {
+    const int   *fields;
+    int         numFields;
+    long        samples;
+    long        mismatches;
+    time_t      expected;
+} checkState_t;
+
+
+// -----------------------------------------------------------------------------
+static
+double  now (void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// -----------------------------------------------------------------------------
+static
+double  noise (long i, int salt)
+{
+    //
+    //  Repeatable, so the query check can regenerate any sample from its time
+    uint32_t    x = (uint32_t) i * 2654435761u ^ (uint32_t) salt * 40503u;
+    x ^= x >> 15;
+    x *= 2246822519u;
+    x ^= x >> 13;
+    return (x & 0xFFFF) / 65535.0 - 0.5;
+}
+
+// -----------------------------------------------------------------------------
+static
+double  quantize (double value)
+{
+    //
+    //  Most registers are hundredths
+    return floor( value * 100.0 + 0.5 ) / 100.0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    makeSample (long i, epsolarRealTimeData_t *rtData)
+{
+    double  hour = fmod( i / 3600.0, 24.0 );
+    double  sun = (hour > 6.0 && hour < 18.0) ? sin( (hour - 6.0) / 12.0 * M_PI ) : 0.0;
+
+    memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
+    rtData->isNightTime = (sun == 0.0);
+    rtData->loadIsOn = TRUE;
+
+    rtData->pvVoltage = quantize( sun > 0 ? 36.0 + 2.0 * sun + noise( i, 1 ) * 0.2 : 0.0 );
+    rtData->pvCurrent = quantize( sun * 8.0 * (1.0 + noise( i, 2 ) * 0.05) );
+    rtData->pvPower = quantize( rtData->pvVoltage * rtData->pvCurrent );
+
+    rtData->loadVoltage = quantize( 12.8 + sun * 0.8 + noise( i / 10, 3 ) * 0.04 );
+    rtData->loadCurrent = quantize( 0.85 + noise( i / 30, 4 ) * 0.1 );
+    rtData->loadPower = quantize( rtData->loadVoltage * rtData->loadCurrent );
+
+    rtData->batteryVoltage = rtData->loadVoltage;
+    rtData->batteryCurrent = quantize( rtData->pvCurrent - rtData->loadCurrent );
+    rtData->batteryStateOfCharge = 60 + (int) (35.0 * sun);
+    rtData->batteryMaxVoltage = 14.42;
+    rtData->batteryMinVoltage = 12.61;
+    rtData->batteryTemperature = quantize( 20.0 + 5.0 * sun + noise( i / 60, 5 ) * 0.2 );
+    rtData->controllerTemp = quantize( 25.0 + 8.0 * sun + noise( i / 60, 6 ) * 0.2 );
+
+    rtData->chargerStatusNormal = TRUE;
+    rtData->chargerRunning = (sun > 0);
+    rtData->controllerStatusBits = (sun > 0 ? 0x0009 : 0x0001);
+
+    double day = floor( i / 86400.0 );
+    rtData->energyConsumedToday = quantize( fmod( i, 86400.0 ) * 11.0 / 3600000.0 );
+    rtData->energyConsumedMonth = quantize( 3.4 + day * 0.26 );
+    rtData->energyConsumedYear = quantize( 41.07 + day * 0.26 );
+    rtData->energyConsumedTotal = quantize( 212.9 + day * 0.26 );
+    rtData->energyGeneratedToday = quantize( 0.93 * (1.0 - cos( sun * M_PI / 2 )) );
+    rtData->energyGeneratedMonth = quantize( 17.22 + day * 0.93 );
+    rtData->energyGeneratedYear = quantize( 201.5 + day * 0.93 );
+    rtData->energyGeneratedTotal = quantize( 1240.33 + day * 0.93 );
+}
+
+// -----------------------------------------------------------------------------
+static
+int countSample (void *arg, time_t when, const double *values)
+{
+    //
+    //  Touch the values so the timed pass costs what a real consumer would
+    countState_t    *state = arg;
+
+    state->samples += 1;
+    state->sum += values[ 0 ];
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int checkSample (void *arg, time_t when, const double *values)
+{
+    checkState_t            *state = arg;
+    epsolarRealTimeData_t   rtData;
+
+    makeSample( when - START_TIME, &rtData );
+    if (when != state->expected)
+        state->mismatches += 1;
+    for (int i = 0; i < state->numFields; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ RealTimeFields_Find( History_FieldName( state->fields[ i ] ) ) ];
+        float expected = RealTimeFields_IsValid( field, &rtData, FIELD_MASK_ALL ) ? (float) field->number( &rtData ) : NAN;
+        if (!(values[ i ] == expected || (isnan( values[ i ] ) && isnan( expected ))))
+            state->mismatches += 1;
+    }
+
+    state->expected = when + 1;
+    state->samples += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int runQuery (historyStore_t *store, const char *label, time_t from, time_t to, const int *fields, int numFields, long expected)
+{
+    countState_t    counted = { 0, 0.0 };
+    checkState_t    checked = { fields, numFields, 0, 0, from };
+
+    double start = now();
+    History_Query( store, from, to, fields, numFields, countSample, &counted );
+    double seconds = now() - start;
+
+    //
+    //  Then again, untimed, comparing every value with what went in
+    History_Query( store, from, to, fields, numFields, checkSample, &checked );
+    int ok = (checked.mismatches == 0 && checked.samples == expected && counted.samples == expected);
+
+    printf( "    %-24s %8ld samples  %12.0f samples/sec  %8.2f ms  %s\n", label, counted.samples, counted.samples / seconds,
+                    seconds * 1000.0, (ok ? "ok" : "MISMATCH") );
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+int main (int argc, char *argv[])
+{
+    long    samples = (argc > 1) ? atol( argv[ 1 ] ) : 7 * 86400;
+    long    megabytes = (argc > 2) ? atol( argv[ 2 ] ) : 16;
+    char    path[] = "/tmp/historyBench-XXXXXX";
+    historyStore_t  store;
+    historyStats_t  stats;
+
+    int fd = mkstemp( path );
+    if (fd < 0 || !History_Open( &store, path, (size_t) megabytes * 1024 * 1024 )) {
+        printf( "Unable to create [%s]\n", path );
+        return EXIT_FAILURE;
+    }
+    close( fd );
+
+    printf( "history benchmark - %ld samples of %d fields at 1 Hz into %ld MB\n", samples, History_NumFields(), megabytes );
+
+    epsolarRealTimeData_t   rtData;
+    double start = now();
+    for (long i = 0; i < samples; i += 1) {
+        makeSample( i, &rtData );
+        History_Append( &store, START_TIME + i, &rtData, FIELD_MASK_ALL );
+    }
+    double appendSeconds = now() - start;
+
+    History_GetStats( &store, &stats );
+    double bytesPerSample = (double) stats.bytesUsed / stats.samples;
+    double rawBytes = 8 + History_NumFields() * 4;
+    printf( "    append                   %8lu samples  %12.0f samples/sec\n", stats.samples, samples / appendSeconds );
+    printf( "    stored                   %8.2f bytes/sample (%.1fx smaller than raw floats), %lu of %lu blocks\n",
+                    bytesPerSample, rawBytes / bytesPerSample, stats.blocks, stats.totalBlocks );
+    printf( "    %ld MB holds             %8.1f days at 1 Hz\n", megabytes,
+                    (stats.totalBlocks * (double) stats.samples / stats.blocks) / 86400.0 );
+
+    //
+    //  If it wrapped, only what is still in the file can come back
+    time_t oldest = stats.oldest;
+    time_t newest = stats.newest;
+    int all[ HISTORY_MAX_FIELDS ];
+    for (int i = 0; i < History_NumFields(); i += 1)
+        all[ i ] = i;
+    int three[] = { History_FindField( "batteryVoltage" ), History_FindField( "pvPower" ), History_FindField( "batterySOC" ) };
+
+    int ok = runQuery( &store, "all fields, everything", oldest, newest, all, History_NumFields(), newest - oldest + 1 );
+    ok = runQuery( &store, "3 fields, everything", oldest, newest, three, 3, newest - oldest + 1 ) && ok;
+    ok = runQuery( &store, "3 fields, last hour", newest - 3599, newest, three, 3, 3600 ) && ok;
+
+    History_Close( &store );
+    unlink( path );
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
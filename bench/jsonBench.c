@@ -0,0 +1,197 @@
+/*
+ * File:    jsonBench.c
+ * author:  patrick conroy
+ *
+ * Microbenchmark: the streaming realTimeDataToJSON() against the old cJSON
+ * DOM version. Checks the two payloads are byte for byte identical first,
+ * then reports messages/sec and heap allocations per message for each, with
+ * and without the "-x" extra data. Also checks that fields whose registers
+ * didn't come back - strings included - are left out, not written.
+ *
+ *  usage: jsonBench [ iterations ]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libepsolar.h"
+#include "extraData.h"
+#include "realTimeFields.h"
+#include "aggregator.h"
+#include "batteryAnalytics.h"
+#include "allocCounter.h"
+
+
+extern  const char  *realTimeDataToJSON( const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const periodAggregates_t *aggregates, const batteryAnalytics_t *battery, time_t sampleTime );
+extern  char        *realTimeDataToCJSON( const char *topic, const epsolarRealTimeData_t *rtData, const epsolarExtraData_t *extraData );
+
+static  const char  *topic = "SCC/1/DATA";
+
+
+// -----------------------------------------------------------------------------
+static
+double  now (void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    fillSample (epsolarRealTimeData_t *rtData, epsolarExtraData_t *extraData)
+{
+    //
+    //  The strings carry quotes, backslashes and control characters, so the
+    //  identity check covers the escaping too - that is where the two paths
+    //  are most likely to part company
+    memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
+    snprintf( rtData->controllerClock, sizeof rtData->controllerClock, "2024-06-01 12:34:56" );
+    snprintf( rtData->pvStatus, sizeof rtData->pvStatus, "Normal \"MPPT\"" );
+    snprintf( rtData->loadLevel, sizeof rtData->loadLevel, "C:\\load\\level" );
+    snprintf( rtData->loadControlMode, sizeof rtData->loadControlMode, "Manual\tcontrol\r\n" );
+    snprintf( rtData->batteryStatus, sizeof rtData->batteryStatus, "Normal\b\f" );
+    snprintf( rtData->batteryChargingStatus, sizeof rtData->batteryChargingStatus, "Float\x01\x1f\x7f/\"\\" );
+    rtData->pvVoltage = 38.17;              rtData->pvCurrent = 4.21;           rtData->pvPower = 160.69;
+    rtData->loadVoltage = 13.28;            rtData->loadCurrent = 0.87;         rtData->loadPower = 11.55;
+    rtData->batteryStateOfCharge = 87;      rtData->batteryVoltage = 13.28;     rtData->batteryCurrent = -1.05;
+    rtData->batteryMaxVoltage = 14.42;      rtData->batteryMinVoltage = 12.61;
+    rtData->batteryTemperature = 21.37;     rtData->controllerTemp = 29.8;
+    rtData->chargerStatusNormal = TRUE;     rtData->chargerRunning = TRUE;      rtData->controllerStatusBits = 0x0009;
+    rtData->energyConsumedToday = 0.12;     rtData->energyConsumedMonth = 3.4;  rtData->energyConsumedYear = 41.07;
+    rtData->energyConsumedTotal = 212.9;    rtData->energyGeneratedToday = 0.93; rtData->energyGeneratedMonth = 17.22;
+    rtData->energyGeneratedYear = 201.5;    rtData->energyGeneratedTotal = 1240.33;
+    rtData->isNightTime = FALSE;            rtData->loadIsOn = TRUE;
+
+    memset( extraData, '\0', sizeof( epsolarExtraData_t ) );
+    extraData->batteryStatusBits = 0x0000;
+    extraData->chargingEquipmentStatusBits = 0x0009;
+    extraData->dischargingEquipmentStatusBits = 0x0001;
+    extraData->statusRead = FIELD_MASK_ALL;
+
+    epsolarSettings_t *settings = &extraData->settings;
+    settings->batteryRealRatedVoltage = 12.0;      settings->batteryRatedVoltageCode = "Auto";
+    settings->ratedChargingCurrent = 40.0;         settings->ratedLoadCurrent = 40.0;
+    settings->boostDuration = 120;                 settings->equalizeDuration = 120;
+    settings->batteryType = "Sealed \"AGM\"\n";              settings->batteryCapacity = 200;
+    settings->highVoltageDisconnect = 16.0;        settings->chargingLimitVoltage = 15.0;
+    settings->overVoltageReconnect = 15.0;         settings->equalizationVoltage = 14.6;
+    settings->boostingVoltage = 14.4;              settings->floatingVoltage = 13.8;
+    settings->boostReconnectVoltage = 13.2;        settings->lowVoltageReconnectVoltage = 12.6;
+    settings->underVoltageWarningRecoverVoltage = 12.2; settings->underVoltageWarningVoltage = 12.0;
+    settings->lowVoltageDisconnectVoltage = 11.1;  settings->dischargingLimitVoltage = 10.6;
+    settings->dischargingPercentage = 80.0;        settings->chargingPercentage = 100.0;
+    settings->batteryTemperatureWarningUpperLimit = 65.0;  settings->batteryTemperatureWarningLowerLimit = -40.0;
+    settings->controllerInnerTemperatureUpperLimit = 85.0; settings->controllerInnerTemperatureUpperLimitRecover = 75.0;
+    settings->read = FIELD_MASK_ALL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int runCase (const char *label, long iterations, const epsolarRealTimeData_t *rtData, const epsolarExtraData_t *extraData)
+{
+    //
+    //  Both paths stamp "dateTime" with the wall clock, so compare a couple of
+    //  times in case we straddled a second boundary
+    int identical = FALSE;
+    for (int attempt = 0; attempt < 3 && !identical; attempt += 1) {
+        char *reference = realTimeDataToCJSON( topic, rtData, extraData );
+        const char *streamed = realTimeDataToJSON( topic, rtData, FIELD_MASK_ALL, extraData, NULL, NULL, time( NULL ) );
+        identical = (streamed != NULL) && (strcmp( reference, streamed ) == 0);
+        if (!identical && attempt == 2)
+            printf( "MISMATCH\n  cJSON : %s\n  stream: %s\n", reference, (streamed ? streamed : "(overflow)") );
+        free( reference );
+    }
+
+    unsigned long allocsBefore = AllocCounter_Get();
+    double start = now();
+    for (long i = 0; i < iterations; i += 1) {
+        char *message = realTimeDataToCJSON( topic, rtData, extraData );
+        free( message );
+    }
+    double cjsonSeconds = now() - start;
+    unsigned long cjsonAllocs = AllocCounter_Get() - allocsBefore;
+
+    allocsBefore = AllocCounter_Get();
+    start = now();
+    size_t bytes = 0;
+    for (long i = 0; i < iterations; i += 1)
+        bytes += strlen( realTimeDataToJSON( topic, rtData, FIELD_MASK_ALL, extraData, NULL, NULL, time( NULL ) ) );
+    double streamSeconds = now() - start;
+    unsigned long streamAllocs = AllocCounter_Get() - allocsBefore;
+
+    printf( "%-10s  %5zu bytes  identical: %-3s\n", label, bytes / iterations, (identical ? "yes" : "NO") );
+    printf( "    cJSON DOM  %10.0f msgs/sec  %6.1f allocs/msg\n", iterations / cjsonSeconds, (double) cjsonAllocs / iterations );
+    printf( "    streaming  %10.0f msgs/sec  %6.1f allocs/msg  (%.1fx)\n", iterations / streamSeconds, (double) streamAllocs / iterations,
+                    cjsonSeconds / streamSeconds );
+
+    return identical;
+}
+
+// -----------------------------------------------------------------------------
+static
+int checkUnread (const epsolarRealTimeData_t *rtData, const epsolarExtraData_t *extraData)
+{
+    //
+    //  The clock, a status string, the load mode and a reading didn't come
+    //  back, nor did a status word and one setting: they go, everything else stays
+    static  const char  *unread[] = { "controllerDateTime", "pvStatus", "loadControlMode", "batteryTemperature" };
+    static  const char  *unreadExtra[] = { "ChargingEquipmentStatusInputVoltageStatus", "isChargingMOSFETShorted", "BatteryType" };
+    fieldMask_t         rtRead = FIELD_MASK_ALL;
+    epsolarExtraData_t  extra = *extraData;
+    char                quoted[ 64 ];
+    int                 ok = TRUE;
+
+    for (size_t i = 0; i < sizeof unread / sizeof unread[ 0 ]; i += 1)
+        rtRead &= ~((fieldMask_t) 1 << RealTimeFields_Find( unread[ i ] ));
+    for (size_t i = 0; i < sizeof unreadExtra / sizeof unreadExtra[ 0 ]; i += 1)
+        for (int j = 0; j < numExtraFields; j += 1)
+            if (strcmp( extraFields[ j ].key, unreadExtra[ i ] ) == 0) {
+                extra.statusRead &= ~((fieldMask_t) 1 << j);
+                extra.settings.read &= ~((fieldMask_t) 1 << j);
+            }
+
+    const char *message = realTimeDataToJSON( topic, rtData, rtRead, &extra, NULL, NULL, time( NULL ) );
+    for (int i = 0; message != NULL && i < numRealTimeFields + numExtraFields; i += 1) {
+        const char *key;
+        int         wanted;
+        if (i < numRealTimeFields) {
+            key = realTimeFields[ i ].key;
+            wanted = RealTimeFields_WasRead( &realTimeFields[ i ], rtRead );
+        } else {
+            key = extraFields[ i - numRealTimeFields ].key;
+            wanted = ExtraFields_IsValid( &extraFields[ i - numRealTimeFields ], &extra );
+        }
+
+        snprintf( quoted, sizeof quoted, "\"%s\":", key );
+        int present = (strstr( message, quoted ) != NULL);
+        if (present != wanted) {
+            printf( "    %s should%s be there\n", key, (present ? " not" : "") );
+            ok = FALSE;
+        }
+    }
+
+    printf( "unread      %s\n", (message != NULL && ok) ? "left out: yes" : "left out: NO" );
+    return (message != NULL) && ok;
+}
+
+// -----------------------------------------------------------------------------
+int main (int argc, char *argv[])
+{
+    long    iterations = (argc > 1) ? atol( argv[ 1 ] ) : 100000;
+
+    epsolarRealTimeData_t   rtData;
+    epsolarExtraData_t      extraData;
+    fillSample( &rtData, &extraData );
+
+    printf( "realTimeDataToJSON benchmark - %ld iterations\n", iterations );
+    int ok = runCase( "plain", iterations, &rtData, NULL );
+    ok = runCase( "extra (-x)", iterations, &rtData, &extraData ) && ok;
+    ok = checkUnread( &rtData, &extraData ) && ok;
+
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,279 @@
+/*
+ * File:    mqttSink.c
+ * author:  patrick conroy
+ *
+ * Handles CONNECT, SUBSCRIBE, PUBLISH (QoS 0 and 1), PINGREQ and DISCONNECT,
+ * which is everything libmosquitto sends us. Listens on an ephemeral port on
+ * the loopback so several benchmarks can run side by side.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "mqttSink.h"
+
+
+#define MAX_CLIENTS         8
+#define READ_CHUNK          16384
+
+typedef struct  client {
+    int         fd;
+    uint8_t     *buffer;
+    size_t      length;
+    size_t      size;
+} client_t;
+
+static  int             listenFD = -1;
+static  client_t        clients[ MAX_CLIENTS ];
+static  pthread_t       sinkThread;
+static  volatile int    running = 0;
+static  sinkStats_t     stats;
+
+
+// -----------------------------------------------------------------------------
+static
+void    dropClient (client_t *client)
+{
+    close( client->fd );
+    free( client->buffer );
+    memset( client, '\0', sizeof( client_t ) );
+    client->fd = -1;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    sendBytes (client_t *client, const uint8_t *bytes, size_t length)
+{
+    if (write( client->fd, bytes, length ) != (ssize_t) length)
+        dropClient( client );
+}
+
+// -----------------------------------------------------------------------------
+static
+int decodeRemainingLength (const uint8_t *bytes, size_t available, size_t *value, size_t *used)
+{
+    //
+    //  0 - need more bytes, -1 - malformed
+    size_t  multiplier = 1;
+
+    *value = 0;
+    for (size_t i = 1; i < available && i <= 4; i += 1) {
+        *value += (bytes[ i ] & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((bytes[ i ] & 0x80) == 0) {
+            *used = i + 1;
+            return 1;
+        }
+    }
+    return (available > 5) ? -1 : 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    handlePacket (client_t *client, const uint8_t *packet, const uint8_t *body, size_t bodyLength)
+{
+    int type = packet[ 0 ] >> 4;
+
+    switch (type) {
+        case 1: {                               // CONNECT
+            static const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };
+            stats.connections += 1;
+            sendBytes( client, connack, sizeof connack );
+            break;
+        }
+
+        case 3: {                               // PUBLISH
+            int     qos = (packet[ 0 ] >> 1) & 0x03;
+            if (bodyLength < 2)
+                break;
+            size_t  topicLength = (body[ 0 ] << 8) | body[ 1 ];
+            size_t  header = 2 + topicLength + (qos > 0 ? 2 : 0);
+            if (header > bodyLength)
+                break;
+
+            stats.messages += 1;
+            stats.payloadBytes += bodyLength - header;
+            if (qos == 1) {
+                uint8_t puback[] = { 0x40, 0x02, body[ 2 + topicLength ], body[ 3 + topicLength ] };
+                sendBytes( client, puback, sizeof puback );
+            }
+            break;
+        }
+
+        case 8: {                               // SUBSCRIBE - grant QoS 0 to every filter
+            uint8_t suback[ 64 ];
+            size_t  grants = 0;
+            if (bodyLength < 2)
+                break;
+            for (size_t i = 2; i + 2 < bodyLength && grants < sizeof suback - 4; grants += 1)
+                i += 2 + ((body[ i ] << 8) | body[ i + 1 ]) + 1;
+            suback[ 0 ] = 0x90;
+            suback[ 1 ] = 2 + grants;
+            suback[ 2 ] = body[ 0 ];
+            suback[ 3 ] = body[ 1 ];
+            memset( &suback[ 4 ], 0x00, grants );
+            sendBytes( client, suback, 4 + grants );
+            break;
+        }
+
+        case 10: {                              // UNSUBSCRIBE
+            uint8_t unsuback[] = { 0xB0, 0x02, body[ 0 ], body[ 1 ] };
+            if (bodyLength >= 2)
+                sendBytes( client, unsuback, sizeof unsuback );
+            break;
+        }
+
+        case 12: {                              // PINGREQ
+            static const uint8_t pingresp[] = { 0xD0, 0x00 };
+            sendBytes( client, pingresp, sizeof pingresp );
+            break;
+        }
+
+        case 14:                                // DISCONNECT
+            dropClient( client );
+            break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    readClient (client_t *client)
+{
+    if (client->size - client->length < READ_CHUNK) {
+        client->size = client->length + (READ_CHUNK * 2);
+        client->buffer = realloc( client->buffer, client->size );
+    }
+
+    ssize_t n = read( client->fd, &client->buffer[ client->length ], client->size - client->length );
+    if (n <= 0) {
+        dropClient( client );
+        return;
+    }
+    client->length += n;
+
+    size_t  offset = 0;
+    while (client->fd >= 0 && client->length - offset >= 2) {
+        size_t  remaining, used;
+        int     rc = decodeRemainingLength( &client->buffer[ offset ], client->length - offset, &remaining, &used );
+        if (rc < 0) {
+            dropClient( client );
+            return;
+        }
+        if (rc == 0 || client->length - offset < used + remaining)
+            break;
+
+        handlePacket( client, &client->buffer[ offset ], &client->buffer[ offset + used ], remaining );
+        offset += used + remaining;
+    }
+
+    if (client->fd >= 0 && offset > 0) {
+        memmove( client->buffer, &client->buffer[ offset ], client->length - offset );
+        client->length -= offset;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *sinkLoop (void *arg)
+{
+    struct pollfd   fds[ MAX_CLIENTS + 1 ];
+
+    while (running) {
+        fds[ 0 ].fd = listenFD;
+        fds[ 0 ].events = POLLIN;
+        for (int i = 0; i < MAX_CLIENTS; i += 1) {
+            fds[ i + 1 ].fd = clients[ i ].fd;
+            fds[ i + 1 ].events = POLLIN;
+        }
+
+        if (poll( fds, MAX_CLIENTS + 1, 100 ) <= 0)
+            continue;
+
+        if (fds[ 0 ].revents & POLLIN) {
+            int fd = accept( listenFD, NULL, NULL );
+            int slot = 0;
+            while (slot < MAX_CLIENTS && clients[ slot ].fd >= 0)
+                slot += 1;
+            if (fd >= 0 && slot < MAX_CLIENTS) {
+                int one = 1;
+                setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one );
+                clients[ slot ].fd = fd;
+            } else if (fd >= 0) {
+                close( fd );
+            }
+        }
+
+        for (int i = 0; i < MAX_CLIENTS; i += 1)
+            if (clients[ i ].fd >= 0 && (fds[ i + 1 ].revents & (POLLIN | POLLHUP | POLLERR)))
+                readClient( &clients[ i ] );
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Sink_Start (void)
+{
+    struct sockaddr_in  address;
+    socklen_t           addressLength = sizeof address;
+    int                 one = 1;
+
+    memset( &stats, '\0', sizeof stats );
+    memset( clients, '\0', sizeof clients );
+    for (int i = 0; i < MAX_CLIENTS; i += 1)
+        clients[ i ].fd = -1;
+
+    memset( &address, '\0', sizeof address );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    address.sin_port = 0;
+
+    listenFD = socket( AF_INET, SOCK_STREAM, 0 );
+    setsockopt( listenFD, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one );
+    if (listenFD < 0
+            || bind( listenFD, (struct sockaddr *) &address, sizeof address ) != 0
+            || listen( listenFD, MAX_CLIENTS ) != 0
+            || getsockname( listenFD, (struct sockaddr *) &address, &addressLength ) != 0) {
+        fprintf( stderr, "mqttSink: unable to listen: %s\n", strerror( errno ) );
+        return -1;
+    }
+
+    running = 1;
+    if (pthread_create( &sinkThread, NULL, sinkLoop, NULL ) != 0) {
+        running = 0;
+        return -1;
+    }
+    return ntohs( address.sin_port );
+}
+
+// -----------------------------------------------------------------------------
+void    Sink_Stop (void)
+{
+    if (!running)
+        return;
+
+    running = 0;
+    pthread_join( sinkThread, NULL );
+    for (int i = 0; i < MAX_CLIENTS; i += 1)
+        if (clients[ i ].fd >= 0)
+            dropClient( &clients[ i ] );
+    close( listenFD );
+}
+
+// -----------------------------------------------------------------------------
+void    Sink_GetStats (sinkStats_t *out)
+{
+    *out = stats;
+}
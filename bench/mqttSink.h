@@ -0,0 +1,32 @@
+/*
+ * File:   mqttSink.h
+ * Author: pconroy
+ *
+ * Just enough of an MQTT 3.1.1 broker to stand in for the real one in the
+ * benchmarks: it accepts connections, acks what needs acking and counts
+ * what gets published. Nothing is routed anywhere.
+ */
+
+#ifndef MQTTSINK_H
+#define MQTTSINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  sinkStats {
+    unsigned long   connections;
+    unsigned long   messages;
+    unsigned long   payloadBytes;
+} sinkStats_t;
+
+extern  int     Sink_Start( void );         // returns the 127.0.0.1 port, or -1
+extern  void    Sink_Stop( void );
+extern  void    Sink_GetStats( sinkStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MQTTSINK_H */
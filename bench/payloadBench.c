@@ -0,0 +1,232 @@
+/*
+ * File:    payloadBench.c
+ * author:  patrick conroy
+ *
+ * Microbenchmark: the "-B" CBOR payload against the JSON DATA message. Walks
+ * the CBOR back and checks every field against the value printed in the
+ * JSON first, then reports bytes/message and messages/sec for each, with
+ * and without the "-x" extra data.
+ *
+ *  usage: payloadBench [ iterations ]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "libepsolar.h"
+#include "extraData.h"
+#include "aggregator.h"
+#include "batteryAnalytics.h"
+#include "realTimeFields.h"
+#include "cborPayload.h"
+
+
+extern  const char  *realTimeDataToJSON( const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const periodAggregates_t *aggregates, const batteryAnalytics_t *battery, time_t sampleTime );
+
+static  const char  *topic = "SCC/1/DATA";
+
+
+// -----------------------------------------------------------------------------
+static
+double  now (void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    fillSample (epsolarRealTimeData_t *rtData, epsolarExtraData_t *extraData)
+{
+    //
+    //  Same sample as jsonBench
+    memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
+    rtData->pvVoltage = 38.17;              rtData->pvCurrent = 4.21;           rtData->pvPower = 160.69;
+    rtData->loadVoltage = 13.28;            rtData->loadCurrent = 0.87;         rtData->loadPower = 11.55;
+    rtData->batteryStateOfCharge = 87;      rtData->batteryVoltage = 13.28;     rtData->batteryCurrent = -1.05;
+    rtData->batteryMaxVoltage = 14.42;      rtData->batteryMinVoltage = 12.61;
+    rtData->batteryTemperature = 21.37;     rtData->controllerTemp = 29.8;
+    rtData->chargerStatusNormal = TRUE;     rtData->chargerRunning = TRUE;      rtData->controllerStatusBits = 0x0009;
+    rtData->energyConsumedToday = 0.12;     rtData->energyConsumedMonth = 3.4;  rtData->energyConsumedYear = 41.07;
+    rtData->energyConsumedTotal = 212.9;    rtData->energyGeneratedToday = 0.93; rtData->energyGeneratedMonth = 17.22;
+    rtData->energyGeneratedYear = 201.5;    rtData->energyGeneratedTotal = 1240.33;
+    rtData->isNightTime = FALSE;            rtData->loadIsOn = TRUE;
+
+    memset( extraData, '\0', sizeof( epsolarExtraData_t ) );
+    extraData->batteryStatusBits = 0x0000;
+    extraData->chargingEquipmentStatusBits = 0x0009;
+    extraData->dischargingEquipmentStatusBits = 0x0001;
+    extraData->statusRead = FIELD_MASK_ALL;
+
+    epsolarSettings_t *settings = &extraData->settings;
+    settings->batteryRealRatedVoltage = 12.0;      settings->batteryRatedVoltageCode = "Auto";
+    settings->ratedChargingCurrent = 40.0;         settings->ratedLoadCurrent = 40.0;
+    settings->boostDuration = 120;                 settings->equalizeDuration = 120;
+    settings->batteryType = "Sealed";              settings->batteryCapacity = 200;
+    settings->highVoltageDisconnect = 16.0;        settings->chargingLimitVoltage = 15.0;
+    settings->overVoltageReconnect = 15.0;         settings->equalizationVoltage = 14.6;
+    settings->boostingVoltage = 14.4;              settings->floatingVoltage = 13.8;
+    settings->boostReconnectVoltage = 13.2;        settings->lowVoltageReconnectVoltage = 12.6;
+    settings->underVoltageWarningRecoverVoltage = 12.2; settings->underVoltageWarningVoltage = 12.0;
+    settings->lowVoltageDisconnectVoltage = 11.1;  settings->dischargingLimitVoltage = 10.6;
+    settings->dischargingPercentage = 80.0;        settings->chargingPercentage = 100.0;
+    settings->batteryTemperatureWarningUpperLimit = 65.0;  settings->batteryTemperatureWarningLowerLimit = -40.0;
+    settings->controllerInnerTemperatureUpperLimit = 85.0; settings->controllerInnerTemperatureUpperLimitRecover = 75.0;
+    settings->read = FIELD_MASK_ALL;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    readHead (const uint8_t **p, int *major)
+{
+    uint8_t     initial = *(*p)++;
+    uint64_t    value = initial & 0x1f;
+    int         bytes = (value == 24) ? 1 : (value == 25) ? 2 : (value == 26) ? 4 : (value == 27) ? 8 : 0;
+
+    *major = initial >> 5;
+    if (bytes > 0)
+        value = 0;
+    for (int i = 0; i < bytes; i += 1)
+        value = (value << 8) | *(*p)++;
+    return value;
+}
+
+// -----------------------------------------------------------------------------
+static
+const char  *fieldInfo (int key, fieldKind_t *kind, int *decimals)
+{
+    if (key >= 0 && key < numRealTimeFields) {
+        *kind = realTimeFields[ key ].kind;
+        *decimals = realTimeFields[ key ].decimals;
+        return realTimeFields[ key ].key;
+    }
+    key -= numRealTimeFields;
+    if (key >= 0 && key < numExtraFields) {
+        *kind = extraFields[ key ].kind;
+        *decimals = extraFields[ key ].decimals;
+        return extraFields[ key ].key;
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+int checkAgainstJSON (const uint8_t *payload, size_t length, const char *json)
+{
+    //
+    //  Every field in the CBOR has to decode to what the JSON says, and the
+    //  two have to carry the same number of fields
+    const uint8_t   *p = payload + 1;
+    const uint8_t   *end = payload + length;
+    int             fields = 0, major;
+    char            pattern[ 128 ];
+
+    while (p < end && *p != 0xff) {
+        uint64_t raw = readHead( &p, &major );
+        int key = (major == 1) ? (int) (-1 - (int64_t) raw) : (int) raw;
+
+        uint64_t number = readHead( &p, &major );
+        const char *string = (const char *) p;
+        if (major == 3)
+            p += number;
+        if (key < 0)
+            continue;
+
+        fieldKind_t kind;
+        int         decimals;
+        const char  *name = fieldInfo( key, &kind, &decimals );
+        if (name == NULL) {
+            printf( "  unknown key %d\n", key );
+            return FALSE;
+        }
+
+        snprintf( pattern, sizeof pattern, "\"%s\":", name );
+        const char *text = strstr( json, pattern );
+        if (text == NULL) {
+            printf( "  %s is in the CBOR but not the JSON\n", name );
+            return FALSE;
+        }
+        text += strlen( pattern );
+        fields += 1;
+
+        int ok;
+        if (major == 3)
+            ok = (text[ 0 ] == '"') && (strncmp( text + 1, string, number ) == 0) && (text[ 1 + number ] == '"');
+        else if (major == 7 && (number == 20 || number == 21))
+            ok = (number == 21) ? (strncmp( text, "true", 4 ) == 0 || strncmp( text, "\"Yes\"", 5 ) == 0)
+                                : (strncmp( text, "false", 5 ) == 0 || strncmp( text, "\"No\"", 4 ) == 0);
+        else {
+            double decoded = (major == 1) ? (double) (-1 - (int64_t) number) : (double) number;
+            if (major == 7) {
+                memcpy( &decoded, &number, sizeof decoded );
+            } else if (kind == FIELD_FIXED)
+                decoded /= pow( 10.0, decimals );
+            ok = fabs( decoded - atof( text ) ) < 1e-9;
+        }
+        if (!ok) {
+            printf( "  %s differs: JSON %.20s\n", name, text );
+            return FALSE;
+        }
+    }
+
+    int jsonFields = -3;                    // topic, version, dateTime
+    for (const char *s = strstr( json, "\":" ); s != NULL; s = strstr( s + 2, "\":" ))
+        jsonFields += 1;
+    if (jsonFields != fields)
+        printf( "  %d fields in the CBOR, %d in the JSON\n", fields, jsonFields );
+    return (jsonFields == fields);
+}
+
+// -----------------------------------------------------------------------------
+static
+int runCase (const char *label, long iterations, const epsolarRealTimeData_t *rtData, const epsolarExtraData_t *extraData)
+{
+    time_t      sampleTime = time( NULL );
+    size_t      length;
+
+    CborPayload_Initialize( extraData != NULL );
+
+    const char      *json = realTimeDataToJSON( topic, rtData, FIELD_MASK_ALL, extraData, NULL, NULL, sampleTime );
+    const uint8_t   *cbor = CborPayload_Build( 1, rtData, FIELD_MASK_ALL, extraData, sampleTime, &length );
+    size_t          jsonLength = (json != NULL) ? strlen( json ) : 0;
+    int             same = (json != NULL) && (cbor != NULL) && checkAgainstJSON( cbor, length, json );
+
+    double start = now();
+    for (long i = 0; i < iterations; i += 1)
+        realTimeDataToJSON( topic, rtData, FIELD_MASK_ALL, extraData, NULL, NULL, sampleTime );
+    double jsonSeconds = now() - start;
+
+    start = now();
+    for (long i = 0; i < iterations; i += 1)
+        CborPayload_Build( 1, rtData, FIELD_MASK_ALL, extraData, sampleTime, &length );
+    double cborSeconds = now() - start;
+
+    printf( "%-10s  values match: %s\n", label, (same ? "yes" : "NO") );
+    printf( "    JSON  %5zu bytes  %10.0f msgs/sec\n", jsonLength, iterations / jsonSeconds );
+    printf( "    CBOR  %5zu bytes  %10.0f msgs/sec  (%.0f%% of the bytes, %.1fx)\n", length, iterations / cborSeconds,
+                    (jsonLength > 0 ? 100.0 * length / jsonLength : 0.0), jsonSeconds / cborSeconds );
+
+    return same;
+}
+
+// -----------------------------------------------------------------------------
+int main (int argc, char *argv[])
+{
+    long    iterations = (argc > 1) ? atol( argv[ 1 ] ) : 100000;
+
+    epsolarRealTimeData_t   rtData;
+    epsolarExtraData_t      extraData;
+    fillSample( &rtData, &extraData );
+
+    printf( "DATA payload benchmark - %ld iterations\n", iterations );
+    int ok = runCase( "plain", iterations, &rtData, NULL );
+    ok = runCase( "extra (-x)", iterations, &rtData, &extraData ) && ok;
+
+    return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
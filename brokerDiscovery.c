@@ -0,0 +1,282 @@
+/*
+ * File:    brokerDiscovery.c
+ * author:  patrick conroy
+ *
+ * MQTT_ConnectRV() can sit in an avahi lookup for its whole timeout, and
+ * MQTT_Initialize() against a broker that isn't up yet just fails. Both used
+ * to happen on the main thread before the first read, so every restart lost
+ * the first minute or more of data. Now each way of finding the broker is
+ * its own thread:
+ *
+ *      cached  the address the last connection actually went to, read from
+ *              the cache file - usually connects in milliseconds
+ *      mDNS    MQTT_ConnectRV(), as before
+ *      named   "-h" - only this host, retried
+ *
+ * Each retries with a back off until one of them gets a connection. The
+ * first to connect wins; a slower one that connects afterwards is torn down.
+ * When mDNS wins, the peer address of its socket goes into the cache file
+ * for next time.
+ *
+ * Meanwhile the acquisition threads are already sampling into the rings,
+ * which the publisher empties once BrokerDiscovery_Wait() hands main() a
+ * connection.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "asyncLog.h"
+#include "libmqttrv.h"
+#include "metrics.h"
+#include "timeUtils.h"
+#include "brokerDiscovery.h"
+
+
+#define MAX_ATTEMPTS            2
+#define HOST_LENGTH             256
+
+typedef enum {
+    ATTEMPT_NAMED,
+    ATTEMPT_CACHED,
+    ATTEMPT_MDNS
+} attemptKind_t;
+
+typedef struct  attempt {
+    attemptKind_t   kind;
+    char            host[ HOST_LENGTH ];
+    int             port;
+    char            label[ HOST_LENGTH + 16 ];      // for the log
+    pthread_t       thread;
+} attempt_t;
+
+static  const char  *attemptNames[] = { "named", "cached", "mDNS" };
+
+static  attempt_t           attempts[ MAX_ATTEMPTS ];
+static  int                 numAttempts = 0;
+static  const char          *cachePath = NULL;
+
+static  pthread_mutex_t     mutex = PTHREAD_MUTEX_INITIALIZER;
+static  pthread_cond_t      connected;
+static  struct mosquitto    *winner = NULL;
+static  volatile int        stopping = FALSE;
+
+
+// -----------------------------------------------------------------------------
+static
+int readCache (char *host, size_t size, int *port)
+{
+    char    line[ HOST_LENGTH + 16 ];
+    char    format[ 32 ];
+
+    FILE *fp = (cachePath != NULL) ? fopen( cachePath, "r" ) : NULL;
+    if (fp == NULL)
+        return FALSE;
+
+    int ok = (fgets( line, sizeof line, fp ) != NULL);
+    fclose( fp );
+
+    snprintf( format, sizeof format, "%%%zus %%d", size - 1 );
+    return ok && sscanf( line, format, host, port ) == 2 && *port > 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    writeCache (struct mosquitto *mosq)
+{
+    //
+    //  MQTT_ConnectRV() doesn't say where it connected to, but the socket does
+    struct sockaddr_storage peer;
+    socklen_t               length = sizeof peer;
+    char                    host[ INET6_ADDRSTRLEN ];
+    char                    tempPath[ 1024 ];
+    int                     port;
+
+    if (cachePath == NULL || getpeername( mosquitto_socket( mosq ), (struct sockaddr *) &peer, &length ) != 0)
+        return;
+
+    if (peer.ss_family == AF_INET) {
+        struct sockaddr_in *address = (struct sockaddr_in *) &peer;
+        inet_ntop( AF_INET, &address->sin_addr, host, sizeof host );
+        port = ntohs( address->sin_port );
+    } else if (peer.ss_family == AF_INET6) {
+        struct sockaddr_in6 *address = (struct sockaddr_in6 *) &peer;
+        inet_ntop( AF_INET6, &address->sin6_addr, host, sizeof host );
+        port = ntohs( address->sin6_port );
+    } else {
+        return;
+    }
+
+    snprintf( tempPath, sizeof tempPath, "%s.tmp", cachePath );
+    FILE *fp = fopen( tempPath, "w" );
+    if (fp == NULL) {
+        Logger_LogWarning( "Unable to cache the broker address in [%s]: %s\n", tempPath, strerror( errno ) );
+        return;
+    }
+    fprintf( fp, "%s %d\n", host, port );
+
+    if (fclose( fp ) != 0 || rename( tempPath, cachePath ) != 0) {
+        Logger_LogWarning( "Unable to cache the broker address in [%s]\n", cachePath );
+        remove( tempPath );
+        return;
+    }
+    Logger_LogInfo( "Cached broker address %s:%d in [%s]\n", host, port, cachePath );
+}
+
+// -----------------------------------------------------------------------------
+static
+int waitForRetry (int delayMillis)
+{
+    //
+    //  FALSE if someone else connected (or we are shutting down) meanwhile
+    struct timespec deadline = Time_NanosToTimespec( Time_MonotonicNanos() + (uint64_t) delayMillis * NANOS_PER_MILLI );
+
+    pthread_mutex_lock( &mutex );
+    while (winner == NULL && !stopping && pthread_cond_timedwait( &connected, &mutex, &deadline ) != ETIMEDOUT)
+        ;
+    int carryOn = (winner == NULL && !stopping);
+    pthread_mutex_unlock( &mutex );
+    return carryOn;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *attemptLoop (void *arg)
+{
+    attempt_t   *attempt = arg;
+    int         delayMillis = 1000;
+
+    do {
+        struct mosquitto    *mosq = NULL;
+        int                 ok;
+
+        if (attempt->kind == ATTEMPT_MDNS)
+            ok = MQTT_ConnectRV( &mosq, BROKER_MDNS_TIMEOUT_SECONDS );
+        else
+            ok = MQTT_Initialize( attempt->host, attempt->port, &mosq );
+        ok = ok && (mosq != NULL);
+
+        pthread_mutex_lock( &mutex );
+        int won = ok && (winner == NULL) && !stopping;
+        if (won) {
+            winner = mosq;
+            pthread_cond_broadcast( &connected );
+        }
+        pthread_mutex_unlock( &mutex );
+
+        if (won) {
+            Metrics_StartupEvent( STARTUP_BROKER );
+            Logger_LogWarning( "Connected to the MQTT broker (%s)\n", attempt->label );
+            if (attempt->kind == ATTEMPT_MDNS)
+                writeCache( mosq );
+            return NULL;
+        }
+        if (ok) {
+            MQTT_Teardown( mosq, NULL );            // beaten to it
+            return NULL;
+        }
+
+        Logger_LogWarning( "No MQTT broker yet (%s) - retrying in %d ms\n", attempt->label, delayMillis );
+        int waitMillis = delayMillis;
+        delayMillis = (delayMillis * 2 > BROKER_RETRY_MAX_MILLIS) ? BROKER_RETRY_MAX_MILLIS : delayMillis * 2;
+        if (!waitForRetry( waitMillis ))
+            return NULL;
+    } while (TRUE);
+}
+
+// -----------------------------------------------------------------------------
+static
+int startAttempt (attemptKind_t kind, const char *host, int port)
+{
+    attempt_t       *attempt = &attempts[ numAttempts ];
+    pthread_attr_t  attributes;
+
+    attempt->kind = kind;
+    attempt->port = port;
+    snprintf( attempt->host, sizeof attempt->host, "%s", (host != NULL ? host : "") );
+    if (kind == ATTEMPT_MDNS)
+        snprintf( attempt->label, sizeof attempt->label, "%s", attemptNames[ kind ] );
+    else
+        snprintf( attempt->label, sizeof attempt->label, "%s %s:%d", attemptNames[ kind ], attempt->host, port );
+
+    //
+    //  Detached - an mDNS lookup that is still going when we shut down is
+    //  not worth waiting a minute for
+    pthread_attr_init( &attributes );
+    pthread_attr_setdetachstate( &attributes, PTHREAD_CREATE_DETACHED );
+    int rc = pthread_create( &attempt->thread, &attributes, attemptLoop, attempt );
+    pthread_attr_destroy( &attributes );
+
+    if (rc != 0) {
+        Logger_LogFatal( "Unable to start the %s broker search: %s\n", attemptNames[ kind ], strerror( rc ) );
+        return FALSE;
+    }
+    numAttempts += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int BrokerDiscovery_Start (const char *host, int port, const char *cacheFile)
+{
+    pthread_condattr_t  attributes;
+    char                cachedHost[ HOST_LENGTH ];
+    int                 cachedPort;
+
+    pthread_condattr_init( &attributes );
+    pthread_condattr_setclock( &attributes, CLOCK_MONOTONIC );
+    pthread_cond_init( &connected, &attributes );
+    pthread_condattr_destroy( &attributes );
+
+    cachePath = cacheFile;
+    winner = NULL;
+    stopping = FALSE;
+    numAttempts = 0;
+
+    if (host != NULL) {
+        Logger_LogWarning( "MQTT Broker host (%s) passed in on command line. Looking for JUST THAT ONE\n", host );
+        return startAttempt( ATTEMPT_NAMED, host, port );
+    }
+
+    if (readCache( cachedHost, sizeof cachedHost, &cachedPort )) {
+        Logger_LogWarning( "Trying the last MQTT broker we used, %s:%d, while mDNS looks for one\n", cachedHost, cachedPort );
+        if (!startAttempt( ATTEMPT_CACHED, cachedHost, cachedPort ))
+            return FALSE;
+    } else {
+        Logger_LogWarning( "No MQTT Broker host passed in on command line - trying mDNS to locate broker.\n" );
+    }
+    return startAttempt( ATTEMPT_MDNS, NULL, 0 );
+}
+
+// -----------------------------------------------------------------------------
+struct mosquitto    *BrokerDiscovery_Wait (int timeoutMillis)
+{
+    //
+    //  NULL if nothing connected within the timeout - the caller decides
+    //  whether to keep waiting
+    struct timespec deadline = Time_NanosToTimespec( Time_MonotonicNanos() + (uint64_t) timeoutMillis * NANOS_PER_MILLI );
+
+    pthread_mutex_lock( &mutex );
+    while (winner == NULL && !stopping && pthread_cond_timedwait( &connected, &mutex, &deadline ) != ETIMEDOUT)
+        ;
+    struct mosquitto *mosq = winner;
+    pthread_mutex_unlock( &mutex );
+    return mosq;
+}
+
+// -----------------------------------------------------------------------------
+void    BrokerDiscovery_Stop (void)
+{
+    pthread_mutex_lock( &mutex );
+    stopping = TRUE;
+    pthread_cond_broadcast( &connected );
+    pthread_mutex_unlock( &mutex );
+}
@@ -0,0 +1,34 @@
+/*
+ * File:   brokerDiscovery.h
+ * Author: pconroy
+ *
+ * Finds and connects to the MQTT broker off the main thread, so the
+ * controllers are opened and sampled from the moment we start. Without "-h"
+ * the last broker that worked (cached on disk) is tried at the same time as
+ * an mDNS search; whichever connects first is used. With "-h" that host is
+ * retried until it answers.
+ */
+
+#ifndef BROKERDISCOVERY_H
+#define BROKERDISCOVERY_H
+
+#include "libmqttrv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BROKER_DEFAULT_CACHE_FILE       "/tmp/epsolar_mqtt.broker"
+#define BROKER_MDNS_TIMEOUT_SECONDS     60
+#define BROKER_RETRY_MAX_MILLIS         30000
+
+extern  int                 BrokerDiscovery_Start( const char *host, int port, const char *cacheFile );
+extern  struct mosquitto    *BrokerDiscovery_Wait( int timeoutMillis );
+extern  void                BrokerDiscovery_Stop( void );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BROKERDISCOVERY_H */
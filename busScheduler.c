@@ -0,0 +1,207 @@
+/*
+ * File:    busScheduler.c
+ * author:  patrick conroy
+ *
+ * A job is just a function to run with the bus to itself. Callers either
+ * queue one and carry on (BusScheduler_Submit) or queue one and wait for its
+ * result (BusScheduler_Run). Jobs are never pre-empted - a Modbus exchange
+ * can't be interrupted half way - so priority only decides which queued job
+ * goes next. The queue is a handful of entries at most; a linear scan to
+ * pick the next one is cheaper than keeping it sorted.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "timeUtils.h"
+#include "busScheduler.h"
+
+
+static  const char  *classNames[ BUS_NUM_CLASSES ] = { "command", "realtime", "proxy", "clock", "settings" };
+
+
+// -----------------------------------------------------------------------------
+static
+int pickNextJob (const busScheduler_t *scheduler)
+{
+    int best = 0;
+
+    for (int i = 1; i < scheduler->queueDepth; i += 1) {
+        const busJob_t *job = &scheduler->queue[ i ];
+        const busJob_t *current = &scheduler->queue[ best ];
+
+        if (job->jobClass != current->jobClass) {
+            if (job->jobClass < current->jobClass)
+                best = i;
+        } else if (job->deadlineNanos != current->deadlineNanos) {
+            if (job->deadlineNanos < current->deadlineNanos)
+                best = i;
+        } else if (job->order < current->order) {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *busLoop (void *arg)
+{
+    busScheduler_t  *scheduler = arg;
+
+    pthread_mutex_lock( &scheduler->queueMutex );
+    while (scheduler->running) {
+        if (scheduler->queueDepth == 0) {
+            pthread_cond_wait( &scheduler->jobQueued, &scheduler->queueMutex );
+            continue;
+        }
+
+        int         next = pickNextJob( scheduler );
+        busJob_t    job = scheduler->queue[ next ];
+        scheduler->queue[ next ] = scheduler->queue[ --scheduler->queueDepth ];
+        pthread_mutex_unlock( &scheduler->queueMutex );
+
+        uint64_t    start = Time_MonotonicNanos();
+        int         result = (*job.function)( job.arg );
+        uint64_t    end = Time_MonotonicNanos();
+
+        pthread_mutex_lock( &scheduler->queueMutex );
+        busClassStats_t *classStats = &scheduler->stats.classes[ job.jobClass ];
+        uint64_t        waited = start - job.queuedNanos;
+
+        classStats->jobs += 1;
+        if (job.deadlineNanos != 0 && start > job.deadlineNanos)
+            classStats->lateStarts += 1;
+        classStats->totalWaitNanos += waited;
+        if (waited > classStats->maxWaitNanos)
+            classStats->maxWaitNanos = waited;
+        classStats->totalRunNanos += (end - start);
+        if ((end - start) > classStats->maxRunNanos)
+            classStats->maxRunNanos = end - start;
+        scheduler->stats.busyNanos += (end - start);
+
+        if (job.waiter != NULL) {
+            job.waiter->result = result;
+            job.waiter->done = TRUE;
+            pthread_cond_broadcast( &scheduler->jobFinished );
+        }
+    }
+
+    //
+    //  Shutting down - don't leave anybody waiting on a job that won't run
+    for (int i = 0; i < scheduler->queueDepth; i += 1)
+        if (scheduler->queue[ i ].waiter != NULL)
+            scheduler->queue[ i ].waiter->done = TRUE;
+    scheduler->queueDepth = 0;
+    pthread_cond_broadcast( &scheduler->jobFinished );
+    pthread_mutex_unlock( &scheduler->queueMutex );
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int BusScheduler_Start (busScheduler_t *scheduler, const char *name)
+{
+    memset( scheduler, '\0', sizeof( busScheduler_t ) );
+    scheduler->name = name;
+    scheduler->startedNanos = Time_MonotonicNanos();
+    pthread_mutex_init( &scheduler->queueMutex, NULL );
+    pthread_cond_init( &scheduler->jobQueued, NULL );
+    pthread_cond_init( &scheduler->jobFinished, NULL );
+
+    scheduler->running = TRUE;
+    if (pthread_create( &scheduler->thread, NULL, busLoop, scheduler )) {
+        Logger_LogFatal( "Unable to start the Modbus bus thread for [%s]!\n", name );
+        scheduler->running = FALSE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    BusScheduler_Stop (busScheduler_t *scheduler)
+{
+    if (!scheduler->running)
+        return;
+
+    pthread_mutex_lock( &scheduler->queueMutex );
+    scheduler->running = FALSE;
+    pthread_cond_signal( &scheduler->jobQueued );
+    pthread_mutex_unlock( &scheduler->queueMutex );
+
+    pthread_join( scheduler->thread, NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+int enqueue (busScheduler_t *scheduler, busClass_t jobClass, uint64_t deadlineNanos, busJobFunction_t function, void *arg, busJobWaiter_t *waiter)
+{
+    //
+    //  Called with the queue locked
+    if (!scheduler->running || scheduler->queueDepth == BUS_QUEUE_SIZE) {
+        scheduler->stats.rejected += 1;
+        Logger_LogWarning( "Modbus queue for [%s] is full - dropping a %s job\n", scheduler->name, classNames[ jobClass ] );
+        return FALSE;
+    }
+
+    busJob_t *job = &scheduler->queue[ scheduler->queueDepth++ ];
+    job->jobClass = jobClass;
+    job->deadlineNanos = deadlineNanos;
+    job->queuedNanos = Time_MonotonicNanos();
+    job->order = scheduler->nextOrder++;
+    job->function = function;
+    job->arg = arg;
+    job->waiter = waiter;
+
+    pthread_cond_signal( &scheduler->jobQueued );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int BusScheduler_Submit (busScheduler_t *scheduler, busClass_t jobClass, uint64_t deadlineNanos, busJobFunction_t function, void *arg)
+{
+    pthread_mutex_lock( &scheduler->queueMutex );
+    int queued = enqueue( scheduler, jobClass, deadlineNanos, function, arg, NULL );
+    pthread_mutex_unlock( &scheduler->queueMutex );
+
+    return queued;
+}
+
+// -----------------------------------------------------------------------------
+int BusScheduler_Run (busScheduler_t *scheduler, busClass_t jobClass, uint64_t deadlineNanos, busJobFunction_t function, void *arg)
+{
+    busJobWaiter_t  waiter = { FALSE, FALSE };
+
+    pthread_mutex_lock( &scheduler->queueMutex );
+    if (enqueue( scheduler, jobClass, deadlineNanos, function, arg, &waiter )) {
+        while (!waiter.done)
+            pthread_cond_wait( &scheduler->jobFinished, &scheduler->queueMutex );
+    }
+    pthread_mutex_unlock( &scheduler->queueMutex );
+
+    return waiter.result;
+}
+
+// -----------------------------------------------------------------------------
+void    BusScheduler_GetStats (busScheduler_t *scheduler, busSchedulerStats_t *out)
+{
+    pthread_mutex_lock( &scheduler->queueMutex );
+    *out = scheduler->stats;
+    out->queueDepth = scheduler->queueDepth;
+    out->elapsedNanos = Time_MonotonicNanos() - scheduler->startedNanos;
+    pthread_mutex_unlock( &scheduler->queueMutex );
+}
+
+// -----------------------------------------------------------------------------
+const char  *BusScheduler_ClassName (busClass_t jobClass)
+{
+    return (jobClass >= 0 && jobClass < BUS_NUM_CLASSES) ? classNames[ jobClass ] : "unknown";
+}
@@ -0,0 +1,94 @@
+/*
+ * File:   busScheduler.h
+ * Author: pconroy
+ *
+ * An RS485 line is one shared resource. Every Modbus transaction on it, for
+ * any of the controllers on it, goes through its scheduler's queue and runs
+ * on that scheduler's thread, highest priority class first, earliest deadline
+ * next. One scheduler per serial port.
+ */
+
+#ifndef BUSSCHEDULER_H
+#define BUSSCHEDULER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUS_QUEUE_SIZE      32
+
+typedef enum {
+    BUS_CLASS_COMMAND = 0,              // user commands - someone is waiting on these
+    BUS_CLASS_REALTIME = 1,             // the periodic poll
+    BUS_CLASS_PROXY = 2,                // writes, and reads the cache couldn't answer, from Modbus TCP proxy clients
+    BUS_CLASS_CLOCK_SYNC = 3,
+    BUS_CLASS_SETTINGS = 4,
+    BUS_NUM_CLASSES
+} busClass_t;
+
+typedef int (*busJobFunction_t)( void *arg );
+
+typedef struct  busClassStats {
+    unsigned long   jobs;
+    unsigned long   lateStarts;         // started after their deadline
+    uint64_t        totalWaitNanos;     // queued -> started
+    uint64_t        maxWaitNanos;
+    uint64_t        totalRunNanos;      // started -> finished
+    uint64_t        maxRunNanos;
+} busClassStats_t;
+
+typedef struct  busSchedulerStats {
+    uint64_t        busyNanos;          // time spent running jobs...
+    uint64_t        elapsedNanos;       // ...out of this long
+    int             queueDepth;
+    unsigned long   rejected;           // queue was full
+    busClassStats_t classes[ BUS_NUM_CLASSES ];
+} busSchedulerStats_t;
+
+typedef struct  busJobWaiter {
+    int     done;
+    int     result;
+} busJobWaiter_t;
+
+typedef struct  busJob {
+    busClass_t          jobClass;
+    uint64_t            deadlineNanos;
+    uint64_t            queuedNanos;
+    unsigned long       order;          // FIFO among equals
+    busJobFunction_t    function;
+    void                *arg;
+    busJobWaiter_t      *waiter;        // NULL - nobody is waiting on it
+} busJob_t;
+
+typedef struct  busScheduler {
+    const char          *name;          // the port, for the log
+    pthread_t           thread;
+    pthread_mutex_t     queueMutex;
+    pthread_cond_t      jobQueued;
+    pthread_cond_t      jobFinished;
+    volatile int        running;
+
+    busJob_t            queue[ BUS_QUEUE_SIZE ];
+    int                 queueDepth;
+    unsigned long       nextOrder;
+
+    uint64_t            startedNanos;
+    busSchedulerStats_t stats;
+} busScheduler_t;
+
+extern  int     BusScheduler_Start( busScheduler_t *scheduler, const char *name );
+extern  void    BusScheduler_Stop( busScheduler_t *scheduler );
+extern  int     BusScheduler_Submit( busScheduler_t *scheduler, busClass_t jobClass, uint64_t deadlineNanos, busJobFunction_t function, void *arg );
+extern  int     BusScheduler_Run( busScheduler_t *scheduler, busClass_t jobClass, uint64_t deadlineNanos, busJobFunction_t function, void *arg );
+extern  void    BusScheduler_GetStats( busScheduler_t *scheduler, busSchedulerStats_t *stats );
+extern  const char  *BusScheduler_ClassName( busClass_t jobClass );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUSSCHEDULER_H */
@@ -0,0 +1,518 @@
+/*
+ * File:    capture.c
+ * author:  patrick conroy
+ *
+ * What goes in the file is what each polling pass left in the reader's
+ * register snapshot - the words of every Modbus response, before any of
+ * them were scaled or range checked - plus the night time discrete input
+ * and, when they were re-read and changed, the settings registers. Not the
+ * frames on the wire: CRCs and retries aren't what we are chasing, the
+ * values the decoders were handed are.
+ *
+ * Everything is little endian, whatever we run on:
+ *
+ *  header  "EPCAP1\0\0", u16 version, u16 controllers,
+ *          then per controller: s32 id, u8 slave, u8 length, port name
+ *  record  u16 length of the rest, u32 ms since the capture started,
+ *          s64 wall time, u8 controller, u8 flags, u8 realtime spans,
+ *          u8 settings spans, then each span: u8 kind, u16 address,
+ *          u16 count, count * u16
+ *
+ * Only the valid runs of registers are written, so a record of the usual
+ * read plan is a few hundred bytes.
+ *
+ * Replay puts the registers back where a read would have left them and
+ * runs the same decode as acquisition does, then pushes the sample into the
+ * bus's ring for the publisher. Records are paced at their recorded offsets
+ * divided by the speed factor; at 0 there is no pacing, just back pressure -
+ * replay waits for room in the ring rather than let a sample be dropped.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "extraData.h"
+#include "controllers.h"
+#include "timeUtils.h"
+#include "capture.h"
+
+
+#define CAPTURE_MAGIC           "EPCAP1\0\0"
+#define CAPTURE_MAGIC_LENGTH    8
+#define CAPTURE_VERSION         1
+#define CAPTURE_MAX_SPANS       255
+#define CAPTURE_RECORD_HEADER   16
+
+//
+//  Up to CAPTURE_MAX_SPANS span headers and a whole snapshot of words for the
+//  realtime registers, and the same again for the settings
+#define CAPTURE_MAX_RECORD      (CAPTURE_RECORD_HEADER + 2 * (CAPTURE_MAX_SPANS * 5 + 2 * (INPUT_REGISTER_COUNT + HOLDING_REGISTER_COUNT)))
+
+#define FLAG_NIGHT_READ         0x01
+#define FLAG_NIGHT              0x02
+#define FLAG_SETTINGS           0x04
+
+#define REPLAY_POLL_NANOS       (NANOS_PER_MILLI)
+#define REPLAY_MAX_SLEEP_NANOS  (100 * NANOS_PER_MILLI)     // so Capture_StopReplay() isn't kept waiting
+
+static  FILE            *captureFile = NULL;
+static  pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+static  uint64_t        captureStartNanos;
+static  uint8_t         record[ CAPTURE_MAX_RECORD ];       // under captureMutex
+
+static  FILE            *replayFile = NULL;
+static  pthread_t       replayThread;
+static  volatile int    replaying = FALSE;
+static  double          replaySpeed;
+static  int             replayExtraData;
+static  void            (*notifyPublisher)( void );
+static  void            (*notifyFinished)( void );
+
+static  captureStats_t  stats;
+
+
+// -----------------------------------------------------------------------------
+static
+uint8_t *put16 (uint8_t *p, uint16_t value)
+{
+    p[ 0 ] = value & 0xFF;
+    p[ 1 ] = value >> 8;
+    return p + 2;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint8_t *put32 (uint8_t *p, uint32_t value)
+{
+    return put16( put16( p, value & 0xFFFF ), value >> 16 );
+}
+
+// -----------------------------------------------------------------------------
+static
+uint8_t *put64 (uint8_t *p, uint64_t value)
+{
+    return put32( put32( p, value & 0xFFFFFFFF ), value >> 32 );
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t    get16 (const uint8_t *p)
+{
+    return p[ 0 ] | (p[ 1 ] << 8);
+}
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    get32 (const uint8_t *p)
+{
+    return get16( p ) | ((uint32_t) get16( p + 2 ) << 16);
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    get64 (const uint8_t *p)
+{
+    return get32( p ) | ((uint64_t) get32( p + 4 ) << 32);
+}
+
+// -----------------------------------------------------------------------------
+static
+uint8_t *putSpans (uint8_t *p, const registerSnapshot_t *snapshot, registerKind_t kind, int *numSpans)
+{
+    //
+    //  Each run of valid registers is one span
+    const uint8_t   *valid = (kind == REG_INPUT) ? snapshot->inputValid : snapshot->holdingValid;
+    const uint16_t  *words = (kind == REG_INPUT) ? snapshot->input : snapshot->holding;
+    int             count = (kind == REG_INPUT) ? INPUT_REGISTER_COUNT : HOLDING_REGISTER_COUNT;
+    int             base = (kind == REG_INPUT) ? INPUT_REGISTER_BASE : HOLDING_REGISTER_BASE;
+
+    for (int i = 0; i < count && *numSpans < CAPTURE_MAX_SPANS; ) {
+        if (!valid[ i ]) {
+            i += 1;
+            continue;
+        }
+
+        int first = i;
+        while (i < count && valid[ i ])
+            i += 1;
+
+        *p++ = (uint8_t) kind;
+        p = put16( p, base + first );
+        p = put16( p, i - first );
+        for (int j = first; j < i; j += 1)
+            p = put16( p, words[ j ] );
+        *numSpans += 1;
+    }
+    return p;
+}
+
+// -----------------------------------------------------------------------------
+static
+const uint8_t   *getSpans (const uint8_t *p, const uint8_t *end, int numSpans, registerSnapshot_t *snapshot)
+{
+    //
+    //  NULL if the record is cut short or a span falls outside the windows
+    for (int i = 0; i < numSpans; i += 1) {
+        if (end - p < 5)
+            return NULL;
+
+        registerKind_t  kind = (registerKind_t) p[ 0 ];
+        int             address = get16( p + 1 );
+        int             count = get16( p + 3 );
+        p += 5;
+
+        int             base = (kind == REG_INPUT) ? INPUT_REGISTER_BASE : HOLDING_REGISTER_BASE;
+        int             windowSize = (kind == REG_INPUT) ? INPUT_REGISTER_COUNT : HOLDING_REGISTER_COUNT;
+        uint16_t        *words = (kind == REG_INPUT) ? snapshot->input : snapshot->holding;
+        uint8_t         *valid = (kind == REG_INPUT) ? snapshot->inputValid : snapshot->holdingValid;
+
+        if ((kind != REG_INPUT && kind != REG_HOLDING) || address < base || (address - base) + count > windowSize || end - p < 2 * count)
+            return NULL;
+
+        for (int j = 0; j < count; j += 1, p += 2) {
+            words[ address - base + j ] = get16( p );
+            valid[ address - base + j ] = TRUE;
+        }
+    }
+    return p;
+}
+
+// -----------------------------------------------------------------------------
+int Capture_Open (const char *path)
+{
+    uint8_t     header[ CAPTURE_MAGIC_LENGTH + 4 ];
+
+    captureFile = fopen( path, "wb" );
+    if (captureFile == NULL) {
+        Logger_LogError( "Unable to create the register capture [%s]: %s\n", path, strerror( errno ) );
+        return FALSE;
+    }
+
+    memcpy( header, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH );
+    put16( put16( header + CAPTURE_MAGIC_LENGTH, CAPTURE_VERSION ), numControllers );
+    fwrite( header, sizeof header, 1, captureFile );
+
+    for (int i = 0; i < numControllers; i += 1) {
+        const char  *portName = buses[ controllers[ i ].busIndex ].portName;
+        size_t      length = strlen( portName );
+        uint8_t     entry[ 6 ];
+
+        if (length > 255)
+            length = 255;
+        put32( entry, (uint32_t) controllers[ i ].id );
+        entry[ 4 ] = (uint8_t) controllers[ i ].device.slaveID;
+        entry[ 5 ] = (uint8_t) length;
+        fwrite( entry, sizeof entry, 1, captureFile );
+        fwrite( portName, length, 1, captureFile );
+    }
+
+    if (fflush( captureFile ) != 0) {
+        Logger_LogError( "Unable to write the register capture [%s]: %s\n", path, strerror( errno ) );
+        fclose( captureFile );
+        captureFile = NULL;
+        return FALSE;
+    }
+
+    captureStartNanos = Time_MonotonicNanos();
+    Logger_LogWarning( "Capturing controller registers to [%s]\n", path );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Capture_IsOpen (void)
+{
+    return (captureFile != NULL);
+}
+
+// -----------------------------------------------------------------------------
+void    Capture_Record (int controllerIndex, const realTimeReader_t *reader, const settingsCache_t *settings, time_t wallTime)
+{
+    //
+    //  Called by every bus's acquisition thread, so one record at a time
+    if (captureFile == NULL)
+        return;
+
+    pthread_mutex_lock( &captureMutex );
+
+    uint64_t    millis = (Time_MonotonicNanos() - captureStartNanos) / NANOS_PER_MILLI;
+    uint8_t     *p = record + 2;
+    int         realTimeSpans = 0;
+    int         settingsSpans = 0;
+
+    p = put32( p, (uint32_t) millis );
+    p = put64( p, (uint64_t) (int64_t) wallTime );
+    *p++ = (uint8_t) controllerIndex;
+    *p++ = (reader->nightValid ? FLAG_NIGHT_READ : 0) | (reader->night ? FLAG_NIGHT : 0) | (settings != NULL ? FLAG_SETTINGS : 0);
+
+    uint8_t     *counts = p;
+    p += 2;
+    p = putSpans( p, &reader->snapshot, REG_INPUT, &realTimeSpans );
+    p = putSpans( p, &reader->snapshot, REG_HOLDING, &realTimeSpans );
+    if (settings != NULL) {
+        p = putSpans( p, &settings->snapshot, REG_INPUT, &settingsSpans );
+        p = putSpans( p, &settings->snapshot, REG_HOLDING, &settingsSpans );
+        stats.settingsRecords += 1;
+    }
+    counts[ 0 ] = (uint8_t) realTimeSpans;
+    counts[ 1 ] = (uint8_t) settingsSpans;
+
+    size_t      length = p - record;
+    put16( record, (uint16_t) (length - 2) );
+
+    if (fwrite( record, length, 1, captureFile ) != 1 || fflush( captureFile ) != 0) {
+        if (stats.errors++ == 0)
+            Logger_LogError( "Unable to write to the register capture: %s\n", strerror( errno ) );
+    } else {
+        stats.records += 1;
+        stats.bytes += length;
+    }
+
+    pthread_mutex_unlock( &captureMutex );
+}
+
+// -----------------------------------------------------------------------------
+void    Capture_Close (void)
+{
+    pthread_mutex_lock( &captureMutex );
+    if (captureFile != NULL) {
+        fclose( captureFile );
+        captureFile = NULL;
+        Logger_LogWarning( "Captured %lu samples, %lu bytes\n", stats.records, stats.bytes );
+    }
+    pthread_mutex_unlock( &captureMutex );
+}
+
+// -----------------------------------------------------------------------------
+int Capture_OpenReplay (const char *path)
+{
+    //
+    //  The controllers come from the capture, not "-C" / "-p"
+    uint8_t     header[ CAPTURE_MAGIC_LENGTH + 4 ];
+
+    replayFile = fopen( path, "rb" );
+    if (replayFile == NULL) {
+        Logger_LogError( "Unable to open the register capture [%s]: %s\n", path, strerror( errno ) );
+        return FALSE;
+    }
+
+    if (fread( header, sizeof header, 1, replayFile ) != 1 || memcmp( header, CAPTURE_MAGIC, CAPTURE_MAGIC_LENGTH ) != 0) {
+        Logger_LogError( "[%s] is not a register capture\n", path );
+        Capture_StopReplay();
+        return FALSE;
+    }
+    if (get16( header + CAPTURE_MAGIC_LENGTH ) != CAPTURE_VERSION) {
+        Logger_LogError( "[%s] is a version %d register capture - we read version %d\n", path, get16( header + CAPTURE_MAGIC_LENGTH ), CAPTURE_VERSION );
+        Capture_StopReplay();
+        return FALSE;
+    }
+
+    int count = get16( header + CAPTURE_MAGIC_LENGTH + 2 );
+    for (int i = 0; i < count; i += 1) {
+        uint8_t     entry[ 6 ];
+        char        portName[ 256 ];
+
+        if (fread( entry, sizeof entry, 1, replayFile ) != 1 || (entry[ 5 ] > 0 && fread( portName, entry[ 5 ], 1, replayFile ) != 1)) {
+            Logger_LogError( "The register capture [%s] is cut short\n", path );
+            Capture_StopReplay();
+            return FALSE;
+        }
+        portName[ entry[ 5 ] ] = '\0';
+
+        //
+        //  The bus table hangs on to the port name
+        if (!Controllers_Add( strdup( portName ), entry[ 4 ], (int32_t) get32( entry ) )) {
+            Capture_StopReplay();
+            return FALSE;
+        }
+    }
+
+    Logger_LogWarning( "Replaying %d controller(s) from the register capture [%s]\n", count, path );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int replayOne (const uint8_t *body, size_t length, uint64_t *sequences, sample_t *sample)
+{
+    //
+    //  One record back into its controller, decoded into sample. FALSE if
+    //  the record doesn't make sense
+    const uint8_t   *end = body + length;
+    if (length < CAPTURE_RECORD_HEADER)
+        return FALSE;
+
+    time_t  wallTime = (time_t) (int64_t) get64( body + 4 );
+    int     controllerIndex = body[ 12 ];
+    int     flags = body[ 13 ];
+    int     realTimeSpans = body[ 14 ];
+    int     settingsSpans = body[ 15 ];
+    if (controllerIndex >= numControllers)
+        return FALSE;
+
+    controller_t    *controller = &controllers[ controllerIndex ];
+    realTimeReader_t    *reader = &controller->reader;
+
+    Snapshot_Clear( &reader->snapshot );
+    const uint8_t   *p = getSpans( body + CAPTURE_RECORD_HEADER, end, realTimeSpans, &reader->snapshot );
+    if (p == NULL)
+        return FALSE;
+    reader->nightValid = ((flags & FLAG_NIGHT_READ) != 0);
+    reader->night = ((flags & FLAG_NIGHT) != 0);
+
+    memset( sample, '\0', sizeof( sample_t ) );
+    RealTimeReader_Decode( reader, &sample->rtData, &sample->rtRead );
+
+    if (flags & FLAG_SETTINGS) {
+        registerSnapshot_t  settingsSnapshot;
+
+        Snapshot_Clear( &settingsSnapshot );
+        if (getSpans( p, end, settingsSpans, &settingsSnapshot ) == NULL)
+            return FALSE;
+        sample->settingsChanged = SettingsCache_Load( &controller->settings, &settingsSnapshot, controller->device.slaveID, wallTime );
+    }
+
+    if (replayExtraData) {
+        ExtraData_Decode( &reader->snapshot, SettingsCache_Get( &controller->settings ), &sample->extraData );
+        sample->extraData.settings = *SettingsCache_Get( &controller->settings );
+        sample->haveExtraData = TRUE;
+    }
+
+    uint64_t    now = Time_MonotonicNanos();
+    sample->controller = controllerIndex;
+    sample->sequence = sequences[ controllerIndex ]++;
+    sample->wallTime = wallTime;
+    sample->deadlineNanos = now;
+    sample->acquiredNanos = now;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    sleepNanos (uint64_t nanos)
+{
+    struct timespec delay = { (time_t) (nanos / NANOS_PER_SECOND), (long) (nanos % NANOS_PER_SECOND) };
+    nanosleep( &delay, NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *replayLoop (void *arg)
+{
+    (void) arg;
+    static  uint64_t    sequences[ MAX_CONTROLLERS ];
+    uint8_t     body[ CAPTURE_MAX_RECORD ];
+    uint64_t    started = Time_MonotonicNanos();
+    sample_t    sample;
+
+    while (replaying) {
+        uint8_t     lengthBytes[ 2 ];
+        if (fread( lengthBytes, sizeof lengthBytes, 1, replayFile ) != 1)
+            break;
+
+        //
+        //  A length we could never have written means the rest of the file
+        //  can't be trusted either
+        size_t  length = get16( lengthBytes );
+        if (length < CAPTURE_RECORD_HEADER || length > sizeof body) {
+            Logger_LogWarning( "The register capture has a %lu byte record - giving up on the rest of it\n", (unsigned long) length );
+            stats.errors += 1;
+            break;
+        }
+        if (fread( body, length, 1, replayFile ) != 1) {
+            Logger_LogWarning( "The register capture ends in the middle of a record\n" );
+            stats.errors += 1;
+            break;
+        }
+
+        //
+        //  On the recorded schedule, sped up
+        if (replaySpeed > 0 && length >= 4) {
+            uint64_t    due = started + (uint64_t) (get32( body ) * (double) NANOS_PER_MILLI / replaySpeed);
+            uint64_t    now;
+            while (replaying && (now = Time_MonotonicNanos()) < due)
+                sleepNanos( (due - now < REPLAY_MAX_SLEEP_NANOS) ? due - now : REPLAY_MAX_SLEEP_NANOS );
+        }
+
+        if (!replayOne( body, length, sequences, &sample )) {
+            if (stats.errors++ == 0)
+                Logger_LogWarning( "Skipping a bad record in the register capture\n" );
+            continue;
+        }
+
+        sampleRing_t    *ring = &buses[ controllers[ sample.controller ].busIndex ].ring;
+        while (replaying && SampleRing_Depth( ring ) >= ring->capacity)
+            sleepNanos( REPLAY_POLL_NANOS );
+        if (!replaying)
+            break;
+
+        SampleRing_Push( ring, &sample );
+        stats.records += 1;
+        if (notifyPublisher != NULL)
+            (*notifyPublisher)();
+    }
+
+    //
+    //  Let the publisher get through the last of it before we say we're done
+    for (int i = 0; i < numBuses && replaying; i += 1)
+        while (replaying && SampleRing_Depth( &buses[ i ].ring ) > 0)
+            sleepNanos( REPLAY_POLL_NANOS );
+
+    if (replaying) {
+        uint64_t    elapsed = Time_MonotonicNanos() - started;
+        Logger_LogWarning( "Replayed %lu samples in %.3f seconds\n", stats.records, elapsed / (double) NANOS_PER_SECOND );
+        if (notifyFinished != NULL)
+            (*notifyFinished)();
+    }
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Capture_StartReplay (double speed, int withExtraData, void (*sampleReady)( void ), void (*finished)( void ))
+{
+    replaySpeed = (speed > 0) ? speed : 0;
+    replayExtraData = withExtraData;
+    notifyPublisher = sampleReady;
+    notifyFinished = finished;
+    memset( &stats, '\0', sizeof stats );
+
+    replaying = TRUE;
+    if (pthread_create( &replayThread, NULL, replayLoop, NULL )) {
+        Logger_LogFatal( "Unable to start the capture replay thread!\n" );
+        replaying = FALSE;
+        return FALSE;
+    }
+
+    if (replaySpeed > 0)
+        Logger_LogWarning( "Replaying the capture at %.0fx\n", replaySpeed );
+    else
+        Logger_LogWarning( "Replaying the capture as fast as it will go\n" );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Capture_StopReplay (void)
+{
+    if (replayFile == NULL)
+        return;
+
+    if (replaying) {
+        replaying = FALSE;
+        pthread_join( replayThread, NULL );
+    }
+    fclose( replayFile );
+    replayFile = NULL;
+}
+
+// -----------------------------------------------------------------------------
+void    Capture_GetStats (captureStats_t *out)
+{
+    *out = stats;
+}
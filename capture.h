@@ -0,0 +1,49 @@
+/*
+ * File:   capture.h
+ * Author: pconroy
+ *
+ * "-R" records every register the controllers answered with - the raw words,
+ * before any decoding - into a compact binary file. "-X" plays such a file
+ * back through decode, serialize and publish instead of reading controllers,
+ * "-L" times faster than it was recorded. Spurious readings from the field
+ * can then be reproduced, and the pipeline profiled, without the hardware.
+ */
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <time.h>
+#include "realTimeReader.h"
+#include "settingsCache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_DEFAULT_SPEED       1000.0      // "-L" - 0 means as fast as the publisher keeps up
+
+typedef struct  captureStats {
+    unsigned long   records;                    // written, or replayed
+    unsigned long   bytes;
+    unsigned long   settingsRecords;            // ...that carried a settings read too
+    unsigned long   errors;
+} captureStats_t;
+
+extern  int     Capture_Open( const char *path );
+extern  int     Capture_IsOpen( void );
+extern  void    Capture_Record( int controllerIndex, const realTimeReader_t *reader, const settingsCache_t *settings, time_t wallTime );
+extern  void    Capture_Close( void );
+
+extern  int     Capture_OpenReplay( const char *path );
+extern  int     Capture_StartReplay( double speed, int withExtraData, void (*sampleReady)( void ), void (*finished)( void ) );
+extern  void    Capture_StopReplay( void );
+
+extern  void    Capture_GetStats( captureStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,221 @@
+/*
+ * File:    cborPayload.c
+ * author:  patrick conroy
+ *
+ * A "-x" JSON message is around 3.5K, most of it key strings like
+ * "isDischargeStatusShortedInHighVoltage". Here a field's key is its row in
+ * the field tables (realTimeFields[] first, then extraFields[]) and fixed
+ * point values are scaled integers, so a typical field is 3 or 4 bytes.
+ *
+ * The schema message lists, for every key that can turn up:
+ *
+ *      {"key":2,"name":"pvPower","type":"fixed","decimals":2}
+ *
+ * "fixed" values are integers to be divided by 10^decimals, "number" is an
+ * integer or a double, "bool" and "yesno" are CBOR true / false, "string" is
+ * text. Its schemaId is a hash of that list - any payload carrying a
+ * different one needs a fresh copy of the schema.
+ *
+ * Only the fields are carried. Aggregates ("-r") and delta mode ("-k") stay
+ * JSON only.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "jsonWriter.h"
+#include "cborWriter.h"
+#include "realTimeFields.h"
+#include "cborPayload.h"
+
+
+extern char    *getDateTime( time_t when );
+
+#define PAYLOAD_BUFFER_SIZE     1024
+#define SCHEMA_BUFFER_SIZE      8192
+
+static  uint8_t     payloadBuffer[ PAYLOAD_BUFFER_SIZE ];
+static  char        schemaBuffer[ SCHEMA_BUFFER_SIZE ];
+static  int         includeExtraData = FALSE;
+static  uint32_t    schemaId = 0;
+
+
+// -----------------------------------------------------------------------------
+static
+const char  *kindName (fieldKind_t kind)
+{
+    switch (kind) {
+        case FIELD_FIXED:   return "fixed";
+        case FIELD_NUMBER:  return "number";
+        case FIELD_BOOL:    return "bool";
+        case FIELD_YESNO:   return "yesno";
+        case FIELD_STRING:  return "string";
+    }
+    return "unknown";
+}
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    hashField (uint32_t hash, int key, const char *name, fieldKind_t kind, int decimals)
+{
+    //
+    //  FNV-1a over "key:name:type:decimals;"
+    char    text[ 128 ];
+    int     length = snprintf( text, sizeof text, "%d:%s:%s:%d;", key, name, kindName( kind ), decimals );
+
+    for (int i = 0; i < length && i < (int) sizeof text; i += 1) {
+        hash ^= (uint8_t) text[ i ];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// -----------------------------------------------------------------------------
+int CborPayload_Initialize (int withExtraData)
+{
+    uint32_t    hash = 2166136261u;
+    int         numFields = 0;
+
+    includeExtraData = withExtraData;
+
+    for (int i = 0; i < numRealTimeFields; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ i ];
+        if (RealTimeFields_IsEnabled( field )) {
+            hash = hashField( hash, i, field->key, field->kind, field->decimals );
+            numFields += 1;
+        }
+    }
+    for (int i = 0; includeExtraData && i < numExtraFields; i += 1) {
+        const extraField_t *field = &extraFields[ i ];
+        if (ExtraFields_IsEnabled( field )) {
+            hash = hashField( hash, numRealTimeFields + i, field->key, field->kind, field->decimals );
+            numFields += 1;
+        }
+    }
+
+    schemaId = hash & 0x7fffffff;              // stays positive in a 32 bit long on the Pi
+    Logger_LogInfo( "CBOR payload: %d fields, schema %08x\n", numFields, schemaId );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+uint32_t    CborPayload_SchemaId (void)
+{
+    return schemaId;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    writeValue (cborWriter_t *writer, int key, fieldKind_t kind, int decimals, double number, const char *string)
+{
+    switch (kind) {
+        case FIELD_FIXED:   CBOR_AddFixed( writer, key, number, decimals );     break;
+        case FIELD_NUMBER:  CBOR_AddNumber( writer, key, number );              break;
+        case FIELD_BOOL:
+        case FIELD_YESNO:   CBOR_AddBool( writer, key, number != 0 );           break;
+        case FIELD_STRING:  CBOR_AddString( writer, key, string );              break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+const uint8_t   *CborPayload_Build (int controllerID, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, time_t sampleTime, size_t *length)
+{
+    cborWriter_t    writer;
+
+    CBOR_Begin( &writer, payloadBuffer, sizeof payloadBuffer );
+    CBOR_AddInt( &writer, CBOR_KEY_SCHEMA_ID, (long) schemaId );
+    CBOR_AddInt( &writer, CBOR_KEY_TIME, (long) sampleTime );
+    CBOR_AddInt( &writer, CBOR_KEY_CONTROLLER, controllerID );
+
+    //
+    //  Same fields, same order and same range checks as realTimeDataToJSON()
+    for (int i = 0; i < numRealTimeFields; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ i ];
+        if (!RealTimeFields_IsValid( field, rtData, rtRead ))
+            continue;
+
+        if (field->kind == FIELD_STRING)
+            writeValue( &writer, i, field->kind, field->decimals, 0, field->string( rtData ) );
+        else
+            writeValue( &writer, i, field->kind, field->decimals, field->number( rtData ), NULL );
+    }
+
+    if (includeExtraData && extraData != NULL) {
+        for (int i = 0; i < numExtraFields; i += 1) {
+            const extraField_t *field = &extraFields[ i ];
+            if (!ExtraFields_IsValid( field, extraData ))
+                continue;
+
+            if (field->kind == FIELD_STRING)
+                writeValue( &writer, numRealTimeFields + i, field->kind, field->decimals, 0, field->string( extraData ) );
+            else
+                writeValue( &writer, numRealTimeFields + i, field->kind, field->decimals, field->number( extraData ), NULL );
+        }
+    }
+
+    *length = CBOR_End( &writer );
+    if (*length == 0) {
+        Logger_LogError( "CBOR message does not fit in %d bytes!\n", PAYLOAD_BUFFER_SIZE );
+        return NULL;
+    }
+    return payloadBuffer;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    addSchemaEntry (jsonWriter_t *writer, int key, const char *name, fieldKind_t kind, int decimals)
+{
+    char            entryBuffer[ 160 ];
+    jsonWriter_t    entry;
+
+    JSON_Begin( &entry, entryBuffer, sizeof entryBuffer );
+    JSON_AddInt( &entry, "key", key );
+    JSON_AddString( &entry, "name", name );
+    JSON_AddString( &entry, "type", kindName( kind ) );
+    if (kind == FIELD_FIXED)
+        JSON_AddInt( &entry, "decimals", decimals );
+
+    const char *json = JSON_End( &entry );
+    if (json != NULL)
+        JSON_AddRawElement( writer, json, strlen( json ) );
+}
+
+// -----------------------------------------------------------------------------
+const char  *CborPayload_SchemaToJSON (const char *topic, const char *binaryTopic)
+{
+    jsonWriter_t    writer;
+
+    JSON_Begin( &writer, schemaBuffer, sizeof schemaBuffer );
+    JSON_AddString( &writer, "topic", topic );
+    JSON_AddString( &writer, "version", "4.0" );
+    JSON_AddString( &writer, "dateTime", getDateTime( time( NULL ) ) );
+    JSON_AddString( &writer, "encoding", "cbor" );
+    JSON_AddString( &writer, "dataTopic", binaryTopic );
+    JSON_AddInt( &writer, "schemaId", (long) schemaId );
+
+    JSON_BeginArray( &writer, "fields" );
+    addSchemaEntry( &writer, CBOR_KEY_SCHEMA_ID, "schemaId", FIELD_NUMBER, 0 );
+    addSchemaEntry( &writer, CBOR_KEY_TIME, "time", FIELD_NUMBER, 0 );
+    addSchemaEntry( &writer, CBOR_KEY_CONTROLLER, "controllerId", FIELD_NUMBER, 0 );
+
+    for (int i = 0; i < numRealTimeFields; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ i ];
+        if (RealTimeFields_IsEnabled( field ))
+            addSchemaEntry( &writer, i, field->key, field->kind, field->decimals );
+    }
+    for (int i = 0; includeExtraData && i < numExtraFields; i += 1) {
+        const extraField_t *field = &extraFields[ i ];
+        if (ExtraFields_IsEnabled( field ))
+            addSchemaEntry( &writer, numRealTimeFields + i, field->key, field->kind, field->decimals );
+    }
+    JSON_EndArray( &writer );
+
+    const char *message = JSON_End( &writer );
+    if (message == NULL)
+        Logger_LogError( "CBOR schema does not fit in %d bytes!\n", SCHEMA_BUFFER_SIZE );
+    return message;
+}
@@ -0,0 +1,48 @@
+/*
+ * File:   cborPayload.h
+ * Author: pconroy
+ *
+ * "-B" compact DATA payload. The same fields as the JSON message, as a CBOR
+ * map keyed by small integers instead of key strings, published on the
+ * controller's CBOR topic. What each integer key means - name, type, decimal
+ * places - is in a retained JSON schema message on its SCHEMA topic, and
+ * every payload carries the schema's id so a decoder can tell when the field
+ * list has changed under it (different "-f" / "-F" / "-x", newer version).
+ */
+
+#ifndef CBORPAYLOAD_H
+#define CBORPAYLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "libepsolar.h"
+#include "extraData.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    PAYLOAD_JSON,                       // the default - DATA only
+    PAYLOAD_JSON_AND_CBOR,              // "-B cbor" - both, CBOR on its own topic
+    PAYLOAD_CBOR                        // "-B cbor-only" - no JSON DATA (the journal still keeps JSON)
+} payloadEncoding_t;
+
+//
+//  Keys below zero are the message's own, fields count up from zero
+#define CBOR_KEY_SCHEMA_ID          -1
+#define CBOR_KEY_TIME               -2  // Unix seconds
+#define CBOR_KEY_CONTROLLER         -3
+
+extern  int             CborPayload_Initialize( int withExtraData );
+extern  uint32_t        CborPayload_SchemaId( void );
+extern  const uint8_t   *CborPayload_Build( int controllerID, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, time_t sampleTime, size_t *length );
+extern  const char      *CborPayload_SchemaToJSON( const char *topic, const char *binaryTopic );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CBORPAYLOAD_H */
@@ -0,0 +1,187 @@
+/*
+ * File:    cborWriter.c
+ * author:  patrick conroy
+ *
+ * Just the corner of CBOR we need: an indefinite length map, small integer
+ * keys, integers, doubles, true/false and text strings.
+ *
+ * Fixed point fields go out as scaled integers - 13.28 to 2 places is 1328,
+ * three bytes - with the same (int)(x * 10^n + .5) rounding JSON_AddFixed()
+ * uses, so both payloads always carry the same value. The decoder gets the
+ * number of places from the schema message.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "cborWriter.h"
+
+
+#define MAJOR_UNSIGNED      0x00
+#define MAJOR_NEGATIVE      0x20
+#define MAJOR_TEXT          0x60
+#define CBOR_MAP_START      0xbf            // indefinite length map
+#define CBOR_BREAK          0xff
+#define CBOR_FALSE          0xf4
+#define CBOR_TRUE           0xf5
+#define CBOR_NULL           0xf6
+#define CBOR_DOUBLE         0xfb
+
+static  const long  powersOfTen[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+#define MAX_DECIMALS    6
+
+
+// -----------------------------------------------------------------------------
+static
+void    appendBytes (cborWriter_t *writer, const uint8_t *bytes, size_t length)
+{
+    if (writer->length + length > writer->size) {
+        writer->overflow = 1;
+        return;
+    }
+    memcpy( &writer->buffer[ writer->length ], bytes, length );
+    writer->length += length;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendByte (cborWriter_t *writer, uint8_t byte)
+{
+    appendBytes( writer, &byte, 1 );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendHead (cborWriter_t *writer, uint8_t major, uint64_t value)
+{
+    //
+    //  Shortest form, as the spec's preferred serialization asks
+    uint8_t head[ 9 ];
+    size_t  length;
+
+    if (value < 24) {
+        head[ 0 ] = major | (uint8_t) value;
+        length = 1;
+    } else if (value <= 0xff) {
+        head[ 0 ] = major | 24;
+        head[ 1 ] = (uint8_t) value;
+        length = 2;
+    } else if (value <= 0xffff) {
+        head[ 0 ] = major | 25;
+        head[ 1 ] = (uint8_t) (value >> 8);
+        head[ 2 ] = (uint8_t) value;
+        length = 3;
+    } else if (value <= 0xffffffffUL) {
+        head[ 0 ] = major | 26;
+        for (int i = 0; i < 4; i += 1)
+            head[ 1 + i ] = (uint8_t) (value >> (24 - 8 * i));
+        length = 5;
+    } else {
+        head[ 0 ] = major | 27;
+        for (int i = 0; i < 8; i += 1)
+            head[ 1 + i ] = (uint8_t) (value >> (56 - 8 * i));
+        length = 9;
+    }
+    appendBytes( writer, head, length );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendInteger (cborWriter_t *writer, long value)
+{
+    if (value >= 0)
+        appendHead( writer, MAJOR_UNSIGNED, (uint64_t) value );
+    else
+        appendHead( writer, MAJOR_NEGATIVE, (uint64_t) (-1 - value) );
+}
+
+// -----------------------------------------------------------------------------
+void    CBOR_Begin (cborWriter_t *writer, uint8_t *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->overflow = 0;
+
+    appendByte( writer, CBOR_MAP_START );
+}
+
+// -----------------------------------------------------------------------------
+size_t  CBOR_End (cborWriter_t *writer)
+{
+    //
+    //  Length of the message, 0 if it didn't fit
+    appendByte( writer, CBOR_BREAK );
+    return writer->overflow ? 0 : writer->length;
+}
+
+// -----------------------------------------------------------------------------
+void    CBOR_AddInt (cborWriter_t *writer, int key, long value)
+{
+    appendInteger( writer, key );
+    appendInteger( writer, value );
+}
+
+// -----------------------------------------------------------------------------
+void    CBOR_AddNumber (cborWriter_t *writer, int key, double value)
+{
+    appendInteger( writer, key );
+
+    if (isnan( value ) || isinf( value )) {
+        appendByte( writer, CBOR_NULL );
+        return;
+    }
+
+    //
+    //  Whole numbers as integers, the way JSON_AddNumber() prints them
+    if (value > INT_MIN && value < INT_MAX && value == (double)(int) value) {
+        appendInteger( writer, (int) value );
+        return;
+    }
+
+    uint64_t    bits;
+    uint8_t     bytes[ 9 ];
+
+    memcpy( &bits, &value, sizeof bits );
+    bytes[ 0 ] = CBOR_DOUBLE;
+    for (int i = 0; i < 8; i += 1)
+        bytes[ 1 + i ] = (uint8_t) (bits >> (56 - 8 * i));
+    appendBytes( writer, bytes, sizeof bytes );
+}
+
+// -----------------------------------------------------------------------------
+void    CBOR_AddFixed (cborWriter_t *writer, int key, double value, int decimals)
+{
+    if (decimals < 0)
+        decimals = 0;
+    if (decimals > MAX_DECIMALS)
+        decimals = MAX_DECIMALS;
+
+    float product = (float) value * (float) powersOfTen[ decimals ];
+    appendInteger( writer, key );
+    appendInteger( writer, (int)(product + .5) );
+}
+
+// -----------------------------------------------------------------------------
+void    CBOR_AddBool (cborWriter_t *writer, int key, int value)
+{
+    appendInteger( writer, key );
+    appendByte( writer, (value ? CBOR_TRUE : CBOR_FALSE) );
+}
+
+// -----------------------------------------------------------------------------
+void    CBOR_AddString (cborWriter_t *writer, int key, const char *value)
+{
+    //
+    //  Same as JSON_AddString() - a NULL string adds nothing
+    if (value == NULL)
+        return;
+
+    size_t length = strlen( value );
+    appendInteger( writer, key );
+    appendHead( writer, MAJOR_TEXT, length );
+    appendBytes( writer, (const uint8_t *) value, length );
+}
@@ -0,0 +1,41 @@
+/*
+ * File:   cborWriter.h
+ * Author: pconroy
+ *
+ * Streams a flat CBOR (RFC 8949) map with integer keys straight into a caller
+ * supplied buffer - the binary twin of jsonWriter. No heap. The map is
+ * indefinite length, so fields can be skipped without counting them first.
+ */
+
+#ifndef CBORWRITER_H
+#define CBORWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  cborWriter {
+    uint8_t *buffer;
+    size_t  size;
+    size_t  length;
+    int     overflow;
+} cborWriter_t;
+
+extern  void        CBOR_Begin( cborWriter_t *writer, uint8_t *buffer, size_t size );
+extern  size_t      CBOR_End( cborWriter_t *writer );
+
+extern  void        CBOR_AddInt( cborWriter_t *writer, int key, long value );
+extern  void        CBOR_AddNumber( cborWriter_t *writer, int key, double value );
+extern  void        CBOR_AddFixed( cborWriter_t *writer, int key, double value, int decimals );
+extern  void        CBOR_AddBool( cborWriter_t *writer, int key, int value );
+extern  void        CBOR_AddString( cborWriter_t *writer, int key, const char *value );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CBORWRITER_H */
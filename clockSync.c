@@ -0,0 +1,150 @@
+/*
+ * File:    clockSync.c
+ * author:  patrick conroy
+ *
+ * We used to call eps_setRealtimeClockToNow() every time round the loop: a
+ * Modbus write per cycle, in series with the realtime reads, to fix a clock
+ * that drifts a few seconds a week. Now the clock registers are read every
+ * CLOCK_CHECK_SECONDS as a low priority bus job, and the clock is only set
+ * when it is off by more than the tolerance.
+ *
+ *  0x9013  D15-8 minute, D7-0 second
+ *  0x9014  D15-8 day,    D7-0 hour
+ *  0x9015  D15-8 year (from 2000), D7-0 month
+ *
+ * The controller keeps local time, same as eps_setRealtimeClockToNow() set it.
+ * We write the three registers ourselves now, since libepsolar can only talk
+ * to the one slave it connected to.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "modbusBus.h"
+#include "busScheduler.h"
+#include "metrics.h"
+#include "timeUtils.h"
+#include "clockSync.h"
+
+
+#define REG_REAL_TIME_CLOCK     0x9013
+
+
+// -----------------------------------------------------------------------------
+void    ClockSync_Initialize (clockSync_t *clock, const modbusDevice_t *device, busScheduler_t *scheduler, int toleranceSeconds)
+{
+    memset( clock, '\0', sizeof( clockSync_t ) );
+    clock->device = device;
+    clock->scheduler = scheduler;
+    clock->tolerance = (toleranceSeconds > 0) ? toleranceSeconds : CLOCK_DEFAULT_TOLERANCE_SECONDS;
+}
+
+// -----------------------------------------------------------------------------
+static
+int readControllerClock (const modbusDevice_t *device, time_t *controllerTime)
+{
+    uint16_t    registers[ 3 ];
+    struct tm   clock;
+
+    if (!Bus_ReadRegisters( device, REG_HOLDING, REG_REAL_TIME_CLOCK, 3, registers ))
+        return FALSE;
+
+    memset( &clock, '\0', sizeof clock );
+    clock.tm_sec = registers[ 0 ] & 0xFF;
+    clock.tm_min = registers[ 0 ] >> 8;
+    clock.tm_hour = registers[ 1 ] & 0xFF;
+    clock.tm_mday = registers[ 1 ] >> 8;
+    clock.tm_mon = (registers[ 2 ] & 0xFF) - 1;
+    clock.tm_year = (registers[ 2 ] >> 8) + 100;
+    clock.tm_isdst = -1;
+
+    *controllerTime = mktime( &clock );
+    return (*controllerTime != (time_t) -1);
+}
+
+// -----------------------------------------------------------------------------
+int ClockSync_SetToNow (const modbusDevice_t *device)
+{
+    uint16_t    registers[ 3 ];
+    struct tm   now;
+    time_t      t = time( NULL );
+
+    localtime_r( &t, &now );
+    registers[ 0 ] = (now.tm_min << 8) | now.tm_sec;
+    registers[ 1 ] = (now.tm_mday << 8) | now.tm_hour;
+    registers[ 2 ] = ((now.tm_year - 100) << 8) | (now.tm_mon + 1);
+
+    return Bus_WriteRegisters( device, REG_REAL_TIME_CLOCK, 3, registers );
+}
+
+// -----------------------------------------------------------------------------
+static
+int checkClock (clockSync_t *clock)
+{
+    time_t  controllerTime;
+
+    clock->stats.checks += 1;
+
+    if (!readControllerClock( clock->device, &controllerTime )) {
+        clock->stats.failures += 1;
+        Logger_LogWarning( "Unable to read the clock of slave %d\n", clock->device->slaveID );
+        return FALSE;
+    }
+
+    clock->stats.lastDriftSeconds = (long) (controllerTime - time( NULL ));
+    if (labs( clock->stats.lastDriftSeconds ) <= clock->tolerance) {
+        Logger_LogDebug( "Slave %d clock is %ld seconds off - leaving it alone\n", clock->device->slaveID, clock->stats.lastDriftSeconds );
+        return TRUE;
+    }
+
+    Logger_LogInfo( "Slave %d clock is %ld seconds off - setting it\n", clock->device->slaveID, clock->stats.lastDriftSeconds );
+    if (!ClockSync_SetToNow( clock->device )) {
+        clock->stats.failures += 1;
+        return FALSE;
+    }
+    clock->stats.corrections += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int checkClockJob (void *arg)
+{
+    //
+    //  Runs on the bus thread
+    clockSync_t *clock = arg;
+    uint64_t    started = Time_MonotonicNanos();
+
+    __atomic_store_n( &clock->checkQueued, FALSE, __ATOMIC_RELEASE );
+    int ok = checkClock( clock );
+
+    Metrics_Record( STAGE_CLOCK_SYNC, Time_MonotonicNanos() - started );
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+void    ClockSync_Poll (clockSync_t *clock, uint64_t nowNanos)
+{
+    //
+    //  Called every acquisition cycle; only queues a check when one is due
+    if (__atomic_load_n( &clock->checkQueued, __ATOMIC_ACQUIRE ) || nowNanos < clock->nextCheckNanos)
+        return;
+
+    uint64_t checkInterval = (uint64_t) CLOCK_CHECK_SECONDS * NANOS_PER_SECOND;
+    clock->nextCheckNanos = nowNanos + checkInterval;
+    __atomic_store_n( &clock->checkQueued, TRUE, __ATOMIC_RELEASE );
+    if (!BusScheduler_Submit( clock->scheduler, BUS_CLASS_CLOCK_SYNC, nowNanos + checkInterval, checkClockJob, clock ))
+        __atomic_store_n( &clock->checkQueued, FALSE, __ATOMIC_RELEASE );
+}
+
+// -----------------------------------------------------------------------------
+void    ClockSync_GetStats (const clockSync_t *clock, clockSyncStats_t *out)
+{
+    *out = clock->stats;
+}
@@ -0,0 +1,49 @@
+/*
+ * File:   clockSync.h
+ * Author: pconroy
+ *
+ * Keeps each controller's real time clock in line with ours. The clock is
+ * read every so often and only written when it has drifted past a tolerance.
+ */
+
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <stdint.h>
+#include "modbusBus.h"
+#include "busScheduler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CLOCK_DEFAULT_TOLERANCE_SECONDS     5
+#define CLOCK_CHECK_SECONDS                 600
+
+typedef struct  clockSyncStats {
+    unsigned long   checks;
+    unsigned long   corrections;
+    unsigned long   failures;           // could not read the controller clock
+    long            lastDriftSeconds;   // controller minus host, as of the last check
+} clockSyncStats_t;
+
+typedef struct  clockSync {
+    const modbusDevice_t    *device;
+    busScheduler_t          *scheduler; // the one for the device's bus
+    int                     tolerance;
+    uint64_t                nextCheckNanos;
+    int                     checkQueued;    // set by the poll, cleared on the bus thread - __atomic only
+    clockSyncStats_t        stats;
+} clockSync_t;
+
+extern  void    ClockSync_Initialize( clockSync_t *clock, const modbusDevice_t *device, busScheduler_t *scheduler, int toleranceSeconds );
+extern  void    ClockSync_Poll( clockSync_t *clock, uint64_t nowNanos );
+extern  int     ClockSync_SetToNow( const modbusDevice_t *device );
+extern  void    ClockSync_GetStats( const clockSync_t *clock, clockSyncStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLOCKSYNC_H */
@@ -0,0 +1,330 @@
+/*
+ * File:    commands.c
+ * author:  patrick conroy
+ *
+ * The mosquitto callback runs on mosquitto's network thread, so it does as
+ * little as it can: copy the payload into a slot of a lock-free single
+ * producer / single consumer queue, stamp it, and post a semaphore. The
+ * command worker wakes on that, parses the JSON and hands the Modbus part to
+ * the bus scheduler in the COMMAND class. That puts it ahead of anything
+ * already queued, so it waits at most for one transaction that is already
+ * on the wire - never for the next polling period.
+ *
+ * Every controller has its own COMMAND topic. The message is routed by topic
+ * to that controller's slave, queued on the scheduler for its bus, and acked
+ * on its ACK topic. One worker does it for all of them.
+ *
+ * The load is switched with coil 0x0002 ("manual control the load"), then
+ * the coil is read back so the ack says what the controller actually did.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <cjson/cJSON.h>
+
+#include "asyncLog.h"
+#include "libmqttrv.h"
+#include "libepsolar.h"
+#include "modbusBus.h"
+#include "busScheduler.h"
+#include "clockSync.h"
+#include "controllers.h"
+#include "historyQuery.h"
+#include "jsonWriter.h"
+#include "metrics.h"
+#include "timeUtils.h"
+#include "commands.h"
+
+
+#define COIL_MANUAL_LOAD_CONTROL    0x0002
+#define ACK_BUFFER_SIZE             1024
+
+typedef struct  inboundCommand {
+    controller_t    *controller;        // whose COMMAND topic it came in on
+    uint64_t    receivedNanos;
+    int         length;
+    char        payload[ COMMAND_MAX_PAYLOAD ];
+} inboundCommand_t;
+
+//
+//  What a bus job needs, and what it hands back for the ack
+typedef struct  commandContext {
+    const modbusDevice_t    *device;
+    const char  *value;
+    int         loadIsOn;               // -1 - not applicable / unknown
+    const char  *error;
+    uint64_t    startedNanos;
+    uint64_t    appliedNanos;
+} commandContext_t;
+
+typedef struct  commandHandler {
+    const char          *name;
+    busJobFunction_t    job;            // NULL - nothing to do on the bus
+    int                 (*local)( controller_t *controller, const cJSON *json, commandContext_t *context );
+} commandHandler_t;
+
+extern  char    *getDateTime( time_t when );
+
+static  struct mosquitto    *mosquittoInstance = NULL;
+
+static  inboundCommand_t    queue[ COMMAND_QUEUE_SIZE ];
+static  uint64_t            head = 0;               // mosquitto thread writes here
+static  uint64_t            tail = 0;               // command worker reads here
+static  sem_t               commandsWaiting;
+
+static  pthread_t           workerThread;
+static  volatile int        running = FALSE;
+static  commandStats_t      stats;
+
+static  char                ackBuffer[ ACK_BUFFER_SIZE ];
+
+
+// -----------------------------------------------------------------------------
+static
+int loadJob (void *arg)
+{
+    commandContext_t    *context = arg;
+    uint8_t             coil;
+    int                 on;
+
+    context->startedNanos = Time_MonotonicNanos();
+    if (context->value != NULL && strcasecmp( context->value, "on" ) == 0)
+        on = TRUE;
+    else if (context->value != NULL && strcasecmp( context->value, "off" ) == 0)
+        on = FALSE;
+    else {
+        context->error = "value must be \"on\" or \"off\"";
+        return FALSE;
+    }
+
+    if (!Bus_WriteCoil( context->device, COIL_MANUAL_LOAD_CONTROL, on )) {
+        context->error = "controller refused the write";
+        return FALSE;
+    }
+    context->appliedNanos = Time_MonotonicNanos();
+
+    if (Bus_ReadCoils( context->device, COIL_MANUAL_LOAD_CONTROL, 1, &coil ))
+        context->loadIsOn = (coil != 0);
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int syncClockJob (void *arg)
+{
+    commandContext_t    *context = arg;
+
+    context->startedNanos = Time_MonotonicNanos();
+    if (!ClockSync_SetToNow( context->device )) {
+        context->error = "controller refused the write";
+        return FALSE;
+    }
+    context->appliedNanos = Time_MonotonicNanos();
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int historyCommand (controller_t *controller, const cJSON *json, commandContext_t *context)
+{
+    //
+    //  The ack only says it was accepted - the samples follow on HISTORY
+    return HistoryQuery_Submit( controller, json, &context->error );
+}
+
+static  const commandHandler_t  handlers[] = {
+    { "load",       loadJob,        NULL },
+    { "syncClock",  syncClockJob,   NULL },
+    { "ping",       NULL,           NULL },
+    { "history",    NULL,           historyCommand },
+};
+
+// -----------------------------------------------------------------------------
+static
+void    onMessage (struct mosquitto *mosq, void *userData, const struct mosquitto_message *message)
+{
+    //
+    //  mosquitto's thread - copy it and get out
+    controller_t *controller = (message->topic != NULL ? Controllers_FindByCommandTopic( message->topic ) : NULL);
+    if (controller == NULL)
+        return;
+
+    uint64_t    index = head;
+    uint64_t    readIndex = __atomic_load_n( &tail, __ATOMIC_ACQUIRE );
+
+    __atomic_add_fetch( &stats.received, 1, __ATOMIC_RELAXED );
+    if ((index - readIndex) >= COMMAND_QUEUE_SIZE || message->payloadlen >= COMMAND_MAX_PAYLOAD) {
+        __atomic_add_fetch( &stats.rejected, 1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    inboundCommand_t *command = &queue[ index % COMMAND_QUEUE_SIZE ];
+    command->controller = controller;
+    command->receivedNanos = Time_MonotonicNanos();
+    command->length = message->payloadlen;
+    memcpy( command->payload, message->payload, message->payloadlen );
+    command->payload[ message->payloadlen ] = '\0';
+
+    __atomic_store_n( &head, index + 1, __ATOMIC_RELEASE );
+    sem_post( &commandsWaiting );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishAck (const char *ackTopic, const cJSON *id, const char *name, const commandContext_t *context, uint64_t receivedNanos)
+{
+    jsonWriter_t    writer;
+    uint64_t        now = Time_MonotonicNanos();
+
+    JSON_Begin( &writer, ackBuffer, sizeof ackBuffer );
+    JSON_AddString( &writer, "topic", ackTopic );
+    JSON_AddString( &writer, "version", "4.0" );
+    JSON_AddString( &writer, "dateTime", getDateTime( time( NULL ) ) );
+    if (cJSON_IsString( id ))
+        JSON_AddString( &writer, "id", id->valuestring );
+    else if (cJSON_IsNumber( id ))
+        JSON_AddNumber( &writer, "id", id->valuedouble );
+    JSON_AddString( &writer, "command", name );
+    JSON_AddString( &writer, "status", (context->error == NULL ? "ok" : "error") );
+    JSON_AddString( &writer, "error", context->error );
+    if (context->loadIsOn >= 0)
+        JSON_AddBool( &writer, "loadIsOn", context->loadIsOn );
+
+    if (context->startedNanos != 0)
+        JSON_AddFixed( &writer, "queuedMillis", (context->startedNanos - receivedNanos) / (double) NANOS_PER_MILLI, 1 );
+    if (context->appliedNanos != 0)
+        JSON_AddFixed( &writer, "appliedMillis", (context->appliedNanos - receivedNanos) / (double) NANOS_PER_MILLI, 1 );
+    JSON_AddFixed( &writer, "latencyMillis", (now - receivedNanos) / (double) NANOS_PER_MILLI, 1 );
+
+    const char *message = JSON_End( &writer );
+    if (message != NULL)
+        mosquitto_publish( mosquittoInstance, NULL, ackTopic, strlen( message ), message, 1, false );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    executeCommand (const inboundCommand_t *command)
+{
+    controller_t        *controller = command->controller;
+    commandContext_t    context = { &controller->device, NULL, -1, NULL, 0, 0 };
+    const char          *name = "unknown";
+    const cJSON         *id = NULL;
+
+    cJSON *json = cJSON_Parse( command->payload );
+    if (json != NULL) {
+        const cJSON *commandName = cJSON_GetObjectItemCaseSensitive( json, "command" );
+        const cJSON *value = cJSON_GetObjectItemCaseSensitive( json, "value" );
+
+        id = cJSON_GetObjectItemCaseSensitive( json, "id" );
+        if (cJSON_IsString( commandName ))
+            name = commandName->valuestring;
+        if (cJSON_IsString( value ))
+            context.value = value->valuestring;
+    }
+
+    const commandHandler_t *handler = NULL;
+    for (size_t i = 0; i < sizeof handlers / sizeof handlers[ 0 ]; i += 1)
+        if (strcmp( handlers[ i ].name, name ) == 0)
+            handler = &handlers[ i ];
+
+    if (json == NULL) {
+        context.error = "not a JSON object";
+        __atomic_add_fetch( &stats.rejected, 1, __ATOMIC_RELAXED );
+    } else if (handler == NULL) {
+        context.error = "unknown command";
+        __atomic_add_fetch( &stats.rejected, 1, __ATOMIC_RELAXED );
+    } else if (handler->local != NULL) {
+        if (!(*handler->local)( controller, json, &context ))
+            stats.failed += 1;
+    } else if (handler->job != NULL) {
+        //
+        //  COMMAND beats everything else in the queue
+        uint64_t deadline = command->receivedNanos + (COMMAND_TARGET_MILLIS * NANOS_PER_MILLI);
+        if (!BusScheduler_Run( &buses[ controller->busIndex ].scheduler, BUS_CLASS_COMMAND, deadline, handler->job, &context )) {
+            if (context.error == NULL)
+                context.error = "bus unavailable";
+            stats.failed += 1;
+        }
+    }
+
+    if (context.error == NULL) {
+        stats.executed += 1;
+
+        uint64_t applied = (context.appliedNanos != 0 ? context.appliedNanos : Time_MonotonicNanos());
+        stats.lastLatencyNanos = applied - command->receivedNanos;
+        Metrics_Record( STAGE_COMMAND, stats.lastLatencyNanos );
+        if (stats.lastLatencyNanos > stats.maxLatencyNanos)
+            stats.maxLatencyNanos = stats.lastLatencyNanos;
+        if (stats.lastLatencyNanos > COMMAND_TARGET_MILLIS * NANOS_PER_MILLI) {
+            stats.overTarget += 1;
+            Logger_LogWarning( "Command [%s] took %lu ms to apply\n", name, (unsigned long) (stats.lastLatencyNanos / NANOS_PER_MILLI) );
+        }
+    }
+
+    Logger_LogInfo( "Controller %d command [%s] %s%s\n", controller->id, name, (context.error == NULL ? "done" : "failed: "), (context.error == NULL ? "" : context.error) );
+    publishAck( controller->ackTopic, id, name, &context, command->receivedNanos );
+    cJSON_Delete( json );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *commandWorker (void *arg)
+{
+    while (running) {
+        if (sem_wait( &commandsWaiting ) != 0)
+            continue;
+
+        while (tail != __atomic_load_n( &head, __ATOMIC_ACQUIRE )) {
+            executeCommand( &queue[ tail % COMMAND_QUEUE_SIZE ] );
+            __atomic_store_n( &tail, tail + 1, __ATOMIC_RELEASE );
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Commands_Start (struct mosquitto *mosq)
+{
+    mosquittoInstance = mosq;
+    memset( &stats, '\0', sizeof stats );
+
+    if (sem_init( &commandsWaiting, 0, 0 ) != 0) {
+        Logger_LogFatal( "Unable to create the command semaphore\n" );
+        return FALSE;
+    }
+
+    running = TRUE;
+    if (pthread_create( &workerThread, NULL, commandWorker, NULL )) {
+        Logger_LogFatal( "Unable to start the command processing thread!\n" );
+        running = FALSE;
+        return FALSE;
+    }
+
+    mosquitto_message_callback_set( mosquittoInstance, onMessage );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Commands_Stop (void)
+{
+    if (!running)
+        return;
+
+    running = FALSE;
+    sem_post( &commandsWaiting );
+    pthread_join( workerThread, NULL );
+}
+
+// -----------------------------------------------------------------------------
+void    Commands_GetStats (commandStats_t *out)
+{
+    *out = stats;
+}
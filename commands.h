@@ -0,0 +1,48 @@
+/*
+ * File:   commands.h
+ * Author: pconroy
+ *
+ * Inbound commands on <topTopic>/<controllerID>/COMMAND, for any of the
+ * controllers we poll. Each one is acked on <topTopic>/<controllerID>/ACK
+ * with its outcome and how long it took.
+ *
+ *  {"id":42,"command":"load","value":"on"}
+ *  {"command":"syncClock"}
+ *  {"command":"ping"}
+ *  {"id":7,"command":"history","from":-3600}       (see historyQuery.h)
+ */
+
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdint.h>
+#include "libmqttrv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define COMMAND_QUEUE_SIZE          16
+#define COMMAND_MAX_PAYLOAD         512
+#define COMMAND_TARGET_MILLIS       100     // receipt to applied write
+
+typedef struct  commandStats {
+    unsigned long   received;
+    unsigned long   rejected;           // queue full, too big, or not understood
+    unsigned long   executed;
+    unsigned long   failed;             // understood, but the controller said no
+    unsigned long   overTarget;         // took longer than COMMAND_TARGET_MILLIS
+    uint64_t        lastLatencyNanos;   // receipt -> applied
+    uint64_t        maxLatencyNanos;
+} commandStats_t;
+
+extern  int     Commands_Start( struct mosquitto *mosquittoInstance );
+extern  void    Commands_Stop( void );
+extern  void    Commands_GetStats( commandStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMMANDS_H */
@@ -0,0 +1,258 @@
+/*
+ * File:    controllers.c
+ * author:  patrick conroy
+ *
+ * Buses are keyed by port name, so two "-C" entries naming the same port
+ * share one bus. Nothing here is per-controller threads or connections: a
+ * controller is a slave ID, a few topics and its caches.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "controllers.h"
+
+
+controller_t    controllers[ MAX_CONTROLLERS ];
+int             numControllers = 0;
+controllerBus_t buses[ MAX_BUSES ];
+int             numBuses = 0;
+
+
+// -----------------------------------------------------------------------------
+static
+int findBus (const char *portName)
+{
+    for (int i = 0; i < numBuses; i += 1)
+        if (strcmp( buses[ i ].portName, portName ) == 0)
+            return i;
+
+    if (numBuses >= MAX_BUSES) {
+        Logger_LogError( "Too many serial ports - %d at most\n", MAX_BUSES );
+        return -1;
+    }
+
+    controllerBus_t *bus = &buses[ numBuses ];
+    memset( bus, '\0', sizeof( controllerBus_t ) );
+    bus->portName = portName;
+    return numBuses++;
+}
+
+// -----------------------------------------------------------------------------
+int Controllers_Add (const char *portName, int slaveID, int controllerID)
+{
+    if (portName == NULL)
+        portName = epsolarGetDefaultPortName();
+
+    if (numControllers >= MAX_CONTROLLERS) {
+        Logger_LogError( "Too many controllers - %d at most\n", MAX_CONTROLLERS );
+        return FALSE;
+    }
+    if (slaveID < 1 || slaveID > 247) {
+        Logger_LogError( "Bad Modbus slave ID %d for [%s]\n", slaveID, portName );
+        return FALSE;
+    }
+    for (int i = 0; i < numControllers; i += 1)
+        if (controllers[ i ].id == controllerID) {
+            Logger_LogError( "Controller ID %d is used twice\n", controllerID );
+            return FALSE;
+        }
+
+    int busIndex = findBus( portName );
+    if (busIndex < 0)
+        return FALSE;
+
+    controller_t *controller = &controllers[ numControllers ];
+    memset( controller, '\0', sizeof( controller_t ) );
+    controller->id = controllerID;
+    controller->busIndex = busIndex;
+    controller->device.bus = &buses[ busIndex ].modbus;
+    controller->device.slaveID = slaveID;
+    controller->device.timer = &controller->timer;
+    ResponseTimer_Initialize( &controller->timer );
+
+    controllerBus_t *bus = &buses[ busIndex ];
+    bus->controllers[ bus->numControllers++ ] = numControllers++;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    releasePortName (char *portName)
+{
+    //
+    //  Unless a bus was made for it - then the bus table has it
+    for (int i = 0; i < numBuses; i += 1)
+        if (buses[ i ].portName == portName)
+            return;
+    free( portName );
+}
+
+// -----------------------------------------------------------------------------
+int Controllers_Parse (const char *spec)
+{
+    //
+    //  <port>:<slave>=<id>[,<slave>=<id>...]. The slave list has no colons in
+    //  it, so the port is everything up to the last one - tcp://host:502 works
+    const char  *colon = strrchr( spec, ':' );
+    if (colon == NULL || colon == spec)
+        return FALSE;
+
+    //
+    //  The bus table hangs on to the port name, and spec is argv
+    char *portName = strndup( spec, colon - spec );
+    const char *p = colon + 1;
+    int ok = TRUE;
+    while (ok && *p != '\0') {
+        char    *end;
+        long    slaveID = strtol( p, &end, 10 );
+        if (end == p || *end != '=') {
+            ok = FALSE;
+            break;
+        }
+
+        p = end + 1;
+        long controllerID = strtol( p, &end, 10 );
+        if (end == p || (*end != ',' && *end != '\0')) {
+            ok = FALSE;
+            break;
+        }
+        ok = Controllers_Add( portName, (int) slaveID, (int) controllerID );
+
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    releasePortName( portName );
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+void    Controllers_SetTopics (const char *topTopic)
+{
+    for (int i = 0; i < numControllers; i += 1) {
+        controller_t *controller = &controllers[ i ];
+
+        snprintf( controller->dataTopic, sizeof controller->dataTopic, "%s/%d/%s", topTopic, controller->id, "DATA" );
+        snprintf( controller->commandTopic, sizeof controller->commandTopic, "%s/%d/%s", topTopic, controller->id, "COMMAND" );
+        snprintf( controller->ackTopic, sizeof controller->ackTopic, "%s/%d/%s", topTopic, controller->id, "ACK" );
+        snprintf( controller->settingsTopic, sizeof controller->settingsTopic, "%s/%d/%s", topTopic, controller->id, "SETTINGS" );
+        snprintf( controller->historyTopic, sizeof controller->historyTopic, "%s/%d/%s", topTopic, controller->id, "HISTORY" );
+        snprintf( controller->binaryTopic, sizeof controller->binaryTopic, "%s/%d/%s", topTopic, controller->id, "CBOR" );
+        snprintf( controller->schemaTopic, sizeof controller->schemaTopic, "%s/%d/%s", topTopic, controller->id, "SCHEMA" );
+    }
+}
+
+// -----------------------------------------------------------------------------
+int Controllers_Open (int settingsRefreshSeconds, int clockTolerance, int ringCapacity, overflowPolicy_t policy, int withStatusBits, int openPorts)
+{
+    //
+    //  openPorts is FALSE when replaying a capture - the rings, readers and
+    //  caches are all it needs
+    for (int i = 0; i < numBuses; i += 1) {
+        controllerBus_t *bus = &buses[ i ];
+
+        if (openPorts && !Bus_Open( &bus->modbus, bus->portName )) {
+            Logger_LogFatal( "Unable to open device port %s to connect to the solar charge controller(s)\n", bus->portName );
+            return FALSE;
+        }
+        if (!SampleRing_Initialize( &bus->ring, ringCapacity, policy )) {
+            Logger_LogFatal( "Unable to allocate a sample ring of %d entries\n", ringCapacity );
+            return FALSE;
+        }
+    }
+
+    for (int i = 0; i < numControllers; i += 1) {
+        controller_t *controller = &controllers[ i ];
+
+        RealTimeReader_Initialize( &controller->reader, withStatusBits );
+        SettingsCache_Initialize( &controller->settings, settingsRefreshSeconds );
+        ClockSync_Initialize( &controller->clock, &controller->device, &buses[ controller->busIndex ].scheduler, clockTolerance );
+        Logger_LogWarning( "Controller %d is slave %d on [%s]\n", controller->id, controller->device.slaveID, buses[ controller->busIndex ].portName );
+    }
+
+    //
+    //  From here on every Modbus transaction is queued through a bus scheduler
+    for (int i = 0; i < numBuses && openPorts; i += 1)
+        if (!BusScheduler_Start( &buses[ i ].scheduler, buses[ i ].portName ))
+            return FALSE;
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Controllers_OpenHistory (const char *directory, size_t bytesEach)
+{
+    //
+    //  One file per controller, named for its id so re-ordering "-C" lists
+    //  doesn't mix them up
+    for (int i = 0; i < numControllers; i += 1) {
+        char    path[ PATH_MAX ];
+
+        snprintf( path, sizeof path, "%s/history-%d.dat", directory, controllers[ i ].id );
+        if (!History_Open( &controllers[ i ].history, path, bytesEach ))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Controllers_Close (void)
+{
+    for (int i = 0; i < numControllers; i += 1)
+        History_Close( &controllers[ i ].history );
+    for (int i = 0; i < numBuses; i += 1) {
+        BusScheduler_Stop( &buses[ i ].scheduler );
+        Bus_Close( &buses[ i ].modbus );
+    }
+}
+
+// -----------------------------------------------------------------------------
+controller_t    *Controllers_FindByCommandTopic (const char *topic)
+{
+    for (int i = 0; i < numControllers; i += 1)
+        if (strcmp( controllers[ i ].commandTopic, topic ) == 0)
+            return &controllers[ i ];
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+void    Controllers_GetBusStats (busStats_t *total)
+{
+    memset( total, '\0', sizeof( busStats_t ) );
+    for (int i = 0; i < numBuses; i += 1) {
+        busStats_t  bus;
+        Bus_GetStats( &buses[ i ].modbus, &bus );
+
+        total->transactions += bus.transactions;
+        total->errors += bus.errors;
+        total->timeouts += bus.timeouts;
+        total->busyMicros += bus.busyMicros;
+        total->reconnects += bus.reconnects;
+        total->pipelined += bus.pipelined;
+        total->retries += bus.retries;
+        total->recovered += bus.recovered;
+        total->abandoned += bus.abandoned;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    Controllers_GetRingStats (sampleRingStats_t *total)
+{
+    memset( total, '\0', sizeof( sampleRingStats_t ) );
+    for (int i = 0; i < numBuses; i += 1) {
+        sampleRingStats_t   ring;
+        SampleRing_GetStats( &buses[ i ].ring, &ring );
+
+        total->pushed += ring.pushed;
+        total->popped += ring.popped;
+        total->dropped += ring.dropped;
+        if (ring.highWater > total->highWater)
+            total->highWater = ring.highWater;
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * File:   controllers.h
+ * Author: pconroy
+ *
+ * The controllers we poll and the RS485 buses they hang off. Each bus has
+ * its own Modbus context, bus scheduler and sample ring; each controller is
+ * a slave ID on one of them with its own topics and per-controller state.
+ *
+ *  -C /dev/ttyUSB0:1=1,2=2 -C /dev/ttyUSB1:1=3
+ *
+ * is two buses, slaves 1 and 2 on the first published as controllers 1 and
+ * 2, slave 1 on the second published as controller 3. A Modbus TCP gateway
+ * is a bus too: -C tcp://10.0.0.7:502?inflight=4:1=4,2=5
+ */
+
+#ifndef CONTROLLERS_H
+#define CONTROLLERS_H
+
+#include "modbusBus.h"
+#include "busScheduler.h"
+#include "sampleRing.h"
+#include "realTimeReader.h"
+#include "settingsCache.h"
+#include "clockSync.h"
+#include "history.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_BUSES                   8
+#define MAX_CONTROLLERS             64
+#define CONTROLLER_TOPIC_LENGTH     256
+
+typedef struct  controller {
+    int                 id;             // the <controllerID> in its topics
+    int                 busIndex;
+    modbusDevice_t      device;
+    responseTimer_t     timer;          // how long device waits for this controller's answers
+    realTimeReader_t    reader;
+    settingsCache_t     settings;
+    clockSync_t         clock;
+    historyStore_t      history;        // not open unless "-H"
+
+    char                dataTopic[ CONTROLLER_TOPIC_LENGTH ];
+    char                commandTopic[ CONTROLLER_TOPIC_LENGTH ];
+    char                ackTopic[ CONTROLLER_TOPIC_LENGTH ];
+    char                settingsTopic[ CONTROLLER_TOPIC_LENGTH ];
+    char                historyTopic[ CONTROLLER_TOPIC_LENGTH ];
+    char                binaryTopic[ CONTROLLER_TOPIC_LENGTH ];     // "-B" CBOR copy of DATA
+    char                schemaTopic[ CONTROLLER_TOPIC_LENGTH ];     // ...and what its keys mean
+} controller_t;
+
+typedef struct  controllerBus {
+    const char          *portName;
+    modbusBus_t         modbus;
+    busScheduler_t      scheduler;
+    sampleRing_t        ring;           // filled by this bus's acquisition worker
+    int                 numControllers;
+    int                 controllers[ MAX_CONTROLLERS ];     // indexes into the controller table
+} controllerBus_t;
+
+extern  controller_t    controllers[ MAX_CONTROLLERS ];
+extern  int             numControllers;
+extern  controllerBus_t buses[ MAX_BUSES ];
+extern  int             numBuses;
+
+extern  int     Controllers_Add( const char *portName, int slaveID, int controllerID );
+extern  int     Controllers_Parse( const char *spec );
+extern  void    Controllers_SetTopics( const char *topTopic );
+extern  int     Controllers_Open( int settingsRefreshSeconds, int clockTolerance, int ringCapacity, overflowPolicy_t policy, int withStatusBits, int openPorts );
+extern  int     Controllers_OpenHistory( const char *directory, size_t bytesEach );
+extern  void    Controllers_Close( void );
+extern  controller_t    *Controllers_FindByCommandTopic( const char *topic );
+extern  void    Controllers_GetBusStats( busStats_t *total );
+extern  void    Controllers_GetRingStats( sampleRingStats_t *total );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONTROLLERS_H */
@@ -0,0 +1,201 @@
+/*
+ * File:    deltaEncoder.c
+ * author:  patrick conroy
+ *
+ * Every keyframeInterval cycles (and on the very first one) the normal full
+ * DATA message goes out, so a late subscriber can resync. In between we send
+ *
+ *    {"topic":..,"version":"4.0","dateTime":..,"delta":true, <changed fields>}
+ *
+ * or nothing at all if no field moved. A field is compared with the value it
+ * had when it was last *published*, not last read, so a slow drift still gets
+ * reported once it adds up to the deadband. Extra ("-x") data only rides
+ * along in keyframes; the settings have their own retained topic anyway.
+ * So do the "-u" battery estimates - they only move slowly.
+ * Period aggregates ("-r") are new every time, so they are always sent.
+ *
+ * Keyframe interval and deadbands are the same for every controller; what was
+ * last published is kept per controller, in its deltaState_t.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "jsonWriter.h"
+#include "realTimeFields.h"
+#include "deltaEncoder.h"
+
+
+#define MAX_FIELDS          DELTA_MAX_FIELDS
+#define MAX_STRING_LENGTH   DELTA_MAX_STRING_LENGTH
+#define DELTA_BUFFER_SIZE   4096
+#define MAX_DECIMALS        6
+
+//
+//  Same scaling JSON_AddFixed() prints with - and no pow(), so no libm
+static  const long  powersOfTen[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+extern  const char  *realTimeDataToJSON( const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const periodAggregates_t *aggregates, const batteryAnalytics_t *battery, time_t sampleTime );
+extern  char        *getDateTime( time_t when );
+
+static  int         keyframeEvery = 0;
+static  double      deadbands[ MAX_FIELDS ];
+
+static  char        deltaBuffer[ DELTA_BUFFER_SIZE ];
+
+
+// -----------------------------------------------------------------------------
+static
+int parseDeadbands (const char *spec)
+{
+    //
+    //  "batteryVoltage=0.05,pvPower=2,batteryStatus=0"
+    char    copy[ 1024 ];
+    char    *savePtr = NULL;
+
+    snprintf( copy, sizeof copy, "%s", spec );
+    for (char *entry = strtok_r( copy, ",", &savePtr ); entry != NULL; entry = strtok_r( NULL, ",", &savePtr )) {
+        char *equals = strchr( entry, '=' );
+        if (equals == NULL) {
+            Logger_LogError( "Deadband [%s] should look like field=value\n", entry );
+            return FALSE;
+        }
+
+        *equals = '\0';
+        int index = RealTimeFields_Find( entry );
+        if (index < 0) {
+            Logger_LogError( "Deadband given for unknown field [%s]\n", entry );
+            return FALSE;
+        }
+        deadbands[ index ] = atof( equals + 1 );
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Delta_Initialize (int keyframeInterval, const char *deadbandSpec)
+{
+    keyframeEvery = (keyframeInterval > 0) ? keyframeInterval : 1;
+
+    for (int i = 0; i < numRealTimeFields && i < MAX_FIELDS; i += 1)
+        deadbands[ i ] = realTimeFields[ i ].deadband;
+
+    if (deadbandSpec != NULL && !parseDeadbands( deadbandSpec ))
+        return FALSE;
+
+    Logger_LogInfo( "Delta publishing: full message every %d cycles\n", keyframeEvery );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+double  comparableValue (const realTimeField_t *field, const epsolarRealTimeData_t *rtData)
+{
+    //
+    //  Compare what would actually be printed, so noise below the published
+    //  precision never counts as a change
+    double value = field->number( rtData );
+    if (field->kind == FIELD_FIXED) {
+        int     decimals = (field->decimals < 0) ? 0 : (field->decimals > MAX_DECIMALS) ? MAX_DECIMALS : field->decimals;
+        double  scale = (double) powersOfTen[ decimals ];
+        value = (int)((float) value * (float) scale + .5) / scale;
+    } else if (field->kind == FIELD_BOOL || field->kind == FIELD_YESNO) {
+        value = (value != 0);
+    }
+    return value;
+}
+
+// -----------------------------------------------------------------------------
+static
+int fieldChanged (const deltaState_t *state, int index, const epsolarRealTimeData_t *rtData)
+{
+    const realTimeField_t *field = &realTimeFields[ index ];
+
+    if (!state->published[ index ])
+        return TRUE;
+
+    if (field->kind == FIELD_STRING) {
+        const char *value = field->string( rtData );
+        return (value != NULL) && (strncmp( value, state->lastString[ index ], MAX_STRING_LENGTH - 1 ) != 0);
+    }
+
+    double difference = fabs( comparableValue( field, rtData ) - state->lastNumber[ index ] );
+    if (deadbands[ index ] <= 0.0)
+        return (difference > 0.0);
+
+    //
+    //  A little slack - 13.33 - 13.28 is 0.0499999.. in binary
+    return (difference >= (deadbands[ index ] - 1e-9));
+}
+
+// -----------------------------------------------------------------------------
+static
+void    rememberField (deltaState_t *state, int index, const epsolarRealTimeData_t *rtData)
+{
+    const realTimeField_t *field = &realTimeFields[ index ];
+
+    if (field->kind == FIELD_STRING) {
+        const char *value = field->string( rtData );
+        snprintf( state->lastString[ index ], MAX_STRING_LENGTH, "%s", (value != NULL ? value : "") );
+    } else {
+        state->lastNumber[ index ] = comparableValue( field, rtData );
+    }
+    state->published[ index ] = TRUE;
+}
+
+// -----------------------------------------------------------------------------
+const char  *Delta_ToJSON (deltaState_t *state, const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const periodAggregates_t *aggregates, const batteryAnalytics_t *battery, time_t sampleTime)
+{
+    if (state->cyclesSinceKeyframe == 0) {
+        const char *keyframe = realTimeDataToJSON( topic, rtData, rtRead, extraData, aggregates, battery, sampleTime );
+        if (keyframe == NULL)
+            return NULL;
+
+        for (int i = 0; i < numRealTimeFields && i < MAX_FIELDS; i += 1)
+            if (RealTimeFields_IsValid( &realTimeFields[ i ], rtData, rtRead ))
+                rememberField( state, i, rtData );
+
+        state->cyclesSinceKeyframe = (keyframeEvery > 1) ? 1 : 0;
+        return keyframe;
+    }
+
+    state->cyclesSinceKeyframe = (state->cyclesSinceKeyframe + 1) % keyframeEvery;
+
+    jsonWriter_t    writer;
+    int             numChanged = 0;
+
+    JSON_Begin( &writer, deltaBuffer, sizeof deltaBuffer );
+    JSON_AddString( &writer, "topic", topic );
+    JSON_AddString( &writer, "version", "4.0" );
+    JSON_AddString( &writer, "dateTime", getDateTime( sampleTime ) );
+    JSON_AddBool( &writer, "delta", TRUE );
+
+    for (int i = 0; i < numRealTimeFields && i < MAX_FIELDS; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ i ];
+
+        if (field->rate == RATE_KEYFRAME || !RealTimeFields_IsValid( field, rtData, rtRead ) || !fieldChanged( state, i, rtData ))
+            continue;
+
+        RealTimeFields_Write( &writer, field, rtData );
+        rememberField( state, i, rtData );
+        numChanged += 1;
+    }
+
+    if (aggregates != NULL)
+        Aggregator_Write( &writer, aggregates );
+
+    const char *message = JSON_End( &writer );
+    if (message == NULL)
+        Logger_LogError( "Delta message does not fit in %d bytes!\n", DELTA_BUFFER_SIZE );
+
+    Logger_LogDebug( "Delta: %d of %d fields changed\n", numChanged, numRealTimeFields );
+    return (numChanged > 0 || aggregates != NULL) ? message : NULL;
+}
@@ -0,0 +1,42 @@
+/*
+ * File:   deltaEncoder.h
+ * Author: pconroy
+ *
+ * Report-by-exception: between keyframes only the realtime fields that moved
+ * past their deadband since they were last published are sent.
+ */
+
+#ifndef DELTAENCODER_H
+#define DELTAENCODER_H
+
+#include <time.h>
+#include "libepsolar.h"
+#include "extraData.h"
+#include "aggregator.h"
+#include "batteryAnalytics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DELTA_MAX_FIELDS        64
+#define DELTA_MAX_STRING_LENGTH 64
+
+//
+//  What each controller last published. All zero is a fresh start
+typedef struct  deltaState {
+    int         cyclesSinceKeyframe;
+    int         published[ DELTA_MAX_FIELDS ];
+    double      lastNumber[ DELTA_MAX_FIELDS ];
+    char        lastString[ DELTA_MAX_FIELDS ][ DELTA_MAX_STRING_LENGTH ];
+} deltaState_t;
+
+extern  int         Delta_Initialize( int keyframeInterval, const char *deadbandSpec );
+extern  const char  *Delta_ToJSON( deltaState_t *state, const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const periodAggregates_t *aggregates, const batteryAnalytics_t *battery, time_t sampleTime );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DELTAENCODER_H */
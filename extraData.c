@@ -0,0 +1,47 @@
+/*
+ * File:    extraData.c
+ * author:  patrick conroy
+ *
+ * Register addresses are from the EPSolar "Tracer A/B series Modbus protocol"
+ * document. The three status words come in with the realtime block reads;
+ * everything else comes out of the settings cache, which has its own refresh
+ * schedule. So the extra data costs no bus time of its own.
+ *
+ * Like the realtime fields, a status row whose register didn't come back
+ * this cycle is left out of the messages rather than sent as zero.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "extraData.h"
+#include "realTimeFields.h"
+
+
+//
+//  Input registers
+#define REG_BATTERY_STATUS                  0x3200
+#define REG_CHARGING_EQUIPMENT_STATUS       0x3201
+#define REG_DISCHARGING_EQUIPMENT_STATUS    0x3202
+
+
+// -----------------------------------------------------------------------------
+void    ExtraData_Decode (const registerSnapshot_t *snapshot, const epsolarSettings_t *settings, epsolarExtraData_t *extraData)
+{
+    //
+    //  Registers that could not be read stay zero, same as a failed eps_get*()
+    extraData->batteryStatusBits = Snapshot_U16( snapshot, REG_INPUT, REG_BATTERY_STATUS );
+    extraData->chargingEquipmentStatusBits = Snapshot_U16( snapshot, REG_INPUT, REG_CHARGING_EQUIPMENT_STATUS );
+    extraData->dischargingEquipmentStatusBits = Snapshot_U16( snapshot, REG_INPUT, REG_DISCHARGING_EQUIPMENT_STATUS );
+    extraData->settings = *settings;
+
+    extraData->statusRead = 0;
+    for (int i = 0; i < numExtraFields; i += 1) {
+        const registerSource_t *source = &extraFields[ i ].source;
+        if (extraFields[ i ].rate == RATE_CYCLE && Snapshot_IsValid( snapshot, source->kind, source->address, source->registers ))
+            extraData->statusRead |= (fieldMask_t) 1 << i;
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ * File:   extraData.h
+ * Author: pconroy
+ *
+ * The "-x" extra data: the live status bit words, read with the realtime
+ * data every cycle, plus the ratings and charge settings from the settings
+ * cache.
+ */
+
+#ifndef EXTRADATA_H
+#define EXTRADATA_H
+
+#include <stdint.h>
+#include "registerPlanner.h"
+#include "settingsCache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  epsolarExtraData {
+    uint16_t            batteryStatusBits;
+    uint16_t            chargingEquipmentStatusBits;
+    uint16_t            dischargingEquipmentStatusBits;
+    fieldMask_t         statusRead;         // extraFields[] status rows whose register came back
+    epsolarSettings_t   settings;           // its own mask of the settings rows, from the cache
+} epsolarExtraData_t;
+
+extern  void    ExtraData_Decode( const registerSnapshot_t *snapshot, const epsolarSettings_t *settings, epsolarExtraData_t *extraData );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EXTRADATA_H */
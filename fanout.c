@@ -0,0 +1,433 @@
+/*
+ * File:    fanout.c
+ * author:  patrick conroy
+ *
+ * One mosquitto instance, one network thread (mosquitto_loop_start) and one
+ * sender thread per target. Fanout_Publish() runs on the publisher thread:
+ * it copies the message once, with a count of the targets that want it, and
+ * drops a pointer into each of their queues - it only ever holds a target's
+ * lock long enough to do that.
+ *
+ * The sender hands messages to mosquitto while the target is connected and
+ * fewer than FANOUT_INFLIGHT_WINDOW are still waiting to be written out,
+ * so the only place a backlog builds is our own queue. When that is full
+ * the oldest message goes - the same choice as the sample rings - and the
+ * last reference to a message frees it.
+ *
+ * mosquitto does the reconnecting, backing off up to 30 seconds.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "asyncLog.h"
+#include "libmqttrv.h"
+#include "libepsolar.h"
+#include "fanout.h"
+
+
+#define HOST_LENGTH             256
+
+typedef struct  fanoutMessage {
+    int             references;
+    int             retain;
+    size_t          length;
+    const char      *topic;             // both point into data[]
+    const void      *payload;
+    char            data[];
+} fanoutMessage_t;
+
+typedef struct  target {
+    char                host[ HOST_LENGTH ];
+    int                 port;
+    int                 qos;
+    int                 kinds;          // fanoutKind_t bits it takes
+    int                 capacity;
+
+    struct mosquitto    *mosq;
+    pthread_t           sender;
+    int                 started;
+
+    pthread_mutex_t     mutex;
+    pthread_cond_t      wake;
+    fanoutMessage_t     **queue;
+    int                 head;
+    int                 depth;
+    int                 inflight;
+    int                 connected;
+    int                 running;
+    fanoutStats_t       stats;
+} target_t;
+
+static  target_t    targets[ FANOUT_MAX_TARGETS ];
+static  int         numTargets = 0;
+
+
+// -----------------------------------------------------------------------------
+static
+void    release (fanoutMessage_t *message)
+{
+    if (__atomic_sub_fetch( &message->references, 1, __ATOMIC_ACQ_REL ) == 0)
+        free( message );
+}
+
+// -----------------------------------------------------------------------------
+static
+int parseOption (target_t *target, const char *key, size_t keyLength, const char *value)
+{
+    if (keyLength == 3 && strncmp( key, "qos", 3 ) == 0) {
+        if (value[ 0 ] < '0' || value[ 0 ] > '2' || (value[ 1 ] != '\0' && value[ 1 ] != '&'))
+            return FALSE;
+        target->qos = value[ 0 ] - '0';
+        return TRUE;
+    }
+
+    if (keyLength == 5 && strncmp( key, "queue", 5 ) == 0) {
+        char    *end;
+        long    n = strtol( value, &end, 10 );
+        if (end == value || (*end != '\0' && *end != '&') || n < 1 || n > FANOUT_MAX_QUEUE)
+            return FALSE;
+        target->capacity = (int) n;
+        return TRUE;
+    }
+
+    if (keyLength == 8 && strncmp( key, "encoding", 8 ) == 0) {
+        size_t  length = strcspn( value, "&" );
+        if (length == 4 && strncmp( value, "json", 4 ) == 0)
+            target->kinds = FANOUT_JSON;
+        else if (length == 4 && strncmp( value, "cbor", 4 ) == 0)
+            target->kinds = FANOUT_CBOR;
+        else if (length == 4 && strncmp( value, "both", 4 ) == 0)
+            target->kinds = FANOUT_ALL;
+        else
+            return FALSE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// -----------------------------------------------------------------------------
+int Fanout_AddTarget (const char *spec, int defaultPort)
+{
+    if (numTargets >= FANOUT_MAX_TARGETS) {
+        Logger_LogFatal( "No more than %d extra brokers\n", FANOUT_MAX_TARGETS );
+        return FALSE;
+    }
+
+    target_t    *target = &targets[ numTargets ];
+    memset( target, '\0', sizeof( target_t ) );
+    pthread_mutex_init( &target->mutex, NULL );
+    pthread_cond_init( &target->wake, NULL );
+    target->port = defaultPort;
+    target->kinds = FANOUT_JSON;
+    target->capacity = FANOUT_DEFAULT_QUEUE;
+
+    //
+    //  host[:port]
+    size_t  hostLength = strcspn( spec, "?" );
+    const char *colon = memchr( spec, ':', hostLength );
+    size_t  nameLength = (colon != NULL) ? (size_t) (colon - spec) : hostLength;
+    if (nameLength == 0 || nameLength >= HOST_LENGTH) {
+        Logger_LogFatal( "Bad broker [%s]\n", spec );
+        return FALSE;
+    }
+    memcpy( target->host, spec, nameLength );
+    target->host[ nameLength ] = '\0';
+    if (colon != NULL) {
+        char    *end;
+        long    port = strtol( colon + 1, &end, 10 );
+        if (end != spec + hostLength || port <= 0 || port > 65535) {
+            Logger_LogFatal( "Bad port in broker [%s]\n", spec );
+            return FALSE;
+        }
+        target->port = (int) port;
+    }
+
+    //
+    //  [?key=value&...]
+    const char *option = spec + hostLength;
+    while (*option != '\0') {
+        option += 1;
+        const char *equals = strchr( option, '=' );
+        size_t  optionLength = strcspn( option, "&" );
+        if (equals == NULL || (size_t) (equals - option) >= optionLength ||
+            !parseOption( target, option, (size_t) (equals - option), equals + 1 )) {
+            Logger_LogFatal( "Bad option [%.*s] in broker [%s]\n", (int) optionLength, option, spec );
+            return FALSE;
+        }
+        option += optionLength;
+    }
+
+    snprintf( target->stats.host, sizeof target->stats.host, "%s", target->host );
+    target->stats.port = target->port;
+    numTargets += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Fanout_NumTargets (void)
+{
+    return numTargets;
+}
+
+// -----------------------------------------------------------------------------
+int Fanout_Wants (fanoutKind_t kind)
+{
+    for (int i = 0; i < numTargets; i += 1)
+        if (targets[ i ].kinds & kind)
+            return TRUE;
+    return FALSE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    onConnect (struct mosquitto *mosq, void *obj, int rc)
+{
+    target_t    *target = obj;
+
+    (void) mosq;
+    if (rc != 0) {
+        Logger_LogWarning( "Broker [%s:%d] refused the connection: %d\n", target->host, target->port, rc );
+        return;
+    }
+
+    pthread_mutex_lock( &target->mutex );
+    target->connected = TRUE;
+    target->inflight = 0;                   // what was waiting went with the old socket
+    target->stats.connects += 1;
+    int queued = target->depth;
+    pthread_cond_signal( &target->wake );
+    pthread_mutex_unlock( &target->mutex );
+    Logger_LogWarning( "Connected to broker [%s:%d], %d messages queued\n", target->host, target->port, queued );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    onDisconnect (struct mosquitto *mosq, void *obj, int rc)
+{
+    target_t    *target = obj;
+
+    (void) mosq;
+    pthread_mutex_lock( &target->mutex );
+    int wasConnected = target->connected;
+    target->connected = FALSE;
+    pthread_mutex_unlock( &target->mutex );
+
+    if (wasConnected && target->running)
+        Logger_LogWarning( "Lost broker [%s:%d]: %s - queueing up to %d messages\n", target->host, target->port,
+                            mosquitto_strerror( rc ), target->capacity );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    onPublish (struct mosquitto *mosq, void *obj, int mid)
+{
+    target_t    *target = obj;
+
+    (void) mosq;
+    (void) mid;
+    pthread_mutex_lock( &target->mutex );
+    if (target->inflight > 0)
+        target->inflight -= 1;
+    pthread_cond_signal( &target->wake );
+    pthread_mutex_unlock( &target->mutex );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *senderLoop (void *arg)
+{
+    target_t    *target = arg;
+
+    pthread_mutex_lock( &target->mutex );
+    while (target->running) {
+        if (target->depth == 0 || !target->connected || target->inflight >= FANOUT_INFLIGHT_WINDOW) {
+            pthread_cond_wait( &target->wake, &target->mutex );
+            continue;
+        }
+
+        //
+        //  Off the queue while it's with mosquitto, so Fanout_Publish() can't
+        //  trim it out from under us
+        fanoutMessage_t *message = target->queue[ target->head ];
+        target->head = (target->head + 1) % target->capacity;
+        target->depth -= 1;
+        target->inflight += 1;
+        pthread_mutex_unlock( &target->mutex );
+
+        int rc = mosquitto_publish( target->mosq, NULL, message->topic, (int) message->length, message->payload, target->qos, message->retain );
+
+        pthread_mutex_lock( &target->mutex );
+        if (rc == MOSQ_ERR_SUCCESS) {
+            target->stats.published += 1;
+            release( message );
+            continue;
+        }
+
+        target->inflight -= 1;
+        target->stats.failures += 1;
+        if (rc != MOSQ_ERR_NO_CONN && rc != MOSQ_ERR_CONN_LOST) {
+            //
+            //  Something about this message - the next one may be fine
+            Logger_LogWarning( "Publish to [%s] on [%s:%d] failed: %s\n", message->topic, target->host, target->port, mosquitto_strerror( rc ) );
+            release( message );
+            continue;
+        }
+
+        //
+        //  Back to the front for when we're reconnected, unless newer ones
+        //  have filled the queue in the meantime
+        target->connected = FALSE;
+        if (target->depth < target->capacity) {
+            target->head = (target->head + target->capacity - 1) % target->capacity;
+            target->queue[ target->head ] = message;
+            target->depth += 1;
+        } else {
+            target->stats.dropped += 1;
+            release( message );
+        }
+    }
+    pthread_mutex_unlock( &target->mutex );
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int Fanout_Start (void)
+{
+    if (numTargets == 0)
+        return TRUE;
+
+    mosquitto_lib_init();
+    for (int i = 0; i < numTargets; i += 1) {
+        target_t    *target = &targets[ i ];
+
+        target->queue = calloc( target->capacity, sizeof( fanoutMessage_t * ) );
+        target->mosq = mosquitto_new( NULL, true, target );
+        if (target->queue == NULL || target->mosq == NULL) {
+            Logger_LogFatal( "Unable to set up broker [%s:%d]\n", target->host, target->port );
+            return FALSE;
+        }
+        mosquitto_connect_callback_set( target->mosq, onConnect );
+        mosquitto_disconnect_callback_set( target->mosq, onDisconnect );
+        mosquitto_publish_callback_set( target->mosq, onPublish );
+        mosquitto_reconnect_delay_set( target->mosq, 1, 30, true );
+
+        //
+        //  Not there yet is fine - the network thread keeps trying, and
+        //  messages queue up meanwhile
+        int rc = mosquitto_connect_async( target->mosq, target->host, target->port, FANOUT_KEEPALIVE_SECONDS );
+        if (rc != MOSQ_ERR_SUCCESS)
+            Logger_LogWarning( "Broker [%s:%d] not reachable yet: %s\n", target->host, target->port, mosquitto_strerror( rc ) );
+        if (mosquitto_loop_start( target->mosq ) != MOSQ_ERR_SUCCESS) {
+            Logger_LogFatal( "Unable to start the network thread for broker [%s:%d]\n", target->host, target->port );
+            return FALSE;
+        }
+
+        target->running = TRUE;
+        if (pthread_create( &target->sender, NULL, senderLoop, target )) {
+            Logger_LogFatal( "Unable to start the sender thread for broker [%s:%d]\n", target->host, target->port );
+            target->running = FALSE;
+            return FALSE;
+        }
+        target->started = TRUE;
+
+        Logger_LogWarning( "Also publishing %s to broker [%s:%d], QoS %d, queueing up to %d messages\n",
+                            (target->kinds == FANOUT_ALL ? "JSON and CBOR" : (target->kinds == FANOUT_CBOR ? "CBOR" : "JSON")),
+                            target->host, target->port, target->qos, target->capacity );
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Fanout_Publish (fanoutKind_t kind, const char *topic, const void *payload, size_t length, int retain)
+{
+    int interested = 0;
+
+    for (int i = 0; i < numTargets; i += 1)
+        if (targets[ i ].started && (targets[ i ].kinds & kind))
+            interested += 1;
+    if (interested == 0)
+        return;
+
+    //
+    //  The one copy every target shares
+    size_t          topicLength = strlen( topic ) + 1;
+    fanoutMessage_t *message = malloc( sizeof( fanoutMessage_t ) + topicLength + length );
+    if (message == NULL)
+        return;
+    message->references = interested;
+    message->retain = retain;
+    message->length = length;
+    memcpy( message->data, topic, topicLength );
+    memcpy( message->data + topicLength, payload, length );
+    message->topic = message->data;
+    message->payload = message->data + topicLength;
+
+    for (int i = 0; i < numTargets; i += 1) {
+        target_t    *target = &targets[ i ];
+        if (!target->started || !(target->kinds & kind))
+            continue;
+
+        pthread_mutex_lock( &target->mutex );
+        if (target->depth == target->capacity) {
+            release( target->queue[ target->head ] );
+            target->head = (target->head + 1) % target->capacity;
+            target->depth -= 1;
+            target->stats.dropped += 1;
+        }
+        target->queue[ (target->head + target->depth) % target->capacity ] = message;
+        target->depth += 1;
+        target->stats.queued += 1;
+        if ((unsigned long) target->depth > target->stats.highWater)
+            target->stats.highWater = target->depth;
+        pthread_cond_signal( &target->wake );
+        pthread_mutex_unlock( &target->mutex );
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    Fanout_Stop (void)
+{
+    for (int i = 0; i < numTargets; i += 1) {
+        target_t    *target = &targets[ i ];
+        if (!target->started)
+            continue;
+
+        pthread_mutex_lock( &target->mutex );
+        target->running = FALSE;
+        pthread_cond_signal( &target->wake );
+        pthread_mutex_unlock( &target->mutex );
+        pthread_join( target->sender, NULL );
+
+        mosquitto_disconnect( target->mosq );
+        mosquitto_loop_stop( target->mosq, false );
+        mosquitto_destroy( target->mosq );
+        target->mosq = NULL;
+
+        if (target->depth > 0)
+            Logger_LogWarning( "Broker [%s:%d]: %d queued messages never went out\n", target->host, target->port, target->depth );
+        for (; target->depth > 0; target->depth -= 1) {
+            release( target->queue[ target->head ] );
+            target->head = (target->head + 1) % target->capacity;
+        }
+        free( target->queue );
+        target->queue = NULL;
+        target->started = FALSE;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    Fanout_GetStats (int index, fanoutStats_t *out)
+{
+    target_t    *target = &targets[ index ];
+
+    pthread_mutex_lock( &target->mutex );
+    *out = target->stats;
+    out->connected = target->connected;
+    pthread_mutex_unlock( &target->mutex );
+}
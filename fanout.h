@@ -0,0 +1,64 @@
+/*
+ * File:   fanout.h
+ * Author: pconroy
+ *
+ * Extra brokers the same messages go to - a remote aggregation broker
+ * alongside the local one, without a bridge. Each "-h" after the first is a
+ * target with its own connection, QoS, payload encoding and bounded queue:
+ *
+ *      host[:port][?qos=N&encoding=json|cbor|both&queue=N]
+ *
+ * A message is copied once into a reference counted buffer that every
+ * target's queue points at. Each target has its own thread, so one that is
+ * slow or down only fills (then trims) its own queue - the publisher and
+ * the first broker never wait for it.
+ */
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include "cborPayload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FANOUT_MAX_TARGETS          4
+#define FANOUT_DEFAULT_QUEUE        256     // messages per target
+#define FANOUT_MAX_QUEUE            65536
+#define FANOUT_INFLIGHT_WINDOW      16      // handed to mosquitto but not yet written out
+#define FANOUT_KEEPALIVE_SECONDS    60
+
+typedef enum {
+    FANOUT_JSON = 1,                    // DATA
+    FANOUT_CBOR = 2,                    // CBOR, SCHEMA
+    FANOUT_ALL  = 3                     // SETTINGS - whatever the target's encoding
+} fanoutKind_t;
+
+typedef struct  fanoutStats {
+    char            host[ 256 ];
+    int             port;
+    int             connected;
+    unsigned long   queued;
+    unsigned long   published;
+    unsigned long   dropped;            // the queue was full, oldest went
+    unsigned long   failures;
+    unsigned long   connects;
+    unsigned long   highWater;
+} fanoutStats_t;
+
+extern  int     Fanout_AddTarget( const char *spec, int defaultPort );
+extern  int     Fanout_NumTargets( void );
+extern  int     Fanout_Wants( fanoutKind_t kind );
+extern  int     Fanout_Start( void );
+extern  void    Fanout_Publish( fanoutKind_t kind, const char *topic, const void *payload, size_t length, int retain );
+extern  void    Fanout_Stop( void );
+extern  void    Fanout_GetStats( int target, fanoutStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FANOUT_H */
@@ -0,0 +1,214 @@
+/*
+ * File:    fieldGroups.c
+ * author:  patrick conroy
+ *
+ * A group is given on the command line as
+ *
+ *      -g name:seconds[:retain][:split]=key,key,prefix*,...
+ *
+ * e.g. -g fast:1=pvPower,batteryCurrent,batteryVoltage
+ *      -g energy:300:retain=energy*
+ *      -g settings:3600:retain=batteryType,batteryCapacity,...
+ *
+ * Keys can come from either field table; a trailing '*' takes every key
+ * that starts with what comes before it. Extra ("-x") fields only show up
+ * when "-x" is on - they aren't read otherwise.
+ *
+ * Groups don't change what is read off the controller or how often - the
+ * publisher sends each one from the latest sample once its interval is up.
+ * The full DATA message still goes out as before for the existing
+ * subscribers.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "jsonWriter.h"
+#include "realTimeFields.h"
+#include "timeUtils.h"
+#include "fieldGroups.h"
+
+
+extern char    *getDateTime( time_t when );
+
+#define GROUP_BUFFER_SIZE       4096
+#define VALUE_BUFFER_SIZE       128
+
+fieldGroup_t    fieldGroups[ MAX_FIELD_GROUPS ];
+int             numFieldGroups = 0;
+
+static  char    groupBuffer[ GROUP_BUFFER_SIZE ];
+static  char    valueBuffer[ VALUE_BUFFER_SIZE ];
+
+
+// -----------------------------------------------------------------------------
+static
+int keyMatches (const char *key, const char *pattern)
+{
+    size_t length = strlen( pattern );
+    if (length > 0 && pattern[ length - 1 ] == '*')
+        return strncmp( key, pattern, length - 1 ) == 0;
+    return strcmp( key, pattern ) == 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    addField (fieldGroup_t *group, int16_t field)
+{
+    for (int i = 0; i < group->numFields; i += 1)
+        if (group->fields[ i ] == field)
+            return;
+
+    if (group->numFields < FIELD_GROUP_MAX_FIELDS)
+        group->fields[ group->numFields++ ] = field;
+}
+
+// -----------------------------------------------------------------------------
+static
+int addFields (fieldGroup_t *group, char *list)
+{
+    char    *savePtr = NULL;
+    int     ok = TRUE;
+
+    for (char *pattern = strtok_r( list, ",", &savePtr ); pattern != NULL; pattern = strtok_r( NULL, ",", &savePtr )) {
+        int found = FALSE;
+        for (int i = 0; i < numRealTimeFields; i += 1)
+            if (keyMatches( realTimeFields[ i ].key, pattern )) {
+                addField( group, i );
+                found = TRUE;
+            }
+        for (int i = 0; i < numExtraFields; i += 1)
+            if (keyMatches( extraFields[ i ].key, pattern )) {
+                addField( group, -1 - i );
+                found = TRUE;
+            }
+        if (!found) {
+            Logger_LogError( "Field group [%s]: unknown field [%s]\n", group->name, pattern );
+            ok = FALSE;
+        }
+    }
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+int FieldGroups_Parse (const char *spec)
+{
+    char    copy[ 1024 ];
+    char    *savePtr = NULL;
+
+    if (numFieldGroups >= MAX_FIELD_GROUPS) {
+        Logger_LogFatal( "No more than %d field groups\n", MAX_FIELD_GROUPS );
+        return FALSE;
+    }
+
+    snprintf( copy, sizeof copy, "%s", spec );
+    char *list = strchr( copy, '=' );
+    if (list == NULL) {
+        Logger_LogFatal( "Field group [%s] - expecting name:seconds[:retain][:split]=key,key,...\n", spec );
+        return FALSE;
+    }
+    *list++ = '\0';
+
+    fieldGroup_t *group = &fieldGroups[ numFieldGroups ];
+    memset( group, '\0', sizeof( fieldGroup_t ) );
+
+    char *name = strtok_r( copy, ":", &savePtr );
+    char *seconds = strtok_r( NULL, ":", &savePtr );
+    double interval = (seconds != NULL) ? atof( seconds ) : 0.0;
+    if (name == NULL || strlen( name ) >= FIELD_GROUP_NAME_LENGTH || strpbrk( name, "/+#" ) != NULL || interval <= 0.0) {
+        Logger_LogFatal( "Field group [%s] needs a name (no '/', '+' or '#') and an interval in seconds\n", spec );
+        return FALSE;
+    }
+    snprintf( group->name, sizeof group->name, "%s", name );
+    group->intervalNanos = (uint64_t) (interval * NANOS_PER_SECOND);
+
+    for (char *flag = strtok_r( NULL, ":", &savePtr ); flag != NULL; flag = strtok_r( NULL, ":", &savePtr )) {
+        if (strcmp( flag, "retain" ) == 0)
+            group->retain = TRUE;
+        else if (strcmp( flag, "split" ) == 0)
+            group->perField = TRUE;
+        else {
+            Logger_LogFatal( "Field group [%s]: unknown flag [%s]\n", group->name, flag );
+            return FALSE;
+        }
+    }
+
+    for (int i = 0; i < numFieldGroups; i += 1)
+        if (strcmp( fieldGroups[ i ].name, group->name ) == 0) {
+            Logger_LogFatal( "Field group [%s] given twice\n", group->name );
+            return FALSE;
+        }
+
+    if (!addFields( group, list ) || group->numFields == 0)
+        return FALSE;
+
+    Logger_LogInfo( "Field group [%s]: %d fields every %.1f seconds%s%s\n",
+                    group->name, group->numFields, interval,
+                    (group->retain ? ", retained" : ""), (group->perField ? ", one topic per field" : "") );
+    numFieldGroups += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int writeField (jsonWriter_t *writer, int16_t field, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const char **key)
+{
+    //
+    //  FALSE if there's nothing to send for it this time - masked off, not
+    //  read, out of range, or a "-x" field without "-x"
+    if (field >= 0) {
+        const realTimeField_t *realTime = &realTimeFields[ field ];
+        if (!RealTimeFields_IsValid( realTime, rtData, rtRead ))
+            return FALSE;
+        *key = realTime->key;
+        RealTimeFields_Write( writer, realTime, rtData );
+        return TRUE;
+    }
+
+    const extraField_t *extra = &extraFields[ -1 - field ];
+    if (extraData == NULL || !ExtraFields_IsValid( extra, extraData ))
+        return FALSE;
+    *key = extra->key;
+    ExtraFields_Write( writer, extra, extraData );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+const char  *FieldGroups_ToJSON (const fieldGroup_t *group, const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, time_t sampleTime)
+{
+    jsonWriter_t    writer;
+    const char      *key;
+    int             written = 0;
+
+    JSON_Begin( &writer, groupBuffer, sizeof groupBuffer );
+    JSON_AddString( &writer, "topic", topic );
+    JSON_AddString( &writer, "version", "4.0" );
+    JSON_AddString( &writer, "dateTime", getDateTime( sampleTime ) );
+    JSON_AddString( &writer, "group", group->name );
+
+    for (int i = 0; i < group->numFields; i += 1)
+        written += writeField( &writer, group->fields[ i ], rtData, rtRead, extraData, &key );
+
+    const char *message = JSON_End( &writer );
+    if (message == NULL)
+        Logger_LogError( "Field group [%s] does not fit in %d bytes!\n", group->name, GROUP_BUFFER_SIZE );
+
+    return (written > 0) ? message : NULL;
+}
+
+// -----------------------------------------------------------------------------
+const char  *FieldGroups_FieldValue (const fieldGroup_t *group, int index, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const char **key)
+{
+    //
+    //  Just the value - 13.28, true, "Float" - for the per-field topics
+    jsonWriter_t    writer;
+
+    JSON_BeginValue( &writer, valueBuffer, sizeof valueBuffer );
+    if (!writeField( &writer, group->fields[ index ], rtData, rtRead, extraData, key ))
+        return NULL;
+    return JSON_End( &writer );
+}
@@ -0,0 +1,50 @@
+/*
+ * File:   fieldGroups.h
+ * Author: pconroy
+ *
+ * "-g" field groups. A group is a named handful of fields with its own
+ * publish interval and its own topic under the controller's DATA topic, so
+ * pvPower can go out every second on SCC/1/DATA/fast while the energy
+ * totals go out every few minutes on SCC/1/DATA/energy. A group can be
+ * retained, and can also fan every field out to a topic of its own
+ * (SCC/1/DATA/fast/pvPower) carrying just the bare value.
+ */
+
+#ifndef FIELDGROUPS_H
+#define FIELDGROUPS_H
+
+#include <stdint.h>
+#include <time.h>
+#include "libepsolar.h"
+#include "extraData.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_FIELD_GROUPS            8
+#define FIELD_GROUP_MAX_FIELDS      64
+#define FIELD_GROUP_NAME_LENGTH     32
+
+typedef struct  fieldGroup {
+    char        name[ FIELD_GROUP_NAME_LENGTH ];
+    uint64_t    intervalNanos;
+    int         retain;
+    int         perField;                       // also one topic per field
+    int         numFields;
+    int16_t     fields[ FIELD_GROUP_MAX_FIELDS ];   // >= 0 realTimeFields[], < 0 extraFields[ -1 - n ]
+} fieldGroup_t;
+
+extern  fieldGroup_t    fieldGroups[];
+extern  int             numFieldGroups;
+
+extern  int         FieldGroups_Parse( const char *spec );
+extern  const char  *FieldGroups_ToJSON( const fieldGroup_t *group, const char *topic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, time_t sampleTime );
+extern  const char  *FieldGroups_FieldValue( const fieldGroup_t *group, int index, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const char **key );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIELDGROUPS_H */
@@ -0,0 +1,120 @@
+/*
+ * File:    histogram.c
+ * author:  patrick conroy
+ *
+ * Values are kept in microseconds. Below 2 * HISTOGRAM_SUB_BUCKETS every
+ * value has its own bucket; above that, bucket k covers one power of two
+ * split into HISTOGRAM_SUB_BUCKETS equal slices.
+ *
+ * A histogram may have more than one writer - with several "-C" buses every
+ * acquisition thread records the Modbus read and clock sync stages. Counts
+ * are bumped with relaxed atomic adds and the max is raised with a compare
+ * and swap, so no record is lost and another thread can take a snapshot at
+ * any time; a snapshot may be a record or two out of step, which is fine for
+ * metrics.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+
+// -----------------------------------------------------------------------------
+static
+int bucketIndex (uint64_t value)
+{
+    if (value < (2 * HISTOGRAM_SUB_BUCKETS))
+        return (int) value;
+
+    int magnitude = 63 - __builtin_clzll( value );
+    int shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS;
+    int index = ((shift + 1) * HISTOGRAM_SUB_BUCKETS) + (int) ((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+
+    return (index < HISTOGRAM_BUCKETS) ? index : HISTOGRAM_BUCKETS - 1;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    bucketUpperBound (int index)
+{
+    int     magnitude = index / HISTOGRAM_SUB_BUCKETS;
+    int     subBucket = index % HISTOGRAM_SUB_BUCKETS;
+
+    if (magnitude <= 1)
+        return (uint64_t) index;
+
+    int shift = magnitude - 1;
+    return (((uint64_t) (HISTOGRAM_SUB_BUCKETS + subBucket + 1)) << shift) - 1;
+}
+
+// -----------------------------------------------------------------------------
+void    Histogram_Reset (histogram_t *histogram)
+{
+    memset( histogram, '\0', sizeof( histogram_t ) );
+}
+
+// -----------------------------------------------------------------------------
+void    Histogram_Record (histogram_t *histogram, uint64_t nanos)
+{
+    uint64_t    micros = nanos / 1000;
+
+    __atomic_fetch_add( &histogram->buckets[ bucketIndex( micros ) ], 1, __ATOMIC_RELAXED );
+    __atomic_fetch_add( &histogram->sumMicros, micros, __ATOMIC_RELAXED );
+
+    //
+    //  A failed swap hands back the max someone else just set - keep going
+    //  only while ours is still bigger
+    uint64_t    max = __atomic_load_n( &histogram->maxMicros, __ATOMIC_RELAXED );
+    while (micros > max && !__atomic_compare_exchange_n( &histogram->maxMicros, &max, micros, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ))
+        ;
+    __atomic_fetch_add( &histogram->count, 1, __ATOMIC_RELAXED );
+}
+
+// -----------------------------------------------------------------------------
+void    Histogram_Subtract (histogram_t *result, const histogram_t *later, const histogram_t *earlier)
+{
+    //
+    //  What was recorded between two snapshots. The max can't be recovered,
+    //  so it is worked out again from the top non-empty bucket
+    result->count = later->count - earlier->count;
+    result->sumMicros = later->sumMicros - earlier->sumMicros;
+    result->maxMicros = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i += 1) {
+        result->buckets[ i ] = later->buckets[ i ] - earlier->buckets[ i ];
+        if (result->buckets[ i ] > 0)
+            result->maxMicros = bucketUpperBound( i );
+    }
+    if (result->maxMicros > later->maxMicros)
+        result->maxMicros = later->maxMicros;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    Histogram_PercentileMicros (const histogram_t *histogram, double percentile)
+{
+    if (histogram->count == 0)
+        return 0;
+
+    uint64_t    target = (uint64_t) ((percentile / 100.0) * histogram->count + 0.5);
+    uint64_t    seen = 0;
+
+    if (target < 1)
+        target = 1;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i += 1) {
+        seen += histogram->buckets[ i ];
+        if (seen >= target) {
+            uint64_t value = bucketUpperBound( i );
+            return (value < histogram->maxMicros) ? value : histogram->maxMicros;
+        }
+    }
+
+    return histogram->maxMicros;
+}
+
+// -----------------------------------------------------------------------------
+double  Histogram_MeanMicros (const histogram_t *histogram)
+{
+    return (histogram->count > 0) ? (double) histogram->sumMicros / histogram->count : 0.0;
+}
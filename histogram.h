@@ -0,0 +1,42 @@
+/*
+ * File:   histogram.h
+ * Author: pconroy
+ *
+ * Log-linear latency histogram in the HDR style: 32 linear sub-buckets per
+ * power of two, so any value is recorded to within about 3%, with a fixed
+ * footprint and an O(1) record that is just an increment.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTOGRAM_SUB_BUCKET_BITS   5
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAGNITUDES        28      // microseconds: up to 2^32, a bit over an hour
+#define HISTOGRAM_BUCKETS           (HISTOGRAM_MAGNITUDES * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct  histogram {
+    uint64_t    count;
+    uint64_t    sumMicros;
+    uint64_t    maxMicros;
+    uint64_t    buckets[ HISTOGRAM_BUCKETS ];
+} histogram_t;
+
+extern  void        Histogram_Reset( histogram_t *histogram );
+extern  void        Histogram_Record( histogram_t *histogram, uint64_t nanos );
+extern  void        Histogram_Subtract( histogram_t *result, const histogram_t *later, const histogram_t *earlier );
+extern  uint64_t    Histogram_PercentileMicros( const histogram_t *histogram, double percentile );
+extern  double      Histogram_MeanMicros( const histogram_t *histogram );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTOGRAM_H */
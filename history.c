@@ -0,0 +1,562 @@
+/*
+ * File:    history.c
+ * author:  patrick conroy
+ *
+ * One file per controller, mmap()ed and never grown:
+ *
+ *      header      magic, block size, block count, next sequence, field list
+ *      block 0     sequence, first / last time, sample count, bits used, data
+ *      block 1     ...
+ *
+ * Blocks are filled in sequence order and sequence N lives in block
+ * (N - 1) % count, so once the file is full the oldest block is the one that
+ * gets reused. Nothing else tracks where the data is - the sequence numbers
+ * in the block headers are the truth, which is what makes a restart (or a
+ * crash) cheap: carry on with a fresh block and the old ones are still good.
+ *
+ * Inside a block it is the Gorilla scheme from Facebook's paper. The first
+ * sample is written out in full. After that each timestamp is the change in
+ * the change from the one before - almost always 0 at a steady poll rate, so
+ * one bit - and each value is XOR'd with the same field's previous value:
+ * one bit if it didn't move, otherwise just the bits that differ, reusing the
+ * last leading / trailing zero counts when they still cover them. The header
+ * count is bumped after a sample's bits are in, so a reader (or a torn write)
+ * never sees half a sample.
+ *
+ * Every numeric field in the realtime field table is kept. libepsolar hands
+ * them to us as floats - most are a register divided by 100 - so they are
+ * stored as floats, which halves the XOR windows against doing it with
+ * doubles. Ones whose registers weren't read, or that fail their range
+ * check, are stored as NaN. Timestamps are wall clock seconds, the same as
+ * the DATA message's "dateTime".
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "realTimeFields.h"
+#include "history.h"
+
+
+#define HISTORY_MAGIC           0x31485045          // "EPH1"
+#define MIN_BLOCKS              4
+
+typedef struct  historyHeader {
+    uint32_t    magic;
+    uint32_t    blockSize;
+    uint32_t    numBlocks;          // after the header block
+    uint32_t    numFields;
+    uint64_t    nextSequence;       // the next block to be started gets this
+    char        schema[ HISTORY_BLOCK_SIZE - 24 ];  // the field keys, comma separated
+} historyHeader_t;
+
+typedef struct  blockHeader {
+    uint64_t    sequence;           // 0 - never written
+    int64_t     firstTime;
+    int64_t     lastTime;
+    uint32_t    count;              // samples - only bumped once all of a sample's bits are in
+    uint32_t    bits;
+} blockHeader_t;
+
+#define BLOCK_DATA_BYTES        (HISTORY_BLOCK_SIZE - sizeof( blockHeader_t ))
+#define BLOCK_DATA_BITS         (BLOCK_DATA_BYTES * 8)
+
+//
+//  Worst case for one sample after the first: a 68 bit timestamp and 44 bits
+//  a value. A block is closed when another one of those might not fit
+#define MAX_SAMPLE_BITS(n)      (68 + ((n) * 44))
+
+static  pthread_once_t  fieldsOnce = PTHREAD_ONCE_INIT;
+static  int             fieldMap[ HISTORY_MAX_FIELDS ];     // history field -> realTimeFields[] index
+static  int             numFields = 0;
+static  char            schema[ sizeof( ((historyHeader_t *) 0)->schema ) ];
+
+
+// -----------------------------------------------------------------------------
+static
+void    buildFields (void)
+{
+    size_t  used = 0;
+
+    for (int i = 0; i < numRealTimeFields && numFields < HISTORY_MAX_FIELDS; i += 1) {
+        if (realTimeFields[ i ].number == NULL)
+            continue;
+
+        fieldMap[ numFields++ ] = i;
+        used += snprintf( &schema[ used ], sizeof schema - used, "%s%s", (used > 0 ? "," : ""), realTimeFields[ i ].key );
+        if (used >= sizeof schema)
+            used = sizeof schema - 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+int History_NumFields (void)
+{
+    pthread_once( &fieldsOnce, buildFields );
+    return numFields;
+}
+
+// -----------------------------------------------------------------------------
+const char  *History_FieldName (int field)
+{
+    pthread_once( &fieldsOnce, buildFields );
+    return (field >= 0 && field < numFields) ? realTimeFields[ fieldMap[ field ] ].key : NULL;
+}
+
+// -----------------------------------------------------------------------------
+int History_FieldDecimals (int field)
+{
+    //
+    //  What the DATA message would round it to
+    pthread_once( &fieldsOnce, buildFields );
+    if (field < 0 || field >= numFields || realTimeFields[ fieldMap[ field ] ].kind != FIELD_FIXED)
+        return 0;
+    return realTimeFields[ fieldMap[ field ] ].decimals;
+}
+
+// -----------------------------------------------------------------------------
+int History_FindField (const char *key)
+{
+    pthread_once( &fieldsOnce, buildFields );
+    for (int i = 0; i < numFields; i += 1)
+        if (strcmp( realTimeFields[ fieldMap[ i ] ].key, key ) == 0)
+            return i;
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putBits (uint8_t *data, uint32_t *position, uint64_t value, int count)
+{
+    //
+    //  Most significant bit first. The block was zeroed when it was started
+    while (count > 0) {
+        int free = 8 - (*position & 7);
+        int take = (count < free) ? count : free;
+        uint8_t bits = (value >> (count - take)) & ((1u << take) - 1);
+
+        data[ *position >> 3 ] |= bits << (free - take);
+        *position += take;
+        count -= take;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    getBits (const uint8_t *data, uint32_t *position, int count)
+{
+    uint64_t    value = 0;
+
+    while (count > 0) {
+        int available = 8 - (*position & 7);
+        int take = (count < available) ? count : available;
+        uint8_t bits = (data[ *position >> 3 ] >> (available - take)) & ((1u << take) - 1);
+
+        value = (value << take) | bits;
+        *position += take;
+        count -= take;
+    }
+    return value;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    floatBits (float value)
+{
+    uint32_t    bits;
+    memcpy( &bits, &value, sizeof bits );
+    return bits;
+}
+
+// -----------------------------------------------------------------------------
+static
+float   bitsFloat (uint32_t bits)
+{
+    float   value;
+    memcpy( &value, &bits, sizeof value );
+    return value;
+}
+
+// -----------------------------------------------------------------------------
+static
+historyHeader_t *fileHeader (const historyStore_t *store)
+{
+    return (historyHeader_t *) store->base;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint8_t *blockFor (const historyStore_t *store, uint64_t sequence)
+{
+    return store->base + ((size_t) (1 + ((sequence - 1) % fileHeader( store )->numBlocks)) * HISTORY_BLOCK_SIZE);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putTimestamp (uint8_t *data, uint32_t *position, int64_t deltaOfDelta)
+{
+    if (deltaOfDelta == 0)
+        putBits( data, position, 0x0, 1 );
+    else if (deltaOfDelta >= -63 && deltaOfDelta <= 64) {
+        putBits( data, position, 0x2, 2 );
+        putBits( data, position, (uint64_t) (deltaOfDelta + 63), 7 );
+    } else if (deltaOfDelta >= -255 && deltaOfDelta <= 256) {
+        putBits( data, position, 0x6, 3 );
+        putBits( data, position, (uint64_t) (deltaOfDelta + 255), 9 );
+    } else if (deltaOfDelta >= -2047 && deltaOfDelta <= 2048) {
+        putBits( data, position, 0xE, 4 );
+        putBits( data, position, (uint64_t) (deltaOfDelta + 2047), 12 );
+    } else {
+        putBits( data, position, 0xF, 4 );
+        putBits( data, position, (uint64_t) deltaOfDelta, 64 );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int64_t getTimestamp (const uint8_t *data, uint32_t *position)
+{
+    if (getBits( data, position, 1 ) == 0)
+        return 0;
+    if (getBits( data, position, 1 ) == 0)
+        return (int64_t) getBits( data, position, 7 ) - 63;
+    if (getBits( data, position, 1 ) == 0)
+        return (int64_t) getBits( data, position, 9 ) - 255;
+    if (getBits( data, position, 1 ) == 0)
+        return (int64_t) getBits( data, position, 12 ) - 2047;
+    return (int64_t) getBits( data, position, 64 );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    putValue (uint8_t *data, uint32_t *position, uint32_t value, uint32_t *previous, uint8_t *leading, uint8_t *trailing)
+{
+    uint32_t    xor = value ^ *previous;
+
+    *previous = value;
+    if (xor == 0) {
+        putBits( data, position, 0x0, 1 );
+        return;
+    }
+
+    int lead = __builtin_clz( xor );
+    int trail = __builtin_ctz( xor );
+
+    //
+    //  Still inside the last window? Then only the window goes out
+    if (*leading != 0xFF && lead >= *leading && trail >= *trailing) {
+        putBits( data, position, 0x2, 2 );
+        putBits( data, position, xor >> *trailing, 32 - *leading - *trailing );
+        return;
+    }
+
+    int significant = 32 - lead - trail;
+    putBits( data, position, 0x3, 2 );
+    putBits( data, position, lead, 5 );
+    putBits( data, position, significant - 1, 5 );
+    putBits( data, position, xor >> trail, significant );
+    *leading = lead;
+    *trailing = trail;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    getValue (const uint8_t *data, uint32_t *position, uint32_t *previous, uint8_t *leading, uint8_t *trailing)
+{
+    if (getBits( data, position, 1 ) != 0) {
+        if (getBits( data, position, 1 ) != 0) {
+            *leading = getBits( data, position, 5 );
+            int significant = (int) getBits( data, position, 5 ) + 1;
+            *trailing = 32 - *leading - significant;
+        }
+        *previous ^= (uint32_t) getBits( data, position, 32 - *leading - *trailing ) << *trailing;
+    }
+    return *previous;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    initializeFile (historyStore_t *store, uint32_t numBlocks)
+{
+    historyHeader_t *header = fileHeader( store );
+
+    memset( store->base, '\0', store->size );
+    header->magic = HISTORY_MAGIC;
+    header->blockSize = HISTORY_BLOCK_SIZE;
+    header->numBlocks = numBlocks;
+    header->numFields = numFields;
+    header->nextSequence = 1;
+    memcpy( header->schema, schema, sizeof header->schema );
+    msync( store->base, store->size, MS_ASYNC );
+}
+
+// -----------------------------------------------------------------------------
+int History_Open (historyStore_t *store, const char *path, size_t bytes)
+{
+    struct stat fileInfo;
+
+    pthread_once( &fieldsOnce, buildFields );
+    memset( store, '\0', sizeof( historyStore_t ) );
+
+    uint32_t numBlocks = (bytes / HISTORY_BLOCK_SIZE) - 1;
+    if (numBlocks < MIN_BLOCKS)
+        numBlocks = MIN_BLOCKS;
+    size_t size = (size_t) (numBlocks + 1) * HISTORY_BLOCK_SIZE;
+
+    int fd = open( path, O_RDWR | O_CREAT, 0644 );
+    if (fd < 0) {
+        Logger_LogError( "History: unable to open [%s]: %s\n", path, strerror( errno ) );
+        return FALSE;
+    }
+    if (fstat( fd, &fileInfo ) != 0 || (fileInfo.st_size != (off_t) size && ftruncate( fd, size ) != 0)) {
+        Logger_LogError( "History: unable to size [%s]: %s\n", path, strerror( errno ) );
+        close( fd );
+        return FALSE;
+    }
+
+    void *base = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (base == MAP_FAILED) {
+        Logger_LogError( "History: unable to map [%s]: %s\n", path, strerror( errno ) );
+        return FALSE;
+    }
+
+    store->base = base;
+    store->size = size;
+    pthread_mutex_init( &store->lock, NULL );
+
+    //
+    //  A different size or a different field table means the old samples
+    //  can't be read back the way they were written. Start over
+    historyHeader_t *header = fileHeader( store );
+    if (header->magic != HISTORY_MAGIC || header->blockSize != HISTORY_BLOCK_SIZE || header->numBlocks != numBlocks
+            || header->numFields != (uint32_t) numFields || strncmp( header->schema, schema, sizeof header->schema ) != 0) {
+        if (header->magic == HISTORY_MAGIC)
+            Logger_LogWarning( "History: [%s] was written with a different size or field list - starting it over\n", path );
+        initializeFile( store, numBlocks );
+    }
+
+    store->isOpen = TRUE;
+    Logger_LogInfo( "History: [%s] %u blocks, %lu KB\n", path, numBlocks, (unsigned long) (size / 1024) );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    History_Close (historyStore_t *store)
+{
+    if (!store->isOpen)
+        return;
+
+    pthread_mutex_lock( &store->lock );
+    store->isOpen = FALSE;
+    msync( store->base, store->size, MS_SYNC );
+    munmap( store->base, store->size );
+    store->base = NULL;
+    pthread_mutex_unlock( &store->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    startBlock (historyStore_t *store, time_t when, const uint32_t *values)
+{
+    historyHeader_t     *header = fileHeader( store );
+    historyEncoder_t    *encoder = &store->encoder;
+
+    //
+    //  Let the kernel start writing the one we just finished
+    if (encoder->block != NULL)
+        msync( encoder->block, HISTORY_BLOCK_SIZE, MS_ASYNC );
+
+    uint64_t sequence = header->nextSequence++;
+    uint8_t *block = blockFor( store, sequence );
+    blockHeader_t *blockHeader = (blockHeader_t *) block;
+    uint8_t *data = block + sizeof( blockHeader_t );
+
+    memset( block, '\0', HISTORY_BLOCK_SIZE );
+    encoder->block = block;
+    encoder->bits = 0;
+    encoder->previousTime = when;
+    encoder->previousDelta = 0;
+    for (int i = 0; i < numFields; i += 1) {
+        putBits( data, &encoder->bits, values[ i ], 32 );
+        encoder->previousValue[ i ] = values[ i ];
+        encoder->leading[ i ] = 0xFF;
+        encoder->trailing[ i ] = 0;
+    }
+
+    blockHeader->firstTime = when;
+    blockHeader->lastTime = when;
+    blockHeader->bits = encoder->bits;
+    blockHeader->count = 1;
+    blockHeader->sequence = sequence;
+}
+
+// -----------------------------------------------------------------------------
+void    History_Append (historyStore_t *store, time_t when, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead)
+{
+    historyEncoder_t    *encoder = &store->encoder;
+    uint32_t            values[ HISTORY_MAX_FIELDS ];
+
+    if (!store->isOpen)
+        return;
+
+    for (int i = 0; i < numFields; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ fieldMap[ i ] ];
+        values[ i ] = floatBits( RealTimeFields_IsValid( field, rtData, rtRead ) ? (float) field->number( rtData ) : NAN );
+    }
+
+    pthread_mutex_lock( &store->lock );
+    store->appended += 1;
+
+    //
+    //  Clocks get set backwards now and then - a new block keeps the times
+    //  inside each one in order
+    if (encoder->block == NULL || when < encoder->previousTime || encoder->bits + MAX_SAMPLE_BITS( numFields ) > BLOCK_DATA_BITS) {
+        startBlock( store, when, values );
+        pthread_mutex_unlock( &store->lock );
+        return;
+    }
+
+    blockHeader_t *blockHeader = (blockHeader_t *) encoder->block;
+    uint8_t *data = encoder->block + sizeof( blockHeader_t );
+    int64_t delta = when - encoder->previousTime;
+
+    putTimestamp( data, &encoder->bits, delta - encoder->previousDelta );
+    for (int i = 0; i < numFields; i += 1)
+        putValue( data, &encoder->bits, values[ i ], &encoder->previousValue[ i ], &encoder->leading[ i ], &encoder->trailing[ i ] );
+    encoder->previousTime = when;
+    encoder->previousDelta = delta;
+
+    blockHeader->lastTime = when;
+    blockHeader->bits = encoder->bits;
+    __atomic_store_n( &blockHeader->count, blockHeader->count + 1, __ATOMIC_RELEASE );
+    pthread_mutex_unlock( &store->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+int decodeBlock (const uint8_t *block, time_t from, time_t to, const int *fields, int numWanted,
+                 historyCallback_t callback, void *arg, long *delivered)
+{
+    //
+    //  Every field has to be decoded to get to the next sample, but only the
+    //  ones asked for are turned back into doubles. FALSE - the callback
+    //  has had enough
+    const blockHeader_t *blockHeader = (const blockHeader_t *) block;
+    const uint8_t       *data = block + sizeof( blockHeader_t );
+    uint32_t            previous[ HISTORY_MAX_FIELDS ];
+    uint8_t             leading[ HISTORY_MAX_FIELDS ];
+    uint8_t             trailing[ HISTORY_MAX_FIELDS ];
+    double              values[ HISTORY_MAX_FIELDS ];
+    uint32_t            position = 0;
+    int64_t             when = blockHeader->firstTime;
+    int64_t             delta = 0;
+
+    if (blockHeader->bits > BLOCK_DATA_BITS)
+        return TRUE;
+
+    for (uint32_t sample = 0; sample < blockHeader->count && position <= blockHeader->bits; sample += 1) {
+        if (sample == 0) {
+            for (int i = 0; i < numFields; i += 1) {
+                previous[ i ] = getBits( data, &position, 32 );
+                leading[ i ] = 0;
+                trailing[ i ] = 0;
+            }
+        } else {
+            delta += getTimestamp( data, &position );
+            when += delta;
+            for (int i = 0; i < numFields; i += 1)
+                getValue( data, &position, &previous[ i ], &leading[ i ], &trailing[ i ] );
+        }
+
+        if (when < from)
+            continue;
+        if (when > to)
+            return TRUE;
+
+        for (int i = 0; i < numWanted; i += 1)
+            values[ i ] = bitsFloat( previous[ fields[ i ] ] );
+        *delivered += 1;
+        if (!(*callback)( arg, (time_t) when, values ))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+long    History_Query (historyStore_t *store, time_t from, time_t to, const int *fields, int numWanted,
+                       historyCallback_t callback, void *arg)
+{
+    uint8_t     block[ HISTORY_BLOCK_SIZE ];
+    long        delivered = 0;
+
+    if (!store->isOpen)
+        return 0;
+
+    pthread_mutex_lock( &store->lock );
+    uint64_t next = fileHeader( store )->nextSequence;
+    uint32_t numBlocks = fileHeader( store )->numBlocks;
+    pthread_mutex_unlock( &store->lock );
+
+    //
+    //  The lock is only held to copy one block, so the publisher never waits
+    //  on a long query. A block that got reused while we weren't looking has
+    //  the wrong sequence in it and is skipped
+    uint64_t oldest = (next > numBlocks) ? next - numBlocks : 1;
+    for (uint64_t sequence = oldest; sequence < next; sequence += 1) {
+        pthread_mutex_lock( &store->lock );
+        const blockHeader_t *blockHeader = (const blockHeader_t *) blockFor( store, sequence );
+        int wanted = store->isOpen && blockHeader->sequence == sequence && blockHeader->count > 0
+                        && blockHeader->lastTime >= from && blockHeader->firstTime <= to;
+        if (wanted)
+            memcpy( block, blockHeader, HISTORY_BLOCK_SIZE );
+        pthread_mutex_unlock( &store->lock );
+
+        //
+        //  Not stopping at the first block past 'to': a clock set backwards
+        //  starts a new block, so a later block can go back in time
+        if (wanted && !decodeBlock( block, from, to, fields, numWanted, callback, arg, &delivered ))
+            break;
+    }
+
+    return delivered;
+}
+
+// -----------------------------------------------------------------------------
+void    History_GetStats (historyStore_t *store, historyStats_t *stats)
+{
+    memset( stats, '\0', sizeof( historyStats_t ) );
+    if (!store->isOpen)
+        return;
+
+    pthread_mutex_lock( &store->lock );
+    const historyHeader_t *header = fileHeader( store );
+    stats->appended = store->appended;
+    stats->totalBlocks = header->numBlocks;
+    for (uint32_t i = 0; i < header->numBlocks; i += 1) {
+        const blockHeader_t *blockHeader = (const blockHeader_t *) (store->base + ((size_t) (i + 1) * HISTORY_BLOCK_SIZE));
+        if (blockHeader->sequence == 0 || blockHeader->count == 0)
+            continue;
+
+        stats->blocks += 1;
+        stats->samples += blockHeader->count;
+        stats->bytesUsed += (blockHeader->bits + 7) / 8;
+        if (stats->oldest == 0 || blockHeader->firstTime < stats->oldest)
+            stats->oldest = blockHeader->firstTime;
+        if (blockHeader->lastTime > stats->newest)
+            stats->newest = blockHeader->lastTime;
+    }
+    pthread_mutex_unlock( &store->lock );
+}
@@ -0,0 +1,83 @@
+/*
+ * File:   history.h
+ * Author: pconroy
+ *
+ * On-device sample history, so a broker or database outage can be backfilled
+ * after the fact. Every sample's numeric fields are kept, Gorilla compressed
+ * (delta-of-delta timestamps, XOR'd floats), in a fixed size memory mapped
+ * file per controller that wraps around once it is full. A 1 Hz sample of
+ * all 26 fields comes to about 10 bytes, so a few MB is a week or more.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "libepsolar.h"
+#include "registerPlanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTORY_DEFAULT_MB          8           // per controller - ten days at 1 Hz
+#define HISTORY_BLOCK_SIZE          4096
+#define HISTORY_MAX_FIELDS          48
+
+typedef struct  historyStats {
+    unsigned long   appended;           // since startup
+    unsigned long   samples;            // in the file now
+    unsigned long   blocks;             // in use
+    unsigned long   totalBlocks;
+    unsigned long   bytesUsed;          // compressed bytes in those blocks
+    time_t          oldest;             // 0 - empty
+    time_t          newest;
+} historyStats_t;
+
+//
+//  The writer's half-finished block lives in the file; this is what it
+//  needs to carry on compressing into it
+typedef struct  historyEncoder {
+    uint8_t         *block;             // NULL - start a new one with the next sample
+    uint32_t        bits;
+    int64_t         previousTime;
+    int64_t         previousDelta;
+    uint32_t        previousValue[ HISTORY_MAX_FIELDS ];
+    uint8_t         leading[ HISTORY_MAX_FIELDS ];
+    uint8_t         trailing[ HISTORY_MAX_FIELDS ];
+} historyEncoder_t;
+
+typedef struct  historyStore {
+    int             isOpen;
+    pthread_mutex_t lock;               // appends vs. queries on other threads
+    uint8_t         *base;
+    size_t          size;
+    historyEncoder_t    encoder;
+    unsigned long   appended;
+} historyStore_t;
+
+//
+//  Called once per sample in the query range, oldest first; values[ i ] is
+//  the i'th field asked for. Return FALSE to stop early
+typedef int (*historyCallback_t)( void *arg, time_t when, const double *values );
+
+extern  int     History_Open( historyStore_t *store, const char *path, size_t bytes );
+extern  void    History_Close( historyStore_t *store );
+extern  void    History_Append( historyStore_t *store, time_t when, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead );
+extern  long    History_Query( historyStore_t *store, time_t from, time_t to, const int *fields, int numFields,
+                                historyCallback_t callback, void *arg );
+extern  void    History_GetStats( historyStore_t *store, historyStats_t *stats );
+
+extern  int     History_NumFields( void );
+extern  const char  *History_FieldName( int field );
+extern  int     History_FieldDecimals( int field );
+extern  int     History_FindField( const char *key );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTORY_H */
@@ -0,0 +1,328 @@
+/*
+ * File:    historyQuery.c
+ * author:  patrick conroy
+ *
+ * The command worker parses the request and drops it in a small single
+ * producer / single consumer queue; this thread does the decoding and the
+ * publishing. A week of 1 Hz data is over a thousand messages, and that has
+ * no business holding up a "load off".
+ *
+ * Chunks are paced at HISTORY_CHUNKS_PER_SECOND and published QoS 1, the
+ * same as an ack.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "asyncLog.h"
+#include "libmqttrv.h"
+#include "libepsolar.h"
+#include "history.h"
+#include "controllers.h"
+#include "jsonWriter.h"
+#include "timeUtils.h"
+#include "historyQuery.h"
+
+
+#define CHUNK_BUFFER_SIZE       (256 * 1024)
+#define CHUNK_ENVELOPE_BYTES    256                 // room kept for "last" and "numSamples"
+#define ROW_BUFFER_SIZE         (HISTORY_MAX_FIELDS * 24 + 32)
+#define ID_LENGTH               64
+
+typedef struct  historyRequest {
+    controller_t    *controller;
+    int             idKind;                 // 0 - none, 1 - string, 2 - number
+    char            idString[ ID_LENGTH ];
+    double          idNumber;
+    time_t          from;
+    time_t          to;
+    int             numFields;
+    int             fields[ HISTORY_MAX_FIELDS ];
+    int             chunkSamples;
+} historyRequest_t;
+
+//
+//  Where the chunk being built is up to
+typedef struct  chunkState {
+    const historyRequest_t  *request;
+    jsonWriter_t    writer;
+    int             chunk;
+    int             rows;
+    long            total;
+    uint64_t        lastPublishNanos;
+} chunkState_t;
+
+static  struct mosquitto    *mosquittoInstance = NULL;
+
+static  historyRequest_t    queue[ HISTORY_QUERY_QUEUE_SIZE ];
+static  uint64_t            head = 0;               // command worker writes here
+static  uint64_t            tail = 0;               // query thread reads here
+static  sem_t               queriesWaiting;
+
+static  pthread_t           queryThread;
+static  volatile int        running = FALSE;
+static  historyQueryStats_t stats;
+
+static  char                chunkBuffer[ CHUNK_BUFFER_SIZE ];
+
+
+// -----------------------------------------------------------------------------
+static
+void    beginChunk (chunkState_t *state)
+{
+    const historyRequest_t  *request = state->request;
+    jsonWriter_t            *writer = &state->writer;
+    char                    name[ 64 ];
+
+    JSON_Begin( writer, chunkBuffer, sizeof chunkBuffer );
+    JSON_AddString( writer, "topic", request->controller->historyTopic );
+    JSON_AddString( writer, "version", "4.0" );
+    if (request->idKind == 1)
+        JSON_AddString( writer, "id", request->idString );
+    else if (request->idKind == 2)
+        JSON_AddNumber( writer, "id", request->idNumber );
+    JSON_AddInt( writer, "chunk", state->chunk );
+
+    JSON_BeginArray( writer, "fields" );
+    JSON_AddRawElement( writer, "\"time\"", 6 );
+    for (int i = 0; i < request->numFields; i += 1) {
+        int length = snprintf( name, sizeof name, "\"%s\"", History_FieldName( request->fields[ i ] ) );
+        JSON_AddRawElement( writer, name, length );
+    }
+    JSON_EndArray( writer );
+
+    JSON_BeginArray( writer, "samples" );
+    state->rows = 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishChunk (chunkState_t *state, int last)
+{
+    jsonWriter_t    *writer = &state->writer;
+
+    JSON_EndArray( writer );
+    JSON_AddBool( writer, "last", last );
+    if (last)
+        JSON_AddInt( writer, "numSamples", state->total );
+
+    //
+    //  Pace ourselves
+    uint64_t interval = NANOS_PER_SECOND / HISTORY_CHUNKS_PER_SECOND;
+    uint64_t now = Time_MonotonicNanos();
+    if (state->lastPublishNanos != 0 && now < state->lastPublishNanos + interval) {
+        struct timespec pause = Time_NanosToTimespec( state->lastPublishNanos + interval - now );
+        nanosleep( &pause, NULL );
+    }
+
+    const char *message = JSON_End( writer );
+    if (message != NULL) {
+        const char *topic = state->request->controller->historyTopic;
+        int rc = mosquitto_publish( mosquittoInstance, NULL, topic, strlen( message ), message, 1, false );
+        if (rc != MOSQ_ERR_SUCCESS)
+            Logger_LogWarning( "Publish to [%s] failed: %s\n", topic, mosquitto_strerror( rc ) );
+    }
+
+    state->lastPublishNanos = Time_MonotonicNanos();
+    state->chunk += 1;
+    stats.chunks += 1;
+}
+
+// -----------------------------------------------------------------------------
+static
+int addSample (void *arg, time_t when, const double *values)
+{
+    chunkState_t            *state = arg;
+    const historyRequest_t  *request = state->request;
+    char                    row[ ROW_BUFFER_SIZE ];
+    int                     length = snprintf( row, sizeof row, "[%ld", (long) when );
+
+    for (int i = 0; i < request->numFields && length < (int) sizeof row; i += 1) {
+        if (isnan( values[ i ] ))
+            length += snprintf( &row[ length ], sizeof row - length, ",null" );
+        else
+            length += snprintf( &row[ length ], sizeof row - length, ",%.*f", History_FieldDecimals( request->fields[ i ] ), values[ i ] );
+    }
+
+    //
+    //  snprintf() says how long it would have been - a row cut short would
+    //  run past the buffer here, and isn't JSON anyway
+    if (length >= (int) sizeof row - 1) {
+        Logger_LogError( "History row at %ld does not fit in %d bytes - ending the query\n", (long) when, (int) sizeof row );
+        return FALSE;
+    }
+    row[ length++ ] = ']';
+
+    if (state->rows >= request->chunkSamples
+            || state->writer.length + length + CHUNK_ENVELOPE_BYTES > sizeof chunkBuffer) {
+        publishChunk( state, FALSE );
+        beginChunk( state );
+    }
+
+    JSON_AddRawElement( &state->writer, row, length );
+    state->rows += 1;
+    state->total += 1;
+    return running;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    runQuery (const historyRequest_t *request)
+{
+    chunkState_t    state;
+
+    memset( &state, '\0', sizeof state );
+    state.request = request;
+
+    uint64_t started = Time_MonotonicNanos();
+    beginChunk( &state );
+    History_Query( &request->controller->history, request->from, request->to, request->fields, request->numFields, addSample, &state );
+    publishChunk( &state, TRUE );
+
+    stats.samples += state.total;
+    Logger_LogInfo( "Controller %d history query: %ld samples in %d chunk(s), %lu ms\n", request->controller->id,
+                    state.total, state.chunk, (unsigned long) ((Time_MonotonicNanos() - started) / NANOS_PER_MILLI) );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *queryWorker (void *arg)
+{
+    while (running) {
+        if (sem_wait( &queriesWaiting ) != 0)
+            continue;
+
+        while (running && tail != __atomic_load_n( &head, __ATOMIC_ACQUIRE )) {
+            runQuery( &queue[ tail % HISTORY_QUERY_QUEUE_SIZE ] );
+            __atomic_store_n( &tail, tail + 1, __ATOMIC_RELEASE );
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+time_t  requestTime (const cJSON *item, time_t now, time_t fallback)
+{
+    if (!cJSON_IsNumber( item ))
+        return fallback;
+    return (item->valuedouble <= 0) ? now + (time_t) item->valuedouble : (time_t) item->valuedouble;
+}
+
+// -----------------------------------------------------------------------------
+int HistoryQuery_Submit (controller_t *controller, const cJSON *json, const char **error)
+{
+    //
+    //  Runs on the command worker
+    uint64_t    index = head;
+    uint64_t    readIndex = __atomic_load_n( &tail, __ATOMIC_ACQUIRE );
+    time_t      now = time( NULL );
+
+    if (!running || !controller->history.isOpen) {
+        *error = "no history kept (start with -H)";
+        stats.rejected += 1;
+        return FALSE;
+    }
+    if ((index - readIndex) >= HISTORY_QUERY_QUEUE_SIZE) {
+        *error = "too many history queries running";
+        stats.rejected += 1;
+        return FALSE;
+    }
+
+    historyRequest_t *request = &queue[ index % HISTORY_QUERY_QUEUE_SIZE ];
+    memset( request, '\0', sizeof( historyRequest_t ) );
+    request->controller = controller;
+    request->from = requestTime( cJSON_GetObjectItemCaseSensitive( json, "from" ), now, 0 );
+    request->to = requestTime( cJSON_GetObjectItemCaseSensitive( json, "to" ), now, now );
+    request->chunkSamples = HISTORY_CHUNK_SAMPLES;
+
+    const cJSON *id = cJSON_GetObjectItemCaseSensitive( json, "id" );
+    if (cJSON_IsString( id )) {
+        request->idKind = 1;
+        strncpy( request->idString, id->valuestring, ID_LENGTH - 1 );
+    } else if (cJSON_IsNumber( id )) {
+        request->idKind = 2;
+        request->idNumber = id->valuedouble;
+    }
+
+    const cJSON *chunk = cJSON_GetObjectItemCaseSensitive( json, "chunk" );
+    if (cJSON_IsNumber( chunk ) && chunk->valueint > 0)
+        request->chunkSamples = chunk->valueint;
+
+    const cJSON *fields = cJSON_GetObjectItemCaseSensitive( json, "fields" );
+    const cJSON *field;
+    if (fields == NULL) {
+        request->numFields = History_NumFields();
+        for (int i = 0; i < request->numFields; i += 1)
+            request->fields[ i ] = i;
+    } else if (!cJSON_IsArray( fields )) {
+        *error = "fields must be an array of field names";
+    } else {
+        cJSON_ArrayForEach( field, fields ) {
+            int fieldIndex = cJSON_IsString( field ) ? History_FindField( field->valuestring ) : -1;
+            if (fieldIndex < 0) {
+                *error = "unknown field";
+                break;
+            }
+            if (request->numFields < HISTORY_MAX_FIELDS)
+                request->fields[ request->numFields++ ] = fieldIndex;
+        }
+    }
+
+    if (*error == NULL && request->from > request->to)
+        *error = "from is after to";
+    if (*error != NULL) {
+        stats.rejected += 1;
+        return FALSE;
+    }
+
+    stats.queries += 1;
+    __atomic_store_n( &head, index + 1, __ATOMIC_RELEASE );
+    sem_post( &queriesWaiting );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int HistoryQuery_Start (struct mosquitto *mosq)
+{
+    mosquittoInstance = mosq;
+    memset( &stats, '\0', sizeof stats );
+
+    if (sem_init( &queriesWaiting, 0, 0 ) != 0) {
+        Logger_LogFatal( "Unable to create the history query semaphore\n" );
+        return FALSE;
+    }
+
+    running = TRUE;
+    if (pthread_create( &queryThread, NULL, queryWorker, NULL )) {
+        Logger_LogFatal( "Unable to start the history query thread!\n" );
+        running = FALSE;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    HistoryQuery_Stop (void)
+{
+    if (!running)
+        return;
+
+    running = FALSE;
+    sem_post( &queriesWaiting );
+    pthread_join( queryThread, NULL );
+}
+
+// -----------------------------------------------------------------------------
+void    HistoryQuery_GetStats (historyQueryStats_t *out)
+{
+    *out = stats;
+}
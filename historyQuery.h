@@ -0,0 +1,51 @@
+/*
+ * File:   historyQuery.h
+ * Author: pconroy
+ *
+ * Range queries against a controller's sample history, asked for on its
+ * COMMAND topic and streamed back in chunks on <topTopic>/<controllerID>/HISTORY:
+ *
+ *  {"id":7,"command":"history","from":-3600,"fields":["batteryVoltage","pvPower"]}
+ *
+ * "from" and "to" are epoch seconds, or seconds back from now when zero or
+ * negative; "to" defaults to now and "fields" to all of them. Each chunk is
+ *
+ *  {"topic":...,"id":7,"chunk":0,"fields":["time","batteryVoltage","pvPower"],
+ *   "samples":[[1760000000,13.28,160.5],...],"last":false}
+ *
+ * and the one with "last":true carries the total in "numSamples".
+ */
+
+#ifndef HISTORYQUERY_H
+#define HISTORYQUERY_H
+
+#include <cjson/cJSON.h>
+#include "libmqttrv.h"
+#include "controllers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTORY_QUERY_QUEUE_SIZE        4
+#define HISTORY_CHUNK_SAMPLES           500     // default samples per message
+#define HISTORY_CHUNKS_PER_SECOND       20      // so a month of data doesn't all land in mosquitto's queue at once
+
+typedef struct  historyQueryStats {
+    unsigned long   queries;
+    unsigned long   rejected;
+    unsigned long   chunks;
+    unsigned long   samples;
+} historyQueryStats_t;
+
+extern  int     HistoryQuery_Start( struct mosquitto *mosquittoInstance );
+extern  void    HistoryQuery_Stop( void );
+extern  int     HistoryQuery_Submit( controller_t *controller, const cJSON *request, const char **error );
+extern  void    HistoryQuery_GetStats( historyQueryStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTORYQUERY_H */
@@ -0,0 +1,510 @@
+/*
+ * File:    journal.c
+ * author:  patrick conroy
+ *
+ * The journal is a directory of fixed size segment files, each one mmap()ed
+ * and only ever appended to:
+ *
+ *      segment-<16 hex digit id>.jnl
+ *          header  magic, id, size, readOffset
+ *          record  length, checksum, timestamp, message (padded to 8 bytes)
+ *          record  ...
+ *          length 0 marks the end
+ *
+ * Ids only go up, so replaying segments in id order and records in file order
+ * is replaying in timestamp order. The replay position is kept in the header
+ * of the oldest segment, which is what lets a restart pick up where the last
+ * run left off. A segment is deleted once everything in it has been replayed.
+ *
+ * A crash half way through an append leaves a record with a bad checksum;
+ * the scan at startup treats that as the end of the segment.
+ *
+ * Everything here runs on the publishing thread, so there is no locking.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "jsonWriter.h"
+#include "journal.h"
+
+
+#define SEGMENT_MAGIC           0x314A5045          // "EPJ1"
+#define SEGMENT_NAME_FORMAT     "segment-%016" PRIx64 ".jnl"
+#define MIN_SEGMENT_BYTES       (64 * 1024)
+#define MAX_SEGMENT_BYTES       (4 * 1024 * 1024)
+#define MAX_SEGMENTS            64
+
+//
+//  A replay batch of 100 "-x" messages runs to about 350K
+#define BATCH_BUFFER_SIZE       (512 * 1024)
+#define BATCH_ENVELOPE_BYTES    512                 // room kept for the fields after the samples
+#define MAX_RECORD_BYTES        (BATCH_BUFFER_SIZE / 4)
+
+#define ALIGN8(n)               (((n) + 7) & ~(size_t) 7)
+
+typedef struct  segmentHeader {
+    uint32_t    magic;
+    uint32_t    headerSize;
+    uint64_t    id;
+    uint64_t    size;
+    uint64_t    readOffset;         // everything before this has been replayed
+} segmentHeader_t;
+
+typedef struct  recordHeader {
+    uint32_t    length;             // of the message, 0 = end of segment
+    uint32_t    checksum;
+    int64_t     timestamp;
+} recordHeader_t;
+
+typedef struct  segment {
+    uint64_t        id;
+    uint8_t         *base;
+    size_t          size;
+    size_t          writeOffset;
+    unsigned long   records;        // not yet replayed
+    segmentHeader_t *header;
+} segment_t;
+
+extern  char    *getDateTime( time_t when );
+
+static  char            journalDirectory[ PATH_MAX ];
+static  long            maxJournalBytes = 0;
+static  size_t          segmentSize = MIN_SEGMENT_BYTES;
+static  int             isOpen = FALSE;
+
+//
+//  Oldest first: segments[ 0 ] is being replayed, the last one is appended to
+static  segment_t       segments[ MAX_SEGMENTS ];
+static  int             numSegments = 0;
+static  uint64_t        nextSegmentId = 1;
+
+static  journalStats_t  stats;
+
+static  char            batchBuffer[ BATCH_BUFFER_SIZE ];
+static  size_t          batchEndOffset = 0;
+static  int             batchRecords = 0;
+
+
+// -----------------------------------------------------------------------------
+static
+uint32_t    checksum (int64_t timestamp, const uint8_t *bytes, size_t length)
+{
+    //
+    //  FNV-1a. Only has to spot a torn write, not an attacker
+    uint32_t    hash = 2166136261u;
+
+    for (int i = 0; i < (int) sizeof timestamp; i += 1)
+        hash = (hash ^ ((uint8_t) (timestamp >> (i * 8)))) * 16777619u;
+    for (size_t i = 0; i < length; i += 1)
+        hash = (hash ^ bytes[ i ]) * 16777619u;
+
+    return hash;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    segmentPath (uint64_t id, char *path, size_t size)
+{
+    char    name[ 64 ];
+
+    snprintf( name, sizeof name, SEGMENT_NAME_FORMAT, id );
+    snprintf( path, size, "%s/%s", journalDirectory, name );
+}
+
+// -----------------------------------------------------------------------------
+static
+int mapSegment (segment_t *segment, uint64_t id, int create)
+{
+    char        path[ PATH_MAX + 64 ];
+    struct stat fileInfo;
+
+    segmentPath( id, path, sizeof path );
+
+    int fd = open( path, O_RDWR | (create ? O_CREAT | O_EXCL : 0), 0644 );
+    if (fd < 0) {
+        Logger_LogError( "Journal: unable to open [%s]: %s\n", path, strerror( errno ) );
+        return FALSE;
+    }
+
+    if (create && ftruncate( fd, segmentSize ) != 0) {
+        Logger_LogError( "Journal: unable to size [%s]: %s\n", path, strerror( errno ) );
+        close( fd );
+        unlink( path );
+        return FALSE;
+    }
+
+    if (fstat( fd, &fileInfo ) != 0 || fileInfo.st_size < (off_t) (sizeof( segmentHeader_t ) + sizeof( recordHeader_t ))) {
+        Logger_LogWarning( "Journal: [%s] is too short to be a segment\n", path );
+        close( fd );
+        return FALSE;
+    }
+
+    void *base = mmap( NULL, fileInfo.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if (base == MAP_FAILED) {
+        Logger_LogError( "Journal: unable to map [%s]: %s\n", path, strerror( errno ) );
+        return FALSE;
+    }
+
+    memset( segment, '\0', sizeof( segment_t ) );
+    segment->id = id;
+    segment->base = base;
+    segment->size = fileInfo.st_size;
+    segment->header = base;
+
+    if (create) {
+        segment->header->magic = SEGMENT_MAGIC;
+        segment->header->headerSize = sizeof( segmentHeader_t );
+        segment->header->id = id;
+        segment->header->size = segment->size;
+        segment->header->readOffset = sizeof( segmentHeader_t );
+        segment->writeOffset = sizeof( segmentHeader_t );
+        return TRUE;
+    }
+
+    if (segment->header->magic != SEGMENT_MAGIC || segment->header->headerSize != sizeof( segmentHeader_t )
+            || segment->header->id != id || segment->header->size != segment->size) {
+        Logger_LogWarning( "Journal: [%s] does not look like one of our segments\n", path );
+        munmap( base, segment->size );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    scanSegment (segment_t *segment)
+{
+    //
+    //  Find where appending left off and count what is still to be replayed
+    size_t  offset = sizeof( segmentHeader_t );
+    size_t  readOffset = segment->header->readOffset;
+
+    segment->records = 0;
+    while (offset + sizeof( recordHeader_t ) <= segment->size) {
+        const recordHeader_t *record = (const recordHeader_t *) (segment->base + offset);
+        size_t  recordSize = sizeof( recordHeader_t ) + ALIGN8( record->length );
+
+        if (record->length == 0 || offset + recordSize > segment->size)
+            break;
+        if (record->checksum != checksum( record->timestamp, (const uint8_t *) (record + 1), record->length )) {
+            Logger_LogWarning( "Journal: torn record in segment %" PRIu64 " at offset %zu - ignoring the rest of it\n", segment->id, offset );
+            break;
+        }
+
+        if (offset >= readOffset)
+            segment->records += 1;
+        offset += recordSize;
+    }
+
+    segment->writeOffset = offset;
+    if (readOffset < sizeof( segmentHeader_t ) || readOffset > offset)
+        segment->header->readOffset = (readOffset > offset) ? offset : sizeof( segmentHeader_t );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    removeOldestSegment (int unreplayedAreLost)
+{
+    char        path[ PATH_MAX + 64 ];
+    segment_t   *oldest = &segments[ 0 ];
+
+    if (unreplayedAreLost && oldest->records > 0) {
+        Logger_LogWarning( "Journal: over its size cap - dropping %lu samples that were never replayed\n", oldest->records );
+        stats.dropped += oldest->records;
+    }
+    stats.pendingRecords -= oldest->records;
+
+    munmap( oldest->base, oldest->size );
+    segmentPath( oldest->id, path, sizeof path );
+    unlink( path );
+
+    memmove( &segments[ 0 ], &segments[ 1 ], (numSegments - 1) * sizeof( segment_t ) );
+    numSegments -= 1;
+    batchRecords = 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+long    bytesOnDisk (void)
+{
+    long    total = 0;
+    for (int i = 0; i < numSegments; i += 1)
+        total += segments[ i ].size;
+    return total;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    enforceSizeCap (void)
+{
+    //
+    //  Never remove the segment being appended to
+    while (numSegments > 1 && bytesOnDisk() > maxJournalBytes)
+        removeOldestSegment( TRUE );
+}
+
+// -----------------------------------------------------------------------------
+static
+int startNewSegment (void)
+{
+    if (numSegments > 0)
+        msync( segments[ numSegments - 1 ].base, segments[ numSegments - 1 ].size, MS_ASYNC );
+    if (numSegments == MAX_SEGMENTS)
+        removeOldestSegment( TRUE );
+
+    if (!mapSegment( &segments[ numSegments ], nextSegmentId, TRUE ))
+        return FALSE;
+
+    nextSegmentId += 1;
+    numSegments += 1;
+    enforceSizeCap();
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int compareIds (const void *a, const void *b)
+{
+    uint64_t    idA = *(const uint64_t *) a;
+    uint64_t    idB = *(const uint64_t *) b;
+
+    return (idA > idB) - (idA < idB);
+}
+
+// -----------------------------------------------------------------------------
+int Journal_Open (const char *directory, long maxBytes)
+{
+    uint64_t    ids[ MAX_SEGMENTS * 2 ];
+    int         numIds = 0;
+
+    snprintf( journalDirectory, sizeof journalDirectory, "%s", directory );
+    maxJournalBytes = (maxBytes > MIN_SEGMENT_BYTES) ? maxBytes : MIN_SEGMENT_BYTES;
+    memset( &stats, '\0', sizeof stats );
+
+    //
+    //  Aim for about 16 segments under the cap so dropping the oldest one
+    //  doesn't throw away too much at once
+    segmentSize = (maxJournalBytes / 16) & ~(size_t) 4095;
+    if (segmentSize < MIN_SEGMENT_BYTES)
+        segmentSize = MIN_SEGMENT_BYTES;
+    if (segmentSize > MAX_SEGMENT_BYTES)
+        segmentSize = MAX_SEGMENT_BYTES;
+
+    if (mkdir( journalDirectory, 0755 ) != 0 && errno != EEXIST) {
+        Logger_LogError( "Journal: unable to create directory [%s]: %s\n", journalDirectory, strerror( errno ) );
+        return FALSE;
+    }
+
+    DIR *dir = opendir( journalDirectory );
+    if (dir == NULL) {
+        Logger_LogError( "Journal: unable to open directory [%s]: %s\n", journalDirectory, strerror( errno ) );
+        return FALSE;
+    }
+
+    struct dirent   *entry;
+    while ((entry = readdir( dir )) != NULL && numIds < (int) (sizeof ids / sizeof ids[ 0 ])) {
+        char        expected[ 64 ];
+        uint64_t    id;
+
+        if (sscanf( entry->d_name, "segment-%16" SCNx64 ".jnl", &id ) != 1)
+            continue;
+        snprintf( expected, sizeof expected, SEGMENT_NAME_FORMAT, id );
+        if (strcmp( expected, entry->d_name ) == 0)
+            ids[ numIds++ ] = id;
+    }
+    closedir( dir );
+
+    qsort( ids, numIds, sizeof ids[ 0 ], compareIds );
+
+    //
+    //  Pick up what a previous run left behind
+    numSegments = 0;
+    for (int i = 0; i < numIds; i += 1) {
+        nextSegmentId = ids[ i ] + 1;
+
+        if (numSegments == MAX_SEGMENTS)
+            removeOldestSegment( TRUE );
+        if (!mapSegment( &segments[ numSegments ], ids[ i ], FALSE ))
+            continue;
+
+        scanSegment( &segments[ numSegments ] );
+        stats.pendingRecords += segments[ numSegments ].records;
+        numSegments += 1;
+    }
+
+    enforceSizeCap();
+    while (numSegments > 1 && segments[ 0 ].records == 0)
+        removeOldestSegment( FALSE );
+
+    isOpen = TRUE;
+    Logger_LogWarning( "Journal [%s]: %d segment(s) of %zu KB, cap %ld MB, %lu samples waiting to be replayed\n",
+                        journalDirectory, numSegments, segmentSize / 1024, maxJournalBytes / (1024 * 1024), stats.pendingRecords );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Journal_Close (void)
+{
+    for (int i = 0; i < numSegments; i += 1) {
+        msync( segments[ i ].base, segments[ i ].size, MS_SYNC );
+        munmap( segments[ i ].base, segments[ i ].size );
+    }
+    numSegments = 0;
+    isOpen = FALSE;
+}
+
+// -----------------------------------------------------------------------------
+int Journal_IsOpen (void)
+{
+    return isOpen;
+}
+
+// -----------------------------------------------------------------------------
+int Journal_Append (time_t timestamp, const char *message, size_t length)
+{
+    if (!isOpen || length == 0)
+        return FALSE;
+
+    //
+    //  A record has to fit in a fresh segment as well as in a batch
+    size_t  recordSize = sizeof( recordHeader_t ) + ALIGN8( length );
+    if (length > MAX_RECORD_BYTES || sizeof( segmentHeader_t ) + recordSize > segmentSize) {
+        Logger_LogError( "Journal: %zu byte message is too big to journal\n", length );
+        return FALSE;
+    }
+
+    segment_t   *segment = (numSegments > 0) ? &segments[ numSegments - 1 ] : NULL;
+    if (segment == NULL || segment->writeOffset + recordSize > segment->size) {
+        if (!startNewSegment())
+            return FALSE;
+        segment = &segments[ numSegments - 1 ];
+    }
+
+    recordHeader_t  *record = (recordHeader_t *) (segment->base + segment->writeOffset);
+    memcpy( record + 1, message, length );
+    record->timestamp = timestamp;
+    record->checksum = checksum( timestamp, (const uint8_t *) message, length );
+    record->length = (uint32_t) length;
+
+    segment->writeOffset += recordSize;
+    if (segment->writeOffset + sizeof( recordHeader_t ) <= segment->size)
+        ((recordHeader_t *) (segment->base + segment->writeOffset))->length = 0;
+
+    segment->records += 1;
+    stats.pendingRecords += 1;
+    stats.journaled += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+unsigned long   Journal_PendingRecords (void)
+{
+    return (isOpen ? stats.pendingRecords : 0);
+}
+
+// -----------------------------------------------------------------------------
+const char  *Journal_NextBatch (const char *topic, int maxRecords, int *numRecords)
+{
+    jsonWriter_t    writer;
+
+    *numRecords = 0;
+    batchRecords = 0;
+    if (!isOpen)
+        return NULL;
+
+    while (numSegments > 1 && segments[ 0 ].records == 0)
+        removeOldestSegment( FALSE );
+    if (numSegments == 0 || segments[ 0 ].records == 0)
+        return NULL;
+
+    //
+    //  Batches never span segments - the next call picks up the next one
+    segment_t   *segment = &segments[ 0 ];
+    size_t      offset = segment->header->readOffset;
+    time_t      firstTimestamp = 0;
+    time_t      lastTimestamp = 0;
+    int         count = 0;
+
+    JSON_Begin( &writer, batchBuffer, sizeof batchBuffer );
+    JSON_AddString( &writer, "topic", topic );
+    JSON_AddString( &writer, "version", "4.0" );
+    JSON_AddString( &writer, "dateTime", getDateTime( time( NULL ) ) );
+    JSON_AddBool( &writer, "replay", TRUE );
+    JSON_BeginArray( &writer, "samples" );
+
+    while (count < maxRecords && offset + sizeof( recordHeader_t ) <= segment->writeOffset) {
+        const recordHeader_t *record = (const recordHeader_t *) (segment->base + offset);
+
+        if (writer.length + record->length + BATCH_ENVELOPE_BYTES > writer.size)
+            break;
+
+        JSON_AddRawElement( &writer, (const char *) (record + 1), record->length );
+        if (count == 0)
+            firstTimestamp = record->timestamp;
+        lastTimestamp = record->timestamp;
+
+        count += 1;
+        offset += sizeof( recordHeader_t ) + ALIGN8( record->length );
+    }
+
+    JSON_EndArray( &writer );
+    JSON_AddInt( &writer, "count", count );
+    JSON_AddString( &writer, "firstDateTime", getDateTime( firstTimestamp ) );
+    JSON_AddString( &writer, "lastDateTime", getDateTime( lastTimestamp ) );
+
+    const char  *message = JSON_End( &writer );
+    if (message == NULL || count == 0)
+        return NULL;
+
+    batchEndOffset = offset;
+    batchRecords = count;
+    *numRecords = count;
+    return message;
+}
+
+// -----------------------------------------------------------------------------
+void    Journal_CommitBatch (void)
+{
+    //
+    //  The last batch made it to the broker - move the replay position past it
+    if (batchRecords == 0 || numSegments == 0)
+        return;
+
+    segment_t   *segment = &segments[ 0 ];
+    segment->header->readOffset = batchEndOffset;
+    msync( segment->base, sizeof( segmentHeader_t ), MS_ASYNC );
+
+    segment->records -= batchRecords;
+    stats.pendingRecords -= batchRecords;
+    stats.replayed += batchRecords;
+    stats.replayBatches += 1;
+    batchRecords = 0;
+
+    if (segment->records == 0 && numSegments > 1)
+        removeOldestSegment( FALSE );
+}
+
+// -----------------------------------------------------------------------------
+void    Journal_GetStats (journalStats_t *out)
+{
+    *out = stats;
+    out->segments = numSegments;
+    out->bytesOnDisk = bytesOnDisk();
+}
@@ -0,0 +1,49 @@
+/*
+ * File:   journal.h
+ * Author: pconroy
+ *
+ * Store-and-forward journal. DATA messages that could not be published are
+ * appended to memory mapped segment files and replayed, oldest first, once
+ * the broker is reachable again. Lives on disk, so it survives restarts.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JOURNAL_DEFAULT_MAX_MB          64
+#define JOURNAL_DEFAULT_BATCH_RATE      2       // replay batches per second
+#define JOURNAL_MAX_BATCH_RECORDS       100     // samples per replay message
+
+typedef struct  journalStats {
+    unsigned long   segments;           // segment files on disk
+    unsigned long   bytesOnDisk;
+    unsigned long   pendingRecords;     // waiting to be replayed
+    unsigned long   journaled;          // appended since startup
+    unsigned long   replayed;           // confirmed published since startup
+    unsigned long   replayBatches;
+    unsigned long   dropped;            // oldest samples thrown away to stay under the cap
+} journalStats_t;
+
+extern  int         Journal_Open( const char *directory, long maxBytes );
+extern  void        Journal_Close( void );
+extern  int         Journal_IsOpen( void );
+extern  int         Journal_Append( time_t timestamp, const char *message, size_t length );
+extern  unsigned long   Journal_PendingRecords( void );
+extern  const char  *Journal_NextBatch( const char *topic, int maxRecords, int *numRecords );
+extern  void        Journal_CommitBatch( void );
+extern  void        Journal_GetStats( journalStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JOURNAL_H */
@@ -0,0 +1,309 @@
+/*
+ * File:    jsonWriter.c
+ * author:  patrick conroy
+ *
+ * cJSON builds a node per field on the heap, prints the tree with "%1.15g",
+ * then frees it all again. We publish a flat object every cycle, so this just
+ * appends to a reusable buffer.
+ *
+ * Number formatting matches cJSON_PrintUnformatted():
+ *   - a value that is a whole int prints as "%d"
+ *   - anything else prints as "%1.15g" ("%1.17g" if that does not round trip)
+ * The fixed point path takes the same (int)(x * 10^n + .5) rounding the old
+ * FP2nP() macros did and prints the digits itself, trailing zeros dropped,
+ * which is exactly what "%1.15g" made of the rounded double.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "jsonWriter.h"
+
+
+static  const long  powersOfTen[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+#define MAX_DECIMALS    6
+
+
+// -----------------------------------------------------------------------------
+static
+void    appendBytes (jsonWriter_t *writer, const char *bytes, size_t length)
+{
+    //
+    //  Always leave room for the closing NUL
+    if (writer->overflow || (writer->length + length + 1) > writer->size) {
+        writer->overflow = 1;
+        return;
+    }
+
+    memcpy( &writer->buffer[ writer->length ], bytes, length );
+    writer->length += length;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendChar (jsonWriter_t *writer, char c)
+{
+    appendBytes( writer, &c, 1 );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendUnsigned (jsonWriter_t *writer, unsigned long value)
+{
+    char    digits[ 24 ];
+    int     i = sizeof digits;
+
+    do {
+        digits[ --i ] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    appendBytes( writer, &digits[ i ], sizeof digits - i );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendLong (jsonWriter_t *writer, long value)
+{
+    if (value < 0) {
+        appendChar( writer, '-' );
+        appendUnsigned( writer, -(unsigned long) value );
+    } else {
+        appendUnsigned( writer, (unsigned long) value );
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendQuoted (jsonWriter_t *writer, const char *string)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    appendChar( writer, '"' );
+
+    const char *run = string;
+    for (const unsigned char *p = (const unsigned char *) string; *p != '\0'; p += 1) {
+        if (*p >= 32 && *p != '"' && *p != '\\')
+            continue;
+
+        appendBytes( writer, run, (const char *) p - run );
+        run = (const char *) p + 1;
+
+        char escape[ 6 ] = { '\\', 0, 0, 0, 0, 0 };
+        size_t escapeLength = 2;
+        switch (*p) {
+            case '"':   escape[ 1 ] = '"';  break;
+            case '\\':  escape[ 1 ] = '\\'; break;
+            case '\b':  escape[ 1 ] = 'b';  break;
+            case '\f':  escape[ 1 ] = 'f';  break;
+            case '\n':  escape[ 1 ] = 'n';  break;
+            case '\r':  escape[ 1 ] = 'r';  break;
+            case '\t':  escape[ 1 ] = 't';  break;
+            default:    escape[ 1 ] = 'u';
+                        escape[ 2 ] = '0';
+                        escape[ 3 ] = '0';
+                        escape[ 4 ] = hex[ *p >> 4 ];
+                        escape[ 5 ] = hex[ *p & 0x0F ];
+                        escapeLength = 6;
+                        break;
+        }
+        appendBytes( writer, escape, escapeLength );
+    }
+
+    appendBytes( writer, run, strlen( run ) );
+    appendChar( writer, '"' );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    appendKey (jsonWriter_t *writer, const char *key)
+{
+    if (writer->bare)
+        return;
+
+    if (writer->needComma)
+        appendChar( writer, ',' );
+    writer->needComma = 1;
+
+    appendQuoted( writer, key );
+    appendChar( writer, ':' );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_Begin (jsonWriter_t *writer, char *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->needComma = 0;
+    writer->overflow = 0;
+    writer->bare = 0;
+
+    appendChar( writer, '{' );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_BeginValue (jsonWriter_t *writer, char *buffer, size_t size)
+{
+    //
+    //  For a single value on its own topic: the next Add call writes just the
+    //  value, formatted exactly as it would be inside an object
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = 0;
+    writer->needComma = 0;
+    writer->overflow = 0;
+    writer->bare = 1;
+}
+
+// -----------------------------------------------------------------------------
+const char  *JSON_End (jsonWriter_t *writer)
+{
+    if (!writer->bare)
+        appendChar( writer, '}' );
+    if (writer->overflow)
+        return NULL;
+
+    writer->buffer[ writer->length ] = '\0';
+    return writer->buffer;
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_BeginObject (jsonWriter_t *writer, const char *key)
+{
+    appendKey( writer, key );
+    appendChar( writer, '{' );
+    writer->needComma = 0;
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_EndObject (jsonWriter_t *writer)
+{
+    appendChar( writer, '}' );
+    writer->needComma = 1;
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_BeginArray (jsonWriter_t *writer, const char *key)
+{
+    appendKey( writer, key );
+    appendChar( writer, '[' );
+    writer->needComma = 0;
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_AddRawElement (jsonWriter_t *writer, const char *json, size_t length)
+{
+    //
+    //  Already serialized JSON (eg: a journaled message) dropped in as is
+    if (writer->needComma)
+        appendChar( writer, ',' );
+    writer->needComma = 1;
+
+    appendBytes( writer, json, length );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_EndArray (jsonWriter_t *writer)
+{
+    appendChar( writer, ']' );
+    writer->needComma = 1;
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_AddString (jsonWriter_t *writer, const char *key, const char *value)
+{
+    //
+    //  cJSON_AddStringToObject() quietly adds nothing for a NULL string
+    if (value == NULL)
+        return;
+
+    appendKey( writer, key );
+    appendQuoted( writer, value );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_AddBool (jsonWriter_t *writer, const char *key, int value)
+{
+    appendKey( writer, key );
+    if (value)
+        appendBytes( writer, "true", 4 );
+    else
+        appendBytes( writer, "false", 5 );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_AddInt (jsonWriter_t *writer, const char *key, long value)
+{
+    appendKey( writer, key );
+    appendLong( writer, value );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_AddNumber (jsonWriter_t *writer, const char *key, double value)
+{
+    char    number[ 32 ];
+    double  test;
+
+    appendKey( writer, key );
+
+    if (isnan( value ) || isinf( value )) {
+        appendBytes( writer, "null", 4 );
+        return;
+    }
+
+    if (value > INT_MIN && value < INT_MAX && value == (double)(int) value) {
+        appendLong( writer, (int) value );
+        return;
+    }
+
+    int length = snprintf( number, sizeof number, "%1.15g", value );
+    if (sscanf( number, "%lg", &test ) != 1 || test != value)
+        length = snprintf( number, sizeof number, "%1.17g", value );
+    appendBytes( writer, number, length );
+}
+
+// -----------------------------------------------------------------------------
+void    JSON_AddFixed (jsonWriter_t *writer, const char *key, double value, int decimals)
+{
+    if (decimals < 0)
+        decimals = 0;
+    if (decimals > MAX_DECIMALS)
+        decimals = MAX_DECIMALS;
+
+    //
+    //  Same rounding as the old FP2nP() macros, truncation toward zero included.
+    //  Those multiplied a float field by an int, i.e. in float precision.
+    float product = (float) value * (float) powersOfTen[ decimals ];
+    long  scaled = (int)(product + .5);
+
+    appendKey( writer, key );
+
+    if (scaled < 0) {
+        appendChar( writer, '-' );
+        scaled = -scaled;
+    }
+
+    long whole = scaled / powersOfTen[ decimals ];
+    long fraction = scaled % powersOfTen[ decimals ];
+    appendUnsigned( writer, whole );
+    if (fraction == 0)
+        return;
+
+    //
+    //  Print the fraction with leading zeros, then drop the trailing ones
+    char    digits[ MAX_DECIMALS ];
+    int     numDigits = decimals;
+    for (int i = decimals - 1; i >= 0; i -= 1) {
+        digits[ i ] = '0' + (fraction % 10);
+        fraction /= 10;
+    }
+    while (numDigits > 0 && digits[ numDigits - 1 ] == '0')
+        numDigits -= 1;
+
+    appendChar( writer, '.' );
+    appendBytes( writer, digits, numDigits );
+}
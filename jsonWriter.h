@@ -0,0 +1,50 @@
+/*
+ * File:   jsonWriter.h
+ * Author: pconroy
+ *
+ * Streams a flat JSON object straight into a caller supplied buffer. No heap,
+ * no DOM. Output is formatted the same way cJSON_PrintUnformatted() does it so
+ * subscribers see identical payloads.
+ */
+
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  jsonWriter {
+    char    *buffer;
+    size_t  size;
+    size_t  length;
+    int     needComma;
+    int     overflow;
+    int     bare;           // JSON_BeginValue() - one value, no braces, no key
+} jsonWriter_t;
+
+extern  void        JSON_Begin( jsonWriter_t *writer, char *buffer, size_t size );
+extern  void        JSON_BeginValue( jsonWriter_t *writer, char *buffer, size_t size );
+extern  const char  *JSON_End( jsonWriter_t *writer );
+
+extern  void        JSON_AddString( jsonWriter_t *writer, const char *key, const char *value );
+extern  void        JSON_AddBool( jsonWriter_t *writer, const char *key, int value );
+extern  void        JSON_AddInt( jsonWriter_t *writer, const char *key, long value );
+extern  void        JSON_AddNumber( jsonWriter_t *writer, const char *key, double value );
+extern  void        JSON_AddFixed( jsonWriter_t *writer, const char *key, double value, int decimals );
+
+extern  void        JSON_BeginObject( jsonWriter_t *writer, const char *key );
+extern  void        JSON_EndObject( jsonWriter_t *writer );
+
+extern  void        JSON_BeginArray( jsonWriter_t *writer, const char *key );
+extern  void        JSON_AddRawElement( jsonWriter_t *writer, const char *json, size_t length );
+extern  void        JSON_EndArray( jsonWriter_t *writer );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* JSONWRITER_H */
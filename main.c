@@ -12,15 +12,44 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
 #include <getopt.h>
 #include <unistd.h>
-#include "log4c.h"
+#include <time.h>
+#include <sys/resource.h>
+#include "asyncLog.h"
 #include "libmqttrv.h"
 #include "libepsolar.h"
+#include "modbusBus.h"
+#include "controllers.h"
+#include "extraData.h"
+#include "settingsCache.h"
+#include "deltaEncoder.h"
+#include "sampleRing.h"
+#include "acquisition.h"
+#include "publisher.h"
+#include "journal.h"
+#include "busScheduler.h"
+#include "clockSync.h"
+#include "commands.h"
+#include "metrics.h"
+#include "modbusProxy.h"
+#include "history.h"
+#include "historyQuery.h"
+#include "reactor.h"
+#include "realTimeFields.h"
+#include "fieldGroups.h"
+#include "cborPayload.h"
+#include "brokerDiscovery.h"
+#include "capture.h"
+#include "batteryAnalytics.h"
+#include "fanout.h"
+#include "timeUtils.h"
 
 
 
@@ -29,144 +58,403 @@ static  char    *version = "EPSOLAR_MQTT SCC Data Publisher - version 1.0.1 (usi
 
 
 static  int     sleepSeconds = 60;                  // How often to send out SCC data packets
+static  double  sampleSeconds = 0;                  // How often to read the SCC, 0 - same as sleepSeconds
 static  char    *brokerHost = "mqttrv.local";       // default address of our MQTT broker
 static  int     passedInBrokerHost = FALSE;         // TRUE if they passed it in via the command line
+static  int     brokerPort = 1883;
+static  char    *brokerCacheFile = BROKER_DEFAULT_CACHE_FILE;  // last broker that worked, tried first next time
 static  int     loggingLevel = 3;
+static  int     logMaxMB = LOG_DEFAULT_MAX_MB;      // "-l" - rotate the log file at this size
 
 static  char    *topTopic = "SCC";                  // MQTT top level topic
-static  char    publishTopic[ 1024 ];               // published data will be on "<topTopic>/<controlleID>/DATA"
-static  char    subscriptionTopic[ 1024 ];          // subscribe to <"<topTopic>/<controlleID>/COMMAND"
+                                                    // each controller publishes on "<topTopic>/<controlleID>/DATA",
+                                                    // takes commands on ".../COMMAND", acks them on ".../ACK"
+                                                    // and retains its settings on ".../SETTINGS"
+static  int     settingsRefreshSeconds = SETTINGS_DEFAULT_REFRESH_SECONDS;
+static  int     keyframeInterval = 0;               // > 0 turns on delta publishing, full message every N cycles
+static  char    *deadbandSpec = NULL;               // per field deadband overrides for delta publishing
+static  int     ringCapacity = SAMPLE_RING_DEFAULT_CAPACITY;   // samples buffered between the reader and the publisher
+static  overflowPolicy_t overflowPolicy = OVERFLOW_DROP_OLDEST;
+static  char    replayTopic[ 1024 ];                // journaled data is replayed on "<topTopic>/<first controlleID>/REPLAY"
+static  char    *journalDirectory = NULL;           // NULL - no store and forward while the broker is away
+static  int     journalMaxMB = JOURNAL_DEFAULT_MAX_MB;
+static  int     replayBatchesPerSecond = JOURNAL_DEFAULT_BATCH_RATE;
+static  char    metricsTopic[ 1024 ];               // stage timings and counters go to "<topTopic>/<first controlleID>/METRICS"
+static  int     metricsSeconds = METRICS_DEFAULT_INTERVAL_SECONDS;  // 0 - no metrics
+static  char    *prometheusFile = NULL;             // also write the metrics here for node_exporter's textfile collector
 
 static  int     synchClocks  = TRUE;
+static  int     clockTolerance = CLOCK_DEFAULT_TOLERANCE_SECONDS;  // only set the controller clock when it is off by more
 static  int     controllerID = 1;
 static  char    *devicePortName = NULL;
+static  char    *controllerSpecs[ MAX_BUSES ];      // "-C" lists - without any it's slave 1 on -p, published as -i
+static  int     numControllerSpecs = 0;
+static  char    *historyDirectory = NULL;           // NULL - keep no sample history
+static  int     historyMB = HISTORY_DEFAULT_MB;     // per controller
+static  int     proxyPort = 0;                      // > 0 - serve cached registers on this Modbus TCP port
+static  int     proxyMaxAgeMillis = 0;              // 0 - twice the polling period
+static  unsigned long   runSamples = 0;             // > 0 - exit after this many samples and report (benchmarking)
+static  char    *onlyFields = NULL;                 // "-f" - publish just these fields
+static  char    *exceptFields = NULL;               // "-F" - publish everything but these
+static  int     reactorMode = FALSE;                // TRUE - one epoll loop on this thread, clean exit on SIGTERM
+static  char    *groupSpecs[ MAX_FIELD_GROUPS ];    // "-g" - fields published on their own subtopic and schedule
+static  int     numGroupSpecs = 0;
+static  payloadEncoding_t   payloadEncoding = PAYLOAD_JSON;   // "-B" - also (or only) publish CBOR
+static  char    *captureFile = NULL;                // "-R" - record every register read here
+static  char    *replayFile = NULL;                 // "-X" - publish a capture instead of reading controllers
+static  double  replaySpeed = CAPTURE_DEFAULT_SPEED;    // "-L" - that many times faster than it was recorded
+static  double  batteryCapacityAh = -1;             // "-u" - >= 0 adds battery estimates to DATA, 0 - capacity from "-x" settings
+static  char    *extraBrokerSpecs[ FANOUT_MAX_TARGETS ];    // every "-h" after the first - publish there too
+static  int     numExtraBrokerSpecs = 0;
 
 //
 // GLOBAL
 int             sendExtraData = FALSE;
 
+//
+//  Only there when the benchmark build links in bench/allocCounter.c
+extern  unsigned long   AllocCounter_Get( void ) __attribute__(( weak ));
+
 //  
 // Forwards
 static  void    parseCommandLine( int, char ** );
-extern  char    *realTimeDataToJSON( const char *publishTopic, epsolarRealTimeData_t *rtData );
-extern  void    *processInboundCommand( void * );
+static  void    reportRun( uint64_t elapsedNanos, unsigned long allocations );
+static  void    replayFinished( void );
 
 
 
 // -----------------------------------------------------------------------------
 int main (int argc, char* argv[]) 
 {    
+    Metrics_StartupBegin();
     printf( "%s\n", version );
     
     parseCommandLine( argc, argv );
-    Logger_Initialize( "/tmp/epsolar_mqtt.log", loggingLevel );           
+    AsyncLog_Initialize( LOG_DEFAULT_FILE, loggingLevel, logMaxMB );
     Logger_LogWarning( "EPSOLAR_MQTT version: [%s]\n", version );
     Logger_LogWarning( "  libepsolar version: [%s]\n", epsolarGetVersion() );
     Logger_LogWarning( "  libmodbus version: [%s]\n", LIBMODBUS_VERSION_STRING );
     Logger_LogWarning( "  libmqttrv version: [%s]\n", MQTT_GetLibraryVersion() );
+
+    //
+    //  The field table drives the read plans and the messages, so the masks
+    //  go on before anything is planned
+    if (!RealTimeFields_CheckKeys() || !RealTimeFields_SetMask( onlyFields, exceptFields ))
+        return( EXIT_FAILURE );
+    for (int i = 0; i < numGroupSpecs; i += 1)
+        if (!FieldGroups_Parse( groupSpecs[ i ] ))
+            return( EXIT_FAILURE );
+    for (int i = 0; i < numExtraBrokerSpecs; i += 1)
+        if (!Fanout_AddTarget( extraBrokerSpecs[ i ], brokerPort ))
+            return( EXIT_FAILURE );
+    if ((payloadEncoding != PAYLOAD_JSON || Fanout_Wants( FANOUT_CBOR )) && !CborPayload_Initialize( sendExtraData ))
+        return( EXIT_FAILURE );
+    if (batteryCapacityAh >= 0 && !BatteryAnalytics_Check())
+        return( EXIT_FAILURE );
+    if (batteryCapacityAh == 0 && !sendExtraData)
+        Logger_LogWarning( "No battery capacity - there will be no hours to full / empty without -u <Ah> or -x\n" );
+
+    //
+    //  Before any thread exists, so they all inherit the blocked mask
+    if (reactorMode && !Reactor_BlockSignals())
+        return( EXIT_FAILURE );
     
     //
-    //  Connect to the EPSolar Solar Charge Controller
+    //  Connect to the EPSolar Solar Charge Controller(s). Every Modbus
+    //  transaction goes over our own context for the port, queued through
+    //  that port's bus scheduler. A replay brings its own controllers
+    if (replayFile != NULL && !Capture_OpenReplay( replayFile ))
+        return( EXIT_FAILURE );
+    for (int i = 0; i < numControllerSpecs && replayFile == NULL; i += 1)
+        if (!Controllers_Parse( controllerSpecs[ i ] )) {
+            Logger_LogFatal( "Bad controller list [%s]\n", controllerSpecs[ i ] );
+            return( EXIT_FAILURE );
+        }
+    if (numControllerSpecs == 0 && replayFile == NULL && !Controllers_Add( devicePortName, 1, controllerID ))
+        return( EXIT_FAILURE );
+    Controllers_SetTopics( topTopic );
+    if (!Controllers_Open( settingsRefreshSeconds, clockTolerance, ringCapacity, overflowPolicy, sendExtraData, (replayFile == NULL) ))
+        return( EXIT_FAILURE );
+    if (captureFile != NULL && !Capture_Open( captureFile ))
+        return( EXIT_FAILURE );
     
-    //  Second parmeter is Modbus Slave ID.  '1' is fine
-    if (!epsolarModbusConnect( devicePortName, 1 )) {
-        Logger_LogFatal( "Unable to open default device port %s to connect to the solar charge controller\n", epsolarGetDefaultPortName() );
+    if (historyDirectory != NULL && !Controllers_OpenHistory( historyDirectory, (size_t) historyMB * 1024 * 1024 )) {
+        Logger_LogFatal( "Unable to open the sample history in [%s]\n", historyDirectory );
+        return( EXIT_FAILURE );
+    }
+
+    if (journalDirectory != NULL && !Journal_Open( journalDirectory, (long) journalMaxMB * 1024 * 1024 )) {
+        Logger_LogFatal( "Unable to open the journal in [%s]\n", journalDirectory );
+        return( EXIT_FAILURE );
+    }
+
+    if (keyframeInterval > 0 && !Delta_Initialize( keyframeInterval, deadbandSpec )) {
+        Logger_LogFatal( "Bad deadband list [%s]\n", deadbandSpec );
         return( EXIT_FAILURE );
     }
     
     //
-    // Create a FIFO queue for our incoming Commands over MQTT
-    //createQueue( 0, 0 );
+    //  The journal, the replay and the metrics are for the whole process. They
+    //  go out under the first controller; the journaled messages carry their
+    //  own topic
+    snprintf( replayTopic, sizeof replayTopic, "%s/%d/%s", topTopic, controllers[ 0 ].id, "REPLAY" );
+    if (journalDirectory != NULL)
+        Logger_LogWarning( "Replaying journaled messages to MQTT Topic [%s]\n", replayTopic );
+
+    snprintf( metricsTopic, sizeof metricsTopic, "%s/%d/%s", topTopic, controllers[ 0 ].id, "METRICS" );
+    if (metricsSeconds > 0)
+        Logger_LogWarning( "Publishing pipeline metrics every %d seconds to MQTT Topic [%s]\n", metricsSeconds, metricsTopic );
+    Metrics_Initialize( metricsSeconds, controllers[ 0 ].id, prometheusFile );
+
+
+    //
+    //  Reading faster than we publish - each message carries aggregates of
+    //  the samples taken since the last one
+    int periodMillis = (sampleSeconds > 0) ? (int) (sampleSeconds * 1000.0 + 0.5) : sleepSeconds * 1000;
+    if (periodMillis <= 0)
+        periodMillis = 1000;
+    int samplesPerPublish = (sleepSeconds * 1000 + (periodMillis / 2)) / periodMillis;
+    if (samplesPerPublish < 1)
+        samplesPerPublish = 1;
+    if (samplesPerPublish > 1)
+        Logger_LogWarning( "Reading the controller every %d ms, publishing aggregates of %d samples\n", periodMillis, samplesPerPublish );
 
     //
+    //  Other Modbus programs on this box can read through us instead of
+    //  fighting over the RS485 line
+    if (proxyPort > 0 && replayFile != NULL)
+        Logger_LogWarning( "No Modbus TCP proxy while replaying a capture\n" );
+    else if (proxyPort > 0 && !ModbusProxy_Start( proxyPort, (proxyMaxAgeMillis > 0 ? proxyMaxAgeMillis : 2 * periodMillis) ))
+        return( EXIT_FAILURE );
+
+    //
+    //  No broker yet - Publisher_SetBroker() once there is one
+    publisherConfig_t   publisherConfig = { NULL, replayTopic, metricsTopic,
+                                            (keyframeInterval > 0), replayBatchesPerSecond, samplesPerPublish, runSamples, payloadEncoding,
+                                            (batteryCapacityAh >= 0), batteryCapacityAh };
+    if (!Publisher_Initialize( &publisherConfig ))
+        return( EXIT_FAILURE );
+
+    //
+    //  The extra brokers connect (and reconnect) on their own threads, and
+    //  queue what comes their way until they're up
+    if (!Fanout_Start())
+        return( EXIT_FAILURE );
+
+    //
+    //  One acquisition thread per bus reads its controllers on the dot and drops
+    //  samples into the bus's ring. This thread builds the JSON and publishes
+    //  for all of them, so a slow broker no longer pushes out the next read
+    unsigned long   allocationsBefore = (AllocCounter_Get != NULL) ? AllocCounter_Get() : 0;
+    uint64_t        started = Time_MonotonicNanos();
+
+    //
+    //  With "-E" this thread also runs the MQTT socket in place of mosquitto's
+    //  network thread
+    if (reactorMode && !Reactor_Initialize())
+        return( EXIT_FAILURE );
+
+    //
+    //  Sampling starts now, broker or not. Until we have one the samples wait
+    //  in the rings ("-q" of them per bus), then go out oldest first. A
+    //  replay waits for room in the rings instead
+    acquisitionConfig_t acquisitionConfig = { periodMillis, synchClocks, sendExtraData };
+    if (replayFile != NULL) {
+        if (!Capture_StartReplay( replaySpeed, sendExtraData, (reactorMode ? Reactor_SampleReady : Publisher_SampleReady), replayFinished ))
+            return( EXIT_FAILURE );
+    } else if (!Acquisition_Start( &acquisitionConfig, (reactorMode ? Reactor_SampleReady : Publisher_SampleReady) )) {
+        return( EXIT_FAILURE );
+    }
+
+    //
+    //  The last broker we used and an mDNS search, side by side - or just
+    //  the "-h" one, retried until it answers
+    if (!BrokerDiscovery_Start( (passedInBrokerHost ? brokerHost : NULL), brokerPort, brokerCacheFile ))
+        return( EXIT_FAILURE );
+
     struct mosquitto *aMosquittoInstance;
-    if (!passedInBrokerHost) {
-        Logger_LogWarning( "No MQTT Broker host passed in on command line - trying mDNS to locate broker.\n" );
-        MQTT_ConnectRV( &aMosquittoInstance, 60 );
-    } else {
-        Logger_LogWarning( "MQTT Broker host (%s) passed in on command line. Looking for JUST THAT ONE\n.", brokerHost );
-        if (!MQTT_Initialize( brokerHost, 1883, &aMosquittoInstance )) {
-            Logger_LogFatal( "Unable to find a broker by that name [%s] - we will exit.\n", brokerHost );
+    while ((aMosquittoInstance = BrokerDiscovery_Wait( 250 )) == NULL) {
+        if (reactorMode && Reactor_ShutdownPending()) {
+            Logger_LogWarning( "Shut down before a broker was found\n" );
+            BrokerDiscovery_Stop();
+            Acquisition_Stop();
+            Capture_StopReplay();
+            Capture_Close();
+            ModbusProxy_Stop();
+            Fanout_Stop();
+            Reactor_Close();
+            Controllers_Close();
+            Journal_Close();
+            AsyncLog_Terminate();
+            return( EXIT_SUCCESS );
         }
     }
-    
-#if 0    
-    //
-    //  Start up a new thread to watch the Command Queue
-    pthread_t   commandProcessingThread;
-    if(pthread_create( &commandProcessingThread, NULL, processInboundCommand, NULL ) ) {
-        Logger_LogFatal( "Unable to start the command processing thread!\n" );
-        perror( "Error:" );
-        return -1;
-    }
-#endif 
-    
+    Publisher_SetBroker( aMosquittoInstance );
 
     //
-    //  Concatenate topTopic and controller ID to create our Pub and Sub Topics
-    snprintf( publishTopic, sizeof publishTopic, "%s/%d/%s", topTopic, controllerID, "DATA" );
-    Logger_LogWarning( "Publishing messages to MQTT Topic [%s]\n", publishTopic );
-    
-    snprintf( subscriptionTopic, sizeof subscriptionTopic, "%s/%d/%s", topTopic, controllerID, "COMMAND" );
-    Logger_LogWarning( "Subscribing to commands on MQTT Topic [%s]\n", subscriptionTopic );
-    MQTT_Subscribe( aMosquittoInstance, subscriptionTopic, 0 );
+    //  Commands are picked off the MQTT thread and run on the bus as soon as
+    //  they arrive - they don't wait for the next polling period. There is
+    //  no bus to run them on in a replay
+    if (replayFile == NULL && !Commands_Start( aMosquittoInstance ))
+        return( EXIT_FAILURE );
+    if (historyDirectory != NULL && !HistoryQuery_Start( aMosquittoInstance ))
+        return( EXIT_FAILURE );
+    for (int i = 0; i < numControllers; i += 1) {
+        if (payloadEncoding != PAYLOAD_CBOR)
+            Logger_LogWarning( "Publishing messages to MQTT Topic [%s]\n", controllers[ i ].dataTopic );
+        if (payloadEncoding != PAYLOAD_JSON)
+            Logger_LogWarning( "Publishing CBOR messages to MQTT Topic [%s], schema on [%s]\n", controllers[ i ].binaryTopic, controllers[ i ].schemaTopic );
+        if (replayFile == NULL) {
+            Logger_LogWarning( "Subscribing to commands on MQTT Topic [%s]\n", controllers[ i ].commandTopic );
+            MQTT_Subscribe( aMosquittoInstance, controllers[ i ].commandTopic, 0 );
+        }
+        if (historyDirectory != NULL)
+            Logger_LogWarning( "Answering history queries on MQTT Topic [%s]\n", controllers[ i ].historyTopic );
+        if (sendExtraData)
+            Logger_LogWarning( "Publishing retained controller settings to MQTT Topic [%s]\n", controllers[ i ].settingsTopic );
+    }
 
-        
-    //
-    //  Loop forever - read SCC data and send it out
-    epsolarRealTimeData_t   realTimeData;
-    
-    while (TRUE) {
-        if (synchClocks)
-            eps_setRealtimeClockToNow();
-        
-        //
-        //  every time thru the loop - zero out the structs!
-        memset( &realTimeData, '\0', sizeof( epsolarRealTimeData_t ) );
-        epsolarGetRealTimeData( &realTimeData );
-        
-        //
-        // craft a JSON message from the data 
-        char    *jsonMessage = realTimeDataToJSON( publishTopic, &realTimeData );
-       
-        //
-        // Publish it to our MQTT broker; QoS = 0
-        MQTT_Publish( aMosquittoInstance, publishTopic, jsonMessage, 0 );
-        
-        free( jsonMessage );
-        sleep( sleepSeconds );
+    if (reactorMode) {
+        Reactor_Attach( aMosquittoInstance );
+        Reactor_Run();
+    } else {
+        Publisher_Run();
     }
 
     
     //
-    // we never get here!
-    MQTT_Unsubscribe( aMosquittoInstance, subscriptionTopic );
+    // we only get here with "-n", at the end of a "-X" replay, or on SIGTERM / ^C with "-E"
+    uint64_t        elapsed = Time_MonotonicNanos() - started;
+    unsigned long   allocations = (AllocCounter_Get != NULL) ? AllocCounter_Get() - allocationsBefore : 0;
+    BrokerDiscovery_Stop();
+    Acquisition_Stop();
+    Capture_StopReplay();
+    Capture_Close();
+    ModbusProxy_Stop();
+    Commands_Stop();
+    HistoryQuery_Stop();
+    for (int i = 0; i < numControllers; i += 1)
+        MQTT_Unsubscribe( aMosquittoInstance, controllers[ i ].commandTopic );
     MQTT_Teardown( aMosquittoInstance, NULL );
+    Fanout_Stop();
+    if (reactorMode)
+        Reactor_Close();
+    Controllers_Close();
+    Journal_Close();
 
-    //if (pthread_join( commandProcessingThread, NULL )) {
-    //    Logger_LogError( "Shutting down but unable to join the commandProcessingThread\n" );
-    //}    
-    
-    //destroyQueue();
+    if (runSamples > 0 || replayFile != NULL)
+        reportRun( elapsed, allocations );
     
-    Logger_LogWarning( "Exiting (should not happen)" );
-    Logger_Terminate();
+    if (runSamples > 0)
+        Logger_LogWarning( "Exiting after %lu samples\n", runSamples );
+    else
+        Logger_LogWarning( "Exiting\n" );
+    AsyncLog_Terminate();
     
     return( EXIT_SUCCESS );
 }
 
+// -----------------------------------------------------------------------------
+static
+void    reportRun (uint64_t elapsedNanos, unsigned long allocations)
+{
+    //
+    //  One line, same keys every time, so runs can be diffed across commits
+    histogram_t         cycle, endToEnd;
+    acquisitionStats_t  acquisition;
+    publisherStats_t    publisher;
+    busStats_t          bus;
+    struct rusage       usage;
+
+    Metrics_GetHistogram( STAGE_CYCLE, &cycle );
+    Metrics_GetHistogram( STAGE_END_TO_END, &endToEnd );
+    Acquisition_GetStats( &acquisition );
+    Publisher_GetStats( &publisher );
+    if (replayFile != NULL) {
+        //
+        //  A replayed record stands in for a cycle
+        captureStats_t  capture;
+        Capture_GetStats( &capture );
+        acquisition.cycles = capture.records;
+    }
+    Controllers_GetBusStats( &bus );
+    getrusage( RUSAGE_SELF, &usage );
+
+    double  seconds = elapsedNanos / (double) NANOS_PER_SECOND;
+    double  cycles = (acquisition.cycles > 0) ? (double) acquisition.cycles : 1.0;
+
+    printf( "RESULT cycles=%lu seconds=%.3f cyclesPerSec=%.1f cycleP50Ms=%.3f cycleP99Ms=%.3f cycleMaxMs=%.3f "
+            "e2eP50Ms=%.3f e2eP99Ms=%.3f missed=%lu published=%lu failures=%lu modbusErrors=%lu "
+            "allocsPerCycle=%s%.1f maxRssKB=%ld\n",
+            acquisition.cycles, seconds, acquisition.cycles / seconds,
+            Histogram_PercentileMicros( &cycle, 50.0 ) / 1000.0,
+            Histogram_PercentileMicros( &cycle, 99.0 ) / 1000.0,
+            cycle.maxMicros / 1000.0,
+            Histogram_PercentileMicros( &endToEnd, 50.0 ) / 1000.0,
+            Histogram_PercentileMicros( &endToEnd, 99.0 ) / 1000.0,
+            acquisition.missedDeadlines, publisher.published, publisher.failures, bus.errors,
+            (AllocCounter_Get != NULL ? "" : "n/a:"), allocations / cycles,
+            usage.ru_maxrss );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    replayFinished (void)
+{
+    //
+    //  On the replay thread, once the last sample has been published
+    Publisher_Stop();
+    if (reactorMode)
+        Reactor_SampleReady();
+}
+
 // -----------------------------------------------------------------------------
 static
 void    showHelp()
 {
     puts( "Options" );
     puts( "  -h  <string>   MQTT host to connect to" );
+    puts( "                 repeat to also publish to host[:port][?qos=N&encoding=json|cbor|both&queue=N] (up to 4 more)" );
+    puts( "  -P  N          MQTT port on that host (defaults to 1883)" );
+    puts( "  -A  <string>   without -h, cache the broker address here and try it first (defaults to " BROKER_DEFAULT_CACHE_FILE ", 'none' to turn off)" );
     puts( "  -t  <string>   MQTT top level topic" );
     puts( "  -s  N          sleep between sends <seconds>" );
+    puts( "  -r  N          read the controller every N seconds (eg: 1) and publish min/max/mean/Wh every -s" );
     puts( "  -i  N          give this controller an identifier (defaults to 1)" );
     puts( "  -p  <string>   open this /dev/port to talk to contoller (defaults to /dev/ttyUSB0)" );
+    puts( "                 or tcp://host[:port][?inflight=N] for a Modbus TCP gateway" );
+    puts( "  -C  <string>   poll these controllers: port:slave=id[,slave=id...] - repeat for more ports" );
     puts( "  -v  N          logging level 1..5" );
+    puts( "  -l  N          rotate " LOG_DEFAULT_FILE " at N megabytes, keeping 3 old ones, 0 for no cap (defaults to 4)" );
     puts( "  -c             do NOT synch clocks (default is to synch)" );
+    puts( "  -y  N          only set the controller clock when it is more than N seconds off (defaults to 5)" );
+    puts( "  -x             send extra data (status bits and controller settings)" );
+    puts( "  -S  N          re-read controller settings every N seconds (defaults to 3600)" );
+    puts( "  -k  N          delta mode: only send fields that changed, full message every N cycles" );
+    puts( "  -d  <string>   delta mode deadbands, eg: batteryVoltage=0.05,pvPower=2" );
+    puts( "  -f  <string>   only read and publish these fields, eg: pvPower,batteryVoltage,batterySOC" );
+    puts( "  -F  <string>   read and publish every field but these" );
+    puts( "  -B  <string>   'cbor' - also publish each sample as CBOR on <topic>/<id>/CBOR, 'cbor-only' - instead of DATA" );
+    puts( "  -u  N          add battery estimates to DATA: resistance, hours to full/empty, SoC trend, Ah today" );
+    puts( "                 N is the battery capacity in Ah, 0 to take it from the controller (needs -x)" );
+    puts( "  -g  <string>   also publish a field group on DATA/name: name:seconds[:retain][:split]=key,prefix*,..." );
+    puts( "                 eg: fast:1=pvPower,batteryCurrent  energy:300:retain=energy*  - repeat for more groups" );
+    puts( "  -q  N          buffer up to N samples while the broker is slow (defaults to 64)" );
+    puts( "  -o  <string>   when that buffer fills drop the 'oldest' (default) or 'newest' sample" );
+    puts( "  -j  <string>   journal messages to this directory while the broker is unreachable" );
+    puts( "  -J  N          cap the journal at N megabytes (defaults to 64)" );
+    puts( "  -b  N          replay the journal at N batches per second (defaults to 2)" );
+    puts( "  -m  N          publish pipeline metrics every N seconds, 0 for none (defaults to 300)" );
+    puts( "  -e  <string>   also write the metrics to this Prometheus textfile" );
+    puts( "  -H  <string>   keep a compressed sample history in this directory, queryable on COMMAND" );
+    puts( "  -z  N          history file size per controller in megabytes (defaults to 8)" );
+    puts( "  -M  N          serve the polled registers to other programs on Modbus TCP port N (localhost only)" );
+    puts( "  -a  N          proxy answers from registers at most N ms old, else asks the controller (defaults to 2 periods)" );
+    puts( "  -E             run the main loop on epoll (no MQTT network thread, clean exit on SIGTERM)" );
+    puts( "  -n  N          exit after N samples and print a one line performance report" );
+    puts( "  -R  <string>   record every register the controllers send back to this capture file" );
+    puts( "  -X  <string>   publish a capture file instead of reading controllers, then report and exit" );
+    puts( "  -L  N          replay it N times faster than it was recorded, 0 as fast as it will go (defaults to 1000)" );
     exit( 1 ); 
 }
 
@@ -176,31 +464,121 @@ void    parseCommandLine (int argc, char *argv[])
 {
     //
     //  Options
-    //  -h  <string>    MQTT host to connect to
+    //  -h  <string>    MQTT host to connect to; again for each extra broker to publish to
+    //  -P  N           MQTT port
+    //  -A  <string>    broker address cache file, or none
     //  -t  <string>    MQTT top level topic
     //  -s  N           sleep between sends <seconds>
+    //  -r  N           internal sample period <seconds>, aggregated over -s
     //  -i  <string>    give this controller an identifier (defaults to LS1024B_1)
     //  -p  <string>    open this /dev/port to talk to contoller (defaults to /dev/ttyUSB0
+    //                  or tcp://host[:port][?inflight=N]
+    //  -C  <string>    controller list: port:slave=id[,slave=id...], repeatable
     //  -x              send extra data
+    //  -S  N           settings refresh interval <seconds>
+    //  -k  N           delta publishing, keyframe every N cycles
+    //  -d  <string>    delta publishing deadbands field=value,...
+    //  -f  <string>    field mask: only these fields
+    //  -F  <string>    field mask: all but these fields
+    //  -B  <string>    binary payload: cbor | cbor-only
+    //  -u  N           battery analytics, capacity <Ah> or 0 for the controller's setting
+    //  -g  <string>    field group name:seconds[:retain][:split]=keys, repeatable
+    //  -q  N           sample ring capacity
+    //  -o  <string>    sample ring overflow policy: oldest | newest
+    //  -j  <string>    store and forward journal directory
+    //  -J  N           journal size cap <megabytes>
+    //  -b  N           journal replay batches per second
+    //  -l  N           log file cap <megabytes>
     //  -c              do NOT synch controller clock
+    //  -y  N           controller clock drift tolerance <seconds>
+    //  -m  N           metrics interval <seconds>
+    //  -e  <string>    Prometheus textfile for the metrics
+    //  -H  <string>    sample history directory
+    //  -z  N           sample history size per controller <megabytes>
+    //  -M  N           Modbus TCP proxy port
+    //  -a  N           Modbus TCP proxy max register age <milliseconds>
+    //  -E              epoll / timerfd / signalfd main loop
+    //  -n  N           run N samples then report and exit (benchmarking)
+    //  -R  <string>    register capture file to write
+    //  -X  <string>    register capture file to replay
+    //  -L  N           replay speed factor, 0 - unpaced
     char    c;
     
-    while (((c = getopt( argc, argv, "h:t:s:i:p:v:j:c:x" )) != -1) && (c != 255)) {
+    while (((c = getopt( argc, argv, "h:t:s:r:i:p:v:l:j:c:xS:k:d:q:o:J:b:y:m:e:P:n:C:M:a:H:z:Ef:F:g:B:A:R:X:L:u:" )) != -1) && (c != 255)) {
         switch (c) {
-            case 'h':   brokerHost = optarg;
-                        passedInBrokerHost = TRUE;
+            case 'h':   if (!passedInBrokerHost) {
+                            brokerHost = optarg;
+                            passedInBrokerHost = TRUE;
+                        } else if (numExtraBrokerSpecs < FANOUT_MAX_TARGETS) {
+                            extraBrokerSpecs[ numExtraBrokerSpecs++ ] = optarg;
+                        } else {
+                            showHelp();
+                        }
                         break;
                         
+            case 'P':   brokerPort = atoi( optarg );    break;
+            case 'A':   brokerCacheFile = (strcmp( optarg, "none" ) == 0) ? NULL : optarg;     break;
             case 's':   sleepSeconds = atoi( optarg );  break;
+            case 'r':   sampleSeconds = atof( optarg ); break;
             case 't':   topTopic = optarg;              break;
             case 'i':   controllerID = atoi( optarg );  break;
             case 'p':   devicePortName = optarg;        break;
             case 'v':   loggingLevel = atoi( optarg );  break;
+            case 'l':   logMaxMB = atoi( optarg );      break;
             case 'c':   synchClocks = FALSE;            break;
+            case 'y':   clockTolerance = atoi( optarg );            break;
             case 'x':   sendExtraData = TRUE;           break;
+            case 'S':   settingsRefreshSeconds = atoi( optarg );    break;
+            case 'k':   keyframeInterval = atoi( optarg );          break;
+            case 'd':   deadbandSpec = optarg;                      break;
+            case 'f':   onlyFields = optarg;                        break;
+            case 'F':   exceptFields = optarg;                      break;
+            case 'j':   journalDirectory = optarg;                  break;
+            case 'J':   journalMaxMB = atoi( optarg );              break;
+            case 'b':   replayBatchesPerSecond = atoi( optarg );    break;
+            case 'q':   ringCapacity = atoi( optarg );              break;
+            case 'm':   metricsSeconds = atoi( optarg );            break;
+            case 'e':   prometheusFile = optarg;                    break;
+            case 'H':   historyDirectory = optarg;                  break;
+            case 'z':   historyMB = atoi( optarg );                 break;
+            case 'M':   proxyPort = atoi( optarg );                 break;
+            case 'a':   proxyMaxAgeMillis = atoi( optarg );         break;
+            case 'E':   reactorMode = TRUE;                         break;
+            case 'n':   runSamples = strtoul( optarg, NULL, 10 );   break;
+            case 'R':   captureFile = optarg;                       break;
+            case 'X':   replayFile = optarg;                        break;
+            case 'L':   replaySpeed = atof( optarg );               break;
+            case 'u':   batteryCapacityAh = atof( optarg );         break;
+            case 'g':   if (numGroupSpecs >= MAX_FIELD_GROUPS)
+                            showHelp();
+                        groupSpecs[ numGroupSpecs++ ] = optarg;
+                        break;
+            case 'C':   if (numControllerSpecs >= MAX_BUSES)
+                            showHelp();
+                        controllerSpecs[ numControllerSpecs++ ] = optarg;
+                        break;
+            case 'B':   if (strcmp( optarg, "cbor" ) == 0)
+                            payloadEncoding = PAYLOAD_JSON_AND_CBOR;
+                        else if (strcmp( optarg, "cbor-only" ) == 0)
+                            payloadEncoding = PAYLOAD_CBOR;
+                        else
+                            showHelp();
+                        break;
+            case 'o':   if (strcmp( optarg, "newest" ) == 0)
+                            overflowPolicy = OVERFLOW_DROP_NEWEST;
+                        else if (strcmp( optarg, "oldest" ) == 0)
+                            overflowPolicy = OVERFLOW_DROP_OLDEST;
+                        else
+                            showHelp();
+                        break;
             
             default:    showHelp();     break;
         }
     }
+
+    //
+    //  Recording a replay would only copy the file
+    if ((captureFile != NULL && replayFile != NULL) || replaySpeed < 0)
+        showHelp();
 }
 
@@ -0,0 +1,317 @@
+/*
+ * File:    metrics.c
+ * author:  patrick conroy
+ *
+ * Histograms are cumulative from startup. The METRICS message reports the
+ * last interval only (the difference from the previous snapshot), which is
+ * what you want when comparing controllers across the fleet. The Prometheus
+ * file stays cumulative, the way Prometheus expects counters and summaries.
+ *
+ *  {"topic":..,"version":"4.0","dateTime":..,"intervalSeconds":300,
+ *   "stages":{"modbusRead":{"count":300,"meanMillis":..,"p50Millis":..,
+ *                           "p90Millis":..,"p99Millis":..,"maxMillis":..}, ..},
+ *   "counters":{"modbusTransactions":..,"modbusErrors":.., ..}}
+ *
+ * It also carries how long startup took to get to the first sample, the
+ * broker and the first publish - "startup":{"firstSampleMillis":..,..} -
+ * so slow restarts show up across the fleet.
+ *
+ * The Prometheus file is written to a temp file and renamed over the old one,
+ * so node_exporter never reads half of it.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "jsonWriter.h"
+#include "histogram.h"
+#include "modbusBus.h"
+#include "sampleRing.h"
+#include "controllers.h"
+#include "acquisition.h"
+#include "publisher.h"
+#include "journal.h"
+#include "timeUtils.h"
+#include "metrics.h"
+
+
+#define METRICS_BUFFER_SIZE     4096
+
+typedef struct  metricsCounters {
+    unsigned long   modbusTransactions;
+    unsigned long   modbusErrors;
+    unsigned long   modbusTimeouts;
+    unsigned long   modbusReconnects;
+    unsigned long   cycles;
+    unsigned long   missedDeadlines;
+    unsigned long   ringDropped;
+    unsigned long   published;
+    unsigned long   publishFailures;
+    unsigned long   payloadBytes;
+    unsigned long   journaled;
+    unsigned long   journalPending;
+} metricsCounters_t;
+
+extern  char    *getDateTime( time_t when );
+
+static  const char  *stageNames[ METRICS_NUM_STAGES ] = {
+    "clockSync", "busWait", "modbusRead", "settingsRead", "cycle", "serialize", "publish", "endToEnd", "command", "proxy"
+};
+
+static  histogram_t     histograms[ METRICS_NUM_STAGES ];
+static  histogram_t     previous[ METRICS_NUM_STAGES ];     // as of the last METRICS message
+static  histogram_t     interval;
+
+static  const char      *startupNames[ STARTUP_NUM_EVENTS ] = { "firstSample", "broker", "firstPublish" };
+static  uint64_t        startupBeganNanos = 0;
+static  uint64_t        startupNanos[ STARTUP_NUM_EVENTS ];  // 0 - hasn't happened yet
+
+static  uint64_t        intervalNanos = 0;
+static  uint64_t        nextSnapshotNanos = 0;
+static  uint64_t        lastSnapshotNanos = 0;
+static  int             controller = 1;
+static  const char      *prometheusPath = NULL;
+
+static  char            metricsBuffer[ METRICS_BUFFER_SIZE ];
+
+
+// -----------------------------------------------------------------------------
+void    Metrics_Initialize (int intervalSeconds, int controllerID, const char *prometheusFile)
+{
+    for (int i = 0; i < METRICS_NUM_STAGES; i += 1) {
+        Histogram_Reset( &histograms[ i ] );
+        Histogram_Reset( &previous[ i ] );
+    }
+
+    intervalNanos = (intervalSeconds > 0) ? (uint64_t) intervalSeconds * NANOS_PER_SECOND : 0;
+    lastSnapshotNanos = Time_MonotonicNanos();
+    nextSnapshotNanos = lastSnapshotNanos + intervalNanos;
+    controller = controllerID;
+    prometheusPath = prometheusFile;
+}
+
+// -----------------------------------------------------------------------------
+void    Metrics_Record (metricsStage_t stage, uint64_t nanos)
+{
+    Histogram_Record( &histograms[ stage ], nanos );
+}
+
+// -----------------------------------------------------------------------------
+void    Metrics_GetHistogram (metricsStage_t stage, histogram_t *histogram)
+{
+    //
+    //  Cumulative since Metrics_Initialize()
+    *histogram = histograms[ stage ];
+}
+
+// -----------------------------------------------------------------------------
+void    Metrics_StartupBegin (void)
+{
+    startupBeganNanos = Time_MonotonicNanos();
+}
+
+// -----------------------------------------------------------------------------
+void    Metrics_StartupEvent (startupEvent_t event)
+{
+    //
+    //  Any thread, any number of times - only the first one counts
+    uint64_t elapsed = Time_MonotonicNanos() - startupBeganNanos;
+    if (elapsed == 0)
+        elapsed = 1;
+    if (!__sync_bool_compare_and_swap( &startupNanos[ event ], 0, elapsed ))
+        return;
+
+    if (event == STARTUP_FIRST_PUBLISH)
+        Logger_LogWarning( "Startup: first sample after %lu ms, broker after %lu ms, first publish after %lu ms\n",
+                            (unsigned long) (startupNanos[ STARTUP_FIRST_SAMPLE ] / NANOS_PER_MILLI),
+                            (unsigned long) (startupNanos[ STARTUP_BROKER ] / NANOS_PER_MILLI),
+                            (unsigned long) (startupNanos[ STARTUP_FIRST_PUBLISH ] / NANOS_PER_MILLI) );
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    Metrics_StartupNanos (startupEvent_t event)
+{
+    return startupNanos[ event ];
+}
+
+// -----------------------------------------------------------------------------
+int Metrics_IsDue (uint64_t nowNanos)
+{
+    if (intervalNanos == 0 || nowNanos < nextSnapshotNanos)
+        return FALSE;
+
+    nextSnapshotNanos = nowNanos + intervalNanos;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    gatherCounters (metricsCounters_t *counters)
+{
+    busStats_t          bus;
+    acquisitionStats_t  acquisition;
+    sampleRingStats_t   ring;
+    publisherStats_t    publisher;
+    journalStats_t      journal;
+
+    Controllers_GetBusStats( &bus );
+    Acquisition_GetStats( &acquisition );
+    Controllers_GetRingStats( &ring );
+    Publisher_GetStats( &publisher );
+    Journal_GetStats( &journal );
+
+    counters->modbusTransactions = bus.transactions;
+    counters->modbusErrors = bus.errors;
+    counters->modbusTimeouts = bus.timeouts;
+    counters->modbusReconnects = bus.reconnects;
+    counters->cycles = acquisition.cycles;
+    counters->missedDeadlines = acquisition.missedDeadlines;
+    counters->ringDropped = ring.dropped;
+    counters->published = publisher.published;
+    counters->publishFailures = publisher.failures;
+    counters->payloadBytes = publisher.payloadBytes;
+    counters->journaled = publisher.journaled;
+    counters->journalPending = (Journal_IsOpen() ? journal.pendingRecords : 0);
+}
+
+// -----------------------------------------------------------------------------
+const char  *Metrics_ToJSON (const char *topic)
+{
+    jsonWriter_t        writer;
+    metricsCounters_t   counters;
+    uint64_t            now = Time_MonotonicNanos();
+
+    JSON_Begin( &writer, metricsBuffer, sizeof metricsBuffer );
+    JSON_AddString( &writer, "topic", topic );
+    JSON_AddString( &writer, "version", "4.0" );
+    JSON_AddString( &writer, "dateTime", getDateTime( time( NULL ) ) );
+    JSON_AddFixed( &writer, "intervalSeconds", (now - lastSnapshotNanos) / (double) NANOS_PER_SECOND, 1 );
+    lastSnapshotNanos = now;
+
+    JSON_BeginObject( &writer, "stages" );
+    for (int i = 0; i < METRICS_NUM_STAGES; i += 1) {
+        histogram_t snapshot = histograms[ i ];
+
+        Histogram_Subtract( &interval, &snapshot, &previous[ i ] );
+        previous[ i ] = snapshot;
+        if (interval.count == 0)
+            continue;
+
+        JSON_BeginObject( &writer, stageNames[ i ] );
+        JSON_AddInt( &writer, "count", (long) interval.count );
+        JSON_AddFixed( &writer, "meanMillis", Histogram_MeanMicros( &interval ) / 1000.0, 3 );
+        JSON_AddFixed( &writer, "p50Millis", Histogram_PercentileMicros( &interval, 50.0 ) / 1000.0, 3 );
+        JSON_AddFixed( &writer, "p90Millis", Histogram_PercentileMicros( &interval, 90.0 ) / 1000.0, 3 );
+        JSON_AddFixed( &writer, "p99Millis", Histogram_PercentileMicros( &interval, 99.0 ) / 1000.0, 3 );
+        JSON_AddFixed( &writer, "maxMillis", interval.maxMicros / 1000.0, 3 );
+        JSON_EndObject( &writer );
+    }
+    JSON_EndObject( &writer );
+
+    JSON_BeginObject( &writer, "startup" );
+    for (int i = 0; i < STARTUP_NUM_EVENTS; i += 1) {
+        char    key[ 32 ];
+        if (startupNanos[ i ] == 0)
+            continue;
+        snprintf( key, sizeof key, "%sMillis", startupNames[ i ] );
+        JSON_AddInt( &writer, key, (long) (startupNanos[ i ] / NANOS_PER_MILLI) );
+    }
+    JSON_EndObject( &writer );
+
+    gatherCounters( &counters );
+    JSON_BeginObject( &writer, "counters" );
+    JSON_AddInt( &writer, "modbusTransactions", counters.modbusTransactions );
+    JSON_AddInt( &writer, "modbusErrors", counters.modbusErrors );
+    JSON_AddInt( &writer, "modbusTimeouts", counters.modbusTimeouts );
+    JSON_AddInt( &writer, "modbusReconnects", counters.modbusReconnects );
+    JSON_AddInt( &writer, "cycles", counters.cycles );
+    JSON_AddInt( &writer, "missedDeadlines", counters.missedDeadlines );
+    JSON_AddInt( &writer, "ringDropped", counters.ringDropped );
+    JSON_AddInt( &writer, "published", counters.published );
+    JSON_AddInt( &writer, "publishFailures", counters.publishFailures );
+    JSON_AddInt( &writer, "payloadBytes", counters.payloadBytes );
+    JSON_AddInt( &writer, "journaled", counters.journaled );
+    JSON_AddInt( &writer, "journalPending", counters.journalPending );
+    JSON_EndObject( &writer );
+
+    const char *message = JSON_End( &writer );
+    if (message == NULL)
+        Logger_LogError( "Metrics message does not fit in %d bytes!\n", METRICS_BUFFER_SIZE );
+    return message;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    writeCounter (FILE *fp, const char *name, const char *help, const char *type, unsigned long value)
+{
+    fprintf( fp, "# HELP %s %s\n", name, help );
+    fprintf( fp, "# TYPE %s %s\n", name, type );
+    fprintf( fp, "%s{controller=\"%d\"} %lu\n", name, controller, value );
+}
+
+// -----------------------------------------------------------------------------
+int Metrics_WritePrometheus (void)
+{
+    char                tempPath[ 1024 ];
+    metricsCounters_t   counters;
+    static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+    if (prometheusPath == NULL)
+        return TRUE;
+
+    snprintf( tempPath, sizeof tempPath, "%s.tmp", prometheusPath );
+    FILE *fp = fopen( tempPath, "w" );
+    if (fp == NULL) {
+        Logger_LogWarning( "Unable to write metrics to [%s]\n", tempPath );
+        return FALSE;
+    }
+
+    fprintf( fp, "# HELP epsolar_stage_seconds Time spent in each stage of the polling pipeline\n" );
+    fprintf( fp, "# TYPE epsolar_stage_seconds summary\n" );
+    for (int i = 0; i < METRICS_NUM_STAGES; i += 1) {
+        const histogram_t *histogram = &histograms[ i ];
+
+        for (size_t q = 0; q < sizeof quantiles / sizeof quantiles[ 0 ]; q += 1)
+            fprintf( fp, "epsolar_stage_seconds{controller=\"%d\",stage=\"%s\",quantile=\"%g\"} %.6f\n",
+                        controller, stageNames[ i ], quantiles[ q ],
+                        Histogram_PercentileMicros( histogram, quantiles[ q ] * 100.0 ) / 1e6 );
+        fprintf( fp, "epsolar_stage_seconds_sum{controller=\"%d\",stage=\"%s\"} %.6f\n", controller, stageNames[ i ], histogram->sumMicros / 1e6 );
+        fprintf( fp, "epsolar_stage_seconds_count{controller=\"%d\",stage=\"%s\"} %lu\n", controller, stageNames[ i ], (unsigned long) histogram->count );
+    }
+
+    fprintf( fp, "# HELP epsolar_startup_seconds Time from process start to each startup milestone\n" );
+    fprintf( fp, "# TYPE epsolar_startup_seconds gauge\n" );
+    for (int i = 0; i < STARTUP_NUM_EVENTS; i += 1)
+        if (startupNanos[ i ] != 0)
+            fprintf( fp, "epsolar_startup_seconds{controller=\"%d\",event=\"%s\"} %.3f\n",
+                        controller, startupNames[ i ], startupNanos[ i ] / (double) NANOS_PER_SECOND );
+
+    gatherCounters( &counters );
+    writeCounter( fp, "epsolar_modbus_transactions_total", "Modbus requests sent on our own context", "counter", counters.modbusTransactions );
+    writeCounter( fp, "epsolar_modbus_errors_total", "Modbus requests that failed", "counter", counters.modbusErrors );
+    writeCounter( fp, "epsolar_modbus_timeouts_total", "Modbus requests that timed out", "counter", counters.modbusTimeouts );
+    writeCounter( fp, "epsolar_modbus_reconnects_total", "Modbus TCP connections re-established", "counter", counters.modbusReconnects );
+    writeCounter( fp, "epsolar_cycles_total", "Acquisition cycles", "counter", counters.cycles );
+    writeCounter( fp, "epsolar_missed_deadlines_total", "Polling periods skipped because a cycle overran", "counter", counters.missedDeadlines );
+    writeCounter( fp, "epsolar_ring_dropped_total", "Samples dropped between acquisition and publishing", "counter", counters.ringDropped );
+    writeCounter( fp, "epsolar_published_total", "DATA messages published", "counter", counters.published );
+    writeCounter( fp, "epsolar_publish_failures_total", "DATA messages the broker did not take", "counter", counters.publishFailures );
+    writeCounter( fp, "epsolar_payload_bytes_total", "DATA payload bytes published", "counter", counters.payloadBytes );
+    writeCounter( fp, "epsolar_journaled_total", "DATA messages written to the journal", "counter", counters.journaled );
+    writeCounter( fp, "epsolar_journal_pending", "Journaled messages waiting to be replayed", "gauge", counters.journalPending );
+
+    int ok = (fclose( fp ) == 0);
+    if (!ok || rename( tempPath, prometheusPath ) != 0) {
+        Logger_LogWarning( "Unable to write metrics to [%s]\n", prometheusPath );
+        remove( tempPath );
+        return FALSE;
+    }
+
+    return TRUE;
+}
@@ -0,0 +1,60 @@
+/*
+ * File:   metrics.h
+ * Author: pconroy
+ *
+ * Per-stage latency histograms for the polling pipeline, plus a periodic
+ * snapshot of them and the pipeline counters on <topTopic>/<id>/METRICS and,
+ * optionally, in a Prometheus textfile-collector file.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "histogram.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METRICS_DEFAULT_INTERVAL_SECONDS    300
+
+typedef enum {
+    STAGE_CLOCK_SYNC = 0,               // read (and maybe set) the controller clock
+    STAGE_BUS_WAIT,                     // realtime poll queued behind other bus jobs
+    STAGE_MODBUS_READ,                  // the realtime block reads
+    STAGE_SETTINGS_READ,
+    STAGE_CYCLE,                        // whole acquisition cycle
+    STAGE_SERIALIZE,                    // building the JSON
+    STAGE_PUBLISH,                      // mosquitto_publish()
+    STAGE_END_TO_END,                   // sample read -> message published
+    STAGE_COMMAND,                      // command received -> applied
+    STAGE_PROXY,                        // Modbus TCP proxy request received -> answered
+    METRICS_NUM_STAGES
+} metricsStage_t;
+
+//
+//  One-off milestones, timed from Metrics_StartupBegin() at the top of main()
+typedef enum {
+    STARTUP_FIRST_SAMPLE = 0,           // first sample in a ring
+    STARTUP_BROKER,                     // connected to the broker
+    STARTUP_FIRST_PUBLISH,              // first DATA message handed to mosquitto
+    STARTUP_NUM_EVENTS
+} startupEvent_t;
+
+extern  void    Metrics_Initialize( int intervalSeconds, int controllerID, const char *prometheusFile );
+extern  void    Metrics_Record( metricsStage_t stage, uint64_t nanos );
+extern  int     Metrics_IsDue( uint64_t nowNanos );
+extern  const char  *Metrics_ToJSON( const char *topic );
+extern  int     Metrics_WritePrometheus( void );
+extern  void    Metrics_GetHistogram( metricsStage_t stage, histogram_t *histogram );
+extern  void    Metrics_StartupBegin( void );
+extern  void    Metrics_StartupEvent( startupEvent_t event );
+extern  uint64_t    Metrics_StartupNanos( startupEvent_t event );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* METRICS_H */
@@ -0,0 +1,714 @@
+/*
+ * File:    modbusBus.c
+ * author:  patrick conroy
+ *
+ * We open our own libmodbus RTU context on each serial port - libepsolar
+ * keeps a single context, for a single slave, to itself. A context is only
+ * ever driven from its bus scheduler's thread, one request at a time, so
+ * nobody talks over anybody else on the RS485 line.
+ *
+ * Behind a Modbus TCP gateway there is no serial turnaround to wait out on
+ * our side, just the network round trip, so Bus_ReadBlocks() writes several
+ * MBAP framed requests before reading the answers back by transaction id.
+ * libmodbus can't do that, so those go straight to its socket. Everything
+ * else still goes through libmodbus, one request at a time, and only after
+ * the pipelined answers are all in, so its transaction ids and ours never
+ * meet on the wire.
+ *
+ * A TCP error other than a Modbus exception leaves the stream in an unknown
+ * state, so the connection is dropped - and whatever pipelined reads hadn't
+ * been answered are retried like any other read once it's back. The next transaction reconnects,
+ * backing off while the gateway stays away. A gateway that times out with
+ * several requests in flight probably can't queue them; we halve the window
+ * each time it does, down to one.
+ *
+ * Each transaction's response timeout comes from the device's response
+ * timer, set on the context just before the request goes out. A read that
+ * timed out or came back garbled is flushed and asked again, up to
+ * BUS_MAX_RETRIES times, each time after a longer pause and with a longer
+ * timeout - unless that wouldn't be over before the deadline, in which case
+ * the caller gets the failure now and the cycle stays on time. Writes are
+ * never repeated: one that timed out may well have been done.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "timeUtils.h"
+#include "modbusBus.h"
+
+
+#define MBAP_HEADER_LENGTH      7
+#define MBAP_MAX_PDU_LENGTH     253
+#define RTU_READ_REQUEST_BYTES  8
+#define RTU_FRAME_GAP_BYTES     7       // 3.5 characters of silence after each frame
+
+typedef int (*readFunction_t)( modbus_t *ctx, int address, int count, void *dest );
+
+
+// -----------------------------------------------------------------------------
+static
+long    elapsedMicros (const struct timespec *start, const struct timespec *end)
+{
+    return ((end->tv_sec - start->tv_sec) * 1000000L) + ((end->tv_nsec - start->tv_nsec) / 1000L);
+}
+
+// -----------------------------------------------------------------------------
+static
+modbus_t    *newTcpContext (modbusBus_t *bus, const char *portName)
+{
+    //
+    //  tcp://host[:port][?inflight=N]
+    char        host[ 256 ];
+    char        service[ 16 ];
+    const char  *p = portName + strlen( "tcp://" );
+    size_t      hostLength = strcspn( p, ":?" );
+
+    if (hostLength == 0 || hostLength >= sizeof host) {
+        Logger_LogError( "Bad Modbus TCP address [%s]\n", portName );
+        return NULL;
+    }
+    memcpy( host, p, hostLength );
+    host[ hostLength ] = '\0';
+    p += hostLength;
+
+    int port = BUS_DEFAULT_TCP_PORT;
+    if (*p == ':') {
+        port = (int) strtol( p + 1, (char **) &p, 10 );
+        if (port <= 0 || port > 65535) {
+            Logger_LogError( "Bad port in Modbus TCP address [%s]\n", portName );
+            return NULL;
+        }
+    }
+
+    bus->inflight = BUS_DEFAULT_INFLIGHT;
+    if (strncmp( p, "?inflight=", strlen( "?inflight=" ) ) == 0)
+        bus->inflight = atoi( p + strlen( "?inflight=" ) );
+    if (bus->inflight < 1)
+        bus->inflight = 1;
+    if (bus->inflight > BUS_MAX_INFLIGHT)
+        bus->inflight = BUS_MAX_INFLIGHT;
+
+    snprintf( service, sizeof service, "%d", port );
+    return modbus_new_tcp_pi( host, service );
+}
+
+// -----------------------------------------------------------------------------
+int Bus_Open (modbusBus_t *bus, const char *portName)
+{
+    memset( bus, '\0', sizeof( modbusBus_t ) );
+    if (portName == NULL)
+        portName = epsolarGetDefaultPortName();
+    bus->name = portName;
+    bus->inflight = 1;
+
+    if (strncmp( portName, "tcp://", strlen( "tcp://" ) ) == 0) {
+        bus->isTcp = TRUE;
+        bus->ctx = newTcpContext( bus, portName );
+    } else {
+        //
+        //  Same line settings libepsolar uses for the Tracer series: 115200 8N1
+        bus->ctx = modbus_new_rtu( portName, 115200, 'N', 8, 1 );
+    }
+    if (bus->ctx == NULL) {
+        Logger_LogError( "Unable to create a modbus context for [%s]\n", portName );
+        return FALSE;
+    }
+
+    if (modbus_connect( bus->ctx ) == -1) {
+        //
+        //  A gateway that isn't up yet is just reconnected to later; a serial
+        //  port that won't open isn't going to get better
+        if (bus->isTcp) {
+            Logger_LogWarning( "Unable to connect to [%s]: %s - will keep trying\n", portName, modbus_strerror( errno ) );
+            return TRUE;
+        }
+
+        Logger_LogError( "Unable to connect to [%s]: %s\n", portName, modbus_strerror( errno ) );
+        modbus_free( bus->ctx );
+        bus->ctx = NULL;
+        return FALSE;
+    }
+
+    bus->connected = TRUE;
+    if (bus->isTcp)
+        Logger_LogInfo( "Connected to Modbus TCP gateway [%s], up to %d requests in flight\n", portName, bus->inflight );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Bus_Close (modbusBus_t *bus)
+{
+    if (bus->ctx != NULL) {
+        modbus_close( bus->ctx );
+        modbus_free( bus->ctx );
+        bus->ctx = NULL;
+    }
+    bus->connected = FALSE;
+}
+
+// -----------------------------------------------------------------------------
+void    Bus_SetDeadline (modbusBus_t *bus, uint64_t deadlineNanos)
+{
+    bus->deadlineNanos = deadlineNanos;
+}
+
+// -----------------------------------------------------------------------------
+static
+uint64_t    wireNanos (const modbusBus_t *bus, int requestBytes, int responseBytes)
+{
+    //
+    //  RTU is 10 bits a byte. Behind a gateway the network is part of what
+    //  the response timer learns
+    if (bus->isTcp)
+        return 0;
+    return ((uint64_t) (requestBytes + responseBytes + RTU_FRAME_GAP_BYTES) * 10 * NANOS_PER_SECOND) / BUS_SERIAL_BAUD;
+}
+
+// -----------------------------------------------------------------------------
+static
+int isLinkError (int error)
+{
+    //
+    //  An exception means the gateway or the controller answered, just not
+    //  the way we hoped. Anything else and we don't know where the stream is
+    return !(error >= EMBXILFUN && error <= EMBXGTAR);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    dropConnection (modbusBus_t *bus, int error)
+{
+    Logger_LogWarning( "Dropping the connection to [%s]: %s\n", bus->name, modbus_strerror( error ) );
+    modbus_close( bus->ctx );
+    bus->connected = FALSE;
+    bus->nextReconnectNanos = 0;        // first try straight away
+    bus->reconnectMillis = 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+int ensureConnected (modbusBus_t *bus)
+{
+    if (bus->connected)
+        return TRUE;
+
+    uint64_t now = Time_MonotonicNanos();
+    if (now < bus->nextReconnectNanos)
+        return FALSE;
+
+    if (modbus_connect( bus->ctx ) == -1) {
+        bus->reconnectMillis = (bus->reconnectMillis == 0) ? 500 : bus->reconnectMillis * 2;
+        if (bus->reconnectMillis > BUS_MAX_RECONNECT_MILLIS)
+            bus->reconnectMillis = BUS_MAX_RECONNECT_MILLIS;
+        bus->nextReconnectNanos = now + (uint64_t) bus->reconnectMillis * NANOS_PER_MILLI;
+        Logger_LogDebug( "Unable to reconnect to [%s]: %s - next try in %d ms\n", bus->name, modbus_strerror( errno ), bus->reconnectMillis );
+        return FALSE;
+    }
+
+    Logger_LogWarning( "Reconnected to [%s]\n", bus->name );
+    bus->connected = TRUE;
+    bus->reconnectMillis = 0;
+    bus->stats.reconnects += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+modbus_t    *addressDevice (const modbusDevice_t *device, struct timespec *start, uint64_t wire, int attempt)
+{
+    modbusBus_t *bus = device->bus;
+
+    if (bus->ctx == NULL || !ensureConnected( bus ))
+        return NULL;
+
+    if (bus->currentSlave != device->slaveID) {
+        modbus_set_slave( bus->ctx, device->slaveID );
+        bus->currentSlave = device->slaveID;
+    }
+
+    uint64_t    timeout = (device->timer != NULL) ? ResponseTimer_Timeout( device->timer, wire, attempt )
+                                                  : wire + (uint64_t) RESPONSE_INITIAL_TIMEOUT_MILLIS * NANOS_PER_MILLI;
+
+    //
+    //  Backed off waits for a controller that has stopped answering mustn't
+    //  carry the cycle past its deadline - once there, what's left of it
+    //  gets the shortest wait
+    if (bus->deadlineNanos != 0) {
+        uint64_t    now = Time_MonotonicNanos();
+        uint64_t    floor = wire + (uint64_t) RESPONSE_MIN_TIMEOUT_MILLIS * NANOS_PER_MILLI;
+        uint64_t    left = (bus->deadlineNanos > now) ? bus->deadlineNanos - now : 0;
+        if (timeout > left)
+            timeout = (left > floor) ? left : floor;
+    }
+
+    if (timeout != bus->timeoutNanos) {
+        modbus_set_response_timeout( bus->ctx, (uint32_t) (timeout / NANOS_PER_SECOND), (uint32_t) ((timeout % NANOS_PER_SECOND) / NANOS_PER_MICRO) );
+        bus->timeoutNanos = timeout;
+    }
+
+    clock_gettime( CLOCK_MONOTONIC, start );
+    return bus->ctx;
+}
+
+// -----------------------------------------------------------------------------
+static
+int countTransaction (const modbusDevice_t *device, const struct timespec *start, int ok, uint64_t wire)
+{
+    busStats_t      *stats = &device->bus->stats;
+    struct timespec end;
+    int             error = errno;
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    long    micros = elapsedMicros( start, &end );
+    stats->transactions += 1;
+    stats->busyMicros += micros;
+
+    if (ok && device->timer != NULL)
+        ResponseTimer_Answered( device->timer, (uint64_t) micros * NANOS_PER_MICRO, wire );
+
+    if (!ok) {
+        stats->errors += 1;
+        if (error == ETIMEDOUT) {
+            stats->timeouts += 1;
+            if (device->timer != NULL)
+                ResponseTimer_TimedOut( device->timer );
+        }
+        if (device->bus->isTcp && isLinkError( error ))
+            dropConnection( device->bus, error );
+    }
+
+    errno = error;
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+static
+int retry (const modbusDevice_t *device, int attempt, uint64_t wire)
+{
+    modbusBus_t *bus = device->bus;
+    int         error = errno;
+
+    //
+    //  Only a frame the line lost or mangled is worth asking for again - an
+    //  exception would just come back the same
+    if (attempt >= BUS_MAX_RETRIES || (error != ETIMEDOUT && error != EMBBADCRC && error != EMBBADDATA)) {
+        errno = error;
+        return FALSE;
+    }
+
+    uint64_t    pause = ((uint64_t) BUS_RETRY_PAUSE_MILLIS * NANOS_PER_MILLI) << attempt;
+    uint64_t    timeout = (device->timer != NULL) ? ResponseTimer_Timeout( device->timer, wire, attempt + 1 ) : bus->timeoutNanos;
+    if (bus->deadlineNanos != 0 && Time_MonotonicNanos() + pause + timeout > bus->deadlineNanos) {
+        bus->stats.abandoned += 1;
+        errno = error;
+        return FALSE;
+    }
+
+    //
+    //  Let the line go quiet, then throw away whatever half answer came in
+    struct timespec interval = Time_NanosToTimespec( pause );
+    nanosleep( &interval, NULL );
+    if (bus->connected)
+        modbus_flush( bus->ctx );
+
+    bus->stats.retries += 1;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int readWithRetries (const modbusDevice_t *device, readFunction_t function, int address, int count, void *dest, int responseBytes, int firstAttempt)
+{
+    uint64_t    wire = wireNanos( device->bus, RTU_READ_REQUEST_BYTES, responseBytes );
+
+    for (int attempt = firstAttempt; ; attempt += 1) {
+        struct timespec start;
+        modbus_t        *ctx = addressDevice( device, &start, wire, attempt );
+
+        if (ctx == NULL)
+            return FALSE;
+
+        int rc = (*function)( ctx, address, count, dest );
+        if (countTransaction( device, &start, (rc == count), wire )) {
+            if (attempt > 0)
+                device->bus->stats.recovered += 1;
+            return TRUE;
+        }
+
+        if (!retry( device, attempt, wire ))
+            return FALSE;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+int readInputRegisters (modbus_t *ctx, int address, int count, void *dest)
+{
+    return modbus_read_input_registers( ctx, address, count, dest );
+}
+
+// -----------------------------------------------------------------------------
+static
+int readHoldingRegisters (modbus_t *ctx, int address, int count, void *dest)
+{
+    return modbus_read_registers( ctx, address, count, dest );
+}
+
+// -----------------------------------------------------------------------------
+static
+int readCoils (modbus_t *ctx, int address, int count, void *dest)
+{
+    return modbus_read_bits( ctx, address, count, dest );
+}
+
+// -----------------------------------------------------------------------------
+static
+int readDiscreteInputs (modbus_t *ctx, int address, int count, void *dest)
+{
+    return modbus_read_input_bits( ctx, address, count, dest );
+}
+
+// -----------------------------------------------------------------------------
+int Bus_ReadRegisters (const modbusDevice_t *device, registerKind_t kind, int address, int count, uint16_t *dest)
+{
+    readFunction_t  function = (kind == REG_INPUT) ? readInputRegisters : readHoldingRegisters;
+
+    if (!readWithRetries( device, function, address, count, dest, 5 + (2 * count), 0 )) {
+        Logger_LogDebug( "Block read of %d registers at 0x%04X from slave %d failed: %s\n", count, address, device->slaveID, modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int sendAll (int socket, const uint8_t *bytes, size_t length)
+{
+    while (length > 0) {
+        ssize_t sent = send( socket, bytes, length, MSG_NOSIGNAL );
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return FALSE;
+
+        bytes += sent;
+        length -= sent;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int receiveAll (int socket, uint8_t *bytes, size_t length, uint64_t deadlineNanos)
+{
+    while (length > 0) {
+        uint64_t now = Time_MonotonicNanos();
+        if (now >= deadlineNanos) {
+            errno = ETIMEDOUT;
+            return FALSE;
+        }
+
+        struct pollfd   pfd = { socket, POLLIN, 0 };
+        int rc = poll( &pfd, 1, (int) ((deadlineNanos - now + NANOS_PER_MILLI - 1) / NANOS_PER_MILLI) );
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc <= 0) {
+            if (rc == 0)
+                errno = ETIMEDOUT;
+            return FALSE;
+        }
+
+        ssize_t received = recv( socket, bytes, length, 0 );
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0) {
+            if (received == 0)
+                errno = ECONNRESET;
+            return FALSE;
+        }
+
+        bytes += received;
+        length -= received;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int sendRead (modbusBus_t *bus, int socket, int slaveID, busBlockRead_t *read)
+{
+    uint8_t     request[ MBAP_HEADER_LENGTH + 5 ];
+
+    read->transactionID = bus->nextTransactionID++;
+    request[ 0 ] = read->transactionID >> 8;
+    request[ 1 ] = read->transactionID & 0xFF;
+    request[ 2 ] = 0;                           // protocol id, always 0
+    request[ 3 ] = 0;
+    request[ 4 ] = 0;                           // length of what follows
+    request[ 5 ] = 6;
+    request[ 6 ] = slaveID;
+    request[ 7 ] = (read->kind == REG_INPUT) ? 0x04 : 0x03;
+    request[ 8 ] = read->address >> 8;
+    request[ 9 ] = read->address & 0xFF;
+    request[ 10 ] = read->count >> 8;
+    request[ 11 ] = read->count & 0xFF;
+
+    read->sentNanos = Time_MonotonicNanos();
+    return sendAll( socket, request, sizeof request );
+}
+
+// -----------------------------------------------------------------------------
+static
+int receiveAnswer (int socket, busBlockRead_t *reads, int numReads, uint64_t deadline, responseTimer_t *timer)
+{
+    uint8_t     frame[ MBAP_HEADER_LENGTH + MBAP_MAX_PDU_LENGTH ];
+
+    if (!receiveAll( socket, frame, MBAP_HEADER_LENGTH, deadline ))
+        return FALSE;
+
+    //
+    //  The length covers the unit id we already have, plus the PDU
+    int length = (frame[ 4 ] << 8) | frame[ 5 ];
+    if (length < 3 || length > MBAP_MAX_PDU_LENGTH + 1) {
+        errno = EMBBADDATA;
+        return FALSE;
+    }
+    if (!receiveAll( socket, &frame[ MBAP_HEADER_LENGTH ], length - 1, deadline ))
+        return FALSE;
+
+    uint16_t        transactionID = (frame[ 0 ] << 8) | frame[ 1 ];
+    busBlockRead_t  *read = NULL;
+    for (int i = 0; i < numReads && read == NULL; i += 1)
+        if (!reads[ i ].answered && reads[ i ].transactionID == transactionID)
+            read = &reads[ i ];
+
+    //
+    //  An answer to nothing we asked - not fatal, just not counted
+    if (read == NULL)
+        return TRUE;
+
+    const uint8_t   *pdu = &frame[ MBAP_HEADER_LENGTH ];
+    uint8_t         function = (read->kind == REG_INPUT) ? 0x04 : 0x03;
+
+    if (pdu[ 0 ] == (function | 0x80)) {
+        Logger_LogDebug( "Block read of %d registers at 0x%04X refused, exception %d\n", read->count, read->address, pdu[ 1 ] );
+        read->answered = TRUE;
+        return TRUE;
+    }
+
+    //
+    //  A garbled answer leaves the read unanswered, so it's asked again once
+    //  the connection is back
+    if (pdu[ 0 ] != function || pdu[ 1 ] != read->count * 2 || length != 3 + read->count * 2) {
+        errno = EMBBADDATA;
+        return FALSE;
+    }
+    read->answered = TRUE;
+
+    for (int i = 0; i < read->count; i += 1)
+        read->dest[ i ] = (pdu[ 2 + (i * 2) ] << 8) | pdu[ 3 + (i * 2) ];
+    read->ok = TRUE;
+
+    //
+    //  From when this request went out - so time spent queued behind the
+    //  others at the gateway is part of what the timer learns, and of the
+    //  timeout it gives back
+    if (timer != NULL)
+        ResponseTimer_Answered( timer, Time_MonotonicNanos() - read->sentNanos, 0 );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+int pipelineReads (const modbusDevice_t *device, busBlockRead_t *reads, int numReads, int *maxOutstanding)
+{
+    modbusBus_t *bus = device->bus;
+    int         socket = modbus_get_socket( bus->ctx );
+    int         sent = 0, answered = 0;
+
+    //
+    //  addressDevice() just set this from the device's response timer
+    uint64_t    timeout = bus->timeoutNanos;
+
+    while (answered < numReads) {
+        //
+        //  Keep the window full, then take whatever comes back first
+        while (sent < numReads && (sent - answered) < bus->inflight) {
+            if (!sendRead( bus, socket, device->slaveID, &reads[ sent ] ))
+                return FALSE;
+            if ((sent - answered) > 0)
+                bus->stats.pipelined += 1;
+            sent += 1;
+            if ((sent - answered) > *maxOutstanding)
+                *maxOutstanding = sent - answered;
+        }
+
+        //
+        //  Each request gets the timeout from when it went out, so it's the
+        //  oldest one still waiting that runs out first
+        uint64_t    oldest = UINT64_MAX;
+        for (int i = 0; i < sent; i += 1)
+            if (!reads[ i ].answered && reads[ i ].sentNanos < oldest)
+                oldest = reads[ i ].sentNanos;
+
+        if (!receiveAnswer( socket, reads, sent, oldest + timeout, device->timer ))
+            return FALSE;
+
+        answered = 0;
+        for (int i = 0; i < sent; i += 1)
+            answered += reads[ i ].answered;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Bus_ReadBlocks (const modbusDevice_t *device, busBlockRead_t *reads, int numReads)
+{
+    modbusBus_t *bus = device->bus;
+    int         failures = 0;
+
+    for (int i = 0; i < numReads; i += 1) {
+        reads[ i ].ok = FALSE;
+        reads[ i ].answered = FALSE;
+    }
+
+    //
+    //  Serial, or a gateway we only send one at a time: just a loop
+    if (!bus->isTcp || bus->inflight <= 1 || numReads <= 1) {
+        for (int i = 0; i < numReads; i += 1) {
+            reads[ i ].ok = Bus_ReadRegisters( device, reads[ i ].kind, reads[ i ].address, reads[ i ].count, reads[ i ].dest );
+            failures += !reads[ i ].ok;
+        }
+        return (failures == 0);
+    }
+
+    struct timespec start, end;
+    int             maxOutstanding = 0;
+    if (addressDevice( device, &start, 0, 0 ) == NULL)
+        return FALSE;
+
+    int linkOK = pipelineReads( device, reads, numReads, &maxOutstanding );
+    int error = errno;
+
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    bus->stats.busyMicros += elapsedMicros( &start, &end );
+    for (int i = 0; i < numReads; i += 1) {
+        bus->stats.transactions += 1;
+        if (!reads[ i ].ok) {
+            bus->stats.errors += 1;
+            failures += 1;
+        }
+    }
+
+    if (!linkOK) {
+        if (error == ETIMEDOUT) {
+            bus->stats.timeouts += 1;
+            if (device->timer != NULL)
+                ResponseTimer_TimedOut( device->timer );
+            if (maxOutstanding > 1 && bus->inflight > 1) {
+                bus->inflight /= 2;
+                Logger_LogWarning( "[%s] timed out with %d requests in flight - sending at most %d from now on\n",
+                                    bus->name, maxOutstanding, bus->inflight );
+            }
+        }
+        dropConnection( bus, error );
+
+        //
+        //  What never came back is asked again on the new connection, one at
+        //  a time like any other read, as long as the deadline allows
+        for (int i = 0; i < numReads; i += 1) {
+            if (reads[ i ].answered)
+                continue;
+
+            errno = error;
+            if (!retry( device, 0, 0 ))
+                break;
+
+            readFunction_t  function = (reads[ i ].kind == REG_INPUT) ? readInputRegisters : readHoldingRegisters;
+            reads[ i ].ok = readWithRetries( device, function, reads[ i ].address, reads[ i ].count, reads[ i ].dest, 5 + (2 * reads[ i ].count), 1 );
+            if (!reads[ i ].ok)
+                break;
+            failures -= 1;
+        }
+    }
+
+    return (failures == 0);
+}
+
+// -----------------------------------------------------------------------------
+int Bus_WriteRegisters (const modbusDevice_t *device, int address, int count, const uint16_t *values)
+{
+    struct timespec start;
+    uint64_t        wire = wireNanos( device->bus, 9 + (2 * count), 8 );
+    modbus_t        *ctx = addressDevice( device, &start, wire, 0 );
+
+    if (ctx == NULL)
+        return FALSE;
+
+    int rc = modbus_write_registers( ctx, address, count, values );
+    if (!countTransaction( device, &start, (rc == count), wire )) {
+        Logger_LogWarning( "Write of %d registers at 0x%04X to slave %d failed: %s\n", count, address, device->slaveID, modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Bus_ReadCoils (const modbusDevice_t *device, int address, int count, uint8_t *dest)
+{
+    if (!readWithRetries( device, readCoils, address, count, dest, 5 + ((count + 7) / 8), 0 )) {
+        Logger_LogDebug( "Read of %d coils at 0x%04X from slave %d failed: %s\n", count, address, device->slaveID, modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Bus_ReadDiscreteInputs (const modbusDevice_t *device, int address, int count, uint8_t *dest)
+{
+    if (!readWithRetries( device, readDiscreteInputs, address, count, dest, 5 + ((count + 7) / 8), 0 )) {
+        Logger_LogDebug( "Read of %d discrete inputs at 0x%04X from slave %d failed: %s\n", count, address, device->slaveID, modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Bus_WriteCoil (const modbusDevice_t *device, int address, int on)
+{
+    struct timespec start;
+    uint64_t        wire = wireNanos( device->bus, 8, 8 );
+    modbus_t        *ctx = addressDevice( device, &start, wire, 0 );
+
+    if (ctx == NULL)
+        return FALSE;
+
+    int rc = modbus_write_bit( ctx, address, (on ? 1 : 0) );
+    if (!countTransaction( device, &start, (rc == 1), wire )) {
+        Logger_LogWarning( "Write of coil 0x%04X on slave %d failed: %s\n", address, device->slaveID, modbus_strerror( errno ) );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Bus_GetStats (const modbusBus_t *bus, busStats_t *out)
+{
+    *out = bus->stats;
+}
@@ -0,0 +1,108 @@
+/*
+ * File:   modbusBus.h
+ * Author: pconroy
+ *
+ * Thin wrapper around our own libmodbus context so we can issue block
+ * register reads (libepsolar only gives us one-register-per-call getters)
+ * and keep count of how much bus time each polling cycle costs.
+ *
+ * One modbusBus_t per serial port. Several controllers can share a port, so
+ * every transaction names the slave it is for (a modbusDevice_t).
+ *
+ * A port named "tcp://host[:port][?inflight=N]" is a Modbus TCP gateway
+ * instead. The connection is kept open and re-established when it drops,
+ * and block reads can have up to N requests outstanding on it at once.
+ *
+ * A device with a response timer waits as long as that controller usually
+ * takes to answer, not libmodbus' fixed half second, and a read the line
+ * lost or mangled is asked again - as long as there is time left before the
+ * bus's deadline (Bus_SetDeadline()).
+ */
+
+#ifndef MODBUSBUS_H
+#define MODBUSBUS_H
+
+#include <stdint.h>
+#include <modbus/modbus.h>
+#include "responseTimer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUS_DEFAULT_TCP_PORT        502
+#define BUS_DEFAULT_INFLIGHT        4
+#define BUS_MAX_INFLIGHT            16
+#define BUS_MAX_RECONNECT_MILLIS    30000
+#define BUS_SERIAL_BAUD             115200
+#define BUS_MAX_RETRIES             2       // after the first try, reads only
+#define BUS_RETRY_PAUSE_MILLIS      5       // doubled each retry - lets the line go quiet
+
+typedef enum {
+    REG_INPUT = 0,                      // Modbus function 0x04
+    REG_HOLDING = 1                     // Modbus function 0x03
+} registerKind_t;
+
+typedef struct  busStats {
+    unsigned long   transactions;       // every request we put on the wire
+    unsigned long   errors;             // requests that failed (timeout, CRC, exception)
+    unsigned long   timeouts;           // ...of which the controller never answered
+    unsigned long   busyMicros;         // wall time spent waiting on the bus
+    unsigned long   reconnects;         // TCP: connection re-established after a drop
+    unsigned long   pipelined;          // TCP: requests sent while another was still outstanding
+    unsigned long   retries;            // reads asked again after a timeout or a bad frame
+    unsigned long   recovered;          // ...that then came back
+    unsigned long   abandoned;          // not retried - it wouldn't have been done before the deadline
+} busStats_t;
+
+typedef struct  modbusBus {
+    const char      *name;              // port or gateway, for the log
+    modbus_t        *ctx;
+    int             currentSlave;       // the one ctx is addressed to right now
+
+    int             isTcp;
+    int             connected;
+    int             inflight;           // most requests we'll have outstanding
+    uint16_t        nextTransactionID;  // MBAP ids for our pipelined reads
+    uint64_t        nextReconnectNanos;
+    int             reconnectMillis;    // backoff, doubles while the gateway stays away
+    uint64_t        deadlineNanos;      // no retry that would run past this, 0 - none
+    uint64_t        timeoutNanos;       // the response timeout ctx has now
+
+    busStats_t      stats;
+} modbusBus_t;
+
+typedef struct  modbusDevice {
+    modbusBus_t     *bus;
+    int             slaveID;
+    responseTimer_t *timer;             // NULL - libmodbus' fixed timeout
+} modbusDevice_t;
+
+typedef struct  busBlockRead {
+    registerKind_t  kind;
+    int             address;
+    int             count;
+    uint16_t        *dest;
+    int             ok;                 // filled in by Bus_ReadBlocks()
+    int             answered;           // ...as are these
+    uint16_t        transactionID;
+    uint64_t        sentNanos;
+} busBlockRead_t;
+
+extern  int     Bus_Open( modbusBus_t *bus, const char *portName );
+extern  void    Bus_Close( modbusBus_t *bus );
+extern  void    Bus_SetDeadline( modbusBus_t *bus, uint64_t deadlineNanos );
+extern  int     Bus_ReadRegisters( const modbusDevice_t *device, registerKind_t kind, int address, int count, uint16_t *dest );
+extern  int     Bus_ReadBlocks( const modbusDevice_t *device, busBlockRead_t *reads, int numReads );
+extern  int     Bus_WriteRegisters( const modbusDevice_t *device, int address, int count, const uint16_t *values );
+extern  int     Bus_ReadCoils( const modbusDevice_t *device, int address, int count, uint8_t *dest );
+extern  int     Bus_ReadDiscreteInputs( const modbusDevice_t *device, int address, int count, uint8_t *dest );
+extern  int     Bus_WriteCoil( const modbusDevice_t *device, int address, int on );
+extern  void    Bus_GetStats( const modbusBus_t *bus, busStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUSBUS_H */
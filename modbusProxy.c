@@ -0,0 +1,664 @@
+/*
+ * File:    modbusProxy.c
+ * author:  patrick conroy
+ *
+ * Two threads. The server thread owns the sockets: it accepts, reads MBAP
+ * framed requests and answers cache hits on the spot, under a microsecond
+ * or two of work. Anything that has to go to the controller is copied into
+ * a single producer / single consumer queue for the forwarding thread, which
+ * runs it as a BUS_CLASS_PROXY job (after the realtime poll, ahead of the
+ * housekeeping) and sends the answer back itself. So a slow write never
+ * holds up a cached read.
+ *
+ * The cache is filled from the register snapshots the realtime and settings
+ * jobs already take, stamped with when they were read, plus whatever the
+ * forwarded reads and writes see. One lock per controller; it is only held
+ * for a copy.
+ *
+ * The forwarding thread can answer a client the server thread is about to
+ * drop, so each client slot has its own lock and a generation count, and an
+ * answer only goes out if the connection it was meant for is still there.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "modbusBus.h"
+#include "busScheduler.h"
+#include "metrics.h"
+#include "timeUtils.h"
+#include "modbusProxy.h"
+
+
+#define MBAP_HEADER_LENGTH          7
+#define MBAP_MAX_FRAME              260
+
+#define EXCEPTION_ILLEGAL_FUNCTION  0x01
+#define EXCEPTION_ILLEGAL_VALUE     0x03
+#define EXCEPTION_BUSY              0x06
+#define EXCEPTION_PATH_UNAVAILABLE  0x0A
+#define EXCEPTION_TARGET_FAILED     0x0B
+
+typedef struct  registerCache {
+    pthread_mutex_t lock;
+    uint16_t        input[ INPUT_REGISTER_COUNT ];
+    uint16_t        holding[ HOLDING_REGISTER_COUNT ];
+    uint64_t        inputNanos[ INPUT_REGISTER_COUNT ];     // 0 - never read
+    uint64_t        holdingNanos[ HOLDING_REGISTER_COUNT ];
+} registerCache_t;
+
+typedef struct  proxyClient {
+    pthread_mutex_t lock;               // the forwarding thread writes to the socket too
+    int             fd;
+    unsigned long   generation;         // bumped every time the slot is closed
+    size_t          have;
+    uint8_t         frame[ MBAP_MAX_FRAME ];
+} proxyClient_t;
+
+typedef struct  forwardedRequest {
+    const controller_t  *controller;
+    int                 client;
+    unsigned long       generation;
+    uint64_t            receivedNanos;
+    int                 length;
+    uint8_t             frame[ MBAP_MAX_FRAME ];
+} forwardedRequest_t;
+
+//
+//  What a bus job needs, and the answer it builds
+typedef struct  forwardContext {
+    const forwardedRequest_t    *request;
+    uint8_t                     response[ MBAP_MAX_FRAME ];
+    int                         length;
+} forwardContext_t;
+
+static  registerCache_t     *caches = NULL;             // indexed the same as controllers[]
+static  uint64_t            maxAgeNanos = 0;
+
+static  int                 listenFD = -1;
+static  proxyClient_t       clients[ PROXY_MAX_CLIENTS ];
+
+static  forwardedRequest_t  queue[ PROXY_QUEUE_SIZE ];
+static  uint64_t            head = 0;                   // server thread writes here
+static  uint64_t            tail = 0;                   // forwarding thread reads here
+static  sem_t               requestsWaiting;
+
+static  pthread_t           serverThread;
+static  pthread_t           forwardThread;
+static  volatile int        running = FALSE;
+static  proxyStats_t        stats;
+
+
+// -----------------------------------------------------------------------------
+static
+int cacheIndex (registerKind_t kind, int address, int count)
+{
+    //
+    //  Offset into the cache, or -1 if the range isn't in the EPSolar windows
+    int base = (kind == REG_INPUT) ? INPUT_REGISTER_BASE : HOLDING_REGISTER_BASE;
+    int size = (kind == REG_INPUT) ? INPUT_REGISTER_COUNT : HOLDING_REGISTER_COUNT;
+
+    if (count < 1 || address < base || (address + count) > (base + size))
+        return -1;
+    return address - base;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    cacheStore (const controller_t *controller, registerKind_t kind, int address, int count, const uint16_t *values, uint64_t readNanos)
+{
+    int offset = cacheIndex( kind, address, count );
+    if (caches == NULL || offset < 0)
+        return;
+
+    registerCache_t *cache = &caches[ controller - controllers ];
+    pthread_mutex_lock( &cache->lock );
+    for (int i = 0; i < count; i += 1) {
+        if (kind == REG_INPUT) {
+            cache->input[ offset + i ] = values[ i ];
+            cache->inputNanos[ offset + i ] = readNanos;
+        } else {
+            cache->holding[ offset + i ] = values[ i ];
+            cache->holdingNanos[ offset + i ] = readNanos;
+        }
+    }
+    pthread_mutex_unlock( &cache->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+int cacheLoad (const controller_t *controller, registerKind_t kind, int address, int count, uint16_t *values)
+{
+    int offset = cacheIndex( kind, address, count );
+    if (offset < 0)
+        return FALSE;
+
+    registerCache_t *cache = &caches[ controller - controllers ];
+    const uint16_t  *registers = (kind == REG_INPUT) ? cache->input : cache->holding;
+    const uint64_t  *readNanos = (kind == REG_INPUT) ? cache->inputNanos : cache->holdingNanos;
+    uint64_t        now = Time_MonotonicNanos();
+    int             fresh = TRUE;
+
+    pthread_mutex_lock( &cache->lock );
+    for (int i = 0; i < count && fresh; i += 1) {
+        fresh = (readNanos[ offset + i ] != 0) && (now - readNanos[ offset + i ] <= maxAgeNanos);
+        values[ i ] = registers[ offset + i ];
+    }
+    pthread_mutex_unlock( &cache->lock );
+
+    return fresh;
+}
+
+// -----------------------------------------------------------------------------
+void    ModbusProxy_Update (const controller_t *controller, const registerSnapshot_t *snapshot, uint64_t readNanos)
+{
+    //
+    //  Called on the bus thread after every snapshot. Only what the snapshot
+    //  actually holds is copied in
+    if (caches == NULL)
+        return;
+
+    registerCache_t *cache = &caches[ controller - controllers ];
+    pthread_mutex_lock( &cache->lock );
+    for (int i = 0; i < INPUT_REGISTER_COUNT; i += 1)
+        if (snapshot->inputValid[ i ]) {
+            cache->input[ i ] = snapshot->input[ i ];
+            cache->inputNanos[ i ] = readNanos;
+        }
+    for (int i = 0; i < HOLDING_REGISTER_COUNT; i += 1)
+        if (snapshot->holdingValid[ i ]) {
+            cache->holding[ i ] = snapshot->holding[ i ];
+            cache->holdingNanos[ i ] = readNanos;
+        }
+    pthread_mutex_unlock( &cache->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    sendToClient (int client, unsigned long generation, const uint8_t *bytes, int length, uint64_t receivedNanos)
+{
+    proxyClient_t   *slot = &clients[ client ];
+    int             sent = FALSE;
+
+    //
+    //  Never block on a client that isn't reading its answers
+    pthread_mutex_lock( &slot->lock );
+    if (slot->fd >= 0 && slot->generation == generation)
+        sent = (send( slot->fd, bytes, length, MSG_NOSIGNAL | MSG_DONTWAIT ) == length);
+    pthread_mutex_unlock( &slot->lock );
+
+    if (!sent)
+        __atomic_add_fetch( &stats.dropped, 1, __ATOMIC_RELAXED );
+    Metrics_Record( STAGE_PROXY, Time_MonotonicNanos() - receivedNanos );
+}
+
+// -----------------------------------------------------------------------------
+static
+int exceptionResponse (uint8_t *response, const uint8_t *request, int code)
+{
+    memcpy( response, request, 4 );     // transaction and protocol ids
+    response[ 4 ] = 0;
+    response[ 5 ] = 3;
+    response[ 6 ] = request[ 6 ];
+    response[ 7 ] = request[ 7 ] | 0x80;
+    response[ 8 ] = code;
+
+    __atomic_add_fetch( &stats.exceptions, 1, __ATOMIC_RELAXED );
+    return MBAP_HEADER_LENGTH + 2;
+}
+
+// -----------------------------------------------------------------------------
+static
+int registersResponse (uint8_t *response, const uint8_t *request, const uint16_t *values, int count)
+{
+    int length = 3 + (count * 2);
+
+    memcpy( response, request, 4 );
+    response[ 4 ] = length >> 8;
+    response[ 5 ] = length & 0xFF;
+    response[ 6 ] = request[ 6 ];
+    response[ 7 ] = request[ 7 ];
+    response[ 8 ] = count * 2;
+    for (int i = 0; i < count; i += 1) {
+        response[ 9 + (i * 2) ] = values[ i ] >> 8;
+        response[ 10 + (i * 2) ] = values[ i ] & 0xFF;
+    }
+    return MBAP_HEADER_LENGTH + 2 + (count * 2);
+}
+
+// -----------------------------------------------------------------------------
+static
+int bitsResponse (uint8_t *response, const uint8_t *request, const uint8_t *bits, int count)
+{
+    int byteCount = (count + 7) / 8;
+
+    memcpy( response, request, 4 );
+    response[ 4 ] = 0;
+    response[ 5 ] = 3 + byteCount;
+    response[ 6 ] = request[ 6 ];
+    response[ 7 ] = request[ 7 ];
+    response[ 8 ] = byteCount;
+    memset( &response[ 9 ], '\0', byteCount );
+    for (int i = 0; i < count; i += 1)
+        if (bits[ i ])
+            response[ 9 + (i / 8) ] |= (1 << (i % 8));
+    return MBAP_HEADER_LENGTH + 2 + byteCount;
+}
+
+// -----------------------------------------------------------------------------
+static
+int busFailure (uint8_t *response, const uint8_t *request)
+{
+    //
+    //  Pass the controller's own exception through; anything else is the
+    //  gateway's "target device failed to respond"
+    int error = errno;
+    if (error >= EMBXILFUN && error <= EMBXGTAR)
+        return exceptionResponse( response, request, error - MODBUS_ENOBASE );
+    return exceptionResponse( response, request, EXCEPTION_TARGET_FAILED );
+}
+
+// -----------------------------------------------------------------------------
+static
+int forwardJob (void *arg)
+{
+    //
+    //  Runs on the bus thread
+    forwardContext_t        *context = arg;
+    const forwardedRequest_t *request = context->request;
+    const controller_t      *controller = request->controller;
+    const uint8_t           *frame = request->frame;
+    uint8_t                 *response = context->response;
+    int                     address = (frame[ 8 ] << 8) | frame[ 9 ];
+    int                     value = (frame[ 10 ] << 8) | frame[ 11 ];
+    uint16_t                words[ 125 ];
+    uint8_t                 bits[ 2000 ];
+
+    switch (frame[ 7 ]) {
+        case 0x01:
+        case 0x02:
+            if (value < 1 || value > 2000) {
+                context->length = exceptionResponse( response, frame, EXCEPTION_ILLEGAL_VALUE );
+                return FALSE;
+            }
+            if (!(frame[ 7 ] == 0x01 ? Bus_ReadCoils( &controller->device, address, value, bits )
+                                     : Bus_ReadDiscreteInputs( &controller->device, address, value, bits ))) {
+                context->length = busFailure( response, frame );
+                return FALSE;
+            }
+            context->length = bitsResponse( response, frame, bits, value );
+            return TRUE;
+
+        case 0x03:
+        case 0x04: {
+            registerKind_t kind = (frame[ 7 ] == 0x04) ? REG_INPUT : REG_HOLDING;
+            if (value < 1 || value > 125) {
+                context->length = exceptionResponse( response, frame, EXCEPTION_ILLEGAL_VALUE );
+                return FALSE;
+            }
+            if (!Bus_ReadRegisters( &controller->device, kind, address, value, words )) {
+                context->length = busFailure( response, frame );
+                return FALSE;
+            }
+            cacheStore( controller, kind, address, value, words, Time_MonotonicNanos() );
+            context->length = registersResponse( response, frame, words, value );
+            return TRUE;
+        }
+
+        case 0x05:
+            if (!Bus_WriteCoil( &controller->device, address, (value == 0xFF00) )) {
+                context->length = busFailure( response, frame );
+                return FALSE;
+            }
+            memcpy( response, frame, MBAP_HEADER_LENGTH + 5 );     // the echo is the request
+            context->length = MBAP_HEADER_LENGTH + 5;
+            return TRUE;
+
+        case 0x06:
+            //
+            //  Sent on as a one register 0x10 - that is all Bus_ has, and
+            //  the Tracers take either
+            words[ 0 ] = value;
+            if (!Bus_WriteRegisters( &controller->device, address, 1, words )) {
+                context->length = busFailure( response, frame );
+                return FALSE;
+            }
+            cacheStore( controller, REG_HOLDING, address, 1, words, Time_MonotonicNanos() );
+            memcpy( response, frame, MBAP_HEADER_LENGTH + 5 );
+            context->length = MBAP_HEADER_LENGTH + 5;
+            return TRUE;
+
+        case 0x10:
+            if (value < 1 || value > 123 || frame[ 12 ] != value * 2 || request->length < 13 + (value * 2)) {
+                context->length = exceptionResponse( response, frame, EXCEPTION_ILLEGAL_VALUE );
+                return FALSE;
+            }
+            for (int i = 0; i < value; i += 1)
+                words[ i ] = (frame[ 13 + (i * 2) ] << 8) | frame[ 14 + (i * 2) ];
+            if (!Bus_WriteRegisters( &controller->device, address, value, words )) {
+                context->length = busFailure( response, frame );
+                return FALSE;
+            }
+            cacheStore( controller, REG_HOLDING, address, value, words, Time_MonotonicNanos() );
+            memcpy( response, frame, MBAP_HEADER_LENGTH + 5 );
+            response[ 4 ] = 0;
+            response[ 5 ] = 6;
+            context->length = MBAP_HEADER_LENGTH + 5;
+            return TRUE;
+    }
+
+    context->length = exceptionResponse( response, frame, EXCEPTION_ILLEGAL_FUNCTION );
+    return FALSE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *forwardWorker (void *arg)
+{
+    forwardContext_t    context;
+
+    while (running) {
+        if (sem_wait( &requestsWaiting ) != 0)
+            continue;
+
+        while (tail != __atomic_load_n( &head, __ATOMIC_ACQUIRE )) {
+            const forwardedRequest_t *request = &queue[ tail % PROXY_QUEUE_SIZE ];
+
+            context.request = request;
+            context.length = 0;
+            uint64_t deadline = request->receivedNanos + (PROXY_FORWARD_DEADLINE_MILLIS * NANOS_PER_MILLI);
+            BusScheduler_Run( &buses[ request->controller->busIndex ].scheduler, BUS_CLASS_PROXY, deadline, forwardJob, &context );
+            if (context.length == 0)
+                context.length = exceptionResponse( context.response, request->frame, EXCEPTION_BUSY );
+
+            sendToClient( request->client, request->generation, context.response, context.length, request->receivedNanos );
+            __atomic_store_n( &tail, tail + 1, __ATOMIC_RELEASE );
+        }
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+const controller_t  *findController (int unitID)
+{
+    if (numControllers == 1)
+        return &controllers[ 0 ];
+
+    for (int i = 0; i < numControllers; i += 1)
+        if (controllers[ i ].id == unitID)
+            return &controllers[ i ];
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    forward (const controller_t *controller, int client, const uint8_t *frame, int length, uint64_t receivedNanos)
+{
+    uint64_t    index = head;
+    uint64_t    readIndex = __atomic_load_n( &tail, __ATOMIC_ACQUIRE );
+
+    if ((index - readIndex) >= PROXY_QUEUE_SIZE) {
+        uint8_t response[ MBAP_HEADER_LENGTH + 2 ];
+        int responseLength = exceptionResponse( response, frame, EXCEPTION_BUSY );
+        sendToClient( client, clients[ client ].generation, response, responseLength, receivedNanos );
+        return;
+    }
+
+    forwardedRequest_t *request = &queue[ index % PROXY_QUEUE_SIZE ];
+    request->controller = controller;
+    request->client = client;
+    request->generation = clients[ client ].generation;
+    request->receivedNanos = receivedNanos;
+    request->length = length;
+    memcpy( request->frame, frame, length );
+
+    stats.forwarded += 1;
+    __atomic_store_n( &head, index + 1, __ATOMIC_RELEASE );
+    sem_post( &requestsWaiting );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    handleRequest (int client, const uint8_t *frame, int length)
+{
+    uint64_t    receivedNanos = Time_MonotonicNanos();
+    uint8_t     response[ MBAP_MAX_FRAME ];
+    uint16_t    words[ 125 ];
+    int         function = frame[ 7 ];
+
+    stats.requests += 1;
+
+    const controller_t *controller = findController( frame[ 6 ] );
+    if (controller == NULL) {
+        int responseLength = exceptionResponse( response, frame, EXCEPTION_PATH_UNAVAILABLE );
+        sendToClient( client, clients[ client ].generation, response, responseLength, receivedNanos );
+        return;
+    }
+
+    if (function != 0x01 && function != 0x02 && function != 0x03 && function != 0x04
+            && function != 0x05 && function != 0x06 && function != 0x10) {
+        int responseLength = exceptionResponse( response, frame, EXCEPTION_ILLEGAL_FUNCTION );
+        sendToClient( client, clients[ client ].generation, response, responseLength, receivedNanos );
+        return;
+    }
+
+    //
+    //  Every one we take has at least an address and a count or value
+    if (length < MBAP_HEADER_LENGTH + 5) {
+        int responseLength = exceptionResponse( response, frame, EXCEPTION_ILLEGAL_VALUE );
+        sendToClient( client, clients[ client ].generation, response, responseLength, receivedNanos );
+        return;
+    }
+
+    //
+    //  The whole point: a register read that the last poll already answered
+    if (function == 0x03 || function == 0x04) {
+        int address = (frame[ 8 ] << 8) | frame[ 9 ];
+        int count = (frame[ 10 ] << 8) | frame[ 11 ];
+
+        if (count >= 1 && count <= 125 && cacheLoad( controller, (function == 0x04 ? REG_INPUT : REG_HOLDING), address, count, words )) {
+            int responseLength = registersResponse( response, frame, words, count );
+            stats.cacheHits += 1;
+            sendToClient( client, clients[ client ].generation, response, responseLength, receivedNanos );
+            return;
+        }
+    }
+
+    forward( controller, client, frame, length, receivedNanos );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    closeClient (int client)
+{
+    proxyClient_t   *slot = &clients[ client ];
+
+    pthread_mutex_lock( &slot->lock );
+    if (slot->fd >= 0)
+        close( slot->fd );
+    slot->fd = -1;
+    slot->generation += 1;
+    slot->have = 0;
+    pthread_mutex_unlock( &slot->lock );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    acceptClient (void)
+{
+    int fd = accept( listenFD, NULL, NULL );
+    if (fd < 0)
+        return;
+
+    for (int i = 0; i < PROXY_MAX_CLIENTS; i += 1) {
+        if (clients[ i ].fd >= 0)
+            continue;
+
+        int on = 1;
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on );
+        pthread_mutex_lock( &clients[ i ].lock );
+        clients[ i ].fd = fd;
+        clients[ i ].have = 0;
+        pthread_mutex_unlock( &clients[ i ].lock );
+        stats.connections += 1;
+        return;
+    }
+
+    Logger_LogWarning( "Modbus proxy already has %d clients - turning one away\n", PROXY_MAX_CLIENTS );
+    close( fd );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    readClient (int client)
+{
+    proxyClient_t   *slot = &clients[ client ];
+
+    ssize_t n = recv( slot->fd, &slot->frame[ slot->have ], sizeof slot->frame - slot->have, 0 );
+    if (n <= 0) {
+        closeClient( client );
+        return;
+    }
+    slot->have += n;
+
+    while (slot->have >= MBAP_HEADER_LENGTH) {
+        size_t length = 6 + ((slot->frame[ 4 ] << 8) | slot->frame[ 5 ]);
+
+        //
+        //  Garbage - there's no resynchronising a TCP stream, hang up
+        if (length < MBAP_HEADER_LENGTH + 1 || length > sizeof slot->frame || slot->frame[ 2 ] != 0 || slot->frame[ 3 ] != 0) {
+            closeClient( client );
+            return;
+        }
+        if (slot->have < length)
+            return;
+
+        handleRequest( client, slot->frame, (int) length );
+        memmove( slot->frame, &slot->frame[ length ], slot->have - length );
+        slot->have -= length;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    *serverLoop (void *arg)
+{
+    struct pollfd   pfds[ PROXY_MAX_CLIENTS + 1 ];
+    int             clientOf[ PROXY_MAX_CLIENTS + 1 ];
+
+    while (running) {
+        int n = 0;
+        pfds[ n ].fd = listenFD;
+        pfds[ n ].events = POLLIN;
+        clientOf[ n++ ] = -1;
+        for (int i = 0; i < PROXY_MAX_CLIENTS; i += 1)
+            if (clients[ i ].fd >= 0) {
+                pfds[ n ].fd = clients[ i ].fd;
+                pfds[ n ].events = POLLIN;
+                clientOf[ n++ ] = i;
+            }
+
+        //
+        //  Wake now and then to notice Stop()
+        if (poll( pfds, n, 250 ) <= 0)
+            continue;
+
+        for (int i = 1; i < n; i += 1)
+            if (pfds[ i ].revents & (POLLIN | POLLHUP | POLLERR))
+                readClient( clientOf[ i ] );
+        if (pfds[ 0 ].revents & POLLIN)
+            acceptClient();
+    }
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------
+int ModbusProxy_Start (int port, int maxAgeMillis)
+{
+    struct sockaddr_in  address;
+    int                 on = 1;
+
+    memset( &stats, '\0', sizeof stats );
+    maxAgeNanos = (uint64_t) maxAgeMillis * NANOS_PER_MILLI;
+
+    caches = calloc( numControllers, sizeof( registerCache_t ) );
+    if (caches == NULL) {
+        Logger_LogFatal( "Unable to allocate the Modbus proxy register cache\n" );
+        return FALSE;
+    }
+    for (int i = 0; i < numControllers; i += 1)
+        pthread_mutex_init( &caches[ i ].lock, NULL );
+    for (int i = 0; i < PROXY_MAX_CLIENTS; i += 1) {
+        pthread_mutex_init( &clients[ i ].lock, NULL );
+        clients[ i ].fd = -1;
+    }
+
+    //
+    //  Loopback only - it's for the other programs on this box, and Modbus
+    //  has no authentication to speak of
+    listenFD = socket( AF_INET, SOCK_STREAM, 0 );
+    memset( &address, '\0', sizeof address );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    address.sin_port = htons( port );
+    if (listenFD >= 0)
+        setsockopt( listenFD, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on );
+    if (listenFD < 0 || bind( listenFD, (struct sockaddr *) &address, sizeof address ) != 0 || listen( listenFD, 8 ) != 0) {
+        Logger_LogFatal( "Unable to listen for Modbus TCP on port %d: %s\n", port, strerror( errno ) );
+        return FALSE;
+    }
+
+    if (sem_init( &requestsWaiting, 0, 0 ) != 0) {
+        Logger_LogFatal( "Unable to create the Modbus proxy semaphore\n" );
+        return FALSE;
+    }
+
+    running = TRUE;
+    if (pthread_create( &serverThread, NULL, serverLoop, NULL ) || pthread_create( &forwardThread, NULL, forwardWorker, NULL )) {
+        Logger_LogFatal( "Unable to start the Modbus proxy threads!\n" );
+        running = FALSE;
+        return FALSE;
+    }
+
+    Logger_LogWarning( "Serving cached registers on Modbus TCP port %d, at most %d ms old\n", port, maxAgeMillis );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    ModbusProxy_Stop (void)
+{
+    if (!running)
+        return;
+
+    running = FALSE;
+    sem_post( &requestsWaiting );
+    pthread_join( serverThread, NULL );
+    pthread_join( forwardThread, NULL );
+
+    for (int i = 0; i < PROXY_MAX_CLIENTS; i += 1)
+        closeClient( i );
+    close( listenFD );
+}
+
+// -----------------------------------------------------------------------------
+void    ModbusProxy_GetStats (proxyStats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,49 @@
+/*
+ * File:   modbusProxy.h
+ * Author: pconroy
+ *
+ * An optional Modbus TCP server ("-M") for other programs on this host that
+ * want the controller's registers too. Reads are answered from the registers
+ * the polling loop last read, as long as they are fresh enough ("-a"); so
+ * any number of readers cost the RS485 line nothing. Writes, and reads the
+ * cache can't answer, are queued onto the bus like any other job.
+ *
+ * The unit id picks the controller by its controller ID. With only one
+ * controller any unit id will do.
+ */
+
+#ifndef MODBUSPROXY_H
+#define MODBUSPROXY_H
+
+#include <stdint.h>
+#include "registerPlanner.h"
+#include "controllers.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROXY_MAX_CLIENTS           16
+#define PROXY_QUEUE_SIZE            16
+#define PROXY_FORWARD_DEADLINE_MILLIS   500
+
+typedef struct  proxyStats {
+    unsigned long   connections;
+    unsigned long   requests;
+    unsigned long   cacheHits;          // answered from the last poll
+    unsigned long   forwarded;          // went out on the bus
+    unsigned long   exceptions;         // answered with a Modbus exception
+    unsigned long   dropped;            // queue full, or the client left before the answer came
+} proxyStats_t;
+
+extern  int     ModbusProxy_Start( int port, int maxAgeMillis );
+extern  void    ModbusProxy_Update( const controller_t *controller, const registerSnapshot_t *snapshot, uint64_t readNanos );
+extern  void    ModbusProxy_Stop( void );
+extern  void    ModbusProxy_GetStats( proxyStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODBUSPROXY_H */
@@ -35,8 +35,40 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
+	${OBJECTDIR}/acquisition.o \
+	${OBJECTDIR}/aggregator.o \
+	${OBJECTDIR}/asyncLog.o \
+	${OBJECTDIR}/batteryAnalytics.o \
+	${OBJECTDIR}/brokerDiscovery.o \
+	${OBJECTDIR}/busScheduler.o \
+	${OBJECTDIR}/capture.o \
+	${OBJECTDIR}/cborPayload.o \
+	${OBJECTDIR}/cborWriter.o \
+	${OBJECTDIR}/clockSync.o \
+	${OBJECTDIR}/commands.o \
+	${OBJECTDIR}/controllers.o \
+	${OBJECTDIR}/deltaEncoder.o \
+	${OBJECTDIR}/extraData.o \
+	${OBJECTDIR}/fanout.o \
+	${OBJECTDIR}/fieldGroups.o \
+	${OBJECTDIR}/histogram.o \
+	${OBJECTDIR}/history.o \
+	${OBJECTDIR}/historyQuery.o \
+	${OBJECTDIR}/journal.o \
 	${OBJECTDIR}/jsonMessageMaker.o \
-	${OBJECTDIR}/main.o
+	${OBJECTDIR}/jsonWriter.o \
+	${OBJECTDIR}/main.o \
+	${OBJECTDIR}/metrics.o \
+	${OBJECTDIR}/modbusBus.o \
+	${OBJECTDIR}/modbusProxy.o \
+	${OBJECTDIR}/publisher.o \
+	${OBJECTDIR}/reactor.o \
+	${OBJECTDIR}/realTimeFields.o \
+	${OBJECTDIR}/realTimeReader.o \
+	${OBJECTDIR}/registerPlanner.o \
+	${OBJECTDIR}/responseTimer.o \
+	${OBJECTDIR}/sampleRing.o \
+	${OBJECTDIR}/settingsCache.o
 
 
 # C Compiler Flags
@@ -53,7 +85,7 @@ FFLAGS=
 ASFLAGS=
 
 # Link Libraries and Options
-LDLIBSOPTIONS=-llibmqttrv -lepsolar -llog4c
+LDLIBSOPTIONS=-llibmqttrv -lepsolar -llog4c -lm
 
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
@@ -61,17 +93,177 @@ LDLIBSOPTIONS=-llibmqttrv -lepsolar -llog4c
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/epsolar_mqtt: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
-	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/epsolar_mqtt ${OBJECTFILES} ${LDLIBSOPTIONS} -lcjson -lmosquitto -lmodbus -lavahi-client -lavahi-common
+	${LINK.c} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/epsolar_mqtt ${OBJECTFILES} ${LDLIBSOPTIONS} -lcjson -lmosquitto -lmodbus -lavahi-client -lavahi-common -pthread
+
+${OBJECTDIR}/acquisition.o: acquisition.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/acquisition.o acquisition.c
+
+${OBJECTDIR}/aggregator.o: aggregator.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/aggregator.o aggregator.c
+
+${OBJECTDIR}/asyncLog.o: asyncLog.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/asyncLog.o asyncLog.c
+
+${OBJECTDIR}/batteryAnalytics.o: batteryAnalytics.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/batteryAnalytics.o batteryAnalytics.c
+
+${OBJECTDIR}/brokerDiscovery.o: brokerDiscovery.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/brokerDiscovery.o brokerDiscovery.c
+
+${OBJECTDIR}/busScheduler.o: busScheduler.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/busScheduler.o busScheduler.c
+
+${OBJECTDIR}/capture.o: capture.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/capture.o capture.c
+
+${OBJECTDIR}/cborPayload.o: cborPayload.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/cborPayload.o cborPayload.c
+
+${OBJECTDIR}/cborWriter.o: cborWriter.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/cborWriter.o cborWriter.c
+
+${OBJECTDIR}/clockSync.o: clockSync.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/clockSync.o clockSync.c
+
+${OBJECTDIR}/commands.o: commands.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/commands.o commands.c
+
+${OBJECTDIR}/controllers.o: controllers.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/controllers.o controllers.c
+
+${OBJECTDIR}/deltaEncoder.o: deltaEncoder.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/deltaEncoder.o deltaEncoder.c
+
+${OBJECTDIR}/extraData.o: extraData.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/extraData.o extraData.c
+
+${OBJECTDIR}/fanout.o: fanout.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/fanout.o fanout.c
+
+${OBJECTDIR}/fieldGroups.o: fieldGroups.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/fieldGroups.o fieldGroups.c
+
+${OBJECTDIR}/histogram.o: histogram.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/histogram.o histogram.c
+
+${OBJECTDIR}/history.o: history.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/history.o history.c
+
+${OBJECTDIR}/historyQuery.o: historyQuery.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/historyQuery.o historyQuery.c
+
+${OBJECTDIR}/journal.o: journal.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/journal.o journal.c
 
 ${OBJECTDIR}/jsonMessageMaker.o: jsonMessageMaker.c
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/jsonMessageMaker.o jsonMessageMaker.c
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/jsonMessageMaker.o jsonMessageMaker.c
+
+${OBJECTDIR}/jsonWriter.o: jsonWriter.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/jsonWriter.o jsonWriter.c
 
 ${OBJECTDIR}/main.o: main.c
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.c) -g -std=c99 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
+
+${OBJECTDIR}/metrics.o: metrics.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/metrics.o metrics.c
+
+${OBJECTDIR}/modbusBus.o: modbusBus.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/modbusBus.o modbusBus.c
+
+${OBJECTDIR}/modbusProxy.o: modbusProxy.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/modbusProxy.o modbusProxy.c
+
+${OBJECTDIR}/publisher.o: publisher.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/publisher.o publisher.c
+
+${OBJECTDIR}/reactor.o: reactor.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/reactor.o reactor.c
+
+${OBJECTDIR}/realTimeFields.o: realTimeFields.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/realTimeFields.o realTimeFields.c
+
+${OBJECTDIR}/realTimeReader.o: realTimeReader.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/realTimeReader.o realTimeReader.c
+
+${OBJECTDIR}/registerPlanner.o: registerPlanner.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/registerPlanner.o registerPlanner.c
+
+${OBJECTDIR}/responseTimer.o: responseTimer.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/responseTimer.o responseTimer.c
+
+${OBJECTDIR}/sampleRing.o: sampleRing.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/sampleRing.o sampleRing.c
+
+${OBJECTDIR}/settingsCache.o: settingsCache.c
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.c) -g -std=c99 -pthread -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/settingsCache.o settingsCache.c
 
 # Subprojects
 .build-subprojects:
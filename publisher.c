@@ -0,0 +1,716 @@
+/*
+ * File:    publisher.c
+ * author:  patrick conroy
+ *
+ * Wakes on a semaphore the acquisition threads post after every sample, then
+ * empties every bus's ring: build the JSON, hand it to mosquitto. All the
+ * controllers share this one thread, its serialization buffers and the one
+ * MQTT connection; what is kept per controller is only the state a message
+ * depends on (aggregates, delta baseline, unpublished settings). A broker that is
+ * slow or reconnecting only backs samples up in the ring; what happens when
+ * the ring fills is the ring's overflow policy, never a late controller read.
+ *
+ * With a journal ("-j") a DATA message the broker could not take is written
+ * to disk instead of being lost. Once a publish goes through again the
+ * backlog is replayed on the REPLAY topic, a batch at a time, no faster than
+ * replayBatchesPerSecond so we don't bury the broker or the subscribers.
+ *
+ * When sampling faster than we publish ("-r") every sample goes into the
+ * aggregator and only the last one of each publish period is sent, carrying
+ * the period's aggregates along with it.
+ *
+ * Each "-g" field group goes out on its own DATA subtopic whenever its
+ * interval is up, built from the newest sample. Those are live only - if the
+ * broker can't take one, the next one will do, so they aren't journaled.
+ *
+ * With "-B" each sample also goes out as CBOR on the controller's CBOR
+ * topic, after a retained schema message on its SCHEMA topic. With
+ * "-B cbor-only" that is the only live copy, but what the broker couldn't
+ * take is still journaled (and replayed) as JSON.
+ *
+ * Each extra "-h" broker gets DATA, CBOR, SETTINGS and SCHEMA too, in the
+ * encoding it asked for. A sample is serialized once for all of them - JSON
+ * if anyone takes JSON, CBOR if anyone takes CBOR - and handed to the fan
+ * out queues before the first broker's publish, so nothing here waits on a
+ * remote broker. Groups, the journal and metrics are the first broker's only.
+ *
+ * Every "-m" seconds it also sends the stage timings and counters out on the
+ * METRICS topic (and to the Prometheus file, with "-e").
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "asyncLog.h"
+#include "libmqttrv.h"
+#include "deltaEncoder.h"
+#include "journal.h"
+#include "aggregator.h"
+#include "batteryAnalytics.h"
+#include "busScheduler.h"
+#include "clockSync.h"
+#include "commands.h"
+#include "modbusProxy.h"
+#include "acquisition.h"
+#include "controllers.h"
+#include "metrics.h"
+#include "fieldGroups.h"
+#include "fanout.h"
+#include "timeUtils.h"
+#include "publisher.h"
+
+
+#define STATS_LOG_INTERVAL      100     // samples between pipeline summaries in the log
+
+extern  const char  *realTimeDataToJSON( const char *publishTopic, const epsolarRealTimeData_t *rtData, fieldMask_t rtRead, const epsolarExtraData_t *extraData, const periodAggregates_t *aggregates, const batteryAnalytics_t *battery, time_t sampleTime );
+extern  const char  *settingsToJSON( const char *settingsTopic, const epsolarSettings_t *settings, time_t sampleTime );
+
+static  publisherConfig_t   config;
+static  sem_t               samplesWaiting;
+static  volatile int        running = FALSE;
+static  publisherStats_t    stats;
+
+static  int                 brokerReachable = FALSE;    // as of the last publish attempt
+static  uint64_t            replayIntervalNanos = 0;
+static  uint64_t            nextReplayNanos = 0;
+static  uint64_t            replayStartedNanos = 0;
+static  unsigned long       replayStartedCount = 0;
+
+typedef struct  controllerState {
+    //
+    //  Settings are only published when they change, so hang on to them until
+    //  the broker actually takes them
+    epsolarSettings_t   unpublishedSettings;
+    time_t              unpublishedSettingsTime;
+    int                 settingsPending;
+    int                 settingsFannedOut;              // the extra brokers got them - they queue their own
+
+    aggregator_t        aggregator;
+    uint64_t            aggregatingPeriod;
+    sample_t            lastSample;                     // most recent one in the period being aggregated
+
+    deltaState_t        delta;
+    batteryAnalytics_t  battery;
+
+    uint64_t            groupDueNanos[ MAX_FIELD_GROUPS ];
+    int                 schemaPublished;
+    int                 schemaFannedOut;
+} controllerState_t;
+
+static  controllerState_t   *states = NULL;             // indexed the same as controllers[]
+
+static  busSchedulerStats_t previousBusStats[ MAX_BUSES ];  // utilisation is reported per logging interval
+
+
+// -----------------------------------------------------------------------------
+int Publisher_Initialize (const publisherConfig_t *publisherConfig)
+{
+    config = *publisherConfig;
+    memset( &stats, '\0', sizeof stats );
+
+    if (config.replayBatchesPerSecond <= 0)
+        config.replayBatchesPerSecond = JOURNAL_DEFAULT_BATCH_RATE;
+    replayIntervalNanos = NANOS_PER_SECOND / config.replayBatchesPerSecond;
+
+    if (config.samplesPerPublish < 1)
+        config.samplesPerPublish = 1;
+
+    states = calloc( numControllers, sizeof( controllerState_t ) );
+    if (states == NULL) {
+        Logger_LogFatal( "Unable to allocate publisher state for %d controllers\n", numControllers );
+        return FALSE;
+    }
+    for (int i = 0; i < numControllers; i += 1) {
+        Aggregator_Initialize( &states[ i ].aggregator );
+        BatteryAnalytics_Initialize( &states[ i ].battery, config.batteryCapacityAh );
+    }
+
+    if (sem_init( &samplesWaiting, 0, 0 ) != 0) {
+        Logger_LogFatal( "Unable to create the publisher semaphore\n" );
+        return FALSE;
+    }
+
+    running = TRUE;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Publisher_SetBroker (struct mosquitto *mosquittoInstance)
+{
+    //
+    //  Samples wait in the rings until there is one
+    config.mosquittoInstance = mosquittoInstance;
+}
+
+// -----------------------------------------------------------------------------
+void    Publisher_SampleReady (void)
+{
+    sem_post( &samplesWaiting );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    logBusStats (int busIndex)
+{
+    controllerBus_t     *controllerBus = &buses[ busIndex ];
+    busSchedulerStats_t *previous = &previousBusStats[ busIndex ];
+    busSchedulerStats_t bus;
+    clockSyncStats_t    clock;
+    unsigned long       checks = 0, corrections = 0;
+    long                worstDrift = 0;
+
+    BusScheduler_GetStats( &controllerBus->scheduler, &bus );
+    for (int i = 0; i < controllerBus->numControllers; i += 1) {
+        ClockSync_GetStats( &controllers[ controllerBus->controllers[ i ] ].clock, &clock );
+        checks += clock.checks;
+        corrections += clock.corrections;
+        if (labs( clock.lastDriftSeconds ) > labs( worstDrift ))
+            worstDrift = clock.lastDriftSeconds;
+    }
+
+    uint64_t    elapsed = bus.elapsedNanos - previous->elapsedNanos;
+    double      utilisation = (elapsed > 0) ? (100.0 * (bus.busyNanos - previous->busyNanos)) / elapsed : 0.0;
+
+    Logger_LogInfo( "Bus [%s]: %d controllers, %.1f%% busy, %d queued, %lu rejected | worst clock %ld s off, %lu checks, %lu corrections\n",
+                    controllerBus->portName, controllerBus->numControllers, utilisation, bus.queueDepth, bus.rejected,
+                    worstDrift, checks, corrections );
+
+    busStats_t  modbus;
+    Bus_GetStats( &controllerBus->modbus, &modbus );
+    if (modbus.retries > 0 || modbus.abandoned > 0)
+        Logger_LogInfo( "Bus [%s]: %lu timeouts, %lu retries, %lu recovered, %lu not retried for the deadline\n",
+                        controllerBus->portName, modbus.timeouts, modbus.retries, modbus.recovered, modbus.abandoned );
+
+    for (int i = 0; i < controllerBus->numControllers; i += 1) {
+        const controller_t      *controller = &controllers[ controllerBus->controllers[ i ] ];
+        responseTimerStats_t    timer;
+
+        ResponseTimer_GetStats( &controller->timer, &timer );
+        Logger_LogInfo( "Controller %d answers: p50 %.1f ms, p99 %.1f ms beyond the wire, timeout %.1f ms | %lu answered, %lu timed out\n",
+                        controller->id, timer.p50Micros / 1000.0, timer.p99Micros / 1000.0, timer.timeoutMicros / 1000.0,
+                        timer.answered, timer.timeouts );
+    }
+
+    for (int i = 0; i < BUS_NUM_CLASSES; i += 1) {
+        const busClassStats_t *classStats = &bus.classes[ i ];
+        unsigned long jobs = classStats->jobs - previous->classes[ i ].jobs;
+        if (jobs == 0)
+            continue;
+
+        Logger_LogInfo( "Bus %-8s: %lu jobs, wait avg %.1f / max %.1f ms, run avg %.1f / max %.1f ms, %lu late starts\n",
+                        BusScheduler_ClassName( i ), jobs,
+                        (classStats->totalWaitNanos - previous->classes[ i ].totalWaitNanos) / (double) jobs / NANOS_PER_MILLI,
+                        classStats->maxWaitNanos / (double) NANOS_PER_MILLI,
+                        (classStats->totalRunNanos - previous->classes[ i ].totalRunNanos) / (double) jobs / NANOS_PER_MILLI,
+                        classStats->maxRunNanos / (double) NANOS_PER_MILLI,
+                        classStats->lateStarts );
+    }
+
+    *previous = bus;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    logPipelineStats (void)
+{
+    acquisitionStats_t  acquisition;
+    sampleRingStats_t   ring;
+
+    Acquisition_GetStats( &acquisition );
+    Controllers_GetRingStats( &ring );
+
+    Logger_LogInfo( "Pipeline: %lu cycles, %lu missed deadlines, max lateness %lu us, max read %lu ms | "
+                    "ring %lu in / %lu out / %lu dropped, high water %lu | "
+                    "%lu published, %lu suppressed, %lu failed, %lu group, max latency %lu ms\n",
+                    acquisition.cycles, acquisition.missedDeadlines,
+                    (unsigned long) (acquisition.maxLatenessNanos / NANOS_PER_MICRO),
+                    (unsigned long) (acquisition.maxCycleNanos / NANOS_PER_MILLI),
+                    ring.pushed, ring.popped, ring.dropped, ring.highWater,
+                    stats.published, stats.suppressed, stats.failures, stats.groupMessages,
+                    (unsigned long) (stats.maxLatencyNanos / NANOS_PER_MILLI) );
+
+    if (stats.binaryPublished > 0)
+        Logger_LogInfo( "CBOR: %lu published, %.0f bytes/message\n",
+                        stats.binaryPublished, (double) stats.binaryBytes / stats.binaryPublished );
+
+    if (Journal_IsOpen()) {
+        journalStats_t  journal;
+        Journal_GetStats( &journal );
+        Logger_LogInfo( "Journal: %lu samples pending in %lu segment(s), %lu KB on disk | "
+                        "%lu journaled, %lu replayed in %lu batches, %lu dropped\n",
+                        journal.pendingRecords, journal.segments, journal.bytesOnDisk / 1024,
+                        journal.journaled, journal.replayed, journal.replayBatches, journal.dropped );
+    }
+
+    for (int i = 0; i < numBuses; i += 1)
+        logBusStats( i );
+
+    commandStats_t  commands;
+    Commands_GetStats( &commands );
+    if (commands.received > 0)
+        Logger_LogInfo( "Commands: %lu received, %lu executed, %lu failed, %lu rejected | last %.1f ms, max %.1f ms, %lu over %d ms\n",
+                        commands.received, commands.executed, commands.failed, commands.rejected,
+                        commands.lastLatencyNanos / (double) NANOS_PER_MILLI, commands.maxLatencyNanos / (double) NANOS_PER_MILLI,
+                        commands.overTarget, COMMAND_TARGET_MILLIS );
+
+    for (int i = 0; i < numControllers; i += 1) {
+        historyStats_t  history;
+        History_GetStats( &controllers[ i ].history, &history );
+        if (history.totalBlocks > 0)
+            Logger_LogInfo( "Controller %d history: %lu samples in %lu of %lu blocks, %.1f bytes/sample, %ld hours\n",
+                            controllers[ i ].id, history.samples, history.blocks, history.totalBlocks,
+                            (history.samples > 0 ? (double) history.bytesUsed / history.samples : 0.0),
+                            (long) ((history.newest - history.oldest) / 3600) );
+    }
+
+    proxyStats_t    proxy;
+    ModbusProxy_GetStats( &proxy );
+    if (proxy.requests > 0)
+        Logger_LogInfo( "Modbus proxy: %lu connections, %lu requests, %lu from cache, %lu forwarded, %lu exceptions, %lu dropped\n",
+                        proxy.connections, proxy.requests, proxy.cacheHits, proxy.forwarded, proxy.exceptions, proxy.dropped );
+
+    for (int i = 0; i < Fanout_NumTargets(); i += 1) {
+        fanoutStats_t   target;
+        Fanout_GetStats( i, &target );
+        Logger_LogInfo( "Broker %s:%d: %s | %lu queued, %lu published, %lu dropped, %lu failed, %lu connects, high water %lu\n",
+                        target.host, target.port, (target.connected ? "connected" : "DISCONNECTED"),
+                        target.queued, target.published, target.dropped, target.failures, target.connects, target.highWater );
+    }
+
+    asyncLogStats_t log;
+    AsyncLog_GetStats( &log );
+    if (log.suppressed > 0 || log.dropped > 0)
+        Logger_LogInfo( "Log: %lu messages, %lu written, %lu repeats suppressed, %lu lost, %lu rotations\n",
+                        log.logged, log.written, log.suppressed, log.dropped, log.rotations );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishSettings (const controller_t *controller, controllerState_t *state)
+{
+    const char *settingsMessage = settingsToJSON( controller->settingsTopic, &state->unpublishedSettings, state->unpublishedSettingsTime );
+    if (settingsMessage == NULL)
+        return;
+
+    if (!state->settingsFannedOut) {
+        Fanout_Publish( FANOUT_ALL, controller->settingsTopic, settingsMessage, strlen( settingsMessage ), TRUE );
+        state->settingsFannedOut = TRUE;
+    }
+
+    if (mosquitto_publish( config.mosquittoInstance, NULL, controller->settingsTopic, strlen( settingsMessage ), settingsMessage, 1, true ) == MOSQ_ERR_SUCCESS)
+        state->settingsPending = FALSE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    replayOneBatch (void)
+{
+    int     numRecords;
+
+    const char *batch = Journal_NextBatch( config.replayTopic, JOURNAL_MAX_BATCH_RECORDS, &numRecords );
+    if (batch == NULL)
+        return;
+
+    if (replayStartedNanos == 0) {
+        replayStartedNanos = Time_MonotonicNanos();
+        replayStartedCount = stats.replayed;
+        Logger_LogWarning( "Broker is back - replaying %lu journaled samples to [%s]\n", Journal_PendingRecords(), config.replayTopic );
+    }
+
+    //
+    //  QoS 1 - once mosquitto has it queued it will see it through a reconnect
+    int rc = mosquitto_publish( config.mosquittoInstance, NULL, config.replayTopic, strlen( batch ), batch, 1, false );
+    if (rc != MOSQ_ERR_SUCCESS) {
+        Logger_LogWarning( "Replay to [%s] failed: %s\n", config.replayTopic, mosquitto_strerror( rc ) );
+        brokerReachable = FALSE;
+        return;
+    }
+
+    Journal_CommitBatch();
+    stats.replayed += numRecords;
+
+    if (Journal_PendingRecords() == 0) {
+        double  seconds = (Time_MonotonicNanos() - replayStartedNanos) / (double) NANOS_PER_SECOND;
+        unsigned long count = stats.replayed - replayStartedCount;
+        Logger_LogWarning( "Journal replay finished: %lu samples in %.1f seconds (%.0f samples/sec)\n",
+                            count, seconds, (seconds > 0 ? count / seconds : 0.0) );
+        replayStartedNanos = 0;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    replayIfDue (void)
+{
+    if (!brokerReachable || Journal_PendingRecords() == 0)
+        return;
+
+    uint64_t now = Time_MonotonicNanos();
+    if (now < nextReplayNanos)
+        return;
+
+    nextReplayNanos = now + replayIntervalNanos;
+    replayOneBatch();
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishSchema (const controller_t *controller, controllerState_t *state)
+{
+    const char *schemaMessage = CborPayload_SchemaToJSON( controller->schemaTopic, controller->binaryTopic );
+    if (schemaMessage == NULL)
+        return;
+
+    if (!state->schemaFannedOut) {
+        Fanout_Publish( FANOUT_CBOR, controller->schemaTopic, schemaMessage, strlen( schemaMessage ), TRUE );
+        state->schemaFannedOut = TRUE;
+    }
+
+    if (config.encoding != PAYLOAD_JSON &&
+        mosquitto_publish( config.mosquittoInstance, NULL, controller->schemaTopic, strlen( schemaMessage ), schemaMessage, 1, true ) == MOSQ_ERR_SUCCESS)
+        state->schemaPublished = TRUE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishBinary (const sample_t *sample)
+{
+    const controller_t  *controller = &controllers[ sample->controller ];
+    controllerState_t   *state = &states[ sample->controller ];
+    const epsolarExtraData_t *extraData = (sample->haveExtraData ? &sample->extraData : NULL);
+    int                 primary = (config.encoding != PAYLOAD_JSON);   // else it's only for the extra brokers
+    int                 only = (config.encoding == PAYLOAD_CBOR);
+
+    //
+    //  Decoders need the schema before the first payload is any use to them
+    if (!state->schemaFannedOut || (primary && !state->schemaPublished))
+        publishSchema( controller, state );
+
+    uint64_t        started = Time_MonotonicNanos();
+    size_t          length;
+    const uint8_t   *payload = CborPayload_Build( controller->id, &sample->rtData, sample->rtRead, extraData, sample->wallTime, &length );
+
+    uint64_t    serialized = Time_MonotonicNanos();
+    if (only)
+        Metrics_Record( STAGE_SERIALIZE, serialized - started );
+    if (payload == NULL)
+        return;
+
+    Fanout_Publish( FANOUT_CBOR, controller->binaryTopic, payload, length, FALSE );
+    if (!primary)
+        return;
+
+    int rc = mosquitto_publish( config.mosquittoInstance, NULL, controller->binaryTopic, length, payload, 0, false );
+    uint64_t    published = Time_MonotonicNanos();
+    if (only)
+        Metrics_Record( STAGE_PUBLISH, published - serialized );
+
+    if (rc != MOSQ_ERR_SUCCESS) {
+        stats.failures += 1;
+        if (only) {
+            if (brokerReachable)
+                Logger_LogWarning( "Publish to [%s] failed: %s\n", controller->binaryTopic, mosquitto_strerror( rc ) );
+            brokerReachable = FALSE;
+
+            //
+            //  The journal and its replay are JSON whatever goes out live
+            const char *jsonMessage = realTimeDataToJSON( controller->dataTopic, &sample->rtData, sample->rtRead, extraData, NULL, NULL, sample->wallTime );
+            if (jsonMessage != NULL && Journal_Append( sample->wallTime, jsonMessage, strlen( jsonMessage ) ))
+                stats.journaled += 1;
+        }
+        return;
+    }
+
+    stats.binaryPublished += 1;
+    stats.binaryBytes += length;
+    if (!only)
+        return;
+
+    brokerReachable = TRUE;
+    stats.published += 1;
+    if (stats.published == 1)
+        Metrics_StartupEvent( STARTUP_FIRST_PUBLISH );
+    stats.payloadBytes += length;
+    stats.lastLatencyNanos = published - sample->acquiredNanos;
+    Metrics_Record( STAGE_END_TO_END, stats.lastLatencyNanos );
+    if (stats.lastLatencyNanos > stats.maxLatencyNanos)
+        stats.maxLatencyNanos = stats.lastLatencyNanos;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishSample (const sample_t *sample, const periodAggregates_t *aggregates)
+{
+    const controller_t  *controller = &controllers[ sample->controller ];
+    const char          *topic = controller->dataTopic;
+    const epsolarExtraData_t *extraData = (sample->haveExtraData ? &sample->extraData : NULL);
+    const batteryAnalytics_t *battery = (config.batteryAnalytics ? &states[ sample->controller ].battery : NULL);
+
+    if (config.encoding != PAYLOAD_JSON || Fanout_Wants( FANOUT_CBOR ))
+        publishBinary( sample );
+    if (config.encoding == PAYLOAD_CBOR && !Fanout_Wants( FANOUT_JSON ))
+        return;
+
+    //
+    // craft a JSON message from the data. It lives in a buffer that gets
+    // reused next time round, so there is nothing to free. In delta mode
+    // we get NULL back when nothing moved enough to be worth sending
+    uint64_t    started = Time_MonotonicNanos();
+    const char  *jsonMessage;
+    if (config.deltaMode)
+        jsonMessage = Delta_ToJSON( &states[ sample->controller ].delta, topic, &sample->rtData, sample->rtRead, extraData, aggregates, battery, sample->wallTime );
+    else
+        jsonMessage = realTimeDataToJSON( topic, &sample->rtData, sample->rtRead, extraData, aggregates, battery, sample->wallTime );
+
+    uint64_t    serialized = Time_MonotonicNanos();
+    if (config.encoding != PAYLOAD_CBOR)
+        Metrics_Record( STAGE_SERIALIZE, serialized - started );
+
+    if (jsonMessage == NULL) {
+        stats.suppressed += 1;
+        return;
+    }
+
+    //
+    //  The extra brokers first - queueing for them costs a copy, never a wait
+    size_t  length = strlen( jsonMessage );
+    Fanout_Publish( FANOUT_JSON, topic, jsonMessage, length, FALSE );
+    if (config.encoding == PAYLOAD_CBOR)
+        return;
+
+    //
+    // Publish it to our MQTT broker; QoS = 0
+    int rc = mosquitto_publish( config.mosquittoInstance, NULL, topic, length, jsonMessage, 0, false );
+    uint64_t    published = Time_MonotonicNanos();
+    Metrics_Record( STAGE_PUBLISH, published - serialized );
+
+    if (rc != MOSQ_ERR_SUCCESS) {
+        stats.failures += 1;
+        if (brokerReachable)
+            Logger_LogWarning( "Publish to [%s] failed: %s\n", topic, mosquitto_strerror( rc ) );
+        brokerReachable = FALSE;
+
+        if (Journal_Append( sample->wallTime, jsonMessage, length ))
+            stats.journaled += 1;
+        return;
+    }
+
+    brokerReachable = TRUE;
+    stats.published += 1;
+    if (stats.published == 1)
+        Metrics_StartupEvent( STARTUP_FIRST_PUBLISH );
+    stats.payloadBytes += length;
+    stats.lastLatencyNanos = published - sample->acquiredNanos;
+    Metrics_Record( STAGE_END_TO_END, stats.lastLatencyNanos );
+    if (stats.lastLatencyNanos > stats.maxLatencyNanos)
+        stats.maxLatencyNanos = stats.lastLatencyNanos;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishGroup (const controller_t *controller, const fieldGroup_t *group, const sample_t *sample)
+{
+    const epsolarExtraData_t *extraData = (sample->haveExtraData ? &sample->extraData : NULL);
+    char    topic[ 256 ];
+
+    snprintf( topic, sizeof topic, "%s/%s", controller->dataTopic, group->name );
+    const char *jsonMessage = FieldGroups_ToJSON( group, topic, &sample->rtData, sample->rtRead, extraData, sample->wallTime );
+    if (jsonMessage == NULL)
+        return;
+
+    int rc = mosquitto_publish( config.mosquittoInstance, NULL, topic, strlen( jsonMessage ), jsonMessage, 0, group->retain );
+    if (rc != MOSQ_ERR_SUCCESS) {
+        stats.failures += 1;
+        return;
+    }
+    stats.groupMessages += 1;
+
+    if (!group->perField)
+        return;
+
+    for (int i = 0; i < group->numFields; i += 1) {
+        const char *key;
+        const char *value = FieldGroups_FieldValue( group, i, &sample->rtData, sample->rtRead, extraData, &key );
+        if (value == NULL)
+            continue;
+
+        snprintf( topic, sizeof topic, "%s/%s/%s", controller->dataTopic, group->name, key );
+        if (mosquitto_publish( config.mosquittoInstance, NULL, topic, strlen( value ), value, 0, group->retain ) != MOSQ_ERR_SUCCESS) {
+            stats.failures += 1;
+            return;
+        }
+        stats.groupMessages += 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishGroupsIfDue (const sample_t *sample, controllerState_t *state)
+{
+    //
+    //  Due times stay on their own grid. Samples land a few ms either side of
+    //  it, so one within half an interval of the due time counts
+    for (int i = 0; i < numFieldGroups; i += 1) {
+        const fieldGroup_t *group = &fieldGroups[ i ];
+        uint64_t    *due = &state->groupDueNanos[ i ];
+
+        if (*due != 0 && sample->acquiredNanos + group->intervalNanos / 2 < *due)
+            continue;
+
+        publishGroup( &controllers[ sample->controller ], group, sample );
+
+        *due = (*due == 0) ? sample->acquiredNanos + group->intervalNanos : *due + group->intervalNanos;
+        if (*due <= sample->acquiredNanos)
+            *due = sample->acquiredNanos + group->intervalNanos;          // fell behind - start a new grid
+    }
+}
+
+// -----------------------------------------------------------------------------
+static
+void    handleSample (const sample_t *sample)
+{
+    controllerState_t   *state = &states[ sample->controller ];
+
+    //
+    //  Every sample goes into the history, whatever gets published
+    History_Append( &controllers[ sample->controller ].history, sample->wallTime, &sample->rtData, sample->rtRead );
+
+    //
+    //  Settings only go out (retained) when the cache saw them change
+    if (sample->settingsChanged) {
+        state->unpublishedSettings = sample->extraData.settings;
+        state->unpublishedSettingsTime = sample->wallTime;
+        state->settingsPending = TRUE;
+        state->settingsFannedOut = FALSE;
+    }
+    if (state->settingsPending)
+        publishSettings( &controllers[ sample->controller ], state );
+
+    //
+    //  Battery estimates see every sample, whatever gets published. Without a
+    //  "-u" capacity the controller's own setting will do
+    if (config.batteryAnalytics) {
+        if (config.batteryCapacityAh <= 0 && sample->haveExtraData && sample->extraData.settings.batteryCapacity > 0)
+            state->battery.capacityAh = sample->extraData.settings.batteryCapacity;
+        BatteryAnalytics_Add( &state->battery, &sample->rtData, sample->rtRead, sample->wallTime, sample->acquiredNanos );
+    }
+
+    publishGroupsIfDue( sample, state );
+
+    if (config.samplesPerPublish == 1) {
+        publishSample( sample, NULL );
+        return;
+    }
+
+    //
+    //  Periods go by acquisition sequence number. If the ring dropped the
+    //  last sample of a period, close that period out with what we did get
+    aggregator_t *aggregator = &state->aggregator;
+    uint64_t period = sample->sequence / config.samplesPerPublish;
+    if (Aggregator_Samples( aggregator ) > 0 && period != state->aggregatingPeriod)
+        publishSample( &state->lastSample, Aggregator_EndPeriod( aggregator ) );
+
+    state->aggregatingPeriod = period;
+    Aggregator_Add( aggregator, &sample->rtData, sample->rtRead, sample->acquiredNanos );
+    state->lastSample = *sample;
+
+    if (((sample->sequence + 1) % config.samplesPerPublish) == 0)
+        publishSample( sample, Aggregator_EndPeriod( aggregator ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    publishMetricsIfDue (void)
+{
+    if (!Metrics_IsDue( Time_MonotonicNanos() ))
+        return;
+
+    Metrics_WritePrometheus();
+
+    const char *jsonMessage = Metrics_ToJSON( config.metricsTopic );
+    if (jsonMessage == NULL || !brokerReachable)
+        return;
+
+    int rc = mosquitto_publish( config.mosquittoInstance, NULL, config.metricsTopic, strlen( jsonMessage ), jsonMessage, 0, false );
+    if (rc != MOSQ_ERR_SUCCESS)
+        Logger_LogWarning( "Publish to [%s] failed: %s\n", config.metricsTopic, mosquitto_strerror( rc ) );
+}
+
+// -----------------------------------------------------------------------------
+int Publisher_Drain (void)
+{
+    //
+    //  Everything that is in the rings now. FALSE once "-n" samples are done
+    sample_t    sample;
+
+    for (int i = 0; i < numBuses && running; i += 1) {
+        while (SampleRing_Pop( &buses[ i ].ring, &sample )) {
+            handleSample( &sample );
+
+            stats.samples += 1;
+            if ((stats.samples % STATS_LOG_INTERVAL) == 0)
+                logPipelineStats();
+            if (config.maxSamples > 0 && stats.samples >= config.maxSamples) {
+                running = FALSE;
+                break;
+            }
+        }
+    }
+
+    return running;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    Publisher_Housekeeping (void)
+{
+    //
+    //  Journal replay and metrics. Returns when the next replay batch is due,
+    //  0 if there is nothing to replay
+    replayIfDue();
+    publishMetricsIfDue();
+
+    return (brokerReachable && Journal_PendingRecords() > 0) ? nextReplayNanos : 0;
+}
+
+// -----------------------------------------------------------------------------
+void    Publisher_Run (void)
+{
+    while (running) {
+        //
+        //  While there is a backlog to replay, wake up for the next batch
+        //  even if no sample comes in
+        if (brokerReachable && Journal_PendingRecords() > 0) {
+            struct timespec wakeup;
+            clock_gettime( CLOCK_REALTIME, &wakeup );
+            uint64_t wakeupNanos = (uint64_t) wakeup.tv_sec * NANOS_PER_SECOND + wakeup.tv_nsec + replayIntervalNanos;
+            wakeup = Time_NanosToTimespec( wakeupNanos );
+
+            if (sem_timedwait( &samplesWaiting, &wakeup ) != 0 && errno != ETIMEDOUT)
+                continue;
+        } else if (sem_wait( &samplesWaiting ) != 0) {
+            continue;
+        }
+
+        if (Publisher_Drain())
+            Publisher_Housekeeping();
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    Publisher_Stop (void)
+{
+    running = FALSE;
+    sem_post( &samplesWaiting );
+}
+
+// -----------------------------------------------------------------------------
+void    Publisher_GetStats (publisherStats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,64 @@
+/*
+ * File:   publisher.h
+ * Author: pconroy
+ *
+ * The serialize / publish side of the pipeline. Runs on the main thread and
+ * drains the sample rings as the acquisition threads fill them. Data and
+ * settings go out on each controller's own topics.
+ */
+
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+
+#include <stdint.h>
+#include "libmqttrv.h"
+#include "sampleRing.h"
+#include "cborPayload.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  publisherConfig {
+    struct mosquitto    *mosquittoInstance;
+    const char          *replayTopic;       // journaled samples come back out here, whichever controller
+    const char          *metricsTopic;      // periodic stage timings and counters
+    int                 deltaMode;
+    int                 replayBatchesPerSecond;
+    int                 samplesPerPublish;  // > 1 - aggregate that many samples into each message
+    unsigned long       maxSamples;         // > 0 - Publisher_Run() returns after this many (benchmarking)
+    payloadEncoding_t   encoding;           // "-B" - JSON, CBOR or both
+    int                 batteryAnalytics;   // "-u" - add the battery estimates to DATA
+    double              batteryCapacityAh;  // ...0 - go by the controller's setting ("-x")
+} publisherConfig_t;
+
+typedef struct  publisherStats {
+    unsigned long   samples;            // taken off the ring
+    unsigned long   published;          // DATA messages handed to mosquitto
+    unsigned long   suppressed;         // delta mode: nothing worth sending
+    unsigned long   failures;           // mosquitto_publish() said no
+    unsigned long   journaled;          // ...and the message went to the journal instead
+    unsigned long   replayed;           // journaled samples that made it out later
+    unsigned long   payloadBytes;       // DATA bytes handed to mosquitto
+    unsigned long   groupMessages;      // "-g" group and per-field messages
+    unsigned long   binaryPublished;    // "-B" CBOR messages handed to mosquitto
+    unsigned long   binaryBytes;
+    uint64_t        lastLatencyNanos;   // sample read -> message published
+    uint64_t        maxLatencyNanos;
+} publisherStats_t;
+
+extern  int     Publisher_Initialize( const publisherConfig_t *config );
+extern  void    Publisher_SetBroker( struct mosquitto *mosquittoInstance );
+extern  void    Publisher_SampleReady( void );
+extern  void    Publisher_Run( void );
+extern  int     Publisher_Drain( void );
+extern  uint64_t    Publisher_Housekeeping( void );
+extern  void    Publisher_Stop( void );
+extern  void    Publisher_GetStats( publisherStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PUBLISHER_H */
@@ -0,0 +1,345 @@
+/*
+ * File:    reactor.c
+ * author:  patrick conroy
+ *
+ * libmqttrv starts mosquitto's own network thread. We stop it (it can only
+ * be cancelled - it never returns on its own while connected) and do its job
+ * here with mosquitto_loop_read / _write / _misc, so the main thread sleeps
+ * in exactly one place:
+ *
+ *      eventfd     an acquisition thread has pushed a sample
+ *      timerfd     one-shot, re-armed every pass: the next journal replay
+ *                  batch or REACTOR_TICK_MILLIS, whichever is sooner
+ *      MQTT socket readable; writable only while mosquitto has output queued
+ *      signalfd    SIGTERM / SIGINT - Reactor_Run() returns and main()
+ *                  tears everything down properly
+ *
+ * The Modbus side stays where it is. libmodbus only does blocking calls, so
+ * the serial ports belong to their bus scheduler threads; those already work
+ * to absolute CLOCK_MONOTONIC deadlines, and their samples arrive here
+ * through the eventfd.
+ *
+ * Other threads (the command worker, history queries) still call
+ * mosquitto_publish(). With no network thread mosquitto writes those out
+ * inline; anything the socket wouldn't take is picked up on our next pass.
+ *
+ * mosquitto_loop_forever() used to do the reconnecting. Now a lost
+ * connection is retried from the tick, backing off to
+ * REACTOR_RECONNECT_MAX_MILLIS. Samples wait in the rings (and the journal)
+ * meanwhile, same as before.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "asyncLog.h"
+#include "libmqttrv.h"
+#include "publisher.h"
+#include "timeUtils.h"
+#include "reactor.h"
+
+
+#define MAX_EVENTS              8
+
+typedef enum {
+    SOURCE_SAMPLES = 1,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL,
+    SOURCE_MQTT
+} eventSource_t;
+
+static  struct mosquitto    *mosquittoInstance = NULL;
+static  sigset_t            shutdownSignals;
+
+static  int                 epollFD = -1;
+static  int                 sampleFD = -1;
+static  int                 timerFD = -1;
+static  int                 signalFD = -1;
+static  int                 socketFD = -1;          // as registered with epoll
+static  uint32_t            socketEvents = 0;
+
+static  int                 connected = TRUE;
+static  uint64_t            nextReconnectNanos = 0;
+static  int                 reconnectMillis = 1000;
+static  reactorStats_t      stats;
+
+
+// -----------------------------------------------------------------------------
+int Reactor_BlockSignals (void)
+{
+    //
+    //  Has to happen before any other thread is started - they inherit the
+    //  mask, and a signal that isn't blocked everywhere can land on a thread
+    //  that isn't reading the signalfd
+    sigemptyset( &shutdownSignals );
+    sigaddset( &shutdownSignals, SIGTERM );
+    sigaddset( &shutdownSignals, SIGINT );
+
+    if (pthread_sigmask( SIG_BLOCK, &shutdownSignals, NULL ) != 0) {
+        Logger_LogFatal( "Unable to block the shutdown signals\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int Reactor_ShutdownPending (void)
+{
+    //
+    //  Before Reactor_Run() - e.g. still waiting for a broker. The signal
+    //  stays pending (it's blocked), so nothing else needs to see it
+    sigset_t    pending;
+
+    return sigpending( &pending ) == 0 && (sigismember( &pending, SIGTERM ) == 1 || sigismember( &pending, SIGINT ) == 1);
+}
+
+// -----------------------------------------------------------------------------
+static
+int watch (int fd, eventSource_t source)
+{
+    struct epoll_event  event;
+
+    memset( &event, '\0', sizeof event );
+    event.events = EPOLLIN;
+    event.data.u32 = source;
+    return epoll_ctl( epollFD, EPOLL_CTL_ADD, fd, &event ) == 0;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    watchSocket (void)
+{
+    //
+    //  mosquitto's socket changes on every reconnect, and we only want to
+    //  hear that it is writable while there is something to write
+    struct epoll_event  event;
+    int                 fd = connected ? mosquitto_socket( mosquittoInstance ) : -1;
+    uint32_t            events = EPOLLIN | (mosquitto_want_write( mosquittoInstance ) ? EPOLLOUT : 0);
+
+    if (fd == socketFD && events == socketEvents)
+        return;
+
+    if (socketFD >= 0 && fd != socketFD)
+        epoll_ctl( epollFD, EPOLL_CTL_DEL, socketFD, NULL );     // may already be gone with the close
+
+    memset( &event, '\0', sizeof event );
+    event.events = events;
+    event.data.u32 = SOURCE_MQTT;
+    if (fd >= 0 && fd == socketFD)
+        epoll_ctl( epollFD, EPOLL_CTL_MOD, fd, &event );
+    else if (fd >= 0 && epoll_ctl( epollFD, EPOLL_CTL_ADD, fd, &event ) != 0 && errno == EEXIST)
+        epoll_ctl( epollFD, EPOLL_CTL_MOD, fd, &event );
+
+    socketFD = fd;
+    socketEvents = events;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    armTimer (uint64_t deadlineNanos)
+{
+    struct itimerspec   timer;
+
+    memset( &timer, '\0', sizeof timer );
+    timer.it_value = Time_NanosToTimespec( deadlineNanos );
+    timerfd_settime( timerFD, TFD_TIMER_ABSTIME, &timer, NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    connectionLost (int rc)
+{
+    if (!connected)
+        return;
+
+    Logger_LogWarning( "Lost the MQTT broker: %s - reconnecting\n", mosquitto_strerror( rc ) );
+    connected = FALSE;
+    reconnectMillis = 1000;
+    nextReconnectNanos = Time_MonotonicNanos() + (uint64_t) reconnectMillis * NANOS_PER_MILLI;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    reconnectIfDue (uint64_t now)
+{
+    if (connected || now < nextReconnectNanos)
+        return;
+
+    //
+    //  A blocking connect, but nothing else here can get anywhere without one
+    int rc = mosquitto_reconnect( mosquittoInstance );
+    if (rc == MOSQ_ERR_SUCCESS) {
+        Logger_LogWarning( "Reconnected to the MQTT broker\n" );
+        connected = TRUE;
+        stats.reconnects += 1;
+        return;
+    }
+
+    reconnectMillis = (reconnectMillis * 2 > REACTOR_RECONNECT_MAX_MILLIS) ? REACTOR_RECONNECT_MAX_MILLIS : reconnectMillis * 2;
+    nextReconnectNanos = Time_MonotonicNanos() + (uint64_t) reconnectMillis * NANOS_PER_MILLI;
+}
+
+// -----------------------------------------------------------------------------
+int Reactor_Initialize (void)
+{
+    //
+    //  Before the acquisition threads start - they poke the eventfd. The
+    //  broker comes later, with Reactor_Attach()
+    memset( &stats, '\0', sizeof stats );
+
+    epollFD = epoll_create1( EPOLL_CLOEXEC );
+    sampleFD = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    timerFD = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+    signalFD = signalfd( -1, &shutdownSignals, SFD_NONBLOCK | SFD_CLOEXEC );
+
+    if (epollFD < 0 || sampleFD < 0 || timerFD < 0 || signalFD < 0
+            || !watch( sampleFD, SOURCE_SAMPLES ) || !watch( timerFD, SOURCE_TIMER ) || !watch( signalFD, SOURCE_SIGNAL )) {
+        Logger_LogFatal( "Unable to set up the event loop: %s\n", strerror( errno ) );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+void    Reactor_Attach (struct mosquitto *mosq)
+{
+    mosquittoInstance = mosq;
+
+    //
+    //  Take the socket over from libmqttrv's thread
+    mosquitto_loop_stop( mosquittoInstance, true );
+
+    connected = (mosquitto_socket( mosquittoInstance ) >= 0);
+    if (!connected)
+        connectionLost( MOSQ_ERR_NO_CONN );
+    watchSocket();
+}
+
+// -----------------------------------------------------------------------------
+void    Reactor_SampleReady (void)
+{
+    //
+    //  Acquisition threads. Several pokes before we get round to it read as one
+    uint64_t    one = 1;
+    if (write( sampleFD, &one, sizeof one ) < 0 && errno != EAGAIN)
+        Logger_LogError( "Unable to wake the event loop: %s\n", strerror( errno ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    serviceSocket (uint32_t events)
+{
+    int rc = MOSQ_ERR_SUCCESS;
+
+    stats.socketWakeups += 1;
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        rc = mosquitto_loop_read( mosquittoInstance, 1 );
+    if (rc == MOSQ_ERR_SUCCESS && (events & EPOLLOUT))
+        rc = mosquitto_loop_write( mosquittoInstance, 1 );
+
+    if (rc != MOSQ_ERR_SUCCESS)
+        connectionLost( rc );
+}
+
+// -----------------------------------------------------------------------------
+int Reactor_Run (void)
+{
+    //
+    //  Returns TRUE on SIGTERM / SIGINT or once "-n" samples are done,
+    //  FALSE if the loop itself broke
+    struct epoll_event  events[ MAX_EVENTS ];
+    uint64_t            counter;
+    uint64_t            nextTick = Time_MonotonicNanos() + (REACTOR_TICK_MILLIS * NANOS_PER_MILLI);
+
+    for (;;) {
+        uint64_t replayDue = Publisher_Housekeeping();
+        armTimer( (replayDue != 0 && replayDue < nextTick) ? replayDue : nextTick );
+        watchSocket();
+
+        int n = epoll_wait( epollFD, events, MAX_EVENTS, -1 );
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            Logger_LogError( "Event loop failed: %s\n", strerror( errno ) );
+            return FALSE;
+        }
+
+        stats.wakeups += 1;
+        for (int i = 0; i < n; i += 1) {
+            switch (events[ i ].data.u32) {
+                case SOURCE_SAMPLES:
+                    stats.sampleWakeups += 1;
+                    if (read( sampleFD, &counter, sizeof counter ) < 0 && errno != EAGAIN)
+                        Logger_LogError( "Unable to read the sample eventfd: %s\n", strerror( errno ) );
+                    if (!Publisher_Drain())
+                        return TRUE;
+                    break;
+
+                case SOURCE_TIMER: {
+                    uint64_t now = Time_MonotonicNanos();
+
+                    stats.timerWakeups += 1;
+                    if (read( timerFD, &counter, sizeof counter ) < 0 && errno != EAGAIN)
+                        Logger_LogError( "Unable to read the timerfd: %s\n", strerror( errno ) );
+                    if (now >= nextTick) {
+                        if (connected) {
+                            int rc = mosquitto_loop_misc( mosquittoInstance );
+                            if (rc != MOSQ_ERR_SUCCESS)
+                                connectionLost( rc );
+                        }
+                        reconnectIfDue( now );
+                        nextTick = now + (REACTOR_TICK_MILLIS * NANOS_PER_MILLI);
+                    }
+                    break;
+                }
+
+                case SOURCE_SIGNAL: {
+                    struct signalfd_siginfo signal;
+                    if (read( signalFD, &signal, sizeof signal ) == sizeof signal) {
+                        Logger_LogWarning( "Caught %s - shutting down\n", strsignal( signal.ssi_signo ) );
+                        return TRUE;
+                    }
+                    break;
+                }
+
+                case SOURCE_MQTT:
+                    serviceSocket( events[ i ].events );
+                    break;
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    Reactor_Close (void)
+{
+    Logger_LogInfo( "Event loop: %lu wakeups - %lu samples, %lu timer, %lu socket, %lu reconnects\n",
+                    stats.wakeups, stats.sampleWakeups, stats.timerWakeups, stats.socketWakeups, stats.reconnects );
+
+    if (epollFD >= 0)
+        close( epollFD );
+    if (sampleFD >= 0)
+        close( sampleFD );
+    if (timerFD >= 0)
+        close( timerFD );
+    if (signalFD >= 0)
+        close( signalFD );
+    epollFD = sampleFD = timerFD = signalFD = -1;
+}
+
+// -----------------------------------------------------------------------------
+void    Reactor_GetStats (reactorStats_t *out)
+{
+    *out = stats;
+}
@@ -0,0 +1,46 @@
+/*
+ * File:   reactor.h
+ * Author: pconroy
+ *
+ * "-E" event loop for the main thread. One epoll set instead of the
+ * publisher's semaphore and mosquitto's network thread: an eventfd the
+ * acquisition threads poke when a sample is ready, a timerfd for the
+ * journal replay / metrics / keepalive schedule, the MQTT socket, and a
+ * signalfd so SIGTERM from systemd (or a ^C) shuts us down cleanly.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "libmqttrv.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REACTOR_TICK_MILLIS             1000    // longest we sleep - mosquitto's keepalive wants that much
+#define REACTOR_RECONNECT_MAX_MILLIS    30000
+
+typedef struct  reactorStats {
+    unsigned long   wakeups;
+    unsigned long   sampleWakeups;
+    unsigned long   timerWakeups;
+    unsigned long   socketWakeups;
+    unsigned long   reconnects;
+} reactorStats_t;
+
+extern  int     Reactor_BlockSignals( void );
+extern  int     Reactor_Initialize( void );
+extern  void    Reactor_Attach( struct mosquitto *mosquittoInstance );
+extern  int     Reactor_ShutdownPending( void );
+extern  void    Reactor_SampleReady( void );
+extern  int     Reactor_Run( void );
+extern  void    Reactor_Close( void );
+extern  void    Reactor_GetStats( reactorStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REACTOR_H */
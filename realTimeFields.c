@@ -0,0 +1,494 @@
+/*
+ * File:    realTimeFields.c
+ * author:  patrick conroy
+ *
+ * The table order is the order fields appear in the DATA message - keep it
+ * that way, subscribers have been parsing "version 4.0" for a long time.
+ *
+ * Register addresses are from the EPSolar "Tracer A/B series Modbus protocol"
+ * document. A key may only appear once in a message; RealTimeFields_CheckKeys()
+ * refuses to start if someone adds one twice.
+ *
+ * Which fields' registers came back is a fieldMask_t, one bit per row of
+ * realTimeFields[], that travels next to the epsolarRealTimeData_t (that
+ * struct is libepsolar's). RealTimeFields_IsValid() says no to a field that
+ * wasn't read, which leaves it out of every message, aggregate and history
+ * block - rather than publishing a zero.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "extraData.h"
+#include "realTimeFields.h"
+
+
+//
+//  Accessors, so the table doesn't care how libepsolar declares each member
+#define NUMBER_ACCESSORS(member)    static double get_##member (const epsolarRealTimeData_t *rtData) { return rtData->member; } \
+                                    static void set_##member (epsolarRealTimeData_t *rtData, double value) { rtData->member = value; }
+#define STRING_GETTER(member)       static const char *get_##member (const epsolarRealTimeData_t *rtData) { return rtData->member; }
+
+STRING_GETTER( controllerClock )
+NUMBER_ACCESSORS( isNightTime )
+NUMBER_ACCESSORS( loadIsOn )
+NUMBER_ACCESSORS( pvVoltage )
+NUMBER_ACCESSORS( pvCurrent )
+NUMBER_ACCESSORS( pvPower )
+STRING_GETTER( pvStatus )
+NUMBER_ACCESSORS( loadVoltage )
+NUMBER_ACCESSORS( loadCurrent )
+NUMBER_ACCESSORS( loadPower )
+STRING_GETTER( loadLevel )
+STRING_GETTER( loadControlMode )
+NUMBER_ACCESSORS( batteryStateOfCharge )
+NUMBER_ACCESSORS( batteryVoltage )
+NUMBER_ACCESSORS( batteryCurrent )
+STRING_GETTER( batteryStatus )
+NUMBER_ACCESSORS( batteryMaxVoltage )
+NUMBER_ACCESSORS( batteryMinVoltage )
+STRING_GETTER( batteryChargingStatus )
+NUMBER_ACCESSORS( batteryTemperature )
+NUMBER_ACCESSORS( controllerTemp )
+NUMBER_ACCESSORS( chargerStatusNormal )
+NUMBER_ACCESSORS( chargerRunning )
+NUMBER_ACCESSORS( controllerStatusBits )
+NUMBER_ACCESSORS( energyConsumedToday )
+NUMBER_ACCESSORS( energyConsumedMonth )
+NUMBER_ACCESSORS( energyConsumedYear )
+NUMBER_ACCESSORS( energyConsumedTotal )
+NUMBER_ACCESSORS( energyGeneratedToday )
+NUMBER_ACCESSORS( energyGeneratedMonth )
+NUMBER_ACCESSORS( energyGeneratedYear )
+NUMBER_ACCESSORS( energyGeneratedTotal )
+
+//
+//  Sources. Voltages, currents, powers and temperatures are scaled by 100
+#define INPUT16(address, scale)     { REG_INPUT, address, 1, FALSE, scale }
+#define SIGNED16(address, scale)    { REG_INPUT, address, 1, TRUE, scale }
+#define INPUT32(address, scale)     { REG_INPUT, address, 2, FALSE, scale }
+#define SIGNED32(address, scale)    { REG_INPUT, address, 2, TRUE, scale }
+#define HOLDING16(address, scale)   { REG_HOLDING, address, 1, FALSE, scale }
+#define HOLDINGS16(address, scale)  { REG_HOLDING, address, 1, TRUE, scale }
+#define DECODED(kind, address, n)   { kind, address, n, FALSE, 0 }
+#define NO_REGISTER                 { REG_INPUT, 0, 0, FALSE, 0 }
+
+#define BATTERY_STATUS              DECODED( REG_INPUT, 0x3200, 1 )
+#define CHARGING_STATUS             DECODED( REG_INPUT, 0x3201, 1 )
+#define DISCHARGING_STATUS          DECODED( REG_INPUT, 0x3202, 1 )
+
+#define FIXED(key, member, decimals, deadband, source)  { key, FIELD_FIXED, decimals, deadband, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, FALSE, FALSE }
+#define NUMBER(key, member, deadband, source)           { key, FIELD_NUMBER, 0, deadband, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, FALSE, FALSE }
+#define BOOL(key, member, source)                       { key, FIELD_BOOL, 0, 0, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, FALSE, FALSE }
+#define YESNO(key, member, source)                      { key, FIELD_YESNO, 0, 0, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, FALSE, FALSE }
+#define STRING(key, member, source)                     { key, FIELD_STRING, 0, 0, RATE_CYCLE, FALSE, 0, 0, source, NULL, get_##member, NULL, FALSE, FALSE }
+
+//
+//  Instantaneous readings - these get period aggregates when sampling faster
+//  than we publish. The energy counters are already totals, so they don't
+#define MEASURED(key, member, deadband, source)         { key, FIELD_FIXED, 2, deadband, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, TRUE, FALSE }
+#define POWER(key, member, deadband, source)            { key, FIELD_FIXED, 2, deadband, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, TRUE, TRUE }
+#define PERCENT(key, member, deadband, source)          { key, FIELD_NUMBER, 0, deadband, RATE_CYCLE, FALSE, 0, 0, source, get_##member, NULL, set_##member, TRUE, FALSE }
+
+//
+//  Been seeing some spurious temperature values coming thru. Those get dropped
+#define TEMPERATURE(key, member, source)                { key, FIELD_FIXED, 1, 0.5, RATE_CYCLE, TRUE, -50.0, 150.0, source, get_##member, NULL, set_##member, TRUE, FALSE }
+
+const realTimeField_t   realTimeFields[] = {
+    { "controllerDateTime", FIELD_STRING, 0, 0, RATE_KEYFRAME, FALSE, 0, 0, DECODED( REG_HOLDING, 0x9013, 3 ), NULL, get_controllerClock, NULL, FALSE, FALSE },
+    BOOL(   "isNightTime",              isNightTime,            NO_REGISTER ),          // discrete input 0x200C
+    BOOL(   "loadIsOn",                 loadIsOn,               DISCHARGING_STATUS ),
+
+    MEASURED( "pvVoltage",              pvVoltage, 0.05,        INPUT16( 0x3100, 100 ) ),
+    MEASURED( "pvCurrent",              pvCurrent, 0.05,        INPUT16( 0x3101, 100 ) ),
+    POWER(  "pvPower",                  pvPower, 1.0,           INPUT32( 0x3102, 100 ) ),
+    STRING( "pvStatus",                 pvStatus,               CHARGING_STATUS ),
+
+    MEASURED( "loadVoltage",            loadVoltage, 0.05,      INPUT16( 0x310C, 100 ) ),
+    MEASURED( "loadCurrent",            loadCurrent, 0.05,      INPUT16( 0x310D, 100 ) ),
+    POWER(  "loadPower",                loadPower, 1.0,         INPUT32( 0x310E, 100 ) ),
+    STRING( "loadLevel",                loadLevel,              DISCHARGING_STATUS ),
+    STRING( "loadControlMode",          loadControlMode,        DECODED( REG_HOLDING, 0x903D, 1 ) ),
+
+    PERCENT( "batterySOC",              batteryStateOfCharge, 1, INPUT16( 0x311A, 1 ) ),
+    MEASURED( "batteryVoltage",         batteryVoltage, 0.05,   INPUT16( 0x331A, 100 ) ),
+    MEASURED( "batteryCurrent",         batteryCurrent, 0.05,   SIGNED32( 0x331B, 100 ) ),
+    STRING( "batteryStatus",            batteryStatus,          BATTERY_STATUS ),
+    FIXED(  "batteryMaxVoltage",        batteryMaxVoltage, 2, 0.05, INPUT16( 0x3302, 100 ) ),
+    FIXED(  "batteryMinVoltage",        batteryMinVoltage, 2, 0.05, INPUT16( 0x3303, 100 ) ),
+    STRING( "batteryChargingStatus",    batteryChargingStatus,  CHARGING_STATUS ),
+
+    TEMPERATURE( "batteryTemperature",      batteryTemperature, SIGNED16( 0x3110, 100 ) ),
+    TEMPERATURE( "controllerTemperature",   controllerTemp,     SIGNED16( 0x3111, 100 ) ),
+
+    YESNO(  "chargerStatusNormal",      chargerStatusNormal,    CHARGING_STATUS ),
+    YESNO(  "chargerRunning",           chargerRunning,         CHARGING_STATUS ),
+    NUMBER( "deviceArrayChargingStatusBits", controllerStatusBits, 0, CHARGING_STATUS ),
+
+    FIXED(  "energyConsumedToday",      energyConsumedToday, 2, 0.01,   INPUT32( 0x3304, 100 ) ),
+    FIXED(  "energyConsumedMonth",      energyConsumedMonth, 2, 0.01,   INPUT32( 0x3306, 100 ) ),
+    FIXED(  "energyConsumedYear",       energyConsumedYear, 2, 0.01,    INPUT32( 0x3308, 100 ) ),
+    FIXED(  "energyConsumedTotal",      energyConsumedTotal, 2, 0.01,   INPUT32( 0x330A, 100 ) ),
+    FIXED(  "energyGeneratedToday",     energyGeneratedToday, 2, 0.01,  INPUT32( 0x330C, 100 ) ),
+    FIXED(  "energyGeneratedMonth",     energyGeneratedMonth, 2, 0.01,  INPUT32( 0x330E, 100 ) ),
+    FIXED(  "energyGeneratedYear",      energyGeneratedYear, 2, 0.01,   INPUT32( 0x3310, 100 ) ),
+    FIXED(  "energyGeneratedTotal",     energyGeneratedTotal, 2, 0.01,  INPUT32( 0x3312, 100 ) ),
+};
+
+const int   numRealTimeFields = sizeof realTimeFields / sizeof realTimeFields[ 0 ];
+
+//
+//  Won't compile once the table outgrows a fieldMask_t
+typedef char    realTimeFieldsFitTheMask[ (sizeof realTimeFields / sizeof realTimeFields[ 0 ] <= FIELD_MASK_BITS) ? 1 : -1 ];
+
+
+//
+//  The "-x" extra data. Status words are read with the realtime registers,
+//  the rest on the settings cache schedule
+#define STATUS_BIT(test, word)      static double get_##test (const epsolarExtraData_t *extraData) { return test( extraData->word ); }
+#define STATUS_TEXT(decode, word)   static const char *get_##decode (const epsolarExtraData_t *extraData) { return decode( extraData->word ); }
+#define SETTING_ACCESSORS(member)   static double get_##member (const epsolarExtraData_t *extraData) { return extraData->settings.member; } \
+                                    static void set_##member (epsolarSettings_t *settings, double value) { settings->member = value; }
+#define SETTING_TEXT(member)        static const char *get_##member (const epsolarExtraData_t *extraData) { return extraData->settings.member; }
+
+STATUS_TEXT( eps_getBatteryStatusInnerResistance, batteryStatusBits )
+STATUS_TEXT( eps_getBatteryStatusIdentification, batteryStatusBits )
+STATUS_TEXT( eps_getChargingEquipmentStatusInputVoltageStatus, chargingEquipmentStatusBits )
+STATUS_BIT( isChargingMOSFETShorted, chargingEquipmentStatusBits )
+STATUS_BIT( isChargingMOSFETOpen, chargingEquipmentStatusBits )
+STATUS_BIT( isAntiReverseMOSFETShort, chargingEquipmentStatusBits )
+STATUS_BIT( isInputOverCurrent, chargingEquipmentStatusBits )
+STATUS_BIT( isLoadOverCurrent, chargingEquipmentStatusBits )
+STATUS_BIT( isLoadShorted, chargingEquipmentStatusBits )
+STATUS_BIT( isLoadMOSFETShorted, chargingEquipmentStatusBits )
+STATUS_BIT( isDisequilibriumInThreeCircuits, chargingEquipmentStatusBits )
+STATUS_BIT( isPVInputShorted, chargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusShorted, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusUnableToDischarge, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusUnableToStopDischarge, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusOutputVoltageAbnormal, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusInputOverVoltage, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusShortedInHighVoltage, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusBoostOverVoltage, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusOutputOverVoltage, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusNormal, dischargingEquipmentStatusBits )
+STATUS_BIT( isDischargeStatusRunning, dischargingEquipmentStatusBits )
+
+SETTING_ACCESSORS( batteryRealRatedVoltage )
+SETTING_TEXT( batteryRatedVoltageCode )
+SETTING_ACCESSORS( ratedChargingCurrent )
+SETTING_ACCESSORS( ratedLoadCurrent )
+SETTING_ACCESSORS( boostDuration )
+SETTING_ACCESSORS( equalizeDuration )
+SETTING_TEXT( batteryType )
+SETTING_ACCESSORS( batteryCapacity )
+SETTING_ACCESSORS( highVoltageDisconnect )
+SETTING_ACCESSORS( chargingLimitVoltage )
+SETTING_ACCESSORS( overVoltageReconnect )
+SETTING_ACCESSORS( equalizationVoltage )
+SETTING_ACCESSORS( boostingVoltage )
+SETTING_ACCESSORS( floatingVoltage )
+SETTING_ACCESSORS( boostReconnectVoltage )
+SETTING_ACCESSORS( lowVoltageReconnectVoltage )
+SETTING_ACCESSORS( underVoltageWarningRecoverVoltage )
+SETTING_ACCESSORS( underVoltageWarningVoltage )
+SETTING_ACCESSORS( lowVoltageDisconnectVoltage )
+SETTING_ACCESSORS( dischargingLimitVoltage )
+SETTING_ACCESSORS( dischargingPercentage )
+SETTING_ACCESSORS( chargingPercentage )
+SETTING_ACCESSORS( batteryTemperatureWarningUpperLimit )
+SETTING_ACCESSORS( batteryTemperatureWarningLowerLimit )
+SETTING_ACCESSORS( controllerInnerTemperatureUpperLimit )
+SETTING_ACCESSORS( controllerInnerTemperatureUpperLimitRecover )
+
+#define STATUS_STRING(key, decode, source)          { key, FIELD_STRING, 0, RATE_CYCLE, source, NULL, get_##decode, NULL }
+#define STATUS_FLAG(key, test, source)              { key, FIELD_BOOL, 0, RATE_CYCLE, source, get_##test, NULL, NULL }
+#define SETTING_FIXED(key, member, source)          { key, FIELD_FIXED, 2, RATE_SETTINGS, source, get_##member, NULL, set_##member }
+#define SETTING_NUMBER(key, member, source)         { key, FIELD_NUMBER, 0, RATE_SETTINGS, source, get_##member, NULL, set_##member }
+#define SETTING_STRING(key, member, source)         { key, FIELD_STRING, 0, RATE_SETTINGS, source, NULL, get_##member, NULL }
+
+const extraField_t  extraFields[] = {
+    SETTING_FIXED(  "BatteryRealRatedVoltage",      batteryRealRatedVoltage,    INPUT16( 0x311D, 100 ) ),
+    SETTING_STRING( "BatteryRatedVoltageCode",      batteryRatedVoltageCode,    DECODED( REG_HOLDING, 0x9067, 1 ) ),
+
+    STATUS_STRING(  "BatteryStatusInnerResistance",  eps_getBatteryStatusInnerResistance, BATTERY_STATUS ),
+    STATUS_STRING(  "BatteryStatusIdentification",   eps_getBatteryStatusIdentification, BATTERY_STATUS ),
+    STATUS_STRING(  "ChargingEquipmentStatusInputVoltageStatus", eps_getChargingEquipmentStatusInputVoltageStatus, CHARGING_STATUS ),
+
+    STATUS_FLAG(    "isChargingMOSFETShorted",              isChargingMOSFETShorted,            CHARGING_STATUS ),
+    STATUS_FLAG(    "isChargingMOSFETOpen",                 isChargingMOSFETOpen,               CHARGING_STATUS ),
+    STATUS_FLAG(    "isAntiReverseMOSFETShort",             isAntiReverseMOSFETShort,           CHARGING_STATUS ),
+    STATUS_FLAG(    "isInputOverCurrent",                   isInputOverCurrent,                 CHARGING_STATUS ),
+    STATUS_FLAG(    "isLoadOverCurrent",                    isLoadOverCurrent,                  CHARGING_STATUS ),
+    STATUS_FLAG(    "isLoadShorted",                        isLoadShorted,                      CHARGING_STATUS ),
+    STATUS_FLAG(    "isLoadMOSFETShorted",                  isLoadMOSFETShorted,                CHARGING_STATUS ),
+    STATUS_FLAG(    "isDisequilibriumInThreeCircuits",      isDisequilibriumInThreeCircuits,    CHARGING_STATUS ),
+    STATUS_FLAG(    "isPVInputShorted",                     isPVInputShorted,                   CHARGING_STATUS ),
+
+    STATUS_FLAG(    "isDischargeStatusShorted",                 isDischargeStatusShorted,               DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusUnableToDischarge",       isDischargeStatusUnableToDischarge,     DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusUnableToStopDischarge",   isDischargeStatusUnableToStopDischarge, DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusOutputVoltageAbnormal",   isDischargeStatusOutputVoltageAbnormal, DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusInputOverVoltage",        isDischargeStatusInputOverVoltage,      DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusShortedInHighVoltage",    isDischargeStatusShortedInHighVoltage,  DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusBoostOverVoltage",        isDischargeStatusBoostOverVoltage,      DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isPVisDischargeStatusOutputOverVoltageInputShorted", isDischargeStatusOutputOverVoltage, DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusNormal",                  isDischargeStatusNormal,                DISCHARGING_STATUS ),
+    STATUS_FLAG(    "isDischargeStatusRunning",                 isDischargeStatusRunning,               DISCHARGING_STATUS ),
+
+    SETTING_FIXED(  "RatedChargingCurrent",         ratedChargingCurrent,       INPUT16( 0x3005, 100 ) ),
+    SETTING_FIXED(  "RatedLoadCurrent",             ratedLoadCurrent,           INPUT16( 0x300E, 100 ) ),
+    SETTING_NUMBER( "BoostDuration",                boostDuration,              HOLDING16( 0x906C, 1 ) ),
+    SETTING_NUMBER( "EqualizeDuration",             equalizeDuration,           HOLDING16( 0x906B, 1 ) ),
+    SETTING_STRING( "BatteryType",                  batteryType,                DECODED( REG_HOLDING, 0x9000, 1 ) ),
+    SETTING_NUMBER( "BatteryCapacity",              batteryCapacity,            HOLDING16( 0x9001, 1 ) ),
+
+    SETTING_FIXED(  "HighVoltageDisconnect",        highVoltageDisconnect,      HOLDING16( 0x9003, 100 ) ),
+    SETTING_FIXED(  "ChargingLimitVoltage",         chargingLimitVoltage,       HOLDING16( 0x9004, 100 ) ),
+    SETTING_FIXED(  "OverVoltageReconnect",         overVoltageReconnect,       HOLDING16( 0x9005, 100 ) ),
+    SETTING_FIXED(  "EqualizationVoltage",          equalizationVoltage,        HOLDING16( 0x9006, 100 ) ),
+    SETTING_FIXED(  "BoostingVoltage",              boostingVoltage,            HOLDING16( 0x9007, 100 ) ),
+    SETTING_FIXED(  "FloatingVoltage",              floatingVoltage,            HOLDING16( 0x9008, 100 ) ),
+    SETTING_FIXED(  "BoostReconnectVoltage",        boostReconnectVoltage,      HOLDING16( 0x9009, 100 ) ),
+    SETTING_FIXED(  "LowVoltageReconnectVoltage",   lowVoltageReconnectVoltage, HOLDING16( 0x900A, 100 ) ),
+    SETTING_FIXED(  "UnderVoltageWarningRecoverVoltage",    underVoltageWarningRecoverVoltage,  HOLDING16( 0x900B, 100 ) ),
+    SETTING_FIXED(  "UnderVoltageWarningVoltage",   underVoltageWarningVoltage, HOLDING16( 0x900C, 100 ) ),
+    SETTING_FIXED(  "LowVoltageDisconnectVoltage",  lowVoltageDisconnectVoltage, HOLDING16( 0x900D, 100 ) ),
+    SETTING_FIXED(  "DischargingLimitVoltage",      dischargingLimitVoltage,    HOLDING16( 0x900E, 100 ) ),
+
+    SETTING_FIXED(  "DischargingPercentage",        dischargingPercentage,      HOLDING16( 0x906D, 100 ) ),
+    SETTING_FIXED(  "ChargingPercentage",           chargingPercentage,         HOLDING16( 0x906E, 100 ) ),
+
+    SETTING_FIXED(  "BatteryTemperatureWarningUpperLimit",  batteryTemperatureWarningUpperLimit,    HOLDINGS16( 0x9017, 100 ) ),
+    SETTING_FIXED(  "BatteryTemperatureWarningLowerLimit",  batteryTemperatureWarningLowerLimit,    HOLDINGS16( 0x9018, 100 ) ),
+    SETTING_FIXED(  "ControllerInnerTemperatureUpperLimit", controllerInnerTemperatureUpperLimit,   HOLDINGS16( 0x9019, 100 ) ),
+    SETTING_FIXED(  "ControllerInnerTemperatureUpperLimitRecover", controllerInnerTemperatureUpperLimitRecover, HOLDINGS16( 0x901A, 100 ) ),
+};
+
+const int   numExtraFields = sizeof extraFields / sizeof extraFields[ 0 ];
+
+typedef char    extraFieldsFitTheMask[ (sizeof extraFields / sizeof extraFields[ 0 ] <= FIELD_MASK_BITS) ? 1 : -1 ];
+
+//
+//  "-f" / "-F". Everything is on unless told otherwise
+static  uint8_t     realTimeDisabled[ sizeof realTimeFields / sizeof realTimeFields[ 0 ] ];
+static  uint8_t     extraDisabled[ sizeof extraFields / sizeof extraFields[ 0 ] ];
+
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_CheckKeys (void)
+{
+    //
+    //  Both tables end up in the same DATA message
+    int ok = TRUE;
+
+    for (int i = 0; i < numRealTimeFields + numExtraFields; i += 1) {
+        const char *key = (i < numRealTimeFields) ? realTimeFields[ i ].key : extraFields[ i - numRealTimeFields ].key;
+        for (int j = 0; j < i; j += 1) {
+            const char *other = (j < numRealTimeFields) ? realTimeFields[ j ].key : extraFields[ j - numRealTimeFields ].key;
+            if (strcmp( key, other ) == 0) {
+                Logger_LogFatal( "Field [%s] is in the field table twice\n", key );
+                ok = FALSE;
+            }
+        }
+    }
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+static
+int setFlags (const char *list, uint8_t value)
+{
+    //
+    //  Comma separated keys from either table
+    char    copy[ 1024 ];
+    char    *savePtr = NULL;
+    int     ok = TRUE;
+
+    snprintf( copy, sizeof copy, "%s", list );
+    for (char *key = strtok_r( copy, ",", &savePtr ); key != NULL; key = strtok_r( NULL, ",", &savePtr )) {
+        int found = FALSE;
+        for (int i = 0; i < numRealTimeFields; i += 1)
+            if (strcmp( realTimeFields[ i ].key, key ) == 0) {
+                realTimeDisabled[ i ] = value;
+                found = TRUE;
+            }
+        for (int i = 0; i < numExtraFields; i += 1)
+            if (strcmp( extraFields[ i ].key, key ) == 0) {
+                extraDisabled[ i ] = value;
+                found = TRUE;
+            }
+        if (!found) {
+            Logger_LogError( "Unknown field [%s]\n", key );
+            ok = FALSE;
+        }
+    }
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_SetMask (const char *onlyThese, const char *notThese)
+{
+    //
+    //  "-f" turns everything else off, then "-F" takes fields back out
+    int ok = TRUE;
+
+    memset( realTimeDisabled, (onlyThese != NULL), sizeof realTimeDisabled );
+    memset( extraDisabled, (onlyThese != NULL), sizeof extraDisabled );
+
+    if (onlyThese != NULL)
+        ok = setFlags( onlyThese, FALSE );
+    if (notThese != NULL)
+        ok = setFlags( notThese, TRUE ) && ok;
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_Find (const char *key)
+{
+    for (int i = 0; i < numRealTimeFields; i += 1)
+        if (strcmp( realTimeFields[ i ].key, key ) == 0)
+            return i;
+    return -1;
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_IsEnabled (const realTimeField_t *field)
+{
+    return !realTimeDisabled[ field - realTimeFields ];
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_WasRead (const realTimeField_t *field, fieldMask_t read)
+{
+    return (read >> (field - realTimeFields)) & 1;
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_IsValid (const realTimeField_t *field, const epsolarRealTimeData_t *rtData, fieldMask_t read)
+{
+    //
+    //  A field masked off was never read, so it is never valid either
+    if (!RealTimeFields_IsEnabled( field ) || !RealTimeFields_WasRead( field, read ))
+        return FALSE;
+    if (!field->rangeChecked)
+        return TRUE;
+
+    double value = field->number( rtData );
+    return (value >= field->minValid) && (value <= field->maxValid);
+}
+
+// -----------------------------------------------------------------------------
+static
+void    writeValue (jsonWriter_t *writer, const char *key, fieldKind_t kind, int decimals, double number, const char *string)
+{
+    switch (kind) {
+        case FIELD_FIXED:   JSON_AddFixed( writer, key, number, decimals );                 break;
+        case FIELD_NUMBER:  JSON_AddNumber( writer, key, number );                          break;
+        case FIELD_BOOL:    JSON_AddBool( writer, key, number != 0 );                       break;
+        case FIELD_YESNO:   JSON_AddString( writer, key, (number != 0 ? "Yes" : "No") );    break;
+        case FIELD_STRING:  JSON_AddString( writer, key, string );                          break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void    RealTimeFields_Write (jsonWriter_t *writer, const realTimeField_t *field, const epsolarRealTimeData_t *rtData)
+{
+    if (field->kind == FIELD_STRING)
+        writeValue( writer, field->key, field->kind, field->decimals, 0, field->string( rtData ) );
+    else
+        writeValue( writer, field->key, field->kind, field->decimals, field->number( rtData ), NULL );
+}
+
+// -----------------------------------------------------------------------------
+int ExtraFields_IsEnabled (const extraField_t *field)
+{
+    return !extraDisabled[ field - extraFields ];
+}
+
+// -----------------------------------------------------------------------------
+int ExtraFields_IsValid (const extraField_t *field, const epsolarExtraData_t *extraData)
+{
+    //
+    //  Status rows were read this cycle, settings rows on the cache's last refresh
+    fieldMask_t read = (field->rate == RATE_SETTINGS) ? extraData->settings.read : extraData->statusRead;
+    return ExtraFields_IsEnabled( field ) && ((read >> (field - extraFields)) & 1);
+}
+
+// -----------------------------------------------------------------------------
+void    ExtraFields_Write (jsonWriter_t *writer, const extraField_t *field, const epsolarExtraData_t *extraData)
+{
+    if (field->kind == FIELD_STRING)
+        writeValue( writer, field->key, field->kind, field->decimals, 0, field->string( extraData ) );
+    else
+        writeValue( writer, field->key, field->kind, field->decimals, field->number( extraData ), NULL );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    addSpan (registerSpan_t *spans, int *numSpans, int maxSpans, const registerSource_t *source)
+{
+    //
+    //  Most status fields share a register, and most readings sit next to
+    //  each other. Fold them together here so the planner gets a short list
+    if (source->registers == 0)
+        return;
+
+    int first = source->address;
+    int last = source->address + source->registers;
+
+    for (int i = 0; i < *numSpans; i += 1) {
+        registerSpan_t *span = &spans[ i ];
+        if (span->kind == source->kind && first <= span->address + span->count && last >= span->address) {
+            int end = (last > span->address + span->count) ? last : span->address + span->count;
+            span->address = (first < span->address) ? first : span->address;
+            span->count = end - span->address;
+            return;
+        }
+    }
+
+    if (*numSpans >= maxSpans) {
+        Logger_LogError( "Too many register spans for one read plan. Register 0x%04X dropped\n", source->address );
+        return;
+    }
+    spans[ *numSpans ].kind = source->kind;
+    spans[ *numSpans ].address = first;
+    spans[ *numSpans ].count = source->registers;
+    *numSpans += 1;
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeFields_Spans (registerSpan_t *spans, int maxSpans, int withStatusBits)
+{
+    //
+    //  What one polling pass has to read: the enabled realtime fields, plus
+    //  the status words when "-x" wants them
+    int numSpans = 0;
+
+    for (int i = 0; i < numRealTimeFields; i += 1)
+        if (!realTimeDisabled[ i ])
+            addSpan( spans, &numSpans, maxSpans, &realTimeFields[ i ].source );
+
+    for (int i = 0; withStatusBits && i < numExtraFields; i += 1)
+        if (!extraDisabled[ i ] && extraFields[ i ].rate == RATE_CYCLE)
+            addSpan( spans, &numSpans, maxSpans, &extraFields[ i ].source );
+
+    return numSpans;
+}
+
+// -----------------------------------------------------------------------------
+int ExtraFields_SettingsSpans (registerSpan_t *spans, int maxSpans)
+{
+    int numSpans = 0;
+
+    for (int i = 0; i < numExtraFields; i += 1)
+        if (!extraDisabled[ i ] && extraFields[ i ].rate == RATE_SETTINGS)
+            addSpan( spans, &numSpans, maxSpans, &extraFields[ i ].source );
+
+    return numSpans;
+}
@@ -0,0 +1,97 @@
+/*
+ * File:   realTimeFields.h
+ * Author: pconroy
+ *
+ * The field registry. One row per field that goes into a message: its JSON
+ * key, how it is formatted, the register(s) it comes from and their scale,
+ * what counts as a real change, its valid range and how often it is read.
+ * The read plans, the decoders, the serializers, the delta encoder and the
+ * "-f" / "-F" field masks all walk these tables.
+ *
+ * Two tables because there are two source structs: realTimeFields[] fills
+ * an epsolarRealTimeData_t, extraFields[] is the "-x" status bits and the
+ * settings cache.
+ */
+
+#ifndef REALTIMEFIELDS_H
+#define REALTIMEFIELDS_H
+
+#include <stdint.h>
+#include "libepsolar.h"
+#include "jsonWriter.h"
+#include "registerPlanner.h"
+#include "extraData.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FIELDS_MAX_SPANS        24      // per read plan, after merging neighbours
+
+typedef enum {
+    FIELD_FIXED,                        // float rounded to 'decimals' places
+    FIELD_NUMBER,                       // whole number
+    FIELD_BOOL,                         // true / false
+    FIELD_YESNO,                        // "Yes" / "No"
+    FIELD_STRING
+} fieldKind_t;
+
+typedef enum {
+    RATE_CYCLE,                         // read every polling pass
+    RATE_KEYFRAME,                      // changes every pass (clock) - only sent in full messages
+    RATE_SETTINGS                       // read on the settings cache schedule ("-S")
+} fieldRate_t;
+
+typedef struct  realTimeField {
+    const char  *key;
+    fieldKind_t kind;
+    int         decimals;
+    double      deadband;               // default report-by-exception threshold
+    fieldRate_t rate;
+    int         rangeChecked;           // drop the field if outside minValid .. maxValid
+    double      minValid;
+    double      maxValid;
+    registerSource_t    source;         // no scale - decoded by hand from a status word or the clock
+    double      (*number)( const epsolarRealTimeData_t *rtData );
+    const char  *(*string)( const epsolarRealTimeData_t *rtData );
+    void        (*set)( epsolarRealTimeData_t *rtData, double value );
+    int         aggregated;             // min / max / mean / last over the publish period ("-r")
+    int         integrated;             // a power in W - also integrated to Wh
+} realTimeField_t;
+
+typedef struct  extraField {
+    const char  *key;
+    fieldKind_t kind;
+    int         decimals;
+    fieldRate_t rate;                   // RATE_CYCLE - status bits, RATE_SETTINGS - also in the SETTINGS message
+    registerSource_t    source;
+    double      (*number)( const epsolarExtraData_t *extraData );
+    const char  *(*string)( const epsolarExtraData_t *extraData );
+    void        (*set)( epsolarSettings_t *settings, double value );
+} extraField_t;
+
+extern  const realTimeField_t   realTimeFields[];
+extern  const int               numRealTimeFields;
+extern  const extraField_t      extraFields[];
+extern  const int               numExtraFields;
+
+extern  int     RealTimeFields_CheckKeys( void );
+extern  int     RealTimeFields_SetMask( const char *onlyThese, const char *notThese );
+extern  int     RealTimeFields_Find( const char *key );
+extern  int     RealTimeFields_IsEnabled( const realTimeField_t *field );
+extern  int     RealTimeFields_WasRead( const realTimeField_t *field, fieldMask_t read );
+extern  int     RealTimeFields_IsValid( const realTimeField_t *field, const epsolarRealTimeData_t *rtData, fieldMask_t read );
+extern  void    RealTimeFields_Write( jsonWriter_t *writer, const realTimeField_t *field, const epsolarRealTimeData_t *rtData );
+extern  int     RealTimeFields_Spans( registerSpan_t *spans, int maxSpans, int withStatusBits );
+
+extern  int     ExtraFields_IsEnabled( const extraField_t *field );
+extern  int     ExtraFields_IsValid( const extraField_t *field, const epsolarExtraData_t *extraData );
+extern  void    ExtraFields_Write( jsonWriter_t *writer, const extraField_t *field, const epsolarExtraData_t *extraData );
+extern  int     ExtraFields_SettingsSpans( registerSpan_t *spans, int maxSpans );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REALTIMEFIELDS_H */
@@ -0,0 +1,158 @@
+/*
+ * File:    realTimeReader.c
+ * author:  patrick conroy
+ *
+ * Register addresses are from the EPSolar "Tracer A/B series Modbus protocol"
+ * document. Voltages, currents, powers and temperatures are scaled by 100,
+ * 32 bit values are low word first, the energy counters are kWh.
+ *
+ * libepsolar made one round trip per value, about thirty a cycle. The same
+ * data comes out of five block reads plus the night time discrete input.
+ * Decoding also says which fields' registers all came back, so one that
+ * didn't is left out of the messages - a failed eps_get*() just handed back
+ * a zero.
+ *
+ * Which registers to read, and the plain scaled values, come from the field
+ * registry (realTimeFields.c) - fields masked off with "-f" / "-F" are not
+ * read at all. The status strings are decoded here from the status words the
+ * way the protocol document words them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "registerPlanner.h"
+#include "realTimeFields.h"
+#include "realTimeReader.h"
+
+
+//
+//  Input registers
+#define REG_BATTERY_STATUS                  0x3200
+#define REG_CHARGING_EQUIPMENT_STATUS       0x3201
+#define REG_DISCHARGING_EQUIPMENT_STATUS    0x3202
+
+//
+//  Holding registers
+#define REG_REAL_TIME_CLOCK                 0x9013      // 0x9013 .. 0x9015
+#define REG_LOAD_CONTROL_MODE               0x903D
+
+//
+//  Discrete inputs
+#define DISCRETE_NIGHT_TIME                 0x200C
+
+
+static  const char  *inputVoltageStatus[] = { "Normal", "No power connected", "Higher volt input", "Input volt error" };
+static  const char  *chargingStatus[] = { "Not charging", "Float", "Boost", "Equalization" };
+static  const char  *batteryVoltageStatus[] = { "Normal", "Overvolt", "Under volt", "Low volt disconnect", "Fault" };
+static  const char  *outputPower[] = { "Light", "Moderate", "Rated", "Overload" };
+static  const char  *loadControlModes[] = { "Manual", "Light ON/OFF", "Light ON+Timer", "Time Control" };
+
+
+// -----------------------------------------------------------------------------
+void    RealTimeReader_Initialize (realTimeReader_t *reader, int withStatusBits)
+{
+    registerSpan_t  spans[ FIELDS_MAX_SPANS ];
+    int             numSpans = RealTimeFields_Spans( spans, FIELDS_MAX_SPANS, withStatusBits );
+
+    RegisterPlan_Build( &reader->plan, spans, numSpans, PLAN_DEFAULT_MAX_GAP );
+    Snapshot_Clear( &reader->snapshot );
+    reader->readNightTime = RealTimeFields_IsEnabled( &realTimeFields[ RealTimeFields_Find( "isNightTime" ) ] );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    lookup (char *dest, size_t size, const char **table, int tableSize, int index)
+{
+    snprintf( dest, size, "%s", (index >= 0 && index < tableSize) ? table[ index ] : "Unknown" );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    decodeClock (const registerSnapshot_t *snapshot, char *dest, size_t size)
+{
+    uint16_t    minuteSecond = Snapshot_U16( snapshot, REG_HOLDING, REG_REAL_TIME_CLOCK );
+    uint16_t    dayHour = Snapshot_U16( snapshot, REG_HOLDING, REG_REAL_TIME_CLOCK + 1 );
+    uint16_t    yearMonth = Snapshot_U16( snapshot, REG_HOLDING, REG_REAL_TIME_CLOCK + 2 );
+
+    snprintf( dest, size, "%04d-%02d-%02d %02d:%02d:%02d",
+                2000 + (yearMonth >> 8), yearMonth & 0xFF, dayHour >> 8,
+                dayHour & 0xFF, minuteSecond >> 8, minuteSecond & 0xFF );
+}
+
+// -----------------------------------------------------------------------------
+static
+void    decode (const registerSnapshot_t *snapshot, epsolarRealTimeData_t *rtData)
+{
+    //
+    //  The plain readings straight off the table
+    for (int i = 0; i < numRealTimeFields; i += 1) {
+        const realTimeField_t *field = &realTimeFields[ i ];
+        if (field->source.scale > 0 && RealTimeFields_IsEnabled( field ))
+            field->set( rtData, Snapshot_Scaled( snapshot, &field->source ) );
+    }
+
+    //
+    //  Charging equipment status: D15-14 input voltage, D3-2 charging stage,
+    //  D1 fault, D0 running. Discharging: D13-12 output power, D0 running.
+    //  Battery: D3-0 voltage status
+    uint16_t    charging = Snapshot_U16( snapshot, REG_INPUT, REG_CHARGING_EQUIPMENT_STATUS );
+    uint16_t    discharging = Snapshot_U16( snapshot, REG_INPUT, REG_DISCHARGING_EQUIPMENT_STATUS );
+    uint16_t    battery = Snapshot_U16( snapshot, REG_INPUT, REG_BATTERY_STATUS );
+
+    rtData->controllerStatusBits = charging;
+    rtData->chargerStatusNormal = ((charging & 0x0002) == 0);
+    rtData->chargerRunning = ((charging & 0x0001) != 0);
+    rtData->loadIsOn = ((discharging & 0x0001) != 0);
+
+    lookup( rtData->pvStatus, sizeof rtData->pvStatus, inputVoltageStatus, 4, (charging >> 14) & 0x03 );
+    lookup( rtData->batteryChargingStatus, sizeof rtData->batteryChargingStatus, chargingStatus, 4, (charging >> 2) & 0x03 );
+    lookup( rtData->batteryStatus, sizeof rtData->batteryStatus, batteryVoltageStatus, 5, battery & 0x0F );
+    lookup( rtData->loadLevel, sizeof rtData->loadLevel, outputPower, 4, (discharging >> 12) & 0x03 );
+    lookup( rtData->loadControlMode, sizeof rtData->loadControlMode, loadControlModes, 4,
+                Snapshot_U16( snapshot, REG_HOLDING, REG_LOAD_CONTROL_MODE ) );
+
+    decodeClock( snapshot, rtData->controllerClock, sizeof rtData->controllerClock );
+}
+
+// -----------------------------------------------------------------------------
+void    RealTimeReader_Decode (const realTimeReader_t *reader, epsolarRealTimeData_t *rtData, fieldMask_t *read)
+{
+    //
+    //  Whatever is in the snapshot - just read, or put there by a capture replay
+    memset( rtData, '\0', sizeof( epsolarRealTimeData_t ) );
+    decode( &reader->snapshot, rtData );
+    rtData->isNightTime = (reader->night != 0);
+
+    //
+    //  The snapshot knows which registers came back
+    *read = 0;
+    for (int i = 0; i < numRealTimeFields; i += 1) {
+        const registerSource_t  *source = &realTimeFields[ i ].source;
+        int came = (source->registers > 0) ? Snapshot_IsValid( &reader->snapshot, source->kind, source->address, source->registers )
+                                           : reader->nightValid;        // isNightTime, the one field not in a register
+        if (came)
+            *read |= (fieldMask_t) 1 << i;
+    }
+}
+
+// -----------------------------------------------------------------------------
+int RealTimeReader_Read (realTimeReader_t *reader, const modbusDevice_t *device, epsolarRealTimeData_t *rtData, fieldMask_t *read)
+{
+    Snapshot_Clear( &reader->snapshot );
+    int allRead = RegisterPlan_Execute( &reader->plan, device, &reader->snapshot );
+
+    reader->night = 0;
+    reader->nightValid = reader->readNightTime && Bus_ReadDiscreteInputs( device, DISCRETE_NIGHT_TIME, 1, &reader->night );
+    if (reader->readNightTime)
+        allRead = reader->nightValid && allRead;
+
+    RealTimeReader_Decode( reader, rtData, read );
+
+    if (!allRead)
+        Logger_LogDebug( "Some realtime registers of slave %d could not be read\n", device->slaveID );
+    return allRead;
+}
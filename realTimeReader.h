@@ -0,0 +1,37 @@
+/*
+ * File:   realTimeReader.h
+ * Author: pconroy
+ *
+ * Fills an epsolarRealTimeData_t with our own block reads instead of
+ * libepsolar's epsolarGetRealTimeData(), which can only talk to the one slave
+ * on the one port it was connected to.
+ */
+
+#ifndef REALTIMEREADER_H
+#define REALTIMEREADER_H
+
+#include "libepsolar.h"
+#include "registerPlanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct  realTimeReader {
+    registerPlan_t      plan;
+    registerSnapshot_t  snapshot;       // the last pass, status words included
+    int                 readNightTime;
+    int                 nightValid;     // the night time discrete input, as of the last pass
+    uint8_t             night;
+} realTimeReader_t;
+
+extern  void    RealTimeReader_Initialize( realTimeReader_t *reader, int withStatusBits );
+extern  int     RealTimeReader_Read( realTimeReader_t *reader, const modbusDevice_t *device, epsolarRealTimeData_t *rtData, fieldMask_t *read );
+extern  void    RealTimeReader_Decode( const realTimeReader_t *reader, epsolarRealTimeData_t *rtData, fieldMask_t *read );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REALTIMEREADER_H */
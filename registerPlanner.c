@@ -0,0 +1,234 @@
+/*
+ * File:    registerPlanner.c
+ * author:  patrick conroy
+ *
+ * Each eps_get*() call in libepsolar is a full Modbus RTU round trip. Here we
+ * take the list of registers a cycle needs, sort it, and merge neighbours into
+ * blocks of up to 125 registers. A small gap of registers nobody asked for is
+ * read through if it saves a round trip.
+ *
+ * Some firmware refuses a read that touches an undefined address. If a merged
+ * block fails, that block is split back into its original spans and stays
+ * split for the rest of the run. Plans are per controller for that reason -
+ * one odd firmware on a shared bus shouldn't slow the others down.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "registerPlanner.h"
+
+
+// -----------------------------------------------------------------------------
+static
+int compareSpans (const void *a, const void *b)
+{
+    const registerSpan_t *s1 = (const registerSpan_t *) a;
+    const registerSpan_t *s2 = (const registerSpan_t *) b;
+
+    if (s1->kind != s2->kind)
+        return (s1->kind < s2->kind) ? -1 : 1;
+    return (int) s1->address - (int) s2->address;
+}
+
+// -----------------------------------------------------------------------------
+static
+int spanIsInWindow (const registerSpan_t *span)
+{
+    int base  = (span->kind == REG_INPUT) ? INPUT_REGISTER_BASE : HOLDING_REGISTER_BASE;
+    int count = (span->kind == REG_INPUT) ? INPUT_REGISTER_COUNT : HOLDING_REGISTER_COUNT;
+
+    return (span->count > 0) && (span->address >= base) && ((span->address + span->count) <= (base + count));
+}
+
+// -----------------------------------------------------------------------------
+static
+uint16_t    *registerSlot (registerSnapshot_t *snapshot, registerKind_t kind, int address, uint8_t **validFlags)
+{
+    if (kind == REG_INPUT) {
+        *validFlags = &snapshot->inputValid[ address - INPUT_REGISTER_BASE ];
+        return &snapshot->input[ address - INPUT_REGISTER_BASE ];
+    }
+
+    *validFlags = &snapshot->holdingValid[ address - HOLDING_REGISTER_BASE ];
+    return &snapshot->holding[ address - HOLDING_REGISTER_BASE ];
+}
+
+// -----------------------------------------------------------------------------
+void    RegisterPlan_Build (registerPlan_t *plan, const registerSpan_t *spans, int numSpans, int maxGap)
+{
+    memset( plan, '\0', sizeof( registerPlan_t ) );
+
+    for (int i = 0; i < numSpans && plan->numSpans < PLAN_MAX_SPANS; i += 1) {
+        if (spanIsInWindow( &spans[ i ] ))
+            plan->spans[ plan->numSpans++ ] = spans[ i ];
+        else
+            Logger_LogError( "Register span 0x%04X/%d is outside the EPSolar register map. Dropped.\n", spans[ i ].address, spans[ i ].count );
+    }
+
+    qsort( plan->spans, plan->numSpans, sizeof( registerSpan_t ), compareSpans );
+
+    registerBlock_t *block = NULL;
+    for (int i = 0; i < plan->numSpans; i += 1) {
+        const registerSpan_t *span = &plan->spans[ i ];
+        int spanEnd = span->address + span->count;
+
+        if (block != NULL && block->kind == span->kind) {
+            int blockEnd = block->address + block->count;
+            int newEnd   = (spanEnd > blockEnd) ? spanEnd : blockEnd;
+
+            if ((span->address <= (blockEnd + maxGap)) && ((newEnd - block->address) <= PLAN_MAX_BLOCK_SIZE)) {
+                block->count = newEnd - block->address;
+                block->numSpans += 1;
+                continue;
+            }
+        }
+
+        block = &plan->blocks[ plan->numBlocks++ ];
+        block->kind = span->kind;
+        block->address = span->address;
+        block->count = span->count;
+        block->firstSpan = i;
+        block->numSpans = 1;
+        block->split = FALSE;
+    }
+
+    Logger_LogDebug( "Register plan: %d spans merged into %d block reads\n", plan->numSpans, plan->numBlocks );
+}
+
+// -----------------------------------------------------------------------------
+static
+int readIntoSnapshot (const modbusDevice_t *device, registerSnapshot_t *snapshot, registerKind_t kind, int address, int count)
+{
+    uint8_t     *valid;
+    uint16_t    *dest = registerSlot( snapshot, kind, address, &valid );
+
+    if (!Bus_ReadRegisters( device, kind, address, count, dest ))
+        return FALSE;
+
+    memset( valid, 1, count );
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int RegisterPlan_Execute (registerPlan_t *plan, const modbusDevice_t *device, registerSnapshot_t *snapshot)
+{
+    busBlockRead_t  reads[ PLAN_MAX_SPANS ];
+    int             readOf[ PLAN_MAX_SPANS ];
+    int             numReads = 0;
+    int             failures = 0;
+
+    //
+    //  The merged blocks go to the bus together, so a TCP gateway can have
+    //  several of them in flight at once
+    for (int b = 0; b < plan->numBlocks; b += 1) {
+        registerBlock_t *block = &plan->blocks[ b ];
+        uint8_t         *valid;
+
+        readOf[ b ] = -1;
+        if (block->split)
+            continue;
+
+        readOf[ b ] = numReads;
+        reads[ numReads ].kind = block->kind;
+        reads[ numReads ].address = block->address;
+        reads[ numReads ].count = block->count;
+        reads[ numReads ].dest = registerSlot( snapshot, block->kind, block->address, &valid );
+        numReads += 1;
+    }
+    Bus_ReadBlocks( device, reads, numReads );
+
+    for (int b = 0; b < plan->numBlocks; b += 1) {
+        registerBlock_t *block = &plan->blocks[ b ];
+
+        if (!block->split) {
+            if (reads[ readOf[ b ] ].ok) {
+                uint8_t *valid;
+                registerSlot( snapshot, block->kind, block->address, &valid );
+                memset( valid, 1, block->count );
+                continue;
+            }
+
+            //
+            //  A dropped gateway connection isn't the controller refusing
+            //  the merged read
+            if (block->numSpans == 1 || !device->bus->connected) {
+                failures += 1;
+                continue;
+            }
+
+            Logger_LogWarning( "Merged read at 0x%04X/%d refused - splitting it into %d reads from now on\n",
+                                block->address, block->count, block->numSpans );
+            block->split = TRUE;
+        }
+
+        for (int s = block->firstSpan; s < (block->firstSpan + block->numSpans); s += 1) {
+            const registerSpan_t *span = &plan->spans[ s ];
+            if (!readIntoSnapshot( device, snapshot, span->kind, span->address, span->count ))
+                failures += 1;
+        }
+    }
+
+    return (failures == 0);
+}
+
+// -----------------------------------------------------------------------------
+void    Snapshot_Clear (registerSnapshot_t *snapshot)
+{
+    memset( snapshot, '\0', sizeof( registerSnapshot_t ) );
+}
+
+// -----------------------------------------------------------------------------
+int Snapshot_IsValid (const registerSnapshot_t *snapshot, registerKind_t kind, int address, int count)
+{
+    for (int i = 0; i < count; i += 1) {
+        if (kind == REG_INPUT) {
+            if (!snapshot->inputValid[ address + i - INPUT_REGISTER_BASE ])
+                return FALSE;
+        } else {
+            if (!snapshot->holdingValid[ address + i - HOLDING_REGISTER_BASE ])
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+uint16_t    Snapshot_U16 (const registerSnapshot_t *snapshot, registerKind_t kind, int address)
+{
+    if (kind == REG_INPUT)
+        return snapshot->input[ address - INPUT_REGISTER_BASE ];
+    return snapshot->holding[ address - HOLDING_REGISTER_BASE ];
+}
+
+// -----------------------------------------------------------------------------
+int16_t Snapshot_S16 (const registerSnapshot_t *snapshot, registerKind_t kind, int address)
+{
+    return (int16_t) Snapshot_U16( snapshot, kind, address );
+}
+
+// -----------------------------------------------------------------------------
+uint32_t    Snapshot_U32 (const registerSnapshot_t *snapshot, registerKind_t kind, int address)
+{
+    //
+    //  EPSolar puts the low word first
+    return ((uint32_t) Snapshot_U16( snapshot, kind, address + 1 ) << 16) | Snapshot_U16( snapshot, kind, address );
+}
+
+// -----------------------------------------------------------------------------
+double  Snapshot_Scaled (const registerSnapshot_t *snapshot, const registerSource_t *source)
+{
+    double  raw;
+
+    if (source->registers == 2)
+        raw = source->isSigned ? (double) (int32_t) Snapshot_U32( snapshot, source->kind, source->address )
+                               : (double) Snapshot_U32( snapshot, source->kind, source->address );
+    else
+        raw = source->isSigned ? (double) Snapshot_S16( snapshot, source->kind, source->address )
+                               : (double) Snapshot_U16( snapshot, source->kind, source->address );
+
+    return (source->scale > 0) ? raw / source->scale : raw;
+}
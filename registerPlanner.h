@@ -0,0 +1,97 @@
+/*
+ * File:   registerPlanner.h
+ * Author: pconroy
+ *
+ * Merges the individual registers we want into as few contiguous block reads
+ * as possible, and keeps the result of one polling pass in a snapshot that
+ * the decoders pull their fields out of.
+ */
+
+#ifndef REGISTERPLANNER_H
+#define REGISTERPLANNER_H
+
+#include <stdint.h>
+#include "modbusBus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+//  EPSolar register windows. Input registers live at 0x3000..0x33FF,
+//  holding (settings) registers at 0x9000..0x90FF.
+#define INPUT_REGISTER_BASE     0x3000
+#define INPUT_REGISTER_COUNT    0x0400
+#define HOLDING_REGISTER_BASE   0x9000
+#define HOLDING_REGISTER_COUNT  0x0100
+
+#define PLAN_MAX_SPANS          48
+#define PLAN_MAX_BLOCK_SIZE     125     // Modbus limit for one read request
+#define PLAN_DEFAULT_MAX_GAP    8       // unwanted registers we'll read through to save a round trip
+
+typedef struct  registerSpan {
+    registerKind_t  kind;
+    uint16_t        address;
+    uint16_t        count;
+} registerSpan_t;
+
+//
+//  Where one value comes from. With a scale the value is just the
+//  register(s) divided by it; without one the registers are only there so a
+//  read plan includes them, and somebody decodes them by hand
+typedef struct  registerSource {
+    registerKind_t  kind;
+    uint16_t        address;
+    uint8_t         registers;          // 0 - not a register, 2 - 32 bit, low word first
+    uint8_t         isSigned;
+    float           scale;              // 0 - decoded by hand
+} registerSource_t;
+
+//
+//  One bit per row of a field table, set when that row's registers were all
+//  read. It goes everywhere the values go, so a field that didn't come back
+//  is left out rather than published as zero
+typedef uint64_t        fieldMask_t;
+#define FIELD_MASK_BITS         64
+#define FIELD_MASK_ALL          (~(fieldMask_t) 0)
+
+typedef struct  registerBlock {
+    registerKind_t  kind;
+    uint16_t        address;
+    uint16_t        count;
+    int             firstSpan;          // spans[ firstSpan .. firstSpan+numSpans-1 ] were merged into this block
+    int             numSpans;
+    int             split;              // controller refused the merged read; read the spans one by one
+} registerBlock_t;
+
+typedef struct  registerPlan {
+    int             numSpans;
+    registerSpan_t  spans[ PLAN_MAX_SPANS ];
+    int             numBlocks;
+    registerBlock_t blocks[ PLAN_MAX_SPANS ];
+} registerPlan_t;
+
+typedef struct  registerSnapshot {
+    uint16_t        input[ INPUT_REGISTER_COUNT ];
+    uint16_t        holding[ HOLDING_REGISTER_COUNT ];
+    uint8_t         inputValid[ INPUT_REGISTER_COUNT ];
+    uint8_t         holdingValid[ HOLDING_REGISTER_COUNT ];
+} registerSnapshot_t;
+
+
+extern  void        RegisterPlan_Build( registerPlan_t *plan, const registerSpan_t *spans, int numSpans, int maxGap );
+extern  int         RegisterPlan_Execute( registerPlan_t *plan, const modbusDevice_t *device, registerSnapshot_t *snapshot );
+
+extern  void        Snapshot_Clear( registerSnapshot_t *snapshot );
+extern  int         Snapshot_IsValid( const registerSnapshot_t *snapshot, registerKind_t kind, int address, int count );
+extern  uint16_t    Snapshot_U16( const registerSnapshot_t *snapshot, registerKind_t kind, int address );
+extern  int16_t     Snapshot_S16( const registerSnapshot_t *snapshot, registerKind_t kind, int address );
+extern  uint32_t    Snapshot_U32( const registerSnapshot_t *snapshot, registerKind_t kind, int address );
+extern  double      Snapshot_Scaled( const registerSnapshot_t *snapshot, const registerSource_t *source );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* REGISTERPLANNER_H */
@@ -0,0 +1,106 @@
+/*
+ * File:    responseTimer.c
+ * author:  patrick conroy
+ *
+ * Only the part of a response time that isn't the frames on the wire is
+ * kept - a 125 register read takes 22 ms longer at 115200 baud than a one
+ * register read, and that's not the controller being slow. The wire time
+ * goes back on per request.
+ *
+ * Answers that never came aren't response times, so timeouts don't go into
+ * the window. They back the next attempts off instead: each retry waits
+ * twice as long as the one before, and so does each request after a run of
+ * timeouts, until something answers again - a controller busy writing its
+ * settings to flash gets the time it needs without every noisy frame
+ * inflating the timeout for good.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeUtils.h"
+#include "responseTimer.h"
+
+
+#define MAX_BACKOFF_SHIFT       4
+
+
+// -----------------------------------------------------------------------------
+void    ResponseTimer_Initialize (responseTimer_t *timer)
+{
+    memset( timer, '\0', sizeof( responseTimer_t ) );
+    timer->stats.timeoutMicros = RESPONSE_INITIAL_TIMEOUT_MILLIS * 1000;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    update (responseTimer_t *timer)
+{
+    uint32_t    sorted[ RESPONSE_WINDOW ];
+    int         count = (timer->next < RESPONSE_WINDOW) ? (int) timer->next : RESPONSE_WINDOW;
+
+    //
+    //  Insertion sort - 64 values, every eighth answer
+    for (int i = 0; i < count; i += 1) {
+        uint32_t    value = timer->micros[ i ];
+        int         j = i;
+        for (; j > 0 && sorted[ j - 1 ] > value; j -= 1)
+            sorted[ j ] = sorted[ j - 1 ];
+        sorted[ j ] = value;
+    }
+
+    timer->stats.p50Micros = sorted[ count / 2 ];
+    timer->stats.p99Micros = sorted[ (count * 99) / 100 ];
+
+    double  timeout = timer->stats.p99Micros * RESPONSE_TIMEOUT_FACTOR;
+    if (timeout < RESPONSE_MIN_TIMEOUT_MILLIS * 1000.0)
+        timeout = RESPONSE_MIN_TIMEOUT_MILLIS * 1000.0;
+    if (timeout > RESPONSE_MAX_TIMEOUT_MILLIS * 1000.0)
+        timeout = RESPONSE_MAX_TIMEOUT_MILLIS * 1000.0;
+    timer->stats.timeoutMicros = (uint32_t) timeout;
+}
+
+// -----------------------------------------------------------------------------
+void    ResponseTimer_Answered (responseTimer_t *timer, uint64_t elapsedNanos, uint64_t wireNanos)
+{
+    uint64_t    micros = (elapsedNanos > wireNanos) ? (elapsedNanos - wireNanos) / NANOS_PER_MICRO : 0;
+
+    timer->micros[ timer->next % RESPONSE_WINDOW ] = (micros > UINT32_MAX) ? UINT32_MAX : (uint32_t) micros;
+    timer->next += 1;
+    timer->consecutiveTimeouts = 0;
+    timer->stats.answered += 1;
+
+    if (timer->next >= RESPONSE_MIN_SAMPLES && (timer->next % RESPONSE_UPDATE_EVERY) == 0)
+        update( timer );
+}
+
+// -----------------------------------------------------------------------------
+void    ResponseTimer_TimedOut (responseTimer_t *timer)
+{
+    timer->consecutiveTimeouts += 1;
+    timer->stats.timeouts += 1;
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    ResponseTimer_Timeout (const responseTimer_t *timer, uint64_t wireNanos, int attempt)
+{
+    //
+    //  attempt 0 is the first try at a request, 1 its first retry...
+    int shift = attempt + (timer->consecutiveTimeouts > 0 ? timer->consecutiveTimeouts - 1 : 0);
+    if (shift > MAX_BACKOFF_SHIFT)
+        shift = MAX_BACKOFF_SHIFT;
+
+    uint64_t    nanos = ((uint64_t) timer->stats.timeoutMicros * NANOS_PER_MICRO) << shift;
+    if (nanos > (uint64_t) RESPONSE_MAX_TIMEOUT_MILLIS * NANOS_PER_MILLI)
+        nanos = (uint64_t) RESPONSE_MAX_TIMEOUT_MILLIS * NANOS_PER_MILLI;
+    return wireNanos + nanos;
+}
+
+// -----------------------------------------------------------------------------
+void    ResponseTimer_GetStats (const responseTimer_t *timer, responseTimerStats_t *out)
+{
+    *out = timer->stats;
+}
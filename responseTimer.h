@@ -0,0 +1,56 @@
+/*
+ * File:   responseTimer.h
+ * Author: pconroy
+ *
+ * How long one controller takes to answer, and so how long to wait for it.
+ * libmodbus waits a fixed half second for every response; a controller that
+ * answers in 15 ms doesn't need that, and a missed frame then costs the
+ * whole cycle half a second. Each controller keeps its recent response times
+ * and its timeout is a multiple of their 99th percentile, on top of the time
+ * the frames themselves take on the wire.
+ */
+
+#ifndef RESPONSETIMER_H
+#define RESPONSETIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESPONSE_WINDOW                 64      // most recent answers kept, power of two
+#define RESPONSE_MIN_SAMPLES            16      // fixed initial timeout until we have this many
+#define RESPONSE_UPDATE_EVERY           8       // answers between percentile updates
+#define RESPONSE_INITIAL_TIMEOUT_MILLIS 500     // libmodbus' own default
+#define RESPONSE_MIN_TIMEOUT_MILLIS     20
+#define RESPONSE_MAX_TIMEOUT_MILLIS     2000
+#define RESPONSE_TIMEOUT_FACTOR         2.0     // times the 99th percentile
+
+typedef struct  responseTimerStats {
+    unsigned long   answered;
+    unsigned long   timeouts;
+    uint32_t        p50Micros;          // beyond the wire time
+    uint32_t        p99Micros;
+    uint32_t        timeoutMicros;      // what a first attempt waits now, wire time aside
+} responseTimerStats_t;
+
+typedef struct  responseTimer {
+    uint32_t        micros[ RESPONSE_WINDOW ];
+    unsigned long   next;               // total answers recorded, and where the next goes
+    int             consecutiveTimeouts;
+    responseTimerStats_t    stats;
+} responseTimer_t;
+
+extern  void        ResponseTimer_Initialize( responseTimer_t *timer );
+extern  void        ResponseTimer_Answered( responseTimer_t *timer, uint64_t elapsedNanos, uint64_t wireNanos );
+extern  void        ResponseTimer_TimedOut( responseTimer_t *timer );
+extern  uint64_t    ResponseTimer_Timeout( const responseTimer_t *timer, uint64_t wireNanos, int attempt );
+extern  void        ResponseTimer_GetStats( const responseTimer_t *timer, responseTimerStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESPONSETIMER_H */
@@ -0,0 +1,123 @@
+/*
+ * File:    sampleRing.c
+ * author:  patrick conroy
+ *
+ * Head and tail are free running 64 bit counters; the slot is counter % capacity.
+ * Only the acquisition thread moves head and only the publisher moves tail.
+ * There is one ring per serial bus, so each still has exactly one producer.
+ *
+ * To let the producer overwrite the oldest sample without ever waiting on the
+ * consumer, each slot carries a sequence stamp (seqlock style): odd while it
+ * is being written, 2 * (index + 1) once it is complete. The consumer copies
+ * the slot out and re-checks the stamp; if it changed underneath, that sample
+ * was lost to an overwrite and is counted as dropped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "sampleRing.h"
+
+
+// -----------------------------------------------------------------------------
+int SampleRing_Initialize (sampleRing_t *ring, int requestedCapacity, overflowPolicy_t policy)
+{
+    memset( ring, '\0', sizeof( sampleRing_t ) );
+    ring->capacity = (requestedCapacity > 1) ? requestedCapacity : SAMPLE_RING_DEFAULT_CAPACITY;
+    ring->overflowPolicy = policy;
+
+    ring->slots = calloc( ring->capacity, sizeof( sampleRingSlot_t ) );
+    if (ring->slots == NULL) {
+        Logger_LogError( "Unable to allocate a sample ring of %d entries\n", (int) ring->capacity );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int SampleRing_Push (sampleRing_t *ring, const sample_t *sample)
+{
+    uint64_t    index = ring->head;
+    uint64_t    readIndex = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+    uint64_t    depth = index - readIndex;
+
+    if (depth >= ring->capacity && ring->overflowPolicy == OVERFLOW_DROP_NEWEST) {
+        __atomic_add_fetch( &ring->dropped, 1, __ATOMIC_RELAXED );
+        return FALSE;
+    }
+
+    sampleRingSlot_t *slot = &ring->slots[ index % ring->capacity ];
+    __atomic_store_n( &slot->stamp, (2 * index) + 1, __ATOMIC_RELEASE );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+    slot->sample = *sample;
+    __atomic_store_n( &slot->stamp, 2 * (index + 1), __ATOMIC_RELEASE );
+    __atomic_store_n( &ring->head, index + 1, __ATOMIC_RELEASE );
+
+    __atomic_add_fetch( &ring->pushed, 1, __ATOMIC_RELAXED );
+    //
+    //  When dropping oldest the tail can lag past a full lap; the ring
+    //  itself never holds more than capacity
+    uint64_t    occupancy = (depth < ring->capacity) ? depth + 1 : ring->capacity;
+    if (occupancy > ring->highWater)
+        ring->highWater = occupancy;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int SampleRing_Pop (sampleRing_t *ring, sample_t *sample)
+{
+    for (;;) {
+        uint64_t    writeIndex = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+        uint64_t    index = ring->tail;
+
+        if (index == writeIndex)
+            return FALSE;
+
+        //
+        //  Producer lapped us - jump to the oldest sample still in the ring
+        if ((writeIndex - index) > ring->capacity) {
+            __atomic_add_fetch( &ring->dropped, (writeIndex - ring->capacity) - index, __ATOMIC_RELAXED );
+            index = writeIndex - ring->capacity;
+        }
+
+        sampleRingSlot_t    *slot = &ring->slots[ index % ring->capacity ];
+        uint64_t            before = __atomic_load_n( &slot->stamp, __ATOMIC_ACQUIRE );
+        if (before == 2 * (index + 1)) {
+            *sample = slot->sample;
+            __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        }
+        uint64_t            after = __atomic_load_n( &slot->stamp, __ATOMIC_ACQUIRE );
+
+        __atomic_store_n( &ring->tail, index + 1, __ATOMIC_RELEASE );
+        if (before == 2 * (index + 1) && after == before) {
+            __atomic_add_fetch( &ring->popped, 1, __ATOMIC_RELAXED );
+            return TRUE;
+        }
+
+        //
+        //  Overwritten while we were copying it - count it and try the next one
+        __atomic_add_fetch( &ring->dropped, 1, __ATOMIC_RELAXED );
+    }
+}
+
+// -----------------------------------------------------------------------------
+uint64_t    SampleRing_Depth (sampleRing_t *ring)
+{
+    //
+    //  Producer side - how many the consumer hasn't got to yet
+    uint64_t    depth = ring->head - __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+    return (depth < ring->capacity) ? depth : ring->capacity;
+}
+
+// -----------------------------------------------------------------------------
+void    SampleRing_GetStats (sampleRing_t *ring, sampleRingStats_t *stats)
+{
+    stats->pushed = __atomic_load_n( &ring->pushed, __ATOMIC_RELAXED );
+    stats->popped = __atomic_load_n( &ring->popped, __ATOMIC_RELAXED );
+    stats->dropped = __atomic_load_n( &ring->dropped, __ATOMIC_RELAXED );
+    stats->highWater = ring->highWater;
+}
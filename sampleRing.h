@@ -0,0 +1,79 @@
+/*
+ * File:   sampleRing.h
+ * Author: pconroy
+ *
+ * Lock-free single producer / single consumer ring that hands timestamped
+ * samples from the acquisition thread to the publishing thread.
+ */
+
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <stdint.h>
+#include <time.h>
+#include "libepsolar.h"
+#include "registerPlanner.h"
+#include "extraData.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLE_RING_DEFAULT_CAPACITY    64
+
+typedef enum {
+    OVERFLOW_DROP_OLDEST = 0,           // producer overwrites, consumer skips what it lost
+    OVERFLOW_DROP_NEWEST = 1            // producer throws the new sample away
+} overflowPolicy_t;
+
+typedef struct  sample {
+    int                     controller;     // index into the controller table
+    uint64_t                sequence;       // acquisition cycle number, per controller
+    time_t                  wallTime;       // when it was read, for the message "dateTime"
+    uint64_t                deadlineNanos;  // CLOCK_MONOTONIC time it was scheduled for
+    uint64_t                acquiredNanos;  // CLOCK_MONOTONIC time the reads finished
+    int                     haveExtraData;
+    int                     settingsChanged;
+    epsolarRealTimeData_t   rtData;
+    fieldMask_t             rtRead;         // realTimeFields[] rows whose registers came back
+    epsolarExtraData_t      extraData;
+} sample_t;
+
+typedef struct  sampleRingStats {
+    unsigned long   pushed;
+    unsigned long   popped;
+    unsigned long   dropped;
+    unsigned long   highWater;
+} sampleRingStats_t;
+
+typedef struct  sampleRingSlot {
+    uint64_t    stamp;
+    sample_t    sample;
+} sampleRingSlot_t;
+
+typedef struct  sampleRing {
+    sampleRingSlot_t    *slots;
+    uint64_t            capacity;
+    overflowPolicy_t    overflowPolicy;
+
+    uint64_t            head;           // next index the producer writes
+    uint64_t            tail;           // next index the consumer reads
+
+    unsigned long       pushed;
+    unsigned long       popped;
+    unsigned long       dropped;
+    unsigned long       highWater;
+} sampleRing_t;
+
+extern  int     SampleRing_Initialize( sampleRing_t *ring, int capacity, overflowPolicy_t policy );
+extern  int     SampleRing_Push( sampleRing_t *ring, const sample_t *sample );
+extern  int     SampleRing_Pop( sampleRing_t *ring, sample_t *sample );
+extern  uint64_t    SampleRing_Depth( sampleRing_t *ring );
+extern  void    SampleRing_GetStats( sampleRing_t *ring, sampleRingStats_t *stats );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SAMPLERING_H */
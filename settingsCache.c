@@ -0,0 +1,159 @@
+/*
+ * File:    settingsCache.c
+ * author:  patrick conroy
+ *
+ * Register addresses are from the EPSolar "Tracer A/B series Modbus protocol"
+ * document. Voltages, currents and temperatures are scaled by 100.
+ *
+ * Which registers those are, and how they scale, comes from the settings rows
+ * of the field registry (realTimeFields.c); fields masked off with "-f" /
+ * "-F" are not read. The two lookups are decoded here.
+ *
+ * A refresh reads every settings register in a handful of block reads and
+ * compares the raw values with the previous refresh. The caller only gets
+ * TRUE back when something actually changed, or on the first good read.
+ * Each controller has its own cache.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asyncLog.h"
+#include "libepsolar.h"
+#include "registerPlanner.h"
+#include "realTimeFields.h"
+#include "settingsCache.h"
+
+
+//
+//  Holding registers
+#define REG_BATTERY_TYPE                    0x9000
+#define REG_BATTERY_RATED_VOLTAGE_CODE      0x9067
+
+static  const char  *batteryTypes[] = { "User Defined", "Sealed", "GEL", "Flooded" };
+static  const char  *ratedVoltageCodes[] = { "Auto", "12V", "24V", "36V", "48V", "60V", "110V", "120V", "220V", "240V" };
+
+
+// -----------------------------------------------------------------------------
+void    SettingsCache_Initialize (settingsCache_t *cache, int refreshSeconds)
+{
+    registerSpan_t  spans[ FIELDS_MAX_SPANS ];
+    int             numSpans = ExtraFields_SettingsSpans( spans, FIELDS_MAX_SPANS );
+
+    memset( cache, '\0', sizeof( settingsCache_t ) );
+    cache->refreshInterval = (refreshSeconds > 0) ? refreshSeconds : SETTINGS_DEFAULT_REFRESH_SECONDS;
+    RegisterPlan_Build( &cache->plan, spans, numSpans, PLAN_DEFAULT_MAX_GAP );
+
+    cache->settings.batteryType = cache->settings.batteryRatedVoltageCode = "Unknown";
+    cache->haveSettings = FALSE;
+}
+
+// -----------------------------------------------------------------------------
+static
+const char  *lookup (const char **table, int tableSize, int index)
+{
+    return (index >= 0 && index < tableSize) ? table[ index ] : "Unknown";
+}
+
+// -----------------------------------------------------------------------------
+static
+int settingsChanged (const settingsCache_t *cache)
+{
+    for (int i = 0; i < cache->plan.numSpans; i += 1) {
+        const registerSpan_t *span = &cache->plan.spans[ i ];
+        for (int reg = span->address; reg < (span->address + span->count); reg += 1)
+            if (Snapshot_U16( &cache->snapshot, span->kind, reg ) != Snapshot_U16( &cache->previous, span->kind, reg ) ||
+                Snapshot_IsValid( &cache->snapshot, span->kind, reg, 1 ) != Snapshot_IsValid( &cache->previous, span->kind, reg, 1 ))
+                return TRUE;
+    }
+    return FALSE;
+}
+
+// -----------------------------------------------------------------------------
+static
+void    decodeSettings (settingsCache_t *cache)
+{
+    const registerSnapshot_t    *snapshot = &cache->snapshot;
+    epsolarSettings_t           *settings = &cache->settings;
+
+    //
+    //  Everything that is just a scaled register comes off the field table.
+    //  A row whose registers a replayed capture didn't have is left out
+    settings->read = 0;
+    for (int i = 0; i < numExtraFields; i += 1) {
+        const extraField_t *field = &extraFields[ i ];
+        if (field->rate != RATE_SETTINGS || !ExtraFields_IsEnabled( field ))
+            continue;
+        if (Snapshot_IsValid( snapshot, field->source.kind, field->source.address, field->source.registers ))
+            settings->read |= (fieldMask_t) 1 << i;
+        if (field->source.scale > 0)
+            field->set( settings, Snapshot_Scaled( snapshot, &field->source ) );
+    }
+
+    settings->batteryType = lookup( batteryTypes, sizeof batteryTypes / sizeof batteryTypes[ 0 ],
+                                        Snapshot_U16( snapshot, REG_HOLDING, REG_BATTERY_TYPE ) );
+    settings->batteryRatedVoltageCode = lookup( ratedVoltageCodes, sizeof ratedVoltageCodes / sizeof ratedVoltageCodes[ 0 ],
+                                        Snapshot_U16( snapshot, REG_HOLDING, REG_BATTERY_RATED_VOLTAGE_CODE ) );
+}
+
+// -----------------------------------------------------------------------------
+static
+int accept (settingsCache_t *cache, int slaveID, time_t now)
+{
+    //
+    //  A good read is in the snapshot. TRUE if that changed the settings
+    cache->lastRefresh = now;
+    cache->lastReadOK = TRUE;
+    if (cache->haveSettings && !settingsChanged( cache ))
+        return FALSE;
+
+    decodeSettings( cache );
+    Logger_LogInfo( "Settings of slave %d %s\n", slaveID, (cache->haveSettings ? "changed" : "loaded") );
+    cache->haveSettings = TRUE;
+    return TRUE;
+}
+
+// -----------------------------------------------------------------------------
+int SettingsCache_IsDue (const settingsCache_t *cache, time_t now)
+{
+    return (!cache->haveSettings || ((now - cache->lastRefresh) >= cache->refreshInterval));
+}
+
+// -----------------------------------------------------------------------------
+int SettingsCache_Refresh (settingsCache_t *cache, const modbusDevice_t *device, time_t now)
+{
+    if (!SettingsCache_IsDue( cache, now ))
+        return FALSE;
+
+    cache->lastReadOK = FALSE;
+    cache->previous = cache->snapshot;
+    Snapshot_Clear( &cache->snapshot );
+    if (!RegisterPlan_Execute( &cache->plan, device, &cache->snapshot )) {
+        //
+        //  Keep what we had. If we never had anything, try again next cycle
+        Logger_LogWarning( "Unable to read the settings of slave %d - keeping the cached values\n", device->slaveID );
+        cache->snapshot = cache->previous;
+        if (cache->haveSettings)
+            cache->lastRefresh = now;
+        return FALSE;
+    }
+
+    return accept( cache, device->slaveID, now );
+}
+
+// -----------------------------------------------------------------------------
+int SettingsCache_Load (settingsCache_t *cache, const registerSnapshot_t *snapshot, int slaveID, time_t now)
+{
+    //
+    //  Registers read somewhere else - a capture being replayed
+    cache->previous = cache->snapshot;
+    cache->snapshot = *snapshot;
+    return accept( cache, slaveID, now );
+}
+
+// -----------------------------------------------------------------------------
+const epsolarSettings_t *SettingsCache_Get (const settingsCache_t *cache)
+{
+    return &cache->settings;
+}
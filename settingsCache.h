@@ -0,0 +1,78 @@
+/*
+ * File:   settingsCache.h
+ * Author: pconroy
+ *
+ * Controller ratings and charge settings hardly ever change, so they are read
+ * on their own slow schedule and kept here between refreshes.
+ */
+
+#ifndef SETTINGSCACHE_H
+#define SETTINGSCACHE_H
+
+#include <time.h>
+#include "registerPlanner.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SETTINGS_DEFAULT_REFRESH_SECONDS    3600
+
+typedef struct  epsolarSettings {
+    float       batteryRealRatedVoltage;
+    const char  *batteryRatedVoltageCode;
+
+    float       ratedChargingCurrent;
+    float       ratedLoadCurrent;
+    int         boostDuration;
+    int         equalizeDuration;
+    const char  *batteryType;
+    int         batteryCapacity;
+
+    float       highVoltageDisconnect;
+    float       chargingLimitVoltage;
+    float       overVoltageReconnect;
+    float       equalizationVoltage;
+    float       boostingVoltage;
+    float       floatingVoltage;
+    float       boostReconnectVoltage;
+    float       lowVoltageReconnectVoltage;
+    float       underVoltageWarningRecoverVoltage;
+    float       underVoltageWarningVoltage;
+    float       lowVoltageDisconnectVoltage;
+    float       dischargingLimitVoltage;
+    float       dischargingPercentage;
+    float       chargingPercentage;
+
+    float       batteryTemperatureWarningUpperLimit;
+    float       batteryTemperatureWarningLowerLimit;
+    float       controllerInnerTemperatureUpperLimit;
+    float       controllerInnerTemperatureUpperLimitRecover;
+
+    fieldMask_t read;                   // extraFields[] settings rows whose registers came back
+} epsolarSettings_t;
+
+typedef struct  settingsCache {
+    registerPlan_t      plan;
+    registerSnapshot_t  snapshot;
+    registerSnapshot_t  previous;
+
+    epsolarSettings_t   settings;
+    int                 haveSettings;
+    int                 lastReadOK;         // snapshot holds what the last refresh read, not the previous one
+    time_t              lastRefresh;
+    int                 refreshInterval;
+} settingsCache_t;
+
+extern  void    SettingsCache_Initialize( settingsCache_t *cache, int refreshSeconds );
+extern  int     SettingsCache_IsDue( const settingsCache_t *cache, time_t now );
+extern  int     SettingsCache_Refresh( settingsCache_t *cache, const modbusDevice_t *device, time_t now );
+extern  int     SettingsCache_Load( settingsCache_t *cache, const registerSnapshot_t *snapshot, int slaveID, time_t now );
+extern  const epsolarSettings_t *SettingsCache_Get( const settingsCache_t *cache );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SETTINGSCACHE_H */
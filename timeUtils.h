@@ -0,0 +1,48 @@
+/*
+ * File:   timeUtils.h
+ * Author: pconroy
+ *
+ * Small clock helpers shared by the polling, publishing and metrics code.
+ * Scheduling always runs off CLOCK_MONOTONIC so NTP steps and our own
+ * controller clock sync never move a deadline.
+ */
+
+#ifndef TIMEUTILS_H
+#define TIMEUTILS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NANOS_PER_SECOND    1000000000ULL
+#define NANOS_PER_MILLI     1000000ULL
+#define NANOS_PER_MICRO     1000ULL
+
+// -----------------------------------------------------------------------------
+static inline
+uint64_t    Time_MonotonicNanos (void)
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t) ts.tv_sec * NANOS_PER_SECOND) + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------
+static inline
+struct timespec Time_NanosToTimespec (uint64_t nanos)
+{
+    struct timespec ts;
+    ts.tv_sec = nanos / NANOS_PER_SECOND;
+    ts.tv_nsec = nanos % NANOS_PER_SECOND;
+    return ts;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMEUTILS_H */